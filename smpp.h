@@ -36,6 +36,36 @@ typedef void* SMSC_HANDLE;
  */
 typedef void* ESME_HANDLE;
 
+/*!
+ * Opaque pointer to a bind being validated asynchronously
+ */
+typedef void* BIND_HANDLE;
+
+/*!
+ * Opaque pointer to a message prepared by \c libSMPP_ClientPrepareMessage
+ */
+typedef void* MESSAGE_HANDLE;
+
+/*!
+ * Opaque pointer to an incoming message waiting to be acknowledged, \see Callback_OnIncomingMessageAsync
+ */
+typedef void* INCOMING_HANDLE;
+
+/*!
+ * Opaque pointer to the threads running a group of clients, \see libSMPP_ExecutorCreate
+ */
+typedef void* EXECUTOR_HANDLE;
+
+/*!
+ * Opaque pointer to a set of routes being built, \see libSMPP_RoutesCreate
+ */
+typedef void* ROUTES_HANDLE;
+
+/*!
+ * Opaque pointer to a router sending messages through several clients, \see libSMPP_RouterCreate
+ */
+typedef void* ROUTER_HANDLE;
+
 
 typedef enum __BindType
 {
@@ -67,10 +97,57 @@ typedef enum __DeliveryResult
 	/*! Destination address is invalid */
 	DELIVERY_INV_DEST_ADDR,
 	/*! I don't know what happen! */
-	DELIVERY_UNKNOWN_ERROR
+	DELIVERY_UNKNOWN_ERROR,
+	/*! There is no receiver for the destination address yet, the message
+	 * will be delivered as soon as one binds \see ServerSettings */
+	DELIVERY_QUEUED
 } DeliveryResult;
 
 
+/*!
+ * Final (or not so) state of a message, as reported by a delivery receipt
+ */
+typedef enum __MessageState
+{
+	MESSAGE_STATE_SCHEDULED     = 0, /*!< \brief Not reported, the receipt did not say */
+	MESSAGE_STATE_ENROUTE       = 1,
+	MESSAGE_STATE_DELIVERED     = 2,
+	MESSAGE_STATE_EXPIRED       = 3,
+	MESSAGE_STATE_DELETED       = 4,
+	MESSAGE_STATE_UNDELIVERABLE = 5,
+	MESSAGE_STATE_ACCEPTED      = 6,
+	MESSAGE_STATE_UNKNOWN       = 7,
+	MESSAGE_STATE_REJECTED      = 8
+} MessageState;
+
+/*!
+ * A delivery receipt sent by the SMSC for a message submitted with
+ * \c MessageSettings::RequestDeliveryReceipts set
+ */
+typedef struct __DeliveryReceipt
+{
+	/*! The message_id returned when the message was submitted */
+	char MessageId[66];
+
+	/*! The recipient of the message */
+	char Recipient[21];
+
+	/*! The sender of the message */
+	char Sender[21];
+
+	MessageState State;
+
+	/*! Network or SMSC specific error code, 0 if there is none */
+	unsigned int ErrorCode;
+
+	/*! Number of messages originally submitted and delivered, for distribution lists */
+	unsigned int Submitted, Delivered;
+
+	/*! When the message was submitted and when it reached its state, YYMMDDhhmm */
+	char SubmitDate[13], DoneDate[13];
+
+} DeliveryReceipt;
+
 typedef enum __DisconnectReason
 {
 	DISCONNECT_REASON_UNBIND, /*!< \brief The user has disconnected his session  */
@@ -133,8 +210,196 @@ typedef struct __MessageSettings
 	 */
 	unsigned char BigEndianUnicode;
 
+	/*! Sets registered_delivery on every message, their receipts are reported with
+	 * \c OnDeliveryReceipt instead of \c OnIncomingMessage (default = 0) */
+	unsigned char RequestDeliveryReceipts;
+
+	/*! Seconds a message waits for its receipt before its context is forgotten (default = 86400) */
+	unsigned int ReceiptTrackingTTL;
+
+	/*! Connects and binds again in the background when the connection is lost, messages
+	 * sent meanwhile wait for the new session, those lost with the connection are sent
+	 * again (default = 0) */
+	unsigned char AutoReconnect;
+
+	/*! Milliseconds before the first attempt to reconnect, doubled after each failed
+	 * attempt. Each delay is picked at random between its half and its whole so
+	 * clients do not reconnect all at once (default = 500) */
+	unsigned int ReconnectMinDelay;
+
+	/*! Maximum milliseconds between attempts to reconnect (default = 30000) */
+	unsigned int ReconnectMaxDelay;
+
+	/*! Milliseconds a message waits for the session to come back before it fails (default = 60000) */
+	unsigned int ReconnectWaitTimeout;
+
+	/*! Threads decoding incoming messages and running their callbacks, so the
+	 * connection keeps reading meanwhile. With more than one, messages may be
+	 * reported out of order. Read by the first bind, 0 runs the callbacks on
+	 * the I/O threads (default = 0) */
+	unsigned int InboundWorkers;
+
+	/*! Incoming messages not acknowledged yet, when there are this many the client
+	 * stops reading until some are acknowledged. 0 means no limit (default = 0) */
+	unsigned int MaxInboundPending;
+
+	/*! Seconds to resolve the server and connect to it when binding asynchronously
+	 * or reconnecting, 0 leaves it to the system (default = 0) */
+	unsigned int ConnectTimeout;
+
+	/*! Seconds to wait for the response to the bind request, 0 means ResponseTimeout (default = 0) */
+	unsigned int BindTimeout;
+
+	/*! priority_flag of the messages sent with SUBMIT_SM and SUBMIT_MULTI (0 to 3). Messages
+	 * with a priority are written ahead of those without it on the same connection, though
+	 * never ahead of responses and enquire_link (default = 0) */
+	unsigned char PriorityFlag;
+
+	/*! Seconds to wait for the response to a request, 0 means 40 (default = 0) */
+	unsigned int ResponseTimeout;
+
+	/*! Seconds to wait for the response to SUBMIT_SM, SUBMIT_MULTI and DATA_SM,
+	 * 0 means ResponseTimeout (default = 0) */
+	unsigned int SubmitTimeout;
+
+	/*! Seconds to wait for the response to ENQUIRE_LINK, 0 means ResponseTimeout (default = 0) */
+	unsigned int EnquireLinkTimeout;
+
+	/*! When set, requests give up on their response once it takes well beyond the round trip
+	 * times measured on the connection (smoothed time plus four times its variation, as TCP
+	 * does), the timeouts above being the limit. Each timeout doubles the next ones until a
+	 * response comes (default = 0) */
+	unsigned char AdaptiveTimeouts;
+
+	/*! Milliseconds an adaptive timeout is never shorter than, 0 means 1000 (default = 0) */
+	unsigned int MinAdaptiveTimeout;
+
+	/*! Path of the journal where messages queued with \c libSMPP_ClientQueueMessage wait
+	 * until the SMSC accepts them, they are sent again after a restart if they were not.
+	 * It's opened the first time it's set, NULL disables queuing (default = NULL) */
+	const char *OutboxJournalPath;
+
+	/*! Messages taken from the outbox and sent at the same time (default = 10) */
+	unsigned int OutboxDrainWindow;
+
 } MessageSettings;
 
+/*!
+ * Defines how the server distributes its connections among threads
+ */
+typedef enum __ServerThreadingModel
+{
+	/*! A pool of threads serving a single io_service, connections are handled by any thread (default) */
+	SERVER_THREADING_SHARED = 0,
+
+	/*!
+	 * One io_service and one thread per core, connections stay on the core that accepted them.
+	 * Callbacks run on the thread of the core, one that blocks stalls every connection on it
+	 */
+	SERVER_THREADING_PER_CORE = 1
+} ServerThreadingModel;
+
+/*!
+ * Defines how the server picks the receiver of a message when several binds own its destination
+ */
+typedef enum __DeliveryBalancing
+{
+	/*! The first bind found, the others only take messages when it's gone (default) */
+	DELIVERY_BALANCING_FIRST = 0,
+
+	/*! Each message goes to the next bind */
+	DELIVERY_BALANCING_ROUND_ROBIN = 1,
+
+	/*! The bind with the least messages waiting for a response */
+	DELIVERY_BALANCING_LEAST_OUTSTANDING = 2,
+
+	/*! Messages from the same source always go to the same bind so they keep their order,
+	 * as long as the binds don't change */
+	DELIVERY_BALANCING_STICKY_SOURCE = 3
+} DeliveryBalancing;
+
+/*!
+ * Defines server-wide settings, must be set before starting the server
+ */
+typedef struct __ServerSettings
+{
+	/*! One of the \c ServerThreadingModel values (default = SERVER_THREADING_SHARED) */
+	unsigned int ThreadingModel;
+
+	/*! Pins each per-core thread to its own CPU, only used with SERVER_THREADING_PER_CORE (default = 0) */
+	unsigned char EnableCPUAffinity;
+
+	/*! Opens one SO_REUSEPORT acceptor per core and lets the kernel balance incoming
+	 * connections, otherwise a single acceptor assigns connections to cores in
+	 * a round-robin fashion. Only used with SERVER_THREADING_PER_CORE (default = 1) */
+	unsigned char EnableReusePort;
+
+	/*! Maximum number of requests of a single connection being processed at the same time
+	 * (dispatched but not answered yet). When reached the server stops reading from the
+	 * connection so TCP flow control pushes back on the ESME (default = 100, 0 = no limit) */
+	unsigned int MaxInboundPerConnection;
+
+	/*! Same as \c MaxInboundPerConnection but for all the connections together (default = 0: no limit) */
+	unsigned int MaxInboundTotal;
+
+	/*! Answer messages over the limits with ESME_RTHROTTLED instead of pausing reads (default = 0) */
+	unsigned char ThrottleOnOverload;
+
+	/*! Messages per second each bound ESME is allowed to submit, messages over the
+	 * limit are rejected with ESME_RTHROTTLED (default = 0: no limit).
+	 * Can be changed for every bind with \c Callback_GetUserThroughput */
+	unsigned int DefaultSubmitRate;
+
+	/*! Messages an ESME is allowed to submit at once, on top of \c DefaultSubmitRate (default = 1) */
+	unsigned int DefaultSubmitBurst;
+
+	/*! Seconds a successful validation is remembered, binds with the same credentials
+	 * within that time are accepted without invoking the validation callback.
+	 * Passwords are not stored, only a salted hash of them (default = 0: disabled) */
+	unsigned int CredentialCacheTTL;
+
+	/*! Maximum number of binds being validated at the same time, binds over
+	 * the limit are rejected with ESME_RTHROTTLED (default = 0: no limit) */
+	unsigned int MaxConcurrentBinds;
+
+	/*! Messages with no receiver bound for their destination that are kept in memory
+	 * until one binds, \c SendMessage returns DELIVERY_QUEUED for them. So are the
+	 * messages to a destination that still has messages queued. Messages over
+	 * the limit are refused with DELIVERY_INV_DEST_ADDR, or DELIVERY_REJECTED if
+	 * they would get ahead of the ones queued (default = 0: none, only
+	 * \c QueueJournalPath is used if set) */
+	unsigned int MaxQueuedMessages;
+
+	/*! File where messages over \c MaxQueuedMessages are spilled, it's memory-mapped
+	 * and survives restarts. The same path plus ".tmp" is used while it's compacted.
+	 * The string must be valid until the server is started (default = NULL: do not spill) */
+	const char *QueueJournalPath;
+
+	/*! Queued messages sent at once to a receiver when it binds (default = 10) */
+	unsigned int QueueDrainWindow;
+
+	/*! Milliseconds before queued messages are sent again to a receiver that
+	 * answered ESME_RTHROTTLED or ESME_RMSGQFUL (default = 1000) */
+	unsigned int QueueRetryDelay;
+
+	/*! Threads handing the destinations of a SUBMIT_MULTI to the callbacks, in parallel
+	 * and away from the network threads (default = 4, 0: one after the other, on the
+	 * network thread that read the command) */
+	unsigned int SubmitMultiThreads;
+
+	/*! One of the \c DeliveryBalancing values (default = DELIVERY_BALANCING_FIRST) */
+	unsigned int DeliveryBalancing;
+
+	/*! Seconds a submitted message is remembered, its state cannot be reported,
+	 * queried, cancelled or replaced after that (default = 86400) */
+	unsigned int MessageIndexTTL;
+
+	/*! Maximum number of messages remembered, the oldest ones are forgotten
+	 * first (default = 100000) */
+	unsigned int MaxIndexedMessages;
+
+} ServerSettings;
+
 /*! Log functions have the same signature so let's define a type for them */
 typedef void (*LogFunction)(const char *message);
 
@@ -169,6 +434,20 @@ typedef LoginResult (*Callback_ValidateUser)(
 			const char* address_range
 	);
 
+/*!
+ * \brief Validate a user login without blocking the server
+ * Same as \c Callback_ValidateUser but the result is given later by calling
+ * \c libSMPP_ServerCompleteBind with \p hBind, from any thread
+ */
+typedef void (*Callback_ValidateUserAsync)(
+			unsigned int connectionId,
+			BindType     loginType,
+			const char*  systemId,
+			const char*  password,
+			const char*  address_range,
+			BIND_HANDLE  hBind
+	);
+
 /*!
  * \brief A new message from a client ESME has come and we should deliver it
  * \param connectionId The is of the connection who sent this message
@@ -185,6 +464,38 @@ typedef DeliveryResult (*Callback_DeliverMessage)(
 			unsigned int msgSize
 	);
 
+/*!
+ * \brief Same as \c Callback_DeliverMessage, with the message_id given to the ESME
+ * \param messageId Needed to report the state of the message with \c libSMPP_ServerReportMessageState,
+ * the destinations of a SUBMIT_MULTI get the same one
+ */
+typedef DeliveryResult (*Callback_DeliverMessageWithId)(
+			unsigned int connectionId,
+			const char*  from,
+			const char*  to,
+			const char*  message,
+			unsigned int msgSize,
+			const char*  messageId
+	);
+
+/*!
+ * \brief The ESME wants to cancel the message \p messageId, \see CSMSCCallback::CancelMessage
+ */
+typedef DeliveryResult (*Callback_CancelMessage)(
+			unsigned int connectionId,
+			const char*  messageId
+	);
+
+/*!
+ * \brief The ESME wants to replace the text of \p messageId, \see CSMSCCallback::ReplaceMessage
+ */
+typedef DeliveryResult (*Callback_ReplaceMessage)(
+			unsigned int connectionId,
+			const char*  messageId,
+			const char*  message,
+			unsigned int msgSize
+	);
+
 
 /*!
  * \brief Advices that a user has been disconnected
@@ -198,6 +509,20 @@ typedef void (*Callback_OnUserDisconnected)(
 			DisconnectReason reason
 	);
 
+/*!
+ * \brief Asks for the throughput allowed to a user that has just bound
+ * \param connectionId The connection id
+ * \param systemId The user name
+ * \param rate Messages per second allowed, holds the server default on input (0 = no limit)
+ * \param burst Messages allowed at once, holds the server default on input
+ */
+typedef void (*Callback_GetUserThroughput)(
+			unsigned int  connectionId,
+			const char*   systemId,
+			unsigned int* rate,
+			unsigned int* burst
+	);
+
 /*!
  * \brief Called when a new text message is received
  * \param hClient The ESME instance who triggered this event
@@ -224,6 +549,71 @@ typedef void (*Callback_OnConnectionLost)(
 			int         reason
 	);
 
+/*!
+ * \brief Called when a new text message is received, it's acknowledged to the SMSC
+ * once \c libSMPP_ClientAcknowledgeMessage is called with \p hMessage
+ * \param hClient The ESME instance who triggered this event
+ * \param from Who sent the message
+ * \param to The address of the receipt of the message
+ * \param content The message text in UTF-8 (It may be not NULL-terminated, use \p size)
+ * \param size   Size (in chars) of the string pointed by \p content
+ * \param hMessage Must be given to \c libSMPP_ClientAcknowledgeMessage, from any thread
+ */
+typedef void (*Callback_OnIncomingMessageAsync)(
+			ESME_HANDLE     hClient,
+			const char*     from,
+			const char*     to,
+			const char*     content,
+			unsigned int    size,
+			INCOMING_HANDLE hMessage
+	);
+
+/*!
+ * \brief Called when the connection lost has been restored, only if \c MessageSettings::AutoReconnect is set
+ * \param hClient The ESME instance who triggered this event
+ */
+typedef void (*Callback_OnReconnected)(
+			ESME_HANDLE hClient
+	);
+
+/*!
+ * \brief Called when a bind requested with \c libSMPP_ClientBindAsync completes
+ * \param hClient The ESME instance who triggered this event
+ * \param result The same \c libSMPP_ClientBind would have returned
+ */
+typedef void (*Callback_OnBound)(
+			ESME_HANDLE hClient,
+			LoginResult result
+	);
+
+/*!
+ * \brief Called when a message queued with \c libSMPP_ClientQueueMessage leaves the outbox
+ * \param hClient The ESME instance who triggered this event
+ * \param reference The one given when the message was queued
+ * \param result The same \c libSMPP_ClientSendMessage would have returned, messages not
+ * answered or throttled are sent again later instead
+ * \param messageId The message_id given by the SMSC, empty if the message was not accepted
+ */
+typedef void (*Callback_OnQueuedMessageSent)(
+			ESME_HANDLE    hClient,
+			const char     *reference,
+			DeliveryResult result,
+			const char     *messageId
+	);
+
+/*!
+ * \brief Called when a delivery receipt arrives
+ * \param hClient The ESME instance who triggered this event
+ * \param receipt The receipt
+ * \param context The context given when the message was sent, NULL if the
+ * message is unknown or its context has been forgotten already
+ */
+typedef void (*Callback_OnDeliveryReceipt)(
+			ESME_HANDLE            hClient,
+			const DeliveryReceipt* receipt,
+			void*                  context
+	);
+
 #if defined(__cplusplus) || defined(c_plusplus)
 extern "C"
 {
@@ -271,6 +661,13 @@ SMPP_API void libSMPP_CreateDefaultMessageSettings(
 			MessageSettings *ms
 	);
 
+/*!
+ * Fills the \p ss variable with default values
+ */
+SMPP_API void libSMPP_CreateDefaultServerSettings(
+			ServerSettings *ss
+	);
+
 /*!
  * \brief Creates a new SMPP Server instance (or SMSC)
  * \return A pointer to the new server instance
@@ -305,6 +702,44 @@ SMPP_API void libSMPP_ServerSetCallbacks (
 			Callback_OnUserDisconnected onDisconFn
 	);
 
+/*!
+ * \brief Sets a callback to validate users asynchronously, it's optional
+ * When set it's used instead of the \c Callback_ValidateUser given to \c libSMPP_ServerSetCallbacks
+ * \remark This function must be called BEFORE \c libSMPP_ServerStart
+ */
+SMPP_API void libSMPP_ServerSetAsyncValidationCallback (
+			SMSC_HANDLE                hServer,
+			Callback_ValidateUserAsync validateFn
+	);
+
+/*!
+ * \brief Completes a bind started by \c Callback_ValidateUserAsync
+ * \param hBind The handle given to the callback, invalid after this call
+ * \param result The validation result
+ */
+SMPP_API void libSMPP_ServerCompleteBind (
+			BIND_HANDLE hBind,
+			LoginResult result
+	);
+
+/*!
+ * \brief Sets the callback used to set the throughput of each bind, it's optional
+ * \remark This function must be called BEFORE \c libSMPP_ServerStart
+ */
+SMPP_API void libSMPP_ServerSetThroughputCallback (
+			SMSC_HANDLE                hServer,
+			Callback_GetUserThroughput throughputFn
+	);
+
+/*!
+ * \brief Sets server-wide settings for this server instance. \see ServerSettings
+ * \remark This function must be called BEFORE \c libSMPP_ServerStart
+ */
+SMPP_API void libSMPP_ServerSetSettings (
+			SMSC_HANDLE           hServer,
+			const ServerSettings *ss
+	);
+
 /*!
  * \brief Start listening
  * \return 0 if the server could be started, no zero if something fails
@@ -329,6 +764,7 @@ SMPP_API void libSMPP_ServerStop(
  * \return \c DELIVERY_OK if everything runs smoothly
  * \return \c DELIVERY_REJECTED if the user rejects the message
  * \return \c DELIVERY_INV_DEST_ADDR if there is no user with address \p to
+ * \return \c DELIVERY_QUEUED if there is no user with address \p to but the message is stored until one binds
  * \return \c DELIVERY_UNKNOWN_ERROR if something gets broken (connection lost, unknown error, whatever)
  */
 SMPP_API DeliveryResult libSMPP_ServerSendMessage (
@@ -338,6 +774,48 @@ SMPP_API DeliveryResult libSMPP_ServerSendMessage (
 			const char *message
 	);
 
+/*!
+ * \brief Sets the function invoked instead of \c Callback_DeliverMessage, which is
+ * given the message_id of the message
+ * \remark This function must be called BEFORE \c libSMPP_ServerStart
+ */
+SMPP_API void libSMPP_ServerSetDeliverMessageWithIdCallback (
+			SMSC_HANDLE                   hServer,
+			Callback_DeliverMessageWithId deliverFn
+	);
+
+/*!
+ * \brief Reports the state of a message, \see CSMPPServer::ReportMessageState
+ */
+SMPP_API DeliveryResult libSMPP_ServerReportMessageState (
+			SMSC_HANDLE  hServer,
+			const char*  messageId,
+			MessageState state,
+			unsigned int errorCode
+	);
+
+/*!
+ * \brief Reports the state of a message to one of its destinations, \see CSMPPServer::ReportMessageState
+ */
+SMPP_API DeliveryResult libSMPP_ServerReportDestinationState (
+			SMSC_HANDLE  hServer,
+			const char*  messageId,
+			const char*  destination,
+			MessageState state,
+			unsigned int errorCode
+	);
+
+/*!
+ * \brief Sets the functions invoked when an ESME cancels or replaces a message,
+ * either one can be NULL to refuse it
+ * \remark This function must be called BEFORE \c libSMPP_ServerStart
+ */
+SMPP_API void libSMPP_ServerSetMessageUpdateCallbacks (
+			SMSC_HANDLE             hServer,
+			Callback_CancelMessage  cancelFn,
+			Callback_ReplaceMessage replaceFn
+	);
+
 
 /*******************************/
 /*         SMPP Client         */
@@ -356,6 +834,16 @@ SMPP_API ESME_HANDLE libSMPP_ClientCreate (
 			Callback_OnConnectionLost  onConnectionLost
 	);
 
+/*!
+ * Same as \c libSMPP_ClientCreate but the client runs on \p hExecutor
+ * instead of one of the default executors
+ */
+SMPP_API ESME_HANDLE libSMPP_ClientCreateWithExecutor (
+			Callback_OnIncomingMessage onNewMessage,
+			Callback_OnConnectionLost  onConnectionLost,
+			EXECUTOR_HANDLE            hExecutor
+	);
+
 /*!
  * Destroys the object \p handle.
  * \param hClient The ESME instance about to be destroyed
@@ -364,6 +852,22 @@ SMPP_API void libSMPP_ClientDelete (
 			ESME_HANDLE hClient
 	);
 
+/*!
+ * Creates a group of threads to run the network I/O and the callbacks of
+ * the clients given to it, which are isolated from the rest of the clients
+ * \param threads Number of threads, at least 2 if callbacks send messages
+ */
+SMPP_API EXECUTOR_HANDLE libSMPP_ExecutorCreate (
+			unsigned int threads
+	);
+
+/*!
+ * Releases \p hExecutor, its threads keep running until its clients are deleted
+ */
+SMPP_API void libSMPP_ExecutorDelete (
+			EXECUTOR_HANDLE hExecutor
+	);
+
 /*!
  * Sets the SMSC's IP address and port
  * \param hClient The ESME instance
@@ -446,6 +950,29 @@ SMPP_API LoginResult libSMPP_ClientBind (
 			ESME_HANDLE hClient
 	);
 
+/*!
+ * Same as \c libSMPP_ClientBind without blocking, the result is given to \c Callback_OnBound
+ * \param hClient The ESME instance
+ */
+SMPP_API void libSMPP_ClientBindAsync (
+			ESME_HANDLE hClient
+	);
+
+/*!
+ * Binds many clients at once, \see CSMPPClient::BindAll
+ * \param clients ESME instances to bind
+ * \param count Number of instances in \p clients
+ * \param parallelism How many binds can be in progress at the same time, 0 means all
+ * \param results Receives the result of each client, can be NULL
+ * \return The number of clients bound
+ */
+SMPP_API unsigned int libSMPP_ClientBindAll (
+			ESME_HANDLE  *clients,
+			unsigned int  count,
+			unsigned int  parallelism,
+			LoginResult  *results
+	);
+
 /*!
  * Unbinds (disconnect) the client from the SMSC
  * \param hClient The ESME instance
@@ -478,6 +1005,230 @@ SMPP_API DeliveryResult libSMPP_ClientSendMessage (
 			unsigned int size
 	);
 
+/*!
+ * Send a short message and keep track of its delivery receipt, \see CSMPPClient::SendMessage
+ * \param hClient The ESME instance (must be bound already)
+ * \param from Sender Id, Who the message is from
+ * \param to   Receipt of the message
+ * \param content UTF-8 encoded message text
+ * \param size   Size (in chars) of \p content
+ * \param context Passed back with the receipt of the message
+ * \param messageId If not NULL, must have room for 66 chars, the message_id given by the SMSC
+ */
+SMPP_API DeliveryResult libSMPP_ClientSendMessageTracked (
+			ESME_HANDLE  hClient,
+			const char*  from,
+			const char*  to,
+			const char*  content,
+			unsigned int size,
+			void*        context,
+			char*        messageId
+	);
+
+/*!
+ * Same as \c libSMPP_ClientSendMessageTracked, the message is sent with DATA_SM,
+ * \see CSMPPClient::SendDataMessage
+ * \param context Can be NULL if the receipt is not wanted
+ * \param messageId Can be NULL, otherwise must hold at least 66 bytes
+ */
+SMPP_API DeliveryResult libSMPP_ClientSendDataMessage (
+			ESME_HANDLE  hClient,
+			const char*  from,
+			const char*  to,
+			const char*  content,
+			unsigned int size,
+			void*        context,
+			char*        messageId
+	);
+
+/*!
+ * Sets the function invoked when a delivery receipt arrives
+ */
+SMPP_API void libSMPP_ClientSetDeliveryReceiptCallback (
+			ESME_HANDLE                hClient,
+			Callback_OnDeliveryReceipt onReceiptFn
+	);
+
+/*!
+ * Sets the function invoked instead of \c Callback_OnIncomingMessage to
+ * acknowledge incoming messages later
+ */
+SMPP_API void libSMPP_ClientSetAsyncMessageCallback (
+			ESME_HANDLE                     hClient,
+			Callback_OnIncomingMessageAsync onNewMessageFn
+	);
+
+/*!
+ * \brief Acknowledges a message reported by \c Callback_OnIncomingMessageAsync,
+ * \p hMessage is released
+ * \param result Anything but \c DELIVERY_OK makes the SMSC try again later
+ */
+SMPP_API void libSMPP_ClientAcknowledgeMessage (
+			INCOMING_HANDLE hMessage,
+			DeliveryResult  result
+	);
+
+/*!
+ * Sets the function invoked when the connection is restored, \see MessageSettings::AutoReconnect
+ */
+SMPP_API void libSMPP_ClientSetReconnectedCallback (
+			ESME_HANDLE            hClient,
+			Callback_OnReconnected onReconnectedFn
+	);
+
+/*!
+ * Sets the function invoked when a bind requested with \c libSMPP_ClientBindAsync completes
+ */
+SMPP_API void libSMPP_ClientSetBoundCallback (
+			ESME_HANDLE      hClient,
+			Callback_OnBound onBoundFn
+	);
+
+/*!
+ * Writes a short message to the outbox and sends it in the background, \see CSMPPClient::QueueMessage
+ * \param hClient The ESME instance, with \c MessageSettings::OutboxJournalPath set
+ * \param reference Passed to \c Callback_OnQueuedMessageSent, can be NULL
+ * \return \c DELIVERY_QUEUED once the message is safe on the disk
+ */
+SMPP_API DeliveryResult libSMPP_ClientQueueMessage (
+			ESME_HANDLE  hClient,
+			const char   *from,
+			const char   *to,
+			const char   *content,
+			unsigned int size,
+			const char   *reference
+	);
+
+/*!
+ * Sets the function invoked when a message queued with \c libSMPP_ClientQueueMessage leaves the outbox
+ */
+SMPP_API void libSMPP_ClientSetQueuedMessageCallback (
+			ESME_HANDLE                  hClient,
+			Callback_OnQueuedMessageSent onSentFn
+	);
+
+/*!
+ * Send the same short message to many recipients, \see CSMPPClient::SendMessageMulti
+ * Long messages are not sent with SUBMIT_MULTI, their segments are pipelined to each recipient
+ * \param hClient The ESME instance (must be bound already)
+ * \param from Sender Id, Who the message is from
+ * \param to   Recipients of the message
+ * \param count Number of elements in \p to
+ * \param content UTF-8 encoded message text
+ * \param size   Size (in chars) of \p content
+ * \param results If not NULL, must have room for \p count values, the result of each recipient
+ */
+SMPP_API DeliveryResult libSMPP_ClientSendMessageMulti (
+			ESME_HANDLE     hClient,
+			const char*     from,
+			const char**    to,
+			unsigned int    count,
+			const char*     content,
+			unsigned int    size,
+			DeliveryResult* results
+	);
+
+/*!
+ * Encodes, splits and packs a short message once, \see CSMPPClient::PrepareMessage
+ * \param hClient The ESME instance whose message settings are used
+ * \param from Sender Id, Who the message is from
+ * \param content UTF-8 encoded message text
+ * \param size   Size (in chars) of \p content
+ * \return The prepared message, to be released with \c libSMPP_ClientDeletePreparedMessage,
+ * NULL if it cannot be packed
+ */
+SMPP_API MESSAGE_HANDLE libSMPP_ClientPrepareMessage (
+			ESME_HANDLE  hClient,
+			const char*  from,
+			const char*  content,
+			unsigned int size
+	);
+
+/*!
+ * Sends a prepared message to many recipients, \see CSMPPClient::SendPreparedMessage
+ * \param hClient The ESME instance (must be bound already)
+ * \param hMessage A message returned by \c libSMPP_ClientPrepareMessage
+ * \param to   Recipients of the message
+ * \param count Number of elements in \p to
+ * \param results If not NULL, must have room for \p count values, the result of each recipient
+ */
+SMPP_API DeliveryResult libSMPP_ClientSendPreparedMessage (
+			ESME_HANDLE     hClient,
+			MESSAGE_HANDLE  hMessage,
+			const char**    to,
+			unsigned int    count,
+			DeliveryResult* results
+	);
+
+/*!
+ * Releases a message returned by \c libSMPP_ClientPrepareMessage
+ */
+SMPP_API void libSMPP_ClientDeletePreparedMessage (
+			MESSAGE_HANDLE hMessage
+	);
+
+/*!
+ * Creates an empty set of routes, \see CRouteTable
+ */
+SMPP_API ROUTES_HANDLE libSMPP_RoutesCreate (
+			void
+	);
+
+/*!
+ * Adds \p hClient to the route of \p prefix, \see CRouteTable::AddRoute
+ * \param hClient Must not be deleted while a router uses it
+ */
+SMPP_API void libSMPP_RoutesAdd (
+			ROUTES_HANDLE hRoutes,
+			const char*   prefix,
+			ESME_HANDLE   hClient,
+			unsigned int  cost
+	);
+
+/*!
+ * Releases \p hRoutes, routers it was given to are not affected
+ */
+SMPP_API void libSMPP_RoutesDelete (
+			ROUTES_HANDLE hRoutes
+	);
+
+/*!
+ * Creates a router with no routes, \see CSMPPRouter
+ */
+SMPP_API ROUTER_HANDLE libSMPP_RouterCreate (
+			void
+	);
+
+/*!
+ * Destroys \p hRouter, its clients are not affected
+ */
+SMPP_API void libSMPP_RouterDelete (
+			ROUTER_HANDLE hRouter
+	);
+
+/*!
+ * Replaces the routes of \p hRouter with \p hRoutes at once
+ */
+SMPP_API void libSMPP_RouterSetRoutes (
+			ROUTER_HANDLE hRouter,
+			ROUTES_HANDLE hRoutes
+	);
+
+/*!
+ * Sends a short message through the client routed to \p to, \see CSMPPRouter::SendMessage
+ * \param context Can be NULL if the receipt is not wanted
+ * \param messageId Can be NULL, otherwise must hold at least 66 bytes
+ */
+SMPP_API DeliveryResult libSMPP_RouterSendMessage (
+			ROUTER_HANDLE hRouter,
+			const char*   from,
+			const char*   to,
+			const char*   content,
+			unsigned int  size,
+			void*         context,
+			char*         messageId
+	);
+
 
 #if defined(__cplusplus) || defined(c_plusplus)
 }
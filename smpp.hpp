@@ -31,6 +31,95 @@
 
 namespace opensmpp
 {
+	/*!
+	* \brief A bind waiting for validation, \see CSMSCCallback::ValidateUserAsync
+	*/
+	class SMPP_API CBindValidation
+	{
+	public:
+
+		/*!
+		* \brief Accepts or rejects the bind, may be called from any thread
+		* Only the first call has effect. If the object is released without
+		* calling this function the bind is rejected with \c LOGIN_RESULT_FAIL
+		*/
+		virtual void Complete (
+					LoginResult result
+			) = 0;
+
+		virtual ~CBindValidation(){}
+	};
+
+	/*!
+	* \brief An incoming message waiting to be acknowledged to the SMSC,
+	* \see CESMECallback::OnIncomingMessageAsync
+	*/
+	class SMPP_API CIncomingMessage
+	{
+	public:
+
+		/*!
+		* \brief Sends the response of the message, may be called from any thread
+		* Only the first call has effect. If the object is released without
+		* calling this function the message is answered with \c DELIVERY_UNKNOWN_ERROR
+		* \param result Anything but \c DELIVERY_OK makes the SMSC try again later
+		*/
+		virtual void Complete (
+					DeliveryResult result
+			) = 0;
+
+		virtual ~CIncomingMessage(){}
+	};
+
+	/*!
+	* \brief A short message encoded, split and packed once so it can be sent
+	* to many recipients, \see CSMPPClient::PrepareMessage
+	*/
+	class SMPP_API CPreparedMessage
+	{
+	public:
+
+		~CPreparedMessage();
+
+		/*! \return The number of SUBMIT_SM each recipient takes */
+		unsigned int GetSegmentCount() const;
+
+	private:
+		friend class CSMPPClient;
+		CPreparedMessage();
+		struct impl;
+		boost::scoped_ptr<impl> pimpl;
+	};
+
+	/*!
+	* \brief Threads running the network I/O and the callbacks of the clients
+	* given to it, \see CSMPPClient::CSMPPClient
+	*
+	* Clients sharing an executor delay each other while running their callbacks,
+	* one with its own executor is isolated from the rest. The executor lives
+	* for as long as any of its clients does.
+	*/
+	class SMPP_API CClientExecutor
+	{
+	public:
+
+		/*!
+		* \param threads Number of threads, callbacks sending messages or binding
+		* need at least 2 since the responses are read by these same threads
+		*/
+		CClientExecutor(unsigned int threads = 2);
+
+		~CClientExecutor();
+
+		/*! \return The number of threads */
+		unsigned int GetThreads() const;
+
+	private:
+		friend class CSMPPClient;
+		struct impl;
+		boost::shared_ptr<impl> pimpl;
+	};
+
 	/*!
 	* \brief This class must be implemented by the user, each method speaks by it self
 	*/
@@ -56,6 +145,26 @@ namespace opensmpp
 			) = 0;
 
 
+		/*!
+		* \brief Validate a user login without blocking the server
+		* The default implementation calls \c ValidateUser and completes the bind right away,
+		* override it to validate users against slow backends. No other request from the
+		* connection is processed until \p validation is completed.
+		* \param validation Must be completed once the user has been validated, from any thread
+		*/
+		virtual void ValidateUserAsync (
+					unsigned int                       connectionId,
+					BindType                           loginType,
+					const std::string&                 systemId,
+					const std::string&                 password,
+					const std::string&                 address_range,
+					boost::shared_ptr<CBindValidation> validation
+			)
+		{
+			validation->Complete(ValidateUser(connectionId, loginType, systemId, password, address_range));
+		}
+
+
 		/*!
 		* \brief A new message from a client ESME has come and we should deliver it
 		* \param connectionId The is of the connection who sent this message
@@ -71,6 +180,76 @@ namespace opensmpp
 			) = 0;
 
 
+		/*!
+		* \brief Same as \c DeliverMessage, with the message_id given to the ESME
+		* Override this one to report the state of the message later with
+		* \c CSMPPServer::ReportMessageState, the default implementation calls \c DeliverMessage
+		* \param messageId The message_id sent back to the ESME if the message is accepted,
+		* the destinations of a SUBMIT_MULTI get the same one
+		*/
+		virtual DeliveryResult DeliverMessageWithId (
+					unsigned int       connectionId,
+					const std::string& from,
+					const std::string& to,
+					const std::string& message,
+					const std::string& /*messageId*/
+			)
+		{
+			return DeliverMessage(connectionId, from, to, message);
+		}
+
+
+		/*!
+		* \brief The ESME wants to cancel a message that has not reached a final state yet
+		* The default implementation refuses it, the message can only be cancelled
+		* by the application holding it
+		* \param messageId The message_id given by \c DeliverMessageWithId
+		* \return \c DELIVERY_OK if the message was cancelled
+		*/
+		virtual DeliveryResult CancelMessage (
+					unsigned int       /*connectionId*/,
+					const std::string& /*messageId*/
+			)
+		{
+			return DELIVERY_REJECTED;
+		}
+
+
+		/*!
+		* \brief The ESME wants to replace the text of a message that has not reached a final state yet
+		* The default implementation refuses it
+		* \param messageId The message_id given by \c DeliverMessageWithId
+		* \param message The new text body of the message, encoded in UTF-8
+		* \return \c DELIVERY_OK if the message was replaced
+		*/
+		virtual DeliveryResult ReplaceMessage (
+					unsigned int       /*connectionId*/,
+					const std::string& /*messageId*/,
+					const std::string& /*message*/
+			)
+		{
+			return DELIVERY_REJECTED;
+		}
+
+
+		/*!
+		* \brief Asks for the throughput allowed to a user that has just bound
+		* Called after \c ValidateUser accepts the bind, the default implementation
+		* keeps the server defaults (\see ServerSettings)
+		* \param connectionId The connection id
+		* \param systemId The user name
+		* \param rate Messages per second allowed, holds the server default on input (0 = no limit)
+		* \param burst Messages allowed at once, holds the server default on input
+		*/
+		virtual void GetUserThroughput (
+					unsigned int       /*connectionId*/,
+					const std::string& /*systemId*/,
+					unsigned int&      /*rate*/,
+					unsigned int&      /*burst*/
+			)
+		{ }
+
+
 		/*!
 		* \brief Advices that a user has been disconnected
 		* \param connectionId The connection id
@@ -114,6 +293,16 @@ namespace opensmpp
 		 */
 		void SetEnconding(DataCoding data_coding);
 
+		/*!
+		 * Sets server-wide settings, \see ServerSettings
+		 *
+		 * \remark Must be called before \c Start
+		 */
+		void SetServerSettings(const ServerSettings& ss);
+
+		/*! Copies server settings to \p ss */
+		void GetServerSettings(ServerSettings *ss);
+
 		/*!
 		* \brief Start listening
 		* \return 0 if ok, no zero if something fails
@@ -138,7 +327,12 @@ namespace opensmpp
 		* \return \c DELIVERY_OK if everything runs smoothly
 		* \return \c DELIVERY_REJECTED if the user rejects the message
 		* \return \c DELIVERY_INV_DEST_ADDR if there is no user with address \p to
+		* \return \c DELIVERY_QUEUED if there is no user with address \p to but the message is stored until one binds
 		* \return \c DELIVERY_UNKNOWN_ERROR if something gets broken (connection lost, unknown error, whatever)
+		*
+		* \remark This function waits for the ESME's response. With \c SERVER_THREADING_PER_CORE
+		* it must not be called from within a callback, the response could be queued
+		* on the very same thread that is waiting for it.
 		*/
 		DeliveryResult SendMessage(
 					const std::string& from,
@@ -146,6 +340,39 @@ namespace opensmpp
 					const std::string& message
 			);
 
+		/*!
+		* \brief Reports the state of a message submitted with SUBMIT_SM, or of every destination
+		* of one submitted with SUBMIT_MULTI
+		* If the ESME asked for it a delivery receipt is sent to one of its receiver binds,
+		* without waiting for the response. The state is remembered for
+		* \c ServerSettings::MessageIndexTTL seconds.
+		* \param messageId The id given to \c CSMSCCallback::DeliverMessageWithId
+		* \param state The state reached by the message
+		* \param errorCode Network specific error code, 0 if there is none
+		* \return \c DELIVERY_OK if the receipt has been sent or is not needed
+		* \return \c DELIVERY_INV_DEST_ADDR if the ESME has no receiver bound
+		* \return \c DELIVERY_UNKNOWN_ERROR if the message is unknown or has been forgotten
+		*/
+		DeliveryResult ReportMessageState(
+					const std::string& messageId,
+					MessageState       state,
+					unsigned int       errorCode = 0
+			);
+
+		/*!
+		* \brief Reports the state of a message submitted with SUBMIT_MULTI to one of its destinations
+		* The receipt, if asked for, is sent for \p destination only. The message as a whole,
+		* as seen by QUERY_SM, takes the state once every destination has reached a final one.
+		* Messages submitted with SUBMIT_SM are accepted too, \p destination must be theirs.
+		* \see ReportMessageState
+		*/
+		DeliveryResult ReportMessageState(
+					const std::string& messageId,
+					const std::string& destination,
+					MessageState       state,
+					unsigned int       errorCode = 0
+			);
+
 	private:
 		struct pimpl;
 		boost::shared_ptr<pimpl> m_pimpl;
@@ -164,11 +391,31 @@ namespace opensmpp
 
 		/*!
 		* Connection Lost callback
+		* If \c MessageSettings::AutoReconnect is set the client is already trying to
+		* bind again, there is no need to call \c CSMPPClient::Bind
 		*/
 		virtual void OnConnectionLost (
 					int cause
 			) = 0;
 
+		/*!
+		* Called when the client binds again after losing the connection,
+		* only if \c MessageSettings::AutoReconnect is set
+		*/
+		virtual void OnReconnected ()
+		{
+		}
+
+		/*!
+		* Called when a bind requested with \c CSMPPClient::BindAsync completes
+		* \param result The same \c CSMPPClient::Bind would have returned
+		*/
+		virtual void OnBound (
+					LoginResult /*result*/
+			)
+		{
+		}
+
 		/*!
 		* Called when a new message arrives
 		* \param from Who send the message
@@ -181,6 +428,54 @@ namespace opensmpp
 					const std::string &content
 			) = 0;
 
+		/*!
+		* Same as \c OnIncomingMessage, but the SMSC gets the response once \p message
+		* is completed. The default implementation calls \c OnIncomingMessage and
+		* completes it right away, override it to acknowledge messages once they
+		* are safely stored. Up to \c MessageSettings::MaxInboundPending messages are
+		* reported before the first one is completed.
+		*/
+		virtual void OnIncomingMessageAsync (
+					const std::string                   &from,
+					const std::string                   &to,
+					const std::string                   &content,
+					boost::shared_ptr<CIncomingMessage>  message
+			)
+		{
+			OnIncomingMessage(from, to, content);
+			message->Complete(DELIVERY_OK);
+		}
+
+		/*!
+		* Called when a delivery receipt arrives, only if \c MessageSettings::RequestDeliveryReceipts is set
+		* \param receipt The receipt
+		* \param context The context given when the message was sent, NULL if the
+		* message is unknown or its context has been forgotten already
+		*/
+		virtual void OnDeliveryReceipt (
+					const DeliveryReceipt &/*receipt*/,
+					void                  * /*context*/
+			)
+		{
+		}
+
+		/*!
+		* Called when a message queued with \c CSMPPClient::QueueMessage leaves the
+		* outbox, from one of the threads sending it
+		* \param reference The one given when the message was queued
+		* \param result The same \c CSMPPClient::SendMessage would have returned, messages
+		* not answered or throttled by the SMSC are not reported, they stay in the outbox
+		* and are sent again later
+		* \param messageId The message_id given by the SMSC, if it was accepted
+		*/
+		virtual void OnQueuedMessageSent (
+					const std::string &/*reference*/,
+					DeliveryResult     /*result*/,
+					const std::string &/*messageId*/
+			)
+		{
+		}
+
 
 		virtual ~CESMECallback(){}
 	};
@@ -196,20 +491,24 @@ namespace opensmpp
 		* \param smscIP IP Address of the SMSC this class should connect to
 		* \param smscPort Port where the SMSC is linstening
 		* \param loginMode Defines how to bind with the SMSC
+		* \param executor Runs the I/O and the callbacks of the client, if empty
+		* the client is given one of the default executors, \see SetClientThreads
 		*/
 		CSMPPClient(
-				boost::shared_ptr<CESMECallback> callbacks,
-				const std::string&               smscIP = "",
-				unsigned short                   smscPort = 0,
-				BindType                         loginMode = BIND_TYPE_TRANSCEIVER
+				boost::shared_ptr<CESMECallback>    callbacks,
+				const std::string&                  smscIP = "",
+				unsigned short                      smscPort = 0,
+				BindType                            loginMode = BIND_TYPE_TRANSCEIVER,
+				boost::shared_ptr<CClientExecutor>  executor = boost::shared_ptr<CClientExecutor>()
 		);
 
 		~CSMPPClient();
 
 	public:
 
-		/*! Sets the number of client threads, use it if you are going
-		* to create a lot of clients. Default is 2 threads */
+		/*! Sets the number of default executors, clients without their own
+		* executor are assigned to them in turns. Default is one per core,
+		* each with 2 threads. Clients already created keep their executor */
 		static void SetClientThreads(unsigned int count);
 
 	public: // Gets
@@ -223,6 +522,9 @@ namespace opensmpp
 		/*! \return The Bind mode */
 		BindType GetBindMode() const;
 
+		/*! \return The executor running the client */
+		boost::shared_ptr<CClientExecutor> GetExecutor() const;
+
 		/*! \return The system  Id (aka username) */
 		std::string GetSystemId() const;
 
@@ -238,6 +540,9 @@ namespace opensmpp
 		/*! \return \c true if this client is bound to a SMSC, otherwise \c false */
 		bool IsBound() const;
 
+		/*! \return The callbacks given on construction */
+		boost::shared_ptr<CESMECallback> GetCallbacks() const;
+
 		/*! \return The systemId of the server this client is connected to */
 		std::string GetServerSystemId() const;
 
@@ -276,6 +581,25 @@ namespace opensmpp
 		/*! Connects and binds the client with the SNMP server (SMSC) */
 		LoginResult Bind();
 
+		/*!
+		 * Same as \c Bind without blocking the calling thread, the result is
+		 * given to \c CESMECallback::OnBound on one of the client threads.
+		 * \see MessageSettings::ConnectTimeout and MessageSettings::BindTimeout
+		 */
+		void BindAsync();
+
+		/*!
+		 * Binds many clients at once, waiting until every bind completes
+		 * \param parallelism How many binds can be in progress at the same time, 0 means all
+		 * \param results Receives the result of each client, in the same order
+		 * \return The number of clients bound
+		 */
+		static unsigned int BindAll(
+					const std::vector<CSMPPClient*>& clients,
+					unsigned int                     parallelism,
+					std::vector<LoginResult>        *results = NULL
+			);
+
 
 		/*! Unbinds (disconnect) the client from the SMSC */
 		void Unbind();
@@ -297,6 +621,194 @@ namespace opensmpp
 					const std::string& content
 			);
 
+		/*!
+		* Sends a short message and keeps track of its delivery receipt
+		* The receipt is reported along with \p context, unless it does not come
+		* within \c MessageSettings::ReceiptTrackingTTL seconds. Long messages get
+		* a receipt for each segment, all of them with \p context.
+		* \param from Sender Id, Who the message is from
+		* \param to   Receipt of the message
+		* \param content UTF-8 encoded message text
+		* \param messageId If not NULL, set to the message_id given by the SMSC
+		* (the one of the first segment)
+		* \param context Passed back with the receipt, only used if
+		* \c MessageSettings::RequestDeliveryReceipts is set
+		*/
+		DeliveryResult SendMessage (
+					const std::string& from,
+					const std::string& to,
+					const std::string& content,
+					std::string*       messageId,
+					void*              context = NULL
+			);
+
+		/*!
+		* Sends the same short message to many recipients
+		* The text is encoded once and sent with SUBMIT_MULTI, up to 255 recipients each,
+		* unless \c MessageSettings::EnableSubmitMulti is not set or the SMSC does not
+		* support it, in such case it's sent with pipelined SUBMIT_SM. A text that does
+		* not fit in one SUBMIT_SM is never sent with SUBMIT_MULTI, its segments go to
+		* every recipient with pipelined SUBMIT_SM. A recipient lost with the connection
+		* gets all of its segments again
+		* \param from Sender Id, Who the message is from
+		* \param to   Recipients of the message
+		* \param content UTF-8 encoded message text
+		* \param results If not NULL, filled with the result of each recipient in \p to
+		* \return \c DELIVERY_OK if the message was accepted for every recipient, otherwise
+		* the result of the first recipient that failed
+		*/
+		DeliveryResult SendMessageMulti (
+					const std::string&               from,
+					const std::vector<std::string>&  to,
+					const std::string&               content,
+					std::vector<DeliveryResult>*     results = NULL
+			);
+
+		/*!
+		* Same as \c SendMessage, but the message is sent with DATA_SM
+		* The text always goes in the message_payload TLV, it's split in segments
+		* of \c MAX_MESSAGE_LENGTH bytes only if it does not fit in one
+		*/
+		DeliveryResult SendDataMessage (
+					const std::string& from,
+					const std::string& to,
+					const std::string& content,
+					std::string*       messageId = NULL,
+					void*              context = NULL
+			);
+
+		/*!
+		* Writes a short message to the outbox and sends it in the background, the
+		* result is given to \c CESMECallback::OnQueuedMessageSent. The outbox is
+		* a journal on the disk, so messages not sent yet are sent when the client
+		* is created again with the same \c MessageSettings::OutboxJournalPath.
+		* A segment is sent again if the client stops before its response comes,
+		* the segments of a long message accepted already are not. Messages may not
+		* be sent in the order they were queued.
+		* \param from Sender Id, Who the message is from
+		* \param to   Receipt of the message
+		* \param content UTF-8 encoded message text
+		* \param reference Passed back once the message is sent, it's kept in the journal
+		* \return \c DELIVERY_QUEUED once the message is safe on the disk, \c DELIVERY_UNKNOWN_ERROR
+		* if there is no outbox or it cannot be written
+		*/
+		DeliveryResult QueueMessage (
+					const std::string& from,
+					const std::string& to,
+					const std::string& content,
+					const std::string& reference = std::string()
+			);
+
+		/*!
+		* Same as \c SendMessageMulti, but the message is sent to every recipient
+		* with pipelined DATA_SM, split in segments if it does not fit in one
+		*/
+		DeliveryResult SendDataMessageMulti (
+					const std::string&               from,
+					const std::vector<std::string>&  to,
+					const std::string&               content,
+					std::vector<DeliveryResult>*     results = NULL
+			);
+
+		/*!
+		* Encodes, splits and packs a short message once, the result can be sent
+		* to any number of recipients with \c SendPreparedMessage, which only has to
+		* write the destination address and sequence numbers of each copy.
+		* The message settings in effect now are the ones used for every copy.
+		* \param from Sender Id, Who the message is from
+		* \param content UTF-8 encoded message text
+		* \return The prepared message, empty if it cannot be packed
+		*/
+		boost::shared_ptr<CPreparedMessage> PrepareMessage (
+					const std::string& from,
+					const std::string& content
+			);
+
+		/*!
+		* Sends a prepared message to many recipients with pipelined SUBMIT_SM
+		* \param message A message returned by \c PrepareMessage
+		* \param to Recipients of the message
+		* \param results If not NULL, filled with the result of each recipient in \p to
+		* \return \c DELIVERY_OK if the message was accepted for every recipient, otherwise
+		* the result of the first recipient that failed
+		*/
+		DeliveryResult SendPreparedMessage (
+					const CPreparedMessage&          message,
+					const std::vector<std::string>&  to,
+					std::vector<DeliveryResult>*     results = NULL
+			);
+
+	private:
+		friend class BindAllState;
+		struct impl;
+		boost::scoped_ptr<impl> pimpl;
+	};
+
+	/*!
+	 * \brief Destination prefixes and the clients serving them, \see CSMPPRouter
+	 */
+	class SMPP_API CRouteTable
+	{
+	public:
+
+		CRouteTable();
+		~CRouteTable();
+
+		/*!
+		 * Adds \p client to the route of \p prefix, only its digits count
+		 * and the empty prefix matches every destination
+		 * \param cost Clients with a lower cost are tried first, the load is
+		 * spread among those with the same cost
+		 */
+		void AddRoute(
+					const std::string&              prefix,
+					boost::shared_ptr<CSMPPClient>  client,
+					unsigned int                    cost = 0
+			);
+
+	private:
+		friend class CSMPPRouter;
+		struct impl;
+		boost::scoped_ptr<impl> pimpl;
+	};
+
+	/*!
+	 * \brief Sends each message through one of several clients, picked by
+	 * the longest prefix of its destination found among the routes
+	 *
+	 * When the client picked is not bound, or the message fails with
+	 * \c DELIVERY_UNKNOWN_ERROR (throttled, timed out or connection lost), the
+	 * message goes through the next client of the route and the one that failed
+	 * is held back for a while. Routes are replaced all at once with
+	 * \c SetRoutes, lookups never wait for it. The router keeps the clients
+	 * of its current routes alive, those dropped by \c SetRoutes are released
+	 * as soon as the messages being sent through them return.
+	 */
+	class SMPP_API CSMPPRouter
+	{
+	public:
+
+		CSMPPRouter();
+		~CSMPPRouter();
+
+		/*! Replaces the routes, messages being sent keep the ones they started with */
+		void SetRoutes(const CRouteTable& routes);
+
+		/*! \return The client a message to \p to would go through, empty if no client is bound */
+		boost::shared_ptr<CSMPPClient> Route(const std::string& to);
+
+		/*!
+		 * Sends a short message, \see CSMPPClient::SendMessage
+		 * \return \c DELIVERY_INV_DEST_ADDR if there is no route to \p to
+		 */
+		DeliveryResult SendMessage (
+					const std::string& from,
+					const std::string& to,
+					const std::string& content,
+					std::string*       messageId = NULL,
+					void*              context = NULL
+			);
+
 	private:
 		struct impl;
 		boost::scoped_ptr<impl> pimpl;
@@ -0,0 +1,371 @@
+/*!
+ * \file commandpool.hpp
+ * \author ichramm
+ */
+#ifndef OPENSMPP_COMMANDPOOL_HPP_
+#define OPENSMPP_COMMANDPOOL_HPP_
+#if _MSC_VER > 1000
+#pragma once
+#endif
+
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/tss.hpp>
+#include <cstddef>
+#include <new>
+#include <vector>
+
+// blocks a thread keeps for each type, those over it are shared with the other threads
+#define COMMAND_POOL_SIZE 256
+
+// blocks moved at once between a thread and the shared pool
+#define COMMAND_POOL_BATCH (COMMAND_POOL_SIZE / 2)
+
+// blocks of each type shared by all threads, those over it go back to the heap
+#define COMMAND_POOL_SHARED_SIZE 1024
+
+// bytes in each chunk of a decode arena, fits a few TLVs
+#define DECODE_ARENA_CHUNK 8192
+
+namespace opensmpp
+{
+	/*!
+	 * \brief Free blocks of one size, there is one list of each size per thread
+	 *
+	 * When the list of a thread is full, half of it goes to a pool of the same
+	 * size shared by every thread, and a thread with an empty list takes a batch
+	 * from there before going to the heap. When one thread frees what another
+	 * allocates, blocks flow back to the allocating thread through the pool,
+	 * taking its lock once per batch.
+	 */
+	template <std::size_t Size>
+	class CBlockFreeList
+	{
+	public:
+
+		static void *Take()
+		{
+			CBlockFreeList *list = Local();
+			if (!list->m_head && Shared().Get(list->m_head)) {
+				list->m_count = COMMAND_POOL_BATCH;
+			}
+			if (list->m_head)
+			{
+				Block *block = list->m_head;
+				list->m_head = block->next;
+				list->m_count--;
+				return block;
+			}
+			return ::operator new(Size);
+		}
+
+		static void Give(void *p)
+		{
+			CBlockFreeList *list = Local();
+			if (list->m_count >= COMMAND_POOL_SIZE)
+			{ // the first blocks of the list make a batch for the other threads
+				Block *last = list->m_head;
+				for (std::size_t i = 1; i < COMMAND_POOL_BATCH; i++) {
+					last = last->next;
+				}
+				Block *batch = list->m_head;
+				list->m_head = last->next;
+				list->m_count -= COMMAND_POOL_BATCH;
+				last->next = 0;
+				Shared().Put(batch);
+			}
+			Block *block = static_cast<Block*>(p);
+			block->next = list->m_head;
+			list->m_head = block;
+			list->m_count++;
+		}
+
+		~CBlockFreeList()
+		{
+			Release(m_head);
+		}
+
+	private:
+
+		struct Block
+		{
+			Block *next;
+		};
+
+		/*! Batches of \c COMMAND_POOL_BATCH blocks given up by the threads */
+		class SharedPool
+		{
+		public:
+
+			SharedPool()
+			{
+				m_batches.reserve(MaxBatches);
+			}
+
+			void Put(Block *batch)
+			{
+				{
+					boost::lock_guard<boost::mutex> lock(m_mutex);
+					if (m_batches.size() < MaxBatches)
+					{
+						m_batches.push_back(batch);
+						return;
+					}
+				}
+				Release(batch);
+			}
+
+			/*! \return \c false if there is no batch */
+			bool Get(Block *&batch)
+			{
+				boost::lock_guard<boost::mutex> lock(m_mutex);
+				if (m_batches.empty()) {
+					return false;
+				}
+				batch = m_batches.back();
+				m_batches.pop_back();
+				return true;
+			}
+
+		private:
+
+			enum { MaxBatches = COMMAND_POOL_SHARED_SIZE / COMMAND_POOL_BATCH };
+
+			boost::mutex          m_mutex;
+			std::vector<Block*>   m_batches;
+		};
+
+		static void Release(Block *head)
+		{
+			while (head)
+			{
+				Block *block = head;
+				head = block->next;
+				::operator delete(block);
+			}
+		}
+
+		CBlockFreeList()
+		 : m_head(0)
+		 , m_count(0)
+		{ }
+
+		static CBlockFreeList *Local()
+		{
+			// never destroyed, commands may still be released while statics are torn down
+			static boost::thread_specific_ptr<CBlockFreeList> *s_lists = new boost::thread_specific_ptr<CBlockFreeList>;
+			CBlockFreeList *list = s_lists->get();
+			if (!list) {
+				s_lists->reset(list = new CBlockFreeList);
+			}
+			return list;
+		}
+
+		static SharedPool& Shared()
+		{
+			// never destroyed either, its blocks stay for the process lifetime
+			static SharedPool *s_shared = new SharedPool;
+			return *s_shared;
+		}
+
+		Block        *m_head;
+		std::size_t   m_count;
+	};
+
+	/*!
+	 * \brief Allocator that takes single objects from the free list of the
+	 * calling thread, it is meant for \c boost::allocate_shared, which puts
+	 * the object and its reference count in a single block
+	 *
+	 * A block freed by another thread joins the list of that thread, once it
+	 * is full the blocks are handed over through the shared pool.
+	 */
+	template <typename T>
+	class CPoolAllocator
+	{
+	public:
+		typedef T               value_type;
+		typedef T*              pointer;
+		typedef const T*        const_pointer;
+		typedef T&              reference;
+		typedef const T&        const_reference;
+		typedef std::size_t     size_type;
+		typedef std::ptrdiff_t  difference_type;
+
+		template <typename U>
+		struct rebind
+		{
+			typedef CPoolAllocator<U> other;
+		};
+
+		CPoolAllocator() { }
+
+		template <typename U>
+		CPoolAllocator(const CPoolAllocator<U>&) { }
+
+		pointer allocate(size_type n, const void* = 0)
+		{
+			if (n != 1) {
+				return static_cast<pointer>(::operator new(n * sizeof(T)));
+			}
+			return static_cast<pointer>(CBlockFreeList<BlockSize>::Take());
+		}
+
+		void deallocate(pointer p, size_type n)
+		{
+			if (n != 1) {
+				::operator delete(p);
+			} else {
+				CBlockFreeList<BlockSize>::Give(p);
+			}
+		}
+
+		size_type max_size() const
+		{
+			return static_cast<size_type>(-1) / sizeof(T);
+		}
+
+		void construct(pointer p, const T& value)
+		{
+			new (p) T(value);
+		}
+
+		void destroy(pointer p)
+		{
+			p->~T();
+		}
+
+		pointer address(reference r) const
+		{
+			return &r;
+		}
+
+		const_pointer address(const_reference r) const
+		{
+			return &r;
+		}
+
+	private:
+
+		// a free block must be able to hold the link to the next one
+		enum { BlockSize = sizeof(T) < sizeof(void*) ? sizeof(void*) : sizeof(T) };
+	};
+
+	/*!
+	 * \brief Holds what libsmpp34 allocates while decoding a PDU, it's all
+	 * released at once along with the arena
+	 *
+	 * Memory is bumped out of chunks taken from the pool of the calling thread,
+	 * nothing is released on its own.
+	 */
+	class CDecodeArena
+	{
+	public:
+
+		CDecodeArena()
+		 : m_chunks(0)
+		 , m_used(Capacity)
+		{ }
+
+		~CDecodeArena()
+		{
+			while (m_chunks)
+			{
+				Chunk *chunk = m_chunks;
+				m_chunks = chunk->next;
+				CBlockFreeList<sizeof(Chunk)>::Give(chunk);
+			}
+		}
+
+		/*! \brief Matches \c smpp34_alloc_t, \c NULL if there is no memory left */
+		static void *Allocate(void *ctx, std::size_t size)
+		{
+			CDecodeArena *arena = static_cast<CDecodeArena*>(ctx);
+			size = (size + sizeof(void*) - 1) & ~(sizeof(void*) - 1);
+			if (size > Capacity) {
+				return 0;
+			}
+			if (arena->m_used + size > Capacity)
+			{
+				try
+				{
+					Chunk *chunk = static_cast<Chunk*>(CBlockFreeList<sizeof(Chunk)>::Take());
+					chunk->next = arena->m_chunks;
+					arena->m_chunks = chunk;
+					arena->m_used = 0;
+				}
+				catch (const std::bad_alloc&)
+				{ // must not go through libsmpp34
+					return 0;
+				}
+			}
+			void *p = arena->m_chunks->data + arena->m_used;
+			arena->m_used += size;
+			return p;
+		}
+
+		/*! \return \c true if \p p was allocated from the arena */
+		bool Owns(const void *p) const
+		{
+			for (const Chunk *chunk = m_chunks; chunk; chunk = chunk->next)
+			{
+				if (p >= chunk->data && p < chunk->data + Capacity) {
+					return true;
+				}
+			}
+			return false;
+		}
+
+		/*!
+		 * \brief Cuts \p list where the nodes from the arena start, those before
+		 * them were added after decoding and come from the heap
+		 * \return \p list, now holding only the nodes from the heap
+		 */
+		template <typename node_t>
+		node_t *HeapNodes(node_t *list) const
+		{
+			if (!list || Owns(list)) {
+				return 0;
+			}
+			for (node_t *node = list; node->next; node = node->next)
+			{
+				if (Owns(node->next))
+				{
+					node->next = 0;
+					break;
+				}
+			}
+			return list;
+		}
+
+	private:
+
+		enum { Capacity = DECODE_ARENA_CHUNK - sizeof(void*) };
+
+		struct Chunk
+		{
+			Chunk  *next;
+			char    data[Capacity];
+		};
+
+		CDecodeArena(const CDecodeArena&);
+		CDecodeArena& operator=(const CDecodeArena&);
+
+		Chunk        *m_chunks;
+		std::size_t   m_used;
+	};
+
+	template <typename T, typename U>
+	inline bool operator==(const CPoolAllocator<T>&, const CPoolAllocator<U>&)
+	{
+		return true;
+	}
+
+	template <typename T, typename U>
+	inline bool operator!=(const CPoolAllocator<T>&, const CPoolAllocator<U>&)
+	{
+		return false;
+	}
+} // namespace opensmpp
+
+#endif // OPENSMPP_COMMANDPOOL_HPP_
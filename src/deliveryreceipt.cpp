@@ -0,0 +1,204 @@
+/*!
+ * \file deliveryreceipt.cpp
+ * \author ichramm
+ */
+#include "stdafx.h"
+#include "deliveryreceipt.hpp"
+#include "smppdefs.h"
+
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+
+#ifdef _MSC_VER
+#define snprintf _snprintf
+#endif
+
+using namespace std;
+using namespace boost;
+
+namespace opensmpp
+{
+
+static const struct
+{
+	const char    *name;
+	MessageState   state;
+} s_states[] = {
+	{ "DELIVRD", MESSAGE_STATE_DELIVERED     },
+	{ "EXPIRED", MESSAGE_STATE_EXPIRED       },
+	{ "DELETED", MESSAGE_STATE_DELETED       },
+	{ "UNDELIV", MESSAGE_STATE_UNDELIVERABLE },
+	{ "ACCEPTD", MESSAGE_STATE_ACCEPTED      },
+	{ "UNKNOWN", MESSAGE_STATE_UNKNOWN       },
+	{ "REJECTD", MESSAGE_STATE_REJECTED      },
+	{ "ENROUTE", MESSAGE_STATE_ENROUTE       }
+};
+
+/*! \return Where the value of field \p name starts if \p text starts with it, otherwise NULL */
+static const char *MatchField(const char *text, const char *end, const char *name)
+{
+	for ( ; *name; name++, text++)
+	{
+		if (text == end || tolower((unsigned char)*text) != tolower((unsigned char)*name)) {
+			return NULL;
+		}
+	}
+	return text;
+}
+
+/*! \return Where the value starting at \p text ends */
+static const char *ValueEnd(const char *text, const char *end)
+{
+	const char *space = (const char *)memchr(text, ' ', end - text);
+	return space ? space : end;
+}
+
+/*! Copies the value starting at \p text to \p dest, truncating it if it does not fit */
+static const char *CopyValue(const char *text, const char *end, char *dest, size_t size)
+{
+	const char *value_end = ValueEnd(text, end);
+	size_t length = min((size_t)(value_end - text), size - 1);
+	memcpy(dest, text, length);
+	dest[length] = '\0';
+	return value_end;
+}
+
+static const char *ParseNumber(const char *text, const char *end, unsigned int &number)
+{
+	const char *value_end = ValueEnd(text, end);
+	number = 0;
+	for ( ; text < value_end && isdigit((unsigned char)*text); text++) {
+		number = number * 10 + (*text - '0');
+	}
+	return value_end;
+}
+
+static const char *ParseState(const char *text, const char *end, MessageState &state)
+{
+	const char *value_end = ValueEnd(text, end);
+	state = MESSAGE_STATE_UNKNOWN;
+	for (size_t i = 0; i < ARRAY_LEN(s_states); i++)
+	{
+		if (MatchField(text, value_end, s_states[i].name) == value_end) {
+			state = s_states[i].state;
+			break;
+		}
+	}
+	return value_end;
+}
+
+bool ParseDeliveryReceipt(const char *text, size_t length, DeliveryReceipt& receipt)
+{
+	bool found_id = false;
+	const char *end = text + length;
+	const char *value;
+
+	while (text < end)
+	{
+		if (*text == ' ') {
+			text++;
+			continue;
+		}
+
+		if (MatchField(text, end, "text:")) {
+			break; // always the last one, and it's free text
+		}
+
+		if ((value = MatchField(text, end, "id:")) != NULL) {
+			text = CopyValue(value, end, receipt.MessageId, sizeof(receipt.MessageId));
+			found_id = true;
+		} else if ((value = MatchField(text, end, "sub:")) != NULL) {
+			text = ParseNumber(value, end, receipt.Submitted);
+		} else if ((value = MatchField(text, end, "dlvrd:")) != NULL) {
+			text = ParseNumber(value, end, receipt.Delivered);
+		} else if ((value = MatchField(text, end, "submit date:")) != NULL) {
+			text = CopyValue(value, end, receipt.SubmitDate, sizeof(receipt.SubmitDate));
+		} else if ((value = MatchField(text, end, "done date:")) != NULL) {
+			text = CopyValue(value, end, receipt.DoneDate, sizeof(receipt.DoneDate));
+		} else if ((value = MatchField(text, end, "stat:")) != NULL) {
+			text = ParseState(value, end, receipt.State);
+		} else if ((value = MatchField(text, end, "err:")) != NULL) {
+			text = ParseNumber(value, end, receipt.ErrorCode);
+		} else {
+			text = ValueEnd(text, end); // unknown field
+		}
+	}
+
+	return found_id;
+}
+
+size_t FormatDeliveryReceipt(const DeliveryReceipt& receipt, char *text, size_t size)
+{
+	const char *stat = "UNKNOWN";
+	for (size_t i = 0; i < ARRAY_LEN(s_states); i++)
+	{
+		if (s_states[i].state == receipt.State) {
+			stat = s_states[i].name;
+			break;
+		}
+	}
+
+	int length = snprintf(text, size, "id:%s sub:%03u dlvrd:%03u submit date:%s done date:%s stat:%s err:%03u text:",
+			receipt.MessageId, receipt.Submitted, receipt.Delivered, receipt.SubmitDate, receipt.DoneDate, stat, receipt.ErrorCode);
+	if (length < 0 || (size_t)length >= size) {
+		return size ? size - 1 : 0;
+	}
+	return length;
+}
+
+
+CReceiptTracker::CReceiptTracker()
+{ }
+
+void CReceiptTracker::Track(const string& messageId, void *context, unsigned int ttl)
+{
+	time_t now = time(NULL);
+
+	lock_guard<mutex> lock(m_mutex);
+	Expire(now);
+
+	Entry &entry = m_entries[messageId];
+	entry.context = context;
+	entry.expires = now + ttl;
+	m_expirations.push_back(make_pair(entry.expires, messageId));
+}
+
+bool CReceiptTracker::Find(const string& messageId, void *&context, bool forget)
+{
+	lock_guard<mutex> lock(m_mutex);
+	Expire(time(NULL));
+
+	EntryMap::iterator it = m_entries.find(messageId);
+	if (it == m_entries.end()) {
+		return false;
+	}
+
+	context = it->second.context;
+	if (forget) {
+		m_entries.erase(it);
+	}
+	return true;
+}
+
+size_t CReceiptTracker::Size() const
+{
+	lock_guard<mutex> lock(m_mutex);
+	return m_entries.size();
+}
+
+void CReceiptTracker::Expire(time_t now)
+{
+	// expirations are (mostly) sorted, entries tracked again or
+	// forgotten leave stale items behind which are just skipped
+	while (!m_expirations.empty() && m_expirations.front().first < now)
+	{
+		EntryMap::iterator it = m_entries.find(m_expirations.front().second);
+		if (it != m_entries.end() && it->second.expires == m_expirations.front().first) {
+			m_entries.erase(it);
+		}
+		m_expirations.pop_front();
+	}
+}
+
+} // namespace opensmpp
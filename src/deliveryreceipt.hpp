@@ -0,0 +1,84 @@
+/*!
+ * \file deliveryreceipt.hpp
+ * \author ichramm
+ */
+#ifndef OPENSMPP_DELIVERYRECEIPT_HPP_
+#define OPENSMPP_DELIVERYRECEIPT_HPP_
+#if _MSC_VER > 1000
+#pragma once
+#endif
+
+#include "../smpp.h"
+
+#include <boost/unordered_map.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/locks.hpp>
+#include <ctime>
+#include <deque>
+#include <string>
+#include <utility>
+
+namespace opensmpp
+{
+	/*!
+	 * \brief Parses the text of a delivery receipt without allocating memory
+	 *
+	 * The text is expected in the format suggested by appendix B of the SMPP 3.4
+	 * specification, fields may come in any order and unknown fields are ignored:
+	 * "id:IIIIIIIIII sub:SSS dlvrd:DDD submit date:YYMMDDhhmm done date:YYMMDDhhmm stat:DDDDDDD err:E text:..."
+	 * Fields not found in \p text are left untouched in \p receipt.
+	 * \return \c false if there is no id in \p text
+	 */
+	bool ParseDeliveryReceipt(const char *text, size_t length, DeliveryReceipt& receipt);
+
+	/*!
+	 * \brief Writes the text of \p receipt in the format read by \c ParseDeliveryReceipt
+	 * \return The length of the text, which is truncated if it does not fit in \p size
+	 */
+	size_t FormatDeliveryReceipt(const DeliveryReceipt& receipt, char *text, size_t size);
+
+	/*!
+	 * \brief Remembers the context of the messages waiting for their receipts
+	 *
+	 * Entries are forgotten once their receipt arrives or their time to live
+	 * expires, whatever happens first.
+	 */
+	class CReceiptTracker
+	{
+	public:
+
+		CReceiptTracker();
+
+		/*! \brief Associates \p context to \p messageId for \p ttl seconds */
+		void Track(const std::string& messageId, void *context, unsigned int ttl);
+
+		/*!
+		 * \brief Looks for the context of \p messageId
+		 * \param forget Whether to forget the message after finding it
+		 * \return \c false if the message is unknown or has expired
+		 */
+		bool Find(const std::string& messageId, void *&context, bool forget);
+
+		/*! \return The number of messages being tracked */
+		size_t Size() const;
+
+	private:
+
+		/*! \brief Forgets the messages whose time to live has expired, the lock must be held */
+		void Expire(time_t now);
+
+		struct Entry
+		{
+			void   *context;
+			time_t  expires;
+		};
+
+		typedef boost::unordered_map<std::string, Entry> EntryMap;
+
+		EntryMap                                      m_entries;
+		std::deque<std::pair<time_t, std::string> >   m_expirations;
+		mutable boost::mutex                          m_mutex;
+	};
+} // namespace opensmpp
+
+#endif // OPENSMPP_DELIVERYRECEIPT_HPP_
@@ -0,0 +1,492 @@
+/*!
+ * \file journal.cpp
+ * \author ichramm
+ */
+#include "stdafx.h"
+#include "journal.hpp"
+#include "logger.h"
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <utility>
+
+#ifdef _WIN32
+# include <io.h>
+#else
+# include <sys/mman.h>
+# include <fcntl.h>
+# include <unistd.h>
+#endif
+
+using namespace std;
+using namespace boost;
+
+#define JOURNAL_MAGIC         "SMPPJRN2"
+#define JOURNAL_HEADER_SIZE   16
+
+#define RECORD_LIVE           0x4556494C // "LIVE"
+#define RECORD_DEAD           0x44414544 // "DEAD"
+#define RECORD_HEADER_SIZE    16
+
+namespace opensmpp
+{
+
+/*!
+ * Every record starts with this header and is padded to 8 bytes, the state
+ * is written last so a record is not visible until it's complete
+ */
+struct RecordHeader
+{
+	uint32_t state;
+	uint32_t length;
+	uint64_t id;
+};
+
+static inline uint64_t RecordSize(size_t length)
+{
+	return RECORD_HEADER_SIZE + ((length + 7) & ~(uint64_t)7);
+}
+
+/*! Writes \p fp to the disk, \c false if it fails */
+static bool SyncFile(FILE *fp)
+{
+	if (fflush(fp)) {
+		return false;
+	}
+#ifdef _WIN32
+	return _commit(_fileno(fp)) == 0;
+#else
+	return fsync(fileno(fp)) == 0;
+#endif
+}
+
+/*! Replaces \p to with \p from, the change is on the disk once it returns */
+static bool ReplaceFile(const string& from, const string& to)
+{
+#ifdef _WIN32
+	return MoveFileExA(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+	if (rename(from.c_str(), to.c_str())) {
+		return false;
+	}
+	// the new name is only safe once the directory is
+	string::size_type slash = to.rfind('/');
+	string dir = slash == string::npos ? string(".") : (slash ? to.substr(0, slash) : string("/"));
+	int fd = open(dir.c_str(), O_RDONLY);
+	if (fd < 0) {
+		return false;
+	}
+	bool synced = fsync(fd) == 0;
+	close(fd);
+	return synced;
+#endif
+}
+
+CJournal::CJournal()
+ :
+#ifdef _WIN32
+   m_handle(INVALID_HANDLE_VALUE),
+#endif
+   m_tail(JOURNAL_HEADER_SIZE)
+ , m_nextId(1)
+ , m_liveBytes(0)
+{ }
+
+CJournal::~CJournal()
+{
+	Close();
+}
+
+bool CJournal::Open(const string& path, size_t initialSize)
+{
+	lock_guard<mutex> lock(m_mutex);
+	unique_lock<shared_mutex> mapLock(m_mapMutex);
+
+	m_path = path;
+	// left by a compaction that did not finish, the journal is still the old file
+	remove((path + ".tmp").c_str());
+
+	if (!Map(initialSize > JOURNAL_HEADER_SIZE ? initialSize : JOURNAL_HEADER_SIZE + RECORD_HEADER_SIZE)) {
+		return false;
+	}
+
+	char *data = m_file.data();
+	if (data[0] == 0)
+	{ // new file
+		memcpy(data, JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC) - 1);
+	}
+	else if (memcmp(data, JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC) - 1))
+	{
+		smpp_log_error("File %s is not a journal", path.c_str());
+		m_file.close();
+		return false;
+	}
+
+#ifdef _WIN32
+	m_handle = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+			NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+#endif
+
+	Scan();
+	smpp_log_info("Journal %s opened with %u records", path.c_str(), (unsigned int)m_records.size());
+	return true;
+}
+
+void CJournal::Close()
+{
+	lock_guard<mutex> lock(m_mutex);
+	unique_lock<shared_mutex> mapLock(m_mapMutex);
+	if (m_file.is_open()) {
+		m_file.close();
+	}
+#ifdef _WIN32
+	if (m_handle != INVALID_HANDLE_VALUE)
+	{
+		CloseHandle(m_handle);
+		m_handle = INVALID_HANDLE_VALUE;
+	}
+#endif
+	m_tail = JOURNAL_HEADER_SIZE;
+	m_nextId = 1;
+	m_liveBytes = 0;
+	m_records.clear();
+}
+
+bool CJournal::IsOpen() const
+{
+	lock_guard<mutex> lock(m_mutex);
+	return m_file.is_open();
+}
+
+bool CJournal::Append(const string& data, uint64_t& id)
+{
+	lock_guard<mutex> lock(m_mutex);
+	if (!m_file.is_open()) {
+		return false;
+	}
+
+	uint64_t size = RecordSize(data.size());
+	if (m_tail + size + RECORD_HEADER_SIZE > m_file.size())
+	{ // room for the record plus the header that terminates the log
+		// either way half of the file is left free, so this does not happen again soon
+		uint64_t needed = JOURNAL_HEADER_SIZE + m_liveBytes + size + RECORD_HEADER_SIZE;
+		uint64_t newSize = m_file.size();
+		while (needed * 2 > newSize) {
+			newSize *= 2;
+		}
+
+		unique_lock<shared_mutex> mapLock(m_mapMutex);
+		if (JOURNAL_HEADER_SIZE + m_liveBytes < m_tail)
+		{ // there are released records in the way, leave them behind
+			if (!Compact((size_t)newSize))
+			{
+				smpp_log_error("Failed to compact journal %s", m_path.c_str());
+				return false;
+			}
+		}
+		else if (!Map((size_t)newSize))
+		{
+			smpp_log_error("Failed to grow journal %s to %lu bytes", m_path.c_str(), (unsigned long)newSize);
+			return false;
+		}
+	}
+
+	id = m_nextId++;
+	uint64_t offset = m_tail;
+	m_tail += size;
+
+	// a stale record may still be there after rewinding, terminate the log first
+	memset(Record(m_tail), 0, RECORD_HEADER_SIZE);
+
+	RecordHeader *header = reinterpret_cast<RecordHeader*>(Record(offset));
+	if (!data.empty()) {
+		memcpy(Record(offset) + RECORD_HEADER_SIZE, data.data(), data.size());
+	}
+	header->length = (uint32_t)data.size();
+	header->id = id;
+	header->state = RECORD_LIVE;
+
+	m_records.insert(m_records.end(), make_pair(id, offset));
+	m_liveBytes += size;
+	return true;
+}
+
+bool CJournal::Write(uint64_t id, size_t pos, const string& data)
+{
+	lock_guard<mutex> lock(m_mutex);
+	RecordMap::const_iterator it = m_records.find(id);
+	if (!m_file.is_open() || it == m_records.end()) {
+		return false;
+	}
+
+	const RecordHeader *header = reinterpret_cast<const RecordHeader*>(Record(it->second));
+	if (pos + data.size() > header->length) {
+		return false;
+	}
+
+	if (!data.empty()) {
+		memcpy(Record(it->second) + RECORD_HEADER_SIZE + pos, data.data(), data.size());
+	}
+	return true;
+}
+
+bool CJournal::Read(uint64_t id, string& data)
+{
+	lock_guard<mutex> lock(m_mutex);
+	RecordMap::const_iterator it = m_records.find(id);
+	if (!m_file.is_open() || it == m_records.end()) {
+		return false;
+	}
+
+	const RecordHeader *header = reinterpret_cast<const RecordHeader*>(Record(it->second));
+	data.assign(Record(it->second) + RECORD_HEADER_SIZE, header->length);
+	return true;
+}
+
+void CJournal::Release(uint64_t id)
+{
+	lock_guard<mutex> lock(m_mutex);
+	RecordMap::iterator it = m_records.find(id);
+	if (!m_file.is_open() || it == m_records.end()) {
+		return;
+	}
+
+	RecordHeader *header = reinterpret_cast<RecordHeader*>(Record(it->second));
+	header->state = RECORD_DEAD;
+	m_liveBytes -= RecordSize(header->length);
+	m_records.erase(it);
+
+	if (m_records.empty())
+	{ // nothing to keep, start over
+		memset(Record(JOURNAL_HEADER_SIZE), 0, RECORD_HEADER_SIZE);
+		m_tail = JOURNAL_HEADER_SIZE;
+	}
+}
+
+void CJournal::Recover(const RecordVisitor& visitor)
+{
+	vector<pair<uint64_t, string> > records;
+
+	{
+		lock_guard<mutex> lock(m_mutex);
+		if (!m_file.is_open()) {
+			return;
+		}
+		records.reserve(m_records.size());
+		for (RecordMap::const_iterator it = m_records.begin(); it != m_records.end(); ++it)
+		{
+			const RecordHeader *header = reinterpret_cast<const RecordHeader*>(Record(it->second));
+			records.push_back(make_pair(it->first, string(Record(it->second) + RECORD_HEADER_SIZE, header->length)));
+		}
+	}
+
+	// the visitor may use the journal
+	for (size_t i = 0; i < records.size(); i++) {
+		visitor(records[i].first, records[i].second);
+	}
+}
+
+size_t CJournal::GetLiveRecords() const
+{
+	lock_guard<mutex> lock(m_mutex);
+	return m_records.size();
+}
+
+bool CJournal::Sync()
+{
+	// the mapping only changes under the exclusive lock, appends write through it meanwhile
+	shared_lock<shared_mutex> mapLock(m_mapMutex);
+	if (!m_file.is_open()) {
+		return false;
+	}
+#ifdef _WIN32
+	// the view is written to the file, the file is then written to the disk
+	bool synced = FlushViewOfFile(m_file.data(), 0) != 0 &&
+	              m_handle != INVALID_HANDLE_VALUE && FlushFileBuffers(m_handle) != 0;
+#else
+	bool synced = msync(m_file.data(), m_file.size(), MS_SYNC) == 0;
+#endif
+	if (!synced)
+	{
+		smpp_log_error("Failed to sync journal %s", m_path.c_str());
+		return false;
+	}
+	return true;
+}
+
+void CJournal::PutString(string& buffer, const string& value)
+{
+	uint32_t length = (uint32_t)value.size();
+	buffer.append((const char*)&length, sizeof(length));
+	buffer.append(value);
+}
+
+bool CJournal::GetString(const string& buffer, size_t& pos, string& value)
+{
+	uint32_t length;
+	if (pos + sizeof(length) > buffer.size()) {
+		return false;
+	}
+	memcpy(&length, buffer.data() + pos, sizeof(length));
+	pos += sizeof(length);
+	if (pos + length > buffer.size()) {
+		return false;
+	}
+	value.assign(buffer, pos, length);
+	pos += length;
+	return true;
+}
+
+bool CJournal::Map(size_t size)
+{
+	if (m_file.is_open()) {
+		m_file.close();
+	}
+
+	FILE *fp = fopen(m_path.c_str(), "r+b");
+	if (!fp) {
+		fp = fopen(m_path.c_str(), "w+b");
+	}
+	if (!fp)
+	{
+		smpp_log_error("Failed to open journal %s", m_path.c_str());
+		return false;
+	}
+
+	fseek(fp, 0, SEEK_END);
+	long current = ftell(fp);
+	if (current < 0 || (size_t)current < size)
+	{ // extend the file, the new space reads as zeros
+		fseek(fp, (long)size - 1, SEEK_SET);
+		fputc(0, fp);
+	}
+	fclose(fp);
+
+	try
+	{
+		iostreams::mapped_file_params params(m_path);
+		params.flags = iostreams::mapped_file::readwrite;
+		m_file.open(params);
+		return true;
+	}
+	catch (const std::exception& e)
+	{
+		smpp_log_error("Failed to map journal %s: %s", m_path.c_str(), e.what());
+		return false;
+	}
+}
+
+bool CJournal::Compact(size_t size)
+{
+	string tmpPath = m_path + ".tmp";
+	FILE *fp = fopen(tmpPath.c_str(), "w+b");
+	if (!fp) {
+		return false;
+	}
+
+	// the records keep their order and their ids, only their offsets change
+	vector<uint64_t> offsets;
+	offsets.reserve(m_records.size());
+	uint64_t tail = JOURNAL_HEADER_SIZE;
+	bool written = fwrite(m_file.data(), JOURNAL_HEADER_SIZE, 1, fp) == 1;
+	for (RecordMap::const_iterator it = m_records.begin(); written && it != m_records.end(); ++it)
+	{
+		uint64_t recordSize = RecordSize(reinterpret_cast<const RecordHeader*>(Record(it->second))->length);
+		written = fwrite(Record(it->second), (size_t)recordSize, 1, fp) == 1;
+		offsets.push_back(tail);
+		tail += recordSize;
+	}
+
+	// the end of the log, then zeros up to the new size
+	char end[RECORD_HEADER_SIZE];
+	memset(end, 0, sizeof(end));
+	written = written && fwrite(end, sizeof(end), 1, fp) == 1;
+	if (written && tail + RECORD_HEADER_SIZE < size) {
+		written = fseek(fp, (long)size - 1, SEEK_SET) == 0 && fputc(0, fp) != EOF;
+	}
+	written = written && SyncFile(fp);
+	fclose(fp);
+
+	if (!written)
+	{
+		remove(tmpPath.c_str());
+		return false;
+	}
+
+	// the file must not be open to be replaced on windows
+	m_file.close();
+#ifdef _WIN32
+	if (m_handle != INVALID_HANDLE_VALUE)
+	{
+		CloseHandle(m_handle);
+		m_handle = INVALID_HANDLE_VALUE;
+	}
+#endif
+
+	bool replaced = ReplaceFile(tmpPath, m_path);
+	if (!replaced) {
+		remove(tmpPath.c_str());
+	}
+
+#ifdef _WIN32
+	m_handle = CreateFileA(m_path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+			NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+#endif
+	// the old file is still there if it could not be replaced
+	if (!Map(size) || !replaced) {
+		return false;
+	}
+
+	size_t i = 0;
+	for (RecordMap::iterator it = m_records.begin(); it != m_records.end(); ++it) {
+		it->second = offsets[i++];
+	}
+	m_tail = tail;
+	smpp_log_info("Journal %s compacted, %u records in %lu bytes",
+		m_path.c_str(), (unsigned int)m_records.size(), (unsigned long)size);
+	return true;
+}
+
+void CJournal::Scan()
+{
+	m_records.clear();
+	m_liveBytes = 0;
+	m_nextId = 1;
+
+	uint64_t offset = JOURNAL_HEADER_SIZE;
+	while (offset + RECORD_HEADER_SIZE <= m_file.size())
+	{
+		const RecordHeader *header = reinterpret_cast<const RecordHeader*>(Record(offset));
+		if (header->state != RECORD_LIVE && header->state != RECORD_DEAD) {
+			break; // end of the log
+		}
+		uint64_t size = RecordSize(header->length);
+		if (offset + size + RECORD_HEADER_SIZE > m_file.size()) {
+			break; // truncated
+		}
+		if (header->state == RECORD_LIVE)
+		{
+			m_records[header->id] = offset;
+			m_liveBytes += size;
+		}
+		if (header->id >= m_nextId) {
+			m_nextId = header->id + 1;
+		}
+		offset += size;
+	}
+	m_tail = offset;
+
+	if (m_records.empty())
+	{ // nothing to recover
+		memset(Record(JOURNAL_HEADER_SIZE), 0, RECORD_HEADER_SIZE);
+		m_tail = JOURNAL_HEADER_SIZE;
+	}
+}
+
+char* CJournal::Record(uint64_t offset)
+{
+	return m_file.data() + offset;
+}
+
+} // namespace opensmpp
@@ -0,0 +1,130 @@
+/*!
+ * \file journal.hpp
+ * \author ichramm
+ */
+#ifndef OPENSMPP_JOURNAL_HPP_
+#define OPENSMPP_JOURNAL_HPP_
+#if _MSC_VER > 1000
+#pragma once
+#endif
+
+#include <boost/cstdint.hpp>
+#include <boost/function.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/shared_mutex.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/iostreams/device/mapped_file.hpp>
+#include <map>
+#include <string>
+
+namespace opensmpp
+{
+	/*!
+	 * \brief Append-only log of opaque records backed by a memory-mapped file
+	 *
+	 * Records are written once and released once they are no longer needed,
+	 * the file is rewound as soon as every record has been released. When it
+	 * gets full while some records are still live, those are copied to a fresh
+	 * file which replaces it, so the file is as big as the live records need
+	 * and not as the traffic that went through it. Records are known by an id
+	 * that does not change when they are copied. Records not released survive
+	 * a restart and are visited again with \c Recover.
+	 */
+	class CJournal
+	{
+	public:
+
+		typedef boost::function<void (boost::uint64_t /*id*/, const std::string& /*data*/)> RecordVisitor;
+
+		CJournal();
+
+		~CJournal();
+
+		/*!
+		 * \brief Opens the journal at \p path, the file is created if it does not exist
+		 * \param initialSize Size of a new file, it doubles when the live records need it
+		 * \return \c false if the file cannot be mapped or is not a journal
+		 */
+		bool Open(const std::string& path, size_t initialSize = 1 << 20);
+
+		void Close();
+
+		bool IsOpen() const;
+
+		/*!
+		 * \brief Appends a record
+		 * \param id Set to the record id, never 0, needed to read and release it
+		 * \return \c false if the journal cannot grow
+		 */
+		bool Append(const std::string& data, boost::uint64_t& id);
+
+		/*!
+		 * \brief Overwrites part of the record \p id in place, starting \p pos
+		 * bytes into it, the record keeps its length
+		 * \return \c false if the record is not live or it's too short
+		 */
+		bool Write(boost::uint64_t id, size_t pos, const std::string& data);
+
+		/*! \brief Reads the record \p id, \c false if it's not live */
+		bool Read(boost::uint64_t id, std::string& data);
+
+		/*! \brief The record \p id is no longer needed */
+		void Release(boost::uint64_t id);
+
+		/*! \brief Visits every live record, oldest first */
+		void Recover(const RecordVisitor& visitor);
+
+		/*! \return The number of records not released yet */
+		size_t GetLiveRecords() const;
+
+		/*!
+		 * \brief Writes the records appended so far to the disk
+		 * Appends are not blocked meanwhile unless the file must grow, several
+		 * writers may share one call
+		 * \return \c false if the journal is closed or the disk fails
+		 */
+		bool Sync();
+
+		/*! \brief Appends \p value to a record being built, preceded by its length */
+		static void PutString(std::string& buffer, const std::string& value);
+
+		/*! \brief Reads a value written by \c PutString at \p pos, which is moved past it */
+		static bool GetString(const std::string& buffer, size_t& pos, std::string& value);
+
+	private:
+
+		/*!
+		 * \brief Maps the file, which is extended to \p size bytes if it's smaller
+		 * \pre \c m_mapMutex is held exclusively
+		 */
+		bool Map(size_t size);
+
+		/*!
+		 * \brief Copies the live records to a new file of \p size bytes, which
+		 * replaces the current one
+		 * \pre Both \c m_mutex and \c m_mapMutex are held, the latter exclusively
+		 */
+		bool Compact(size_t size);
+
+		/*! \brief Finds the end of the log and the live records */
+		void Scan();
+
+		char* Record(boost::uint64_t offset);
+
+		typedef std::map<boost::uint64_t, boost::uint64_t> RecordMap;
+
+		std::string                          m_path;
+		boost::iostreams::mapped_file        m_file;
+#ifdef _WIN32
+		void                                *m_handle;    /*!< The file again, \c FlushFileBuffers needs its own handle */
+#endif
+		boost::uint64_t                      m_tail;
+		boost::uint64_t                      m_nextId;
+		boost::uint64_t                      m_liveBytes; /*!< Taken by live records, headers included */
+		RecordMap                            m_records;   /*!< Offset of every live record by id, oldest first */
+		mutable boost::mutex                 m_mutex;
+		boost::shared_mutex                  m_mapMutex;  /*!< Held by \c Sync so the file is not mapped again under it */
+	};
+} // namespace opensmpp
+
+#endif // OPENSMPP_JOURNAL_HPP_
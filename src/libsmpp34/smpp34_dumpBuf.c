@@ -52,6 +52,11 @@ smpp34_dumpBuf(uint8_t *dest, int destL, uint8_t *src, int srcL)
     size   = srcL;
     buffer = (char *) src;
 
+    /* each line dumps 16 bytes in less than 80 chars, what doesn't fit is left out */
+    if( size > ((destL - 1) / 80) * 16 ){
+        size = ((destL - 1) / 80) * 16;
+    };
+
 	smpp34_err_init();
     lefterror = smpp34_error_size;
 
@@ -45,7 +45,7 @@ smpp34_dumpPdu(uint32_t type, uint8_t *dest, int size_dest, void* tt)
     char dummy_b[SMALL_BUFF];
     int left = size_dest;
     int lenval = 0;
-    char l_dest[512];
+    char l_dest[1024 + 64]; /* the largest OCTET16 value plus its label */
     int lefterror = 0;
 	 
 	smpp34_err_init();
@@ -136,7 +136,7 @@ smpp34_pack(uint32_t type, uint8_t *ptrBuf, int ptrSize, int *ptrLen, void* tt)
                                       "Value lenght exceed buffer lenght");\
         return( -1 );\
     };\
-    if( lenval >= sizeval ){\
+    if( lenval > sizeval ){\
         PUTLOG("[%s:%s(%s)]", par, "<bin>",\
                                       "Data length is invalid (truncate)");\
         return( -1 );\
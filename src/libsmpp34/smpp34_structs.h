@@ -246,14 +246,19 @@ struct alert_notification_t {
 #define PUTLOG( format, param, value, parse ) do { \
 	int lenerror = 0; \
 	TlsInfo *tlsInfo = (TlsInfo *)TlsGetValue(dwTlsIndex); \
+	if( lefterror <= 1 ) break; /* the log is full */ \
 	lenerror = snprintf(tlsInfo->_ptrerror, lefterror, format, #param, value, parse); \
+	if( lenerror < 0 || lenerror >= lefterror ) lenerror = lefterror - 1; /* truncated */ \
 	tlsInfo->_ptrerror += lenerror; lefterror -= lenerror; \
 } while(0)
 #else
 #define PUTLOG( format, param, value, parse ){\
 	int lenerror = 0;\
+	if( lefterror > 1 ){ /* otherwise the log is full */\
 	lenerror = snprintf( (char *)ptrerror, lefterror, format, #param, value, parse);\
+	if( lenerror < 0 || lenerror >= lefterror ) lenerror = lefterror - 1; /* truncated */\
 	ptrerror += lenerror; lefterror -= lenerror;\
+	}\
 }
 #endif
 
@@ -263,6 +268,12 @@ int smpp34_dumpPdu(uint32_t type, uint8_t *dest, int size_dest, void* tt);
 int smpp34_pack(uint32_t type,uint8_t *ptrBuf,int ptrSize,int *ptrLen,void* tt);
 int smpp34_unpack(uint32_t type, void* tt, uint8_t *ptrBuf, int ptrLen);
 
+/* TLVs and destination addresses decoded by smpp34_unpack_alloc are taken
+ * from alloc instead of malloc, they must not be released with destroy_xxx */
+typedef void *(*smpp34_alloc_t)(void *ctx, size_t size);
+int smpp34_unpack_alloc(uint32_t type, void* tt, uint8_t *ptrBuf, int ptrLen,
+                        smpp34_alloc_t alloc, void *ctx);
+
 #if defined(__cplusplus) && !defined(_MSC_VER)
 }
 #endif
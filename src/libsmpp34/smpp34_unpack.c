@@ -40,6 +40,13 @@
 /* FUNCTIONS ******************************************************************/
 int
 smpp34_unpack(uint32_t type, void* tt, uint8_t *ptrBuf, int ptrLen)
+{
+    return( smpp34_unpack_alloc(type, tt, ptrBuf, ptrLen, NULL, NULL) );
+};
+
+int
+smpp34_unpack_alloc(uint32_t type, void* tt, uint8_t *ptrBuf, int ptrLen,
+                    smpp34_alloc_t alloc, void *ctx)
 {
 
     char dummy_b[SMALL_BUFF];
@@ -166,10 +173,16 @@ smpp34_unpack(uint32_t type, void* tt, uint8_t *ptrBuf, int ptrLen)
     left -= l_lenval; aux += l_lenval;\
 }
 
+#define ALLOC( size ) ((alloc != NULL) ? alloc(ctx, size) : malloc(size))
+
 #define TLV( inst, tlv3, do_tlv ){\
     tlv_t *aux_tlv = NULL;\
     while( (aux - ini) < t1->command_length ){\
-        aux_tlv = (tlv_t *) malloc(sizeof( tlv_t ));\
+        aux_tlv = (tlv_t *) ALLOC(sizeof( tlv_t ));\
+        if( aux_tlv == NULL ){\
+            PUTLOG("[%s:%s(%s)]", tlv, "", "Out of memory");\
+            return( -1 );\
+        };\
         memset(aux_tlv, 0, sizeof(tlv_t));\
         do_tlv( aux_tlv );\
         aux_tlv->next = inst tlv3;\
@@ -181,7 +194,11 @@ smpp34_unpack(uint32_t type, void* tt, uint8_t *ptrBuf, int ptrLen)
     udad_t *aux_udad = NULL;\
     int c = 0;\
     while( c < t1->no_unsuccess ){\
-        aux_udad = (udad_t *) malloc(sizeof( udad_t ));\
+        aux_udad = (udad_t *) ALLOC(sizeof( udad_t ));\
+        if( aux_udad == NULL ){\
+            PUTLOG("[%s:%s(%s)]", udad, "", "Out of memory");\
+            return( -1 );\
+        };\
         memset(aux_udad, 0, sizeof(udad_t));\
         do_udad( aux_udad );\
         aux_udad->next = inst udad3;\
@@ -194,7 +211,11 @@ smpp34_unpack(uint32_t type, void* tt, uint8_t *ptrBuf, int ptrLen)
     dad_t *aux_dad = NULL;\
     int c = 0;\
     while( c < t1->number_of_dests ){\
-        aux_dad = (dad_t *) malloc(sizeof( dad_t ));\
+        aux_dad = (dad_t *) ALLOC(sizeof( dad_t ));\
+        if( aux_dad == NULL ){\
+            PUTLOG("[%s:%s(%s)]", dad, "", "Out of memory");\
+            return( -1 );\
+        };\
         memset(aux_dad, 0, sizeof(dad_t));\
         do_dad( aux_dad );\
         aux_dad->next = inst dad3;\
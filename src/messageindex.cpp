@@ -0,0 +1,147 @@
+/*!
+ * \file messageindex.cpp
+ * \author ichramm
+ */
+#include "stdafx.h"
+#include "messageindex.hpp"
+
+#include <boost/functional/hash.hpp>
+#include <boost/thread/thread.hpp>
+
+using namespace std;
+using namespace boost;
+
+// the counter number takes the upper 8 bits of an id
+#define MAX_ID_COUNTERS  256u
+#define ID_VALUE_MASK    ((uint64_t(1) << 56) - 1)
+
+namespace opensmpp
+{
+
+CMessageIdGenerator::CMessageIdGenerator()
+ : m_count(std::max(1u, std::min(thread::hardware_concurrency(), MAX_ID_COUNTERS)))
+ , m_counters(new Counter[m_count])
+{
+	// a million ids per second on each counter before it gets ahead of the clock
+	uint64_t start = (uint64_t)time(NULL) << 20;
+	for (unsigned int i = 0; i < m_count; i++) {
+		m_counters[i].value = start;
+	}
+}
+
+string CMessageIdGenerator::Next()
+{
+	static const char digits[] = "0123456789ABCDEF";
+
+	unsigned int index = hash<thread::id>()(this_thread::get_id()) % m_count;
+	uint64_t id = ((uint64_t)index << 56) |
+			(m_counters[index].value.fetch_add(1, memory_order_relaxed) & ID_VALUE_MASK);
+
+	char buffer[16];
+	for (int i = 15; i >= 0; i--, id >>= 4) {
+		buffer[i] = digits[id & 0x0F];
+	}
+	return string(buffer, sizeof(buffer));
+}
+
+
+string CMessageIndex::DestinationKey(const string& messageId, const string& destination)
+{ // ids are made of hex digits, they don't have slashes
+	return messageId + '/' + destination;
+}
+
+CMessageIndex::CMessageIndex(size_t maxRecords, unsigned int ttl)
+ : m_maxRecords(maxRecords)
+ , m_ttl(ttl)
+{ }
+
+void CMessageIndex::SetLimits(size_t maxRecords, unsigned int ttl)
+{
+	lock_guard<mutex> lock(m_mutex);
+	m_maxRecords = maxRecords;
+	m_ttl = ttl;
+}
+
+void CMessageIndex::Add(const string& messageId, const MessageRecord& record)
+{
+	time_t now = time(NULL);
+
+	lock_guard<mutex> lock(m_mutex);
+
+	Entry &entry = m_entries[messageId];
+	entry.record = record;
+	entry.expires = now + m_ttl;
+	m_expirations.push_back(make_pair(entry.expires, messageId));
+
+	Expire(now);
+}
+
+bool CMessageIndex::Find(const string& messageId, MessageRecord& record)
+{
+	lock_guard<mutex> lock(m_mutex);
+	Expire(time(NULL));
+
+	EntryMap::const_iterator it = m_entries.find(messageId);
+	if (it == m_entries.end()) {
+		return false;
+	}
+	record = it->second.record;
+	return true;
+}
+
+bool CMessageIndex::Update(const string& messageId, MessageState state, unsigned int errorCode, MessageRecord& record)
+{
+	time_t now = time(NULL);
+
+	lock_guard<mutex> lock(m_mutex);
+	Expire(now);
+
+	EntryMap::iterator it = m_entries.find(messageId);
+	if (it == m_entries.end()) {
+		return false;
+	}
+	it->second.record.state = state;
+	it->second.record.errorCode = errorCode;
+	it->second.record.done = (state == MESSAGE_STATE_ENROUTE || state == MESSAGE_STATE_SCHEDULED) ? 0 : now;
+	record = it->second.record;
+	return true;
+}
+
+bool CMessageIndex::Set(const string& messageId, const MessageRecord& record)
+{
+	lock_guard<mutex> lock(m_mutex);
+
+	EntryMap::iterator it = m_entries.find(messageId);
+	if (it == m_entries.end()) {
+		return false;
+	}
+	it->second.record = record;
+	return true;
+}
+
+void CMessageIndex::Remove(const string& messageId)
+{
+	lock_guard<mutex> lock(m_mutex);
+	m_entries.erase(messageId);
+}
+
+size_t CMessageIndex::Size() const
+{
+	lock_guard<mutex> lock(m_mutex);
+	return m_entries.size();
+}
+
+void CMessageIndex::Expire(time_t now)
+{
+	// removed records leave their expiration behind, it's skipped when it comes
+	while (!m_expirations.empty() && (m_expirations.front().first < now || m_entries.size() > m_maxRecords))
+	{
+		EntryMap::iterator it = m_entries.find(m_expirations.front().second);
+		if (it != m_entries.end() && it->second.expires == m_expirations.front().first) {
+			m_entries.erase(it);
+		}
+		m_expirations.pop_front();
+	}
+}
+
+} // namespace opensmpp
@@ -0,0 +1,134 @@
+/*!
+ * \file messageindex.hpp
+ * \author ichramm
+ */
+#ifndef OPENSMPP_MESSAGEINDEX_HPP_
+#define OPENSMPP_MESSAGEINDEX_HPP_
+#if _MSC_VER > 1000
+#pragma once
+#endif
+
+#include "../smpp.h"
+
+#include <boost/atomic.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/scoped_array.hpp>
+#include <boost/unordered_map.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/locks.hpp>
+#include <ctime>
+#include <deque>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace opensmpp
+{
+	/*!
+	 * \brief Generates message ids without locking
+	 *
+	 * There is a counter for each core, threads pick one by their id so they
+	 * seldom share it. Ids are 16 hex digits: the counter number followed by
+	 * its value, which starts at the current time so ids are not repeated
+	 * after a restart.
+	 */
+	class CMessageIdGenerator
+	{
+	public:
+
+		CMessageIdGenerator();
+
+		std::string Next();
+
+	private:
+
+		/*! Each counter takes a whole cache line */
+		struct Counter
+		{
+			boost::atomic<boost::uint64_t> value;
+			char padding[64 - sizeof(boost::atomic<boost::uint64_t>)];
+		};
+
+		unsigned int                  m_count;
+		boost::scoped_array<Counter>  m_counters;
+	};
+
+	/*!
+	 * \brief What is known about a message submitted by an ESME
+	 */
+	struct MessageRecord
+	{
+		unsigned int   connectionId;        /*!< The connection that submitted the message */
+		std::string    systemId;            /*!< The ESME that submitted the message */
+		std::string    source;
+		std::string    destination;
+		unsigned char  registeredDelivery;  /*!< As requested by the ESME */
+		MessageState   state;
+		unsigned int   errorCode;
+		time_t         submitted;
+		time_t         done;                /*!< When the message reached its state, 0 if it's still enroute */
+
+		/*!
+		 * Every destination of a SUBMIT_MULTI, \c destination is empty then. Each
+		 * one has a record of its own, see \c CMessageIndex::DestinationKey
+		 */
+		std::vector<std::string>  destinations;
+	};
+
+	/*!
+	 * \brief Messages by id, each one is remembered for a limited time and
+	 * only up to a maximum number, the oldest are forgotten first
+	 */
+	class CMessageIndex
+	{
+	public:
+
+		CMessageIndex(size_t maxRecords, unsigned int ttl);
+
+		/*! \brief Changes the limits, it takes effect as records are added */
+		void SetLimits(size_t maxRecords, unsigned int ttl);
+
+		void Add(const std::string& messageId, const MessageRecord& record);
+
+		/*! \brief Copies the record of \p messageId to \p record, \c false if it's unknown */
+		bool Find(const std::string& messageId, MessageRecord& record);
+
+		/*!
+		 * \brief Sets the state of \p messageId
+		 * \param record Set to the updated record
+		 * \return \c false if the message is unknown
+		 */
+		bool Update(const std::string& messageId, MessageState state, unsigned int errorCode, MessageRecord& record);
+
+		/*! \brief Overwrites the record of \p messageId, \c false if it's unknown */
+		bool Set(const std::string& messageId, const MessageRecord& record);
+
+		void Remove(const std::string& messageId);
+
+		size_t Size() const;
+
+		/*! \brief The key of the record of \p destination, for messages sent to several destinations */
+		static std::string DestinationKey(const std::string& messageId, const std::string& destination);
+
+	private:
+
+		/*! \brief Forgets expired records and the oldest ones over the limit, the lock must be held */
+		void Expire(time_t now);
+
+		struct Entry
+		{
+			MessageRecord  record;
+			time_t         expires;
+		};
+
+		typedef boost::unordered_map<std::string, Entry> EntryMap;
+
+		size_t                                        m_maxRecords;
+		unsigned int                                  m_ttl;
+		EntryMap                                      m_entries;
+		std::deque<std::pair<time_t, std::string> >   m_expirations;
+		mutable boost::mutex                          m_mutex;
+	};
+} // namespace opensmpp
+
+#endif // OPENSMPP_MESSAGEINDEX_HPP_
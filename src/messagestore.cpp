@@ -0,0 +1,217 @@
+/*!
+ * \file messagestore.cpp
+ * \author ichramm
+ */
+#include "stdafx.h"
+#include "messagestore.hpp"
+#include "logger.h"
+
+#include <boost/bind.hpp>
+#include <algorithm>
+
+using namespace std;
+using namespace boost;
+
+namespace opensmpp
+{
+
+/*! Journal records are the three fields of the message, each preceded by its length */
+static bool DecodeMessage(const string& data, StoredMessage& msg)
+{
+	size_t pos = 0;
+	return CJournal::GetString(data, pos, msg.from) && CJournal::GetString(data, pos, msg.to) &&
+			CJournal::GetString(data, pos, msg.text);
+}
+
+
+CMessageStore::CMessageStore(size_t maxMessages, const string& journalPath)
+ : m_maxMessages(maxMessages)
+ , m_inMemory(0)
+ , m_size(0)
+{
+	if (journalPath.empty()) {
+		return;
+	}
+
+	m_journal.reset(new CJournal());
+	if (!m_journal->Open(journalPath))
+	{
+		smpp_log_error("Messages over the limit of %u will be refused", (unsigned int)maxMessages);
+		m_journal.reset();
+		return;
+	}
+
+	m_journal->Recover(bind(&CMessageStore::OnRecoveredRecord, this, _1, _2));
+}
+
+CMessageStore::~CMessageStore()
+{ }
+
+bool CMessageStore::Push(const string& from, const string& to, const string& text)
+{
+	lock_guard<mutex> lock(m_mutex);
+	return Append(from, to, text);
+}
+
+CMessageStore::PushResult CMessageStore::PushBehind(const string& from, const string& to, const string& text)
+{
+	lock_guard<mutex> lock(m_mutex);
+	QueueMap::const_iterator it = m_queues.find(to);
+	if (it == m_queues.end() || it->second.empty()) {
+		return NOT_WAITING;
+	}
+	return Append(from, to, text) ? PUSHED : FULL;
+}
+
+bool CMessageStore::Append(const string& from, const string& to, const string& text)
+{
+	StoredMessage msg;
+	msg.to = to;
+	msg.record = 0;
+
+	if (m_inMemory < m_maxMessages)
+	{
+		msg.from = from;
+		msg.text = text;
+		m_inMemory++;
+	}
+	else
+	{ // over the limit, only the destination is kept in memory
+		if (!m_journal) {
+			return false;
+		}
+		string data;
+		CJournal::PutString(data, from);
+		CJournal::PutString(data, to);
+		CJournal::PutString(data, text);
+		if (!m_journal->Append(data, msg.record)) {
+			return false;
+		}
+	}
+
+	m_queues[to].push_back(msg);
+	m_size++;
+	return true;
+}
+
+void CMessageStore::Find(const AddressSpans& spans, const AddressFilter& filter, Cursor& cursor) const
+{
+	lock_guard<mutex> lock(m_mutex);
+
+	cursor.destinations.clear();
+	cursor.next = 0;
+
+	for (AddressSpans::const_iterator span = spans.begin(); span != spans.end(); ++span)
+	{ // a span may hold destinations the filter does not take, like "1000" between "100" and "199"
+		QueueMap::const_iterator it = m_queues.lower_bound(span->first);
+		for (; it != m_queues.end() && it->first <= span->last; ++it)
+		{
+			if (filter(it->first)) {
+				cursor.destinations.push_back(it->first);
+			}
+		}
+	}
+
+	// spans of different addresses may overlap
+	sort(cursor.destinations.begin(), cursor.destinations.end());
+	cursor.destinations.erase(unique(cursor.destinations.begin(), cursor.destinations.end()), cursor.destinations.end());
+}
+
+bool CMessageStore::Pop(Cursor& cursor, StoredMessage& msg)
+{
+	lock_guard<mutex> lock(m_mutex);
+
+	for (; cursor.next < cursor.destinations.size(); cursor.next++)
+	{
+		QueueMap::iterator it = m_queues.find(cursor.destinations[cursor.next]);
+		if (it == m_queues.end()) {
+			continue;
+		}
+
+		while (!it->second.empty())
+		{
+			msg = it->second.front();
+			it->second.pop_front();
+			m_size--;
+
+			if (!msg.record)
+			{
+				m_inMemory--;
+			}
+			else
+			{ // bring it back from the journal
+				string data;
+				if (!m_journal->Read(msg.record, data) || !DecodeMessage(data, msg))
+				{
+					smpp_log_error("Lost message to %s, journal record %lu is corrupt", it->first.c_str(), (unsigned long)msg.record);
+					m_journal->Release(msg.record);
+					continue;
+				}
+			}
+
+			if (it->second.empty()) {
+				m_queues.erase(it);
+			}
+			return true;
+		}
+
+		m_queues.erase(it);
+	}
+
+	return false;
+}
+
+void CMessageStore::Release(const StoredMessage& msg)
+{
+	if (msg.record) {
+		m_journal->Release(msg.record);
+	}
+}
+
+void CMessageStore::Requeue(const StoredMessage& msg, Cursor& cursor)
+{
+	lock_guard<mutex> lock(m_mutex);
+
+	// its queue may be behind the cursor by now
+	vector<string>::const_iterator dest = lower_bound(cursor.destinations.begin(), cursor.destinations.end(), msg.to);
+	cursor.next = min(cursor.next, (size_t)(dest - cursor.destinations.begin()));
+
+	if (msg.record)
+	{ // still in the journal
+		StoredMessage spilled;
+		spilled.to = msg.to;
+		spilled.record = msg.record;
+		m_queues[msg.to].push_front(spilled);
+	}
+	else
+	{
+		m_queues[msg.to].push_front(msg);
+		m_inMemory++;
+	}
+	m_size++;
+}
+
+size_t CMessageStore::Size() const
+{
+	lock_guard<mutex> lock(m_mutex);
+	return m_size;
+}
+
+void CMessageStore::OnRecoveredRecord(uint64_t id, const string& data)
+{
+	StoredMessage msg;
+	if (!DecodeMessage(data, msg))
+	{
+		m_journal->Release(id);
+		return;
+	}
+
+	lock_guard<mutex> lock(m_mutex);
+	StoredMessage spilled;
+	spilled.to = msg.to;
+	spilled.record = id;
+	m_queues[msg.to].push_back(spilled);
+	m_size++;
+}
+
+} // namespace opensmpp
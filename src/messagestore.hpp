@@ -0,0 +1,139 @@
+/*!
+ * \file messagestore.hpp
+ * \author ichramm
+ */
+#ifndef OPENSMPP_MESSAGESTORE_HPP_
+#define OPENSMPP_MESSAGESTORE_HPP_
+#if _MSC_VER > 1000
+#pragma once
+#endif
+
+#include "journal.hpp"
+#include <boost/function.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/locks.hpp>
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace opensmpp
+{
+	/*!
+	 * \brief A message waiting for its destination to bind
+	 */
+	struct StoredMessage
+	{
+		std::string      from;
+		std::string      to;
+		std::string      text;   /*!< UTF-8 */
+		boost::uint64_t  record; /*!< Id of its journal record, 0 if the message is only in memory */
+	};
+
+	/*!
+	 * \brief Store-and-forward queues of messages, one for each destination address
+	 *
+	 * Up to \c maxMessages messages are kept in memory, messages over that limit
+	 * are spilled to a journal when there is one, otherwise they are refused.
+	 * Spilled messages only take the space of their destination in memory.
+	 */
+	class CMessageStore
+	{
+	public:
+
+		typedef boost::function<bool (const std::string& /*to*/)> AddressFilter;
+
+		/*! \brief Destinations from \c first to \c last, in string order */
+		struct AddressSpan
+		{
+			std::string first;
+			std::string last;
+		};
+
+		typedef std::vector<AddressSpan> AddressSpans;
+
+		/*!
+		 * \brief The queues of one receiver, found once and walked while it drains them
+		 * Only the store touches it, under its own lock
+		 */
+		struct Cursor
+		{
+			Cursor() : next(0) { }
+
+			std::vector<std::string>  destinations;
+			size_t                    next;
+		};
+
+		/*! \brief What \c PushBehind did with the message */
+		enum PushResult
+		{
+			PUSHED,       /*!< Queued behind the messages waiting for its destination */
+			NOT_WAITING,  /*!< There are no messages waiting for its destination */
+			FULL          /*!< There are, but the store cannot take one more */
+		};
+
+		/*!
+		 * \param maxMessages Messages kept in memory
+		 * \param journalPath Where to spill messages over \p maxMessages, empty to refuse them.
+		 * Messages left in the journal by a previous instance are queued again.
+		 */
+		CMessageStore(size_t maxMessages, const std::string& journalPath);
+
+		~CMessageStore();
+
+		/*! \return \c false if the store is full */
+		bool Push(const std::string& from, const std::string& to, const std::string& text);
+
+		/*!
+		 * \brief Same as \c Push, only if there are messages waiting for \p to, so
+		 * the message does not get ahead of them
+		 */
+		PushResult PushBehind(const std::string& from, const std::string& to, const std::string& text);
+
+		/*!
+		 * \brief Finds the queues a receiver drains, the ones within \p spans accepted by \p filter
+		 * Messages stored for them later are found too, those for other destinations are
+		 * sent to the receiver right away
+		 */
+		void Find(const AddressSpans& spans, const AddressFilter& filter, Cursor& cursor) const;
+
+		/*!
+		 * \brief Takes the oldest message of the first queue of \p cursor that has any
+		 * The message must be given back with either \c Release or \c Requeue
+		 * \return \c false if there is no message left in those queues
+		 */
+		bool Pop(Cursor& cursor, StoredMessage& msg);
+
+		/*! \brief The message has been delivered, forget about it */
+		void Release(const StoredMessage& msg);
+
+		/*!
+		 * \brief The message could not be delivered, put it back in front of its queue
+		 * \p cursor goes back to find it again
+		 */
+		void Requeue(const StoredMessage& msg, Cursor& cursor);
+
+		/*! \return The number of messages queued (not taken) */
+		size_t Size() const;
+
+	private:
+
+		/*! \brief Adds the message to the queue of \p to, the lock must be held */
+		bool Append(const std::string& from, const std::string& to, const std::string& text);
+
+		/*! \brief Queues a message found in the journal on startup */
+		void OnRecoveredRecord(boost::uint64_t id, const std::string& data);
+
+		typedef std::map<std::string, std::deque<StoredMessage> > QueueMap;
+
+		const size_t                    m_maxMessages;
+		size_t                          m_inMemory;
+		size_t                          m_size;
+		QueueMap                        m_queues;
+		boost::scoped_ptr<CJournal>     m_journal;
+		mutable boost::mutex            m_mutex;
+	};
+} // namespace opensmpp
+
+#endif // OPENSMPP_MESSAGESTORE_HPP_
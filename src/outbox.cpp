@@ -0,0 +1,228 @@
+/*!
+ * \file outbox.cpp
+ * \author ichramm
+ */
+#include "stdafx.h"
+#include "outbox.hpp"
+#include "logger.h"
+
+#include <boost/bind.hpp>
+#include <cstring>
+
+using namespace std;
+using namespace boost;
+
+namespace opensmpp
+{
+
+/*!
+ * Journal records start with this, rewritten in place as segments are sent,
+ * followed by the four fields of the message, each preceded by its length
+ */
+struct RecordProgress
+{
+	uint32_t  segmentsSent;
+	uint32_t  segmentCount;
+	uint32_t  segmentReference;
+	char      messageId[68];   // NULL terminated, fits the 65 bytes of the SMPP field
+};
+
+static string EncodeProgress(const OutboxMessage& msg)
+{
+	RecordProgress progress;
+	memset(&progress, 0, sizeof(progress));
+	progress.segmentsSent = msg.segmentsSent;
+	progress.segmentCount = msg.segmentCount;
+	progress.segmentReference = msg.segmentReference;
+	msg.messageId.copy(progress.messageId, sizeof(progress.messageId) - 1);
+	return string((const char*)&progress, sizeof(progress));
+}
+
+static bool DecodeMessage(const string& data, OutboxMessage& msg)
+{
+	RecordProgress progress;
+	if (data.size() < sizeof(progress)) {
+		return false;
+	}
+	memcpy(&progress, data.data(), sizeof(progress));
+	progress.messageId[sizeof(progress.messageId) - 1] = 0;
+	msg.segmentsSent = progress.segmentsSent;
+	msg.segmentCount = progress.segmentCount;
+	msg.segmentReference = progress.segmentReference;
+	msg.messageId = progress.messageId;
+
+	size_t pos = sizeof(progress);
+	return CJournal::GetString(data, pos, msg.from) && CJournal::GetString(data, pos, msg.to) &&
+			CJournal::GetString(data, pos, msg.text) && CJournal::GetString(data, pos, msg.reference);
+}
+
+
+COutbox::COutbox()
+ : m_taken(0)
+ , m_closed(false)
+ , m_pausedUntil(get_system_time())
+ , m_appended(0)
+ , m_synced(0)
+ , m_syncing(false)
+{ }
+
+COutbox::~COutbox()
+{
+	Close();
+}
+
+bool COutbox::Open(const string& path)
+{
+	if (!m_journal.Open(path)) {
+		return false;
+	}
+	m_journal.Recover(bind(&COutbox::OnRecoveredRecord, this, _1, _2));
+	return true;
+}
+
+void COutbox::Close()
+{
+	lock_guard<mutex> lock(m_mutex);
+	m_closed = true;
+	m_available.notify_all();
+}
+
+bool COutbox::Push(const string& from, const string& to, const string& text, const string& reference)
+{
+	OutboxMessage fresh;
+	fresh.segmentsSent = fresh.segmentCount = fresh.segmentReference = 0;
+
+	string data = EncodeProgress(fresh);
+	CJournal::PutString(data, from);
+	CJournal::PutString(data, to);
+	CJournal::PutString(data, text);
+	CJournal::PutString(data, reference);
+
+	uint64_t id;
+	if (!m_journal.Append(data, id)) {
+		return false;
+	}
+
+	mutex::scoped_lock lock(m_mutex);
+	if (!WaitForSync(lock, ++m_appended))
+	{ // the caller is told it failed, it must not be sent later
+		lock.unlock();
+		m_journal.Release(id);
+		return false;
+	}
+
+	m_queue.push_back(id);
+	m_available.notify_one();
+	return true;
+}
+
+bool COutbox::Pop(OutboxMessage& msg)
+{
+	mutex::scoped_lock lock(m_mutex);
+	for (;;)
+	{
+		if (m_closed) {
+			return false;
+		}
+		if (m_queue.empty())
+		{
+			m_available.wait(lock);
+			continue;
+		}
+		if (get_system_time() < m_pausedUntil)
+		{
+			m_available.timed_wait(lock, m_pausedUntil);
+			continue;
+		}
+
+		msg.record = m_queue.front();
+		m_queue.pop_front();
+
+		string data;
+		if (!m_journal.Read(msg.record, data) || !DecodeMessage(data, msg))
+		{
+			smpp_log_error("Lost outbound message, journal record %lu is corrupt", (unsigned long)msg.record);
+			m_journal.Release(msg.record);
+			continue;
+		}
+
+		m_taken++;
+		return true;
+	}
+}
+
+bool COutbox::Progress(const OutboxMessage& msg)
+{
+	if (!m_journal.Write(msg.record, 0, EncodeProgress(msg))) {
+		return false;
+	}
+	mutex::scoped_lock lock(m_mutex);
+	return WaitForSync(lock, ++m_appended);
+}
+
+void COutbox::Done(const OutboxMessage& msg)
+{
+	m_journal.Release(msg.record);
+
+	lock_guard<mutex> lock(m_mutex);
+	m_taken--;
+}
+
+void COutbox::Retry(const OutboxMessage& msg, unsigned int delay)
+{
+	lock_guard<mutex> lock(m_mutex);
+	m_taken--;
+	m_queue.push_front(msg.record);
+	m_pausedUntil = get_system_time() + posix_time::milliseconds(delay);
+	m_available.notify_all();
+}
+
+size_t COutbox::Size() const
+{
+	lock_guard<mutex> lock(m_mutex);
+	return m_queue.size() + m_taken;
+}
+
+bool COutbox::WaitForSync(mutex::scoped_lock& lock, uint64_t count)
+{
+	while (m_synced < count)
+	{
+		if (m_syncing)
+		{ // it may have started before this record was appended, wait for the next one
+			m_syncDone.wait(lock);
+			continue;
+		}
+
+		// this sync covers every record appended so far
+		uint64_t target = m_appended;
+		m_syncing = true;
+		lock.unlock();
+		bool synced = m_journal.Sync();
+		lock.lock();
+		m_syncing = false;
+		if (synced) {
+			m_synced = target;
+		}
+		m_syncDone.notify_all();
+
+		if (!synced) {
+			return false;
+		}
+	}
+	return true;
+}
+
+void COutbox::OnRecoveredRecord(uint64_t id, const string& data)
+{
+	OutboxMessage msg;
+	if (!DecodeMessage(data, msg))
+	{
+		m_journal.Release(id);
+		return;
+	}
+
+	lock_guard<mutex> lock(m_mutex);
+	m_queue.push_back(id);
+}
+
+} // namespace opensmpp
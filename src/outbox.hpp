@@ -0,0 +1,116 @@
+/*!
+ * \file outbox.hpp
+ * \author ichramm
+ */
+#ifndef OPENSMPP_OUTBOX_HPP_
+#define OPENSMPP_OUTBOX_HPP_
+#if _MSC_VER > 1000
+#pragma once
+#endif
+
+#include "journal.hpp"
+#include <boost/cstdint.hpp>
+#include <boost/thread/condition.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/thread_time.hpp>
+#include <deque>
+#include <string>
+
+namespace opensmpp
+{
+	/*!
+	 * \brief A message accepted by the client and not submitted yet
+	 */
+	struct OutboxMessage
+	{
+		std::string      from;
+		std::string      to;
+		std::string      text;       /*!< UTF-8 */
+		std::string      reference;  /*!< Given by the application to tell the message apart */
+		boost::uint64_t  record;     /*!< Id of its journal record */
+
+		// how far a message sent in several segments got, kept in the journal by \c COutbox::Progress
+		unsigned int     segmentsSent;      /*!< Segments accepted by the SMSC */
+		unsigned int     segmentCount;      /*!< Segments the message was split in */
+		unsigned int     segmentReference;  /*!< The sar_msg_ref_num they were sent with */
+		std::string      messageId;         /*!< Given by the SMSC to the first segment */
+	};
+
+	/*!
+	 * \brief Messages written to a journal before they are submitted, so they
+	 * survive a restart
+	 *
+	 * \c Push returns once the message is on the disk. Writers arriving while
+	 * the journal is being synced wait for the next sync, which covers all of
+	 * them at once. Messages leave the journal once they are submitted, the
+	 * journal is compacted around the pending ones so the file grows with them
+	 * only. Those left by a previous run are queued again on \c Open.
+	 */
+	class COutbox
+	{
+	public:
+
+		COutbox();
+
+		~COutbox();
+
+		/*! \return \c false if the journal at \p path cannot be opened */
+		bool Open(const std::string& path);
+
+		/*! \brief Wakes up those waiting in \c Pop, which return \c false from now on */
+		void Close();
+
+		/*! \return \c false if the message cannot be written to the journal */
+		bool Push(const std::string& from, const std::string& to, const std::string& text, const std::string& reference);
+
+		/*!
+		 * \brief Waits for the oldest message, the message must be given back with
+		 * either \c Done or \c Retry
+		 * \return \c false once the outbox is closed
+		 */
+		bool Pop(OutboxMessage& msg);
+
+		/*!
+		 * \brief Some segments of the message have been submitted, the progress
+		 * fields of \p msg are written to its journal record and synced so the
+		 * next attempt, even after a restart, resumes after them
+		 * \return \c false if the progress could not be written, the segments will be sent again
+		 */
+		bool Progress(const OutboxMessage& msg);
+
+		/*! \brief The message has been submitted (or rejected for good), forget it */
+		void Done(const OutboxMessage& msg);
+
+		/*!
+		 * \brief The message could not be submitted, it's put back in front and
+		 * nothing is taken for \p delay milliseconds
+		 */
+		void Retry(const OutboxMessage& msg, unsigned int delay);
+
+		/*! \return The number of messages not submitted yet, including those being submitted */
+		size_t Size() const;
+
+	private:
+
+		/*! \brief Waits until the write to the journal numbered \p count is on the disk */
+		bool WaitForSync(boost::mutex::scoped_lock& lock, boost::uint64_t count);
+
+		/*! \brief Queues a message found in the journal on startup */
+		void OnRecoveredRecord(boost::uint64_t id, const std::string& data);
+
+		CJournal                     m_journal;
+		std::deque<boost::uint64_t>  m_queue;
+		size_t                       m_taken;       /*!< Popped and not given back yet */
+		bool                         m_closed;
+		boost::system_time           m_pausedUntil;
+		boost::uint64_t              m_appended;    /*!< Records appended or rewritten so far */
+		boost::uint64_t              m_synced;      /*!< Writes known to be on the disk */
+		bool                         m_syncing;
+		mutable boost::mutex         m_mutex;
+		boost::condition             m_available;   /*!< Signaled when there is something to pop, or on close */
+		boost::condition             m_syncDone;
+	};
+} // namespace opensmpp
+
+#endif // OPENSMPP_OUTBOX_HPP_
@@ -0,0 +1,166 @@
+/*!
+ * \file pduview.cpp
+ * \author ichramm
+ */
+#include "stdafx.h"
+#include "pduview.hpp"
+#include "smppdefs.h"
+#include "libsmpp34/smpp34.h"
+
+#include <cstring>
+
+using namespace std;
+using namespace boost;
+
+namespace opensmpp
+{
+
+/*! Reads a big endian integer of \p size bytes */
+static uint32_t ReadInteger(const char *data, size_t size)
+{
+	uint32_t value = 0;
+	for (size_t i = 0; i < size; i++) {
+		value = (value << 8) | (unsigned char)data[i];
+	}
+	return value;
+}
+
+
+CPDUView::CPDUView()
+ : m_data(NULL)
+ , m_length(0)
+ , m_tlvs(0)
+ , m_addresses(false)
+{ }
+
+bool CPDUView::Parse(const char *data, size_t length)
+{
+	m_data = data;
+	m_length = length;
+	m_source = m_destination = m_text = string_ref();
+	m_tlvs = length;
+	m_addresses = false;
+
+	if (length < SMPP_HEADER_SIZE || ReadInteger(data, 4) != length) {
+		return false;
+	}
+
+	// field sizes are the ones libsmpp34 enforces when it decodes the PDU
+	size_t sourceSize = 21, destinationSize = 21, timeSize = 0;
+	switch (command_id())
+	{
+	case SUBMIT_SM:
+		timeSize = 17;
+		break;
+	case DELIVER_SM:
+		timeSize = 1;
+		break;
+	case DATA_SM:
+		destinationSize = 65;
+		break;
+	default:
+		return true;
+	}
+
+	string_ref skipped;
+	size_t pos = SMPP_HEADER_SIZE;
+	if (!SkipString(pos, 6, skipped) || (pos += 2) > length ||          // service_type, source ton and npi
+	    !SkipString(pos, sourceSize, m_source) || (pos += 2) > length ||  // destination ton and npi
+	    !SkipString(pos, destinationSize, m_destination)) {
+		return false;
+	}
+
+	if (command_id() == DATA_SM)
+	{ // esm_class, registered_delivery, data_coding
+		pos += 3;
+	}
+	else
+	{
+		pos += 3; // esm_class, protocol_id, priority_flag
+		if (!SkipString(pos, timeSize, skipped) || !SkipString(pos, timeSize, skipped)) {
+			return false;
+		}
+		pos += 5; // registered_delivery up to sm_length
+		if (pos > length) {
+			return false;
+		}
+		size_t textLength = (unsigned char)data[pos - 1];
+		if (textLength > 254 || pos + textLength > length) {
+			return false;
+		}
+		m_text = string_ref(data + pos, textLength);
+		pos += textLength;
+	}
+
+	if (pos > length) {
+		return false;
+	}
+	m_tlvs = pos;
+	m_addresses = true;
+	return true;
+}
+
+uint32_t CPDUView::command_id() const
+{
+	return ReadInteger(m_data + 4, 4);
+}
+
+uint32_t CPDUView::sequence_number() const
+{
+	return ReadInteger(m_data + 12, 4);
+}
+
+bool CPDUView::has_addresses() const
+{
+	return m_addresses;
+}
+
+string_ref CPDUView::source_addr() const
+{
+	return m_source;
+}
+
+string_ref CPDUView::destination_addr() const
+{
+	return m_destination;
+}
+
+string_ref CPDUView::short_message() const
+{
+	return m_text;
+}
+
+bool CPDUView::find_tlv(uint16_t tag, string_ref& value) const
+{
+	size_t pos = m_tlvs;
+	while (pos + 4 <= m_length)
+	{
+		size_t length = ReadInteger(m_data + pos + 2, 2);
+		if (pos + 4 + length > m_length) {
+			return false;
+		}
+		if (ReadInteger(m_data + pos, 2) == tag)
+		{
+			value = string_ref(m_data + pos + 4, length);
+			return true;
+		}
+		pos += 4 + length;
+	}
+	return false;
+}
+
+bool CPDUView::SkipString(size_t& pos, size_t size, string_ref& value) const
+{
+	if (pos >= m_length) {
+		return false;
+	}
+	const char *end = (const char *)memchr(m_data + pos, 0, std::min(size, m_length - pos));
+	if (!end) {
+		return false;
+	}
+	value = string_ref(m_data + pos, end - (m_data + pos));
+	pos += value.size() + 1;
+	return true;
+}
+
+} // namespace opensmpp
@@ -0,0 +1,77 @@
+/*!
+ * \file pduview.hpp
+ * \author ichramm
+ */
+#ifndef OPENSMPP_PDUVIEW_HPP_
+#define OPENSMPP_PDUVIEW_HPP_
+#if _MSC_VER > 1000
+#pragma once
+#endif
+
+#include <boost/cstdint.hpp>
+#include <boost/utility/string_ref.hpp>
+#include <cstddef>
+
+namespace opensmpp
+{
+	/*!
+	 * \brief Reads the fields of a PDU right from the buffer it was received in,
+	 * nothing is copied
+	 *
+	 * \c Parse only checks the framing and remembers where the fields of
+	 * SUBMIT_SM, DELIVER_SM and DATA_SM are, TLVs are looked up when asked
+	 * for. It's meant for the decisions that can be taken before the PDU is
+	 * decoded, the buffer must outlive the view.
+	 */
+	class CPDUView
+	{
+	public:
+
+		CPDUView();
+
+		/*!
+		 * \return \c false if the command length does not match \p length or,
+		 * for the commands whose fields are known, the fields overrun the PDU
+		 * or are longer than allowed
+		 */
+		bool Parse(const char *data, size_t length);
+
+		boost::uint32_t command_id() const;
+
+		boost::uint32_t sequence_number() const;
+
+		/*! \return \c true if the command has addresses, the ones below are empty otherwise */
+		bool has_addresses() const;
+
+		boost::string_ref source_addr() const;
+
+		boost::string_ref destination_addr() const;
+
+		/*! \return The short_message field, it is empty for DATA_SM */
+		boost::string_ref short_message() const;
+
+		/*!
+		 * \brief Looks for the TLV \p tag, walking the TLVs at the end of the PDU
+		 * \return \c false if it's not there
+		 */
+		bool find_tlv(boost::uint16_t tag, boost::string_ref& value) const;
+
+	private:
+
+		/*!
+		 * \brief Skips a C-Octet String of at most \p size bytes, the terminator included
+		 * \return \c false if it is not terminated in time
+		 */
+		bool SkipString(size_t& pos, size_t size, boost::string_ref& value) const;
+
+		const char         *m_data;
+		size_t              m_length;
+		boost::string_ref   m_source;
+		boost::string_ref   m_destination;
+		boost::string_ref   m_text;
+		size_t              m_tlvs;     /*!< Offset of the first TLV, \c m_length if there are none */
+		bool                m_addresses;
+	};
+} // namespace opensmpp
+
+#endif // OPENSMPP_PDUVIEW_HPP_
@@ -0,0 +1,131 @@
+/*!
+ * \file routetrie.hpp
+ * \author ichramm
+ */
+#ifndef OPENSMPP_ROUTETRIE_HPP_
+#define OPENSMPP_ROUTETRIE_HPP_
+#if _MSC_VER > 1000
+#pragma once
+#endif
+
+#include <boost/shared_ptr.hpp>
+#include <algorithm>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace opensmpp
+{
+	/*!
+	 * \brief Routes by prefix in a compressed trie of digits
+	 *
+	 * Each edge holds a run of digits and nodes only branch where prefixes
+	 * differ. Nodes live in a single vector so lookups stay in a few cache lines.
+	 */
+	template <class Route>
+	class CRouteTrie
+	{
+	public:
+
+		CRouteTrie()
+		 : m_nodes(1)
+		{ }
+
+		/*! \brief Sets the route of \p digits, which must have nothing but digits */
+		void Insert(const std::string& digits, const boost::shared_ptr<const Route>& route)
+		{
+			std::size_t node = 0, i = 0;
+			while (i < digits.size())
+			{
+				int digit = digits[i] - '0';
+				int child = m_nodes[node].children[digit];
+				if (child < 0)
+				{
+					child = (int)m_nodes.size();
+					m_nodes.push_back(Node());
+					m_nodes[child].label = digits.substr(i);
+					m_nodes[node].children[digit] = child;
+					node = child;
+					break;
+				}
+
+				const std::string &label = m_nodes[child].label;
+				std::size_t j = 1;
+				while (j < label.size() && i + j < digits.size() && label[j] == digits[i + j]) {
+					j++;
+				}
+
+				if (j < label.size())
+				{ // the prefix ends or differs within the edge, split it
+					int middle = (int)m_nodes.size();
+					m_nodes.push_back(Node());
+					m_nodes[middle].label = m_nodes[child].label.substr(0, j);
+					m_nodes[middle].children[m_nodes[child].label[j] - '0'] = child;
+					m_nodes[child].label.erase(0, j);
+					m_nodes[node].children[digit] = middle;
+					child = middle;
+				}
+
+				node = child;
+				i += j;
+			}
+			m_nodes[node].route = route;
+		}
+
+		/*! \return The route of the longest prefix of \p to, NULL if there is none */
+		const Route *Lookup(const std::string& to) const
+		{
+			const Route *found = m_nodes[0].route.get();
+			const char *it = to.c_str(), *end = it + to.size();
+			const Node *node = &m_nodes[0];
+
+			for (;;)
+			{
+				it = SkipNonDigits(it, end);
+				if (it == end || node->children[*it - '0'] < 0) {
+					break;
+				}
+				node = &m_nodes[node->children[*it - '0']];
+
+				for (std::string::const_iterator label = node->label.begin(); label != node->label.end(); ++label, ++it)
+				{
+					it = SkipNonDigits(it, end);
+					if (it == end || *it != *label) {
+						return found;
+					}
+				}
+
+				if (node->route) {
+					found = node->route.get();
+				}
+			}
+			return found;
+		}
+
+	private:
+
+		struct Node
+		{
+			Node()
+			{
+				std::fill(children, children + 10, -1);
+			}
+
+			std::string                            label;
+			int                                    children[10];
+			boost::shared_ptr<const Route>   route;
+		};
+
+		static const char *SkipNonDigits(const char *it, const char *end)
+		{
+			while (it != end && (*it < '0' || *it > '9')) {
+				it++;
+			}
+			return it;
+		}
+
+		std::vector<Node>  m_nodes;
+	};
+} // namespace opensmpp
+
+#endif // OPENSMPP_ROUTETRIE_HPP_
@@ -16,6 +16,7 @@
 #include "logger.h"
 
 #include <boost/make_shared.hpp>
+#include <boost/core/null_deleter.hpp>
 
 using namespace std;
 using namespace boost;
@@ -29,12 +30,17 @@ public:
 	pimpl(boost::shared_ptr<CSMSCCallback> callbacks, unsigned int port, unsigned int threads);
 	int Start();
 	void SetEnconding(DataCoding data_coding);
+	void SetServerSettings(const ServerSettings& ss);
+	void GetServerSettings(ServerSettings *ss);
 	void Stop();
 	bool IsRunning() const;
 	DeliveryResult SendMessage(const string &from,  const string &to, const string &message);
+	DeliveryResult ReportMessageState(const string &messageId, MessageState state, unsigned int errorCode);
+	DeliveryResult ReportMessageState(const string &messageId, const string &destination, MessageState state, unsigned int errorCode);
 
 private:
 	unsigned int m_threadCount;
+	ServerSettings m_settings;
 	boost::shared_ptr<CSMPPUserManager>  m_userManager;
 	boost::shared_ptr<CSMPPServerImpl>   m_server;
 };
@@ -44,7 +50,7 @@ CSMPPServer::pimpl::pimpl(boost::shared_ptr<CSMSCCallback> callbacks, unsigned i
  , m_userManager(new CSMPPUserManager(callbacks))
  , m_server(new CSMPPServerImpl(m_userManager, port))
 {
-
+	libSMPP_CreateDefaultServerSettings(&m_settings);
 }
 
 int CSMPPServer::pimpl::Start()
@@ -63,6 +69,18 @@ void CSMPPServer::pimpl::SetEnconding(DataCoding data_coding)
 	m_userManager->SetDeliveryEncoding(data_coding);
 }
 
+void CSMPPServer::pimpl::SetServerSettings(const ServerSettings& ss)
+{
+	memcpy(&m_settings, &ss, sizeof(ServerSettings));
+	m_server->SetSettings(m_settings);
+	m_userManager->SetSettings(m_settings);
+}
+
+void CSMPPServer::pimpl::GetServerSettings(ServerSettings *ss)
+{
+	memcpy(ss, &m_settings, sizeof(ServerSettings));
+}
+
 void CSMPPServer::pimpl::Stop()
 {
 	m_server->Stop();
@@ -78,6 +96,16 @@ DeliveryResult CSMPPServer::pimpl::SendMessage( const string &from, const string
 	return m_userManager->SendMessage(from, to, message);
 }
 
+DeliveryResult CSMPPServer::pimpl::ReportMessageState( const string &messageId, MessageState state, unsigned int errorCode )
+{
+	return m_userManager->ReportMessageState(messageId, state, errorCode);
+}
+
+DeliveryResult CSMPPServer::pimpl::ReportMessageState( const string &messageId, const string &destination, MessageState state, unsigned int errorCode )
+{
+	return m_userManager->ReportMessageState(messageId, destination, state, errorCode);
+}
+
 
 /************************************************************************/
 /************************************************************************/
@@ -90,6 +118,16 @@ void CSMPPServer::SetEnconding(DataCoding data_coding)
 	m_pimpl->SetEnconding(data_coding);
 }
 
+void CSMPPServer::SetServerSettings(const ServerSettings& ss)
+{
+	m_pimpl->SetServerSettings(ss);
+}
+
+void CSMPPServer::GetServerSettings(ServerSettings *ss)
+{
+	m_pimpl->GetServerSettings(ss);
+}
+
 int CSMPPServer::Start() {
 	return m_pimpl->Start();
 }
@@ -106,6 +144,14 @@ DeliveryResult CSMPPServer::SendMessage(const string &from, const string &to, co
 	return m_pimpl->SendMessage(from, to, message);
 }
 
+DeliveryResult CSMPPServer::ReportMessageState(const string &messageId, MessageState state, unsigned int errorCode) {
+	return m_pimpl->ReportMessageState(messageId, state, errorCode);
+}
+
+DeliveryResult CSMPPServer::ReportMessageState(const string &messageId, const string &destination, MessageState state, unsigned int errorCode) {
+	return m_pimpl->ReportMessageState(messageId, destination, state, errorCode);
+}
+
 
 /************************************************************************/
 /*     C-API implementation    */
@@ -116,9 +162,14 @@ struct CAPICallback : public CSMSCCallback
 	Callback_ValidateUser ValidateFn;
 	Callback_DeliverMessage DeliverFn;
 	Callback_OnUserDisconnected OnDisconnectFn;
+	Callback_GetUserThroughput ThroughputFn;
+	Callback_ValidateUserAsync ValidateAsyncFn;
+	Callback_DeliverMessageWithId DeliverWithIdFn;
+	Callback_CancelMessage CancelFn;
+	Callback_ReplaceMessage ReplaceFn;
 
 	CAPICallback(Callback_ValidateUser v, Callback_DeliverMessage d, Callback_OnUserDisconnected o)
-		: ValidateFn(v), DeliverFn(d), OnDisconnectFn(o)
+		: ValidateFn(v), DeliverFn(d), OnDisconnectFn(o), ThroughputFn(NULL), ValidateAsyncFn(NULL), DeliverWithIdFn(NULL), CancelFn(NULL), ReplaceFn(NULL)
 	{ }
 
 	LoginResult ValidateUser(unsigned int connectionId, BindType loginType, const string &systemId,
@@ -127,11 +178,54 @@ struct CAPICallback : public CSMSCCallback
 		return ValidateFn(connectionId, loginType, systemId.c_str(), password.c_str(), address_range.c_str());
 	}
 
+	void ValidateUserAsync(unsigned int connectionId, BindType loginType, const string &systemId,
+		const string &password, const string& address_range, boost::shared_ptr<CBindValidation> validation)
+	{
+		if (!ValidateAsyncFn) {
+			CSMSCCallback::ValidateUserAsync(connectionId, loginType, systemId, password, address_range, validation);
+			return;
+		}
+		// the handle keeps the validation alive until libSMPP_ServerCompleteBind
+		BIND_HANDLE hBind = (BIND_HANDLE) new boost::shared_ptr<CBindValidation>(validation);
+		ValidateAsyncFn(connectionId, loginType, systemId.c_str(), password.c_str(), address_range.c_str(), hBind);
+	}
+
 	DeliveryResult DeliverMessage (unsigned int connectionId, const string &from, const string &to, const string &message)
 	{
 		return DeliverFn(connectionId, from.c_str(), to.c_str(), &message[0], message.size());
 	}
 
+	DeliveryResult DeliverMessageWithId (unsigned int connectionId, const string &from, const string &to, const string &message, const string &messageId)
+	{
+		if (!DeliverWithIdFn) {
+			return DeliverMessage(connectionId, from, to, message);
+		}
+		return DeliverWithIdFn(connectionId, from.c_str(), to.c_str(), &message[0], message.size(), messageId.c_str());
+	}
+
+	DeliveryResult CancelMessage (unsigned int connectionId, const string &messageId)
+	{
+		if (!CancelFn) {
+			return DELIVERY_REJECTED;
+		}
+		return CancelFn(connectionId, messageId.c_str());
+	}
+
+	DeliveryResult ReplaceMessage (unsigned int connectionId, const string &messageId, const string &message)
+	{
+		if (!ReplaceFn) {
+			return DELIVERY_REJECTED;
+		}
+		return ReplaceFn(connectionId, messageId.c_str(), &message[0], message.size());
+	}
+
+	void GetUserThroughput (unsigned int connectionId, const string &systemId, unsigned int &rate, unsigned int &burst)
+	{
+		if (ThroughputFn) {
+			ThroughputFn(connectionId, systemId.c_str(), &rate, &burst);
+		}
+	}
+
 	void OnUserDisconnected (unsigned int connectionId, const string &systemId, DisconnectReason reason)
 	{
 		OnDisconnectFn(connectionId, systemId.c_str(), reason);
@@ -140,10 +234,16 @@ struct CAPICallback : public CSMSCCallback
 
 struct CAPIWrapper
 {
-	CAPIWrapper() : port(0) {}
-	boost::shared_ptr<CSMSCCallback> callbacks;
+	CAPIWrapper() : port(0), throughputFn(NULL), validateAsyncFn(NULL), deliverWithIdFn(NULL), cancelFn(NULL), replaceFn(NULL) { libSMPP_CreateDefaultServerSettings(&settings); }
+	boost::shared_ptr<CAPICallback> callbacks;
 	boost::shared_ptr<CSMPPServer> server;
 	unsigned short port; // cached until Start() is called
+	ServerSettings settings; // same as above
+	Callback_GetUserThroughput throughputFn; // same as above
+	Callback_ValidateUserAsync validateAsyncFn; // same as above
+	Callback_DeliverMessageWithId deliverWithIdFn; // same as above
+	Callback_CancelMessage cancelFn; // same as above
+	Callback_ReplaceMessage replaceFn; // same as above
 };
 
 class CAPIESMECallback : public CESMECallback
@@ -151,7 +251,7 @@ class CAPIESMECallback : public CESMECallback
 public:
 
 	CAPIESMECallback(Callback_OnIncomingMessage onNewMessage, Callback_OnConnectionLost onConnectionLost)
-	: m_handle(NULL), m_onNewMessage(onNewMessage), m_onConnectionLost(onConnectionLost)
+	: m_handle(NULL), m_onNewMessage(onNewMessage), m_onConnectionLost(onConnectionLost), m_onReceipt(NULL), m_onReconnected(NULL), m_onNewMessageAsync(NULL), m_onBound(NULL), m_onQueuedSent(NULL)
 	{
 	}
 
@@ -168,6 +268,18 @@ public:
 		}
 	}
 
+	virtual void OnIncomingMessageAsync(const string& from, const string& to, const string& content, boost::shared_ptr<CIncomingMessage> message)
+	{
+		if(!m_handle || !m_onNewMessageAsync)
+		{
+			CESMECallback::OnIncomingMessageAsync(from, to, content, message);
+			return;
+		}
+		// the handle keeps the message alive until libSMPP_ClientAcknowledgeMessage
+		INCOMING_HANDLE hMessage = (INCOMING_HANDLE) new boost::shared_ptr<CIncomingMessage>(message);
+		m_onNewMessageAsync(m_handle, from.c_str(), to.c_str(), content.data(), content.size(), hMessage);
+	}
+
 	virtual void OnConnectionLost(int cause)
 	{
 		if(m_handle && m_onConnectionLost)
@@ -176,10 +288,72 @@ public:
 		}
 	}
 
+	virtual void OnDeliveryReceipt(const DeliveryReceipt& receipt, void *context)
+	{
+		if(m_handle && m_onReceipt)
+		{
+			m_onReceipt(m_handle, &receipt, context);
+		}
+	}
+
+	virtual void OnReconnected()
+	{
+		if(m_handle && m_onReconnected)
+		{
+			m_onReconnected(m_handle);
+		}
+	}
+
+	virtual void OnBound(LoginResult result)
+	{
+		if(m_handle && m_onBound)
+		{
+			m_onBound(m_handle, result);
+		}
+	}
+
+	virtual void OnQueuedMessageSent(const string& reference, DeliveryResult result, const string& messageId)
+	{
+		if(m_handle && m_onQueuedSent)
+		{
+			m_onQueuedSent(m_handle, reference.c_str(), result, messageId.c_str());
+		}
+	}
+
+	void SetDeliveryReceiptCallback(Callback_OnDeliveryReceipt onReceipt)
+	{
+		m_onReceipt = onReceipt;
+	}
+
+	void SetReconnectedCallback(Callback_OnReconnected onReconnected)
+	{
+		m_onReconnected = onReconnected;
+	}
+
+	void SetAsyncMessageCallback(Callback_OnIncomingMessageAsync onNewMessageAsync)
+	{
+		m_onNewMessageAsync = onNewMessageAsync;
+	}
+
+	void SetBoundCallback(Callback_OnBound onBound)
+	{
+		m_onBound = onBound;
+	}
+
+	void SetQueuedMessageCallback(Callback_OnQueuedMessageSent onQueuedSent)
+	{
+		m_onQueuedSent = onQueuedSent;
+	}
+
 private:
-	ESME_HANDLE                m_handle;
-	Callback_OnIncomingMessage m_onNewMessage;
-	Callback_OnConnectionLost  m_onConnectionLost;
+	ESME_HANDLE                     m_handle;
+	Callback_OnIncomingMessage      m_onNewMessage;
+	Callback_OnConnectionLost       m_onConnectionLost;
+	Callback_OnDeliveryReceipt      m_onReceipt;
+	Callback_OnReconnected          m_onReconnected;
+	Callback_OnIncomingMessageAsync m_onNewMessageAsync;
+	Callback_OnBound                m_onBound;
+	Callback_OnQueuedMessageSent    m_onQueuedSent;
 };
 
 } // namespace opensmpp
@@ -237,6 +411,8 @@ SMPP_API const char *libSMPP_DeliveryResultToString(DeliveryResult r)
 		return "Invalid Source Address";
 	case DELIVERY_INV_DEST_ADDR:
 		return "Invalid Destination Address";
+	case DELIVERY_QUEUED:
+		return "Queued";
 	case DELIVERY_UNKNOWN_ERROR:
 	default: // avoid compiler warnings
 		return "Unknown Error";
@@ -263,6 +439,25 @@ SMPP_API void libSMPP_CreateDefaultMessageSettings(MessageSettings *ms)
 	ms->EnablePayload = 1;
 	ms->EnableSubmitMulti = 1;
 	ms->EnableMessageConcatenation = 1;
+	ms->ReceiptTrackingTTL = 86400;
+	ms->ReconnectMinDelay = 500;
+	ms->ReconnectMaxDelay = 30000;
+	ms->ReconnectWaitTimeout = 60000;
+	ms->OutboxDrainWindow = 10;
+}
+
+SMPP_API void libSMPP_CreateDefaultServerSettings(ServerSettings *ss)
+{
+	memset(ss, 0, sizeof(ServerSettings));
+	ss->ThreadingModel = SERVER_THREADING_SHARED;
+	ss->EnableReusePort = 1;
+	ss->MaxInboundPerConnection = 100;
+	ss->DefaultSubmitBurst = 1;
+	ss->QueueDrainWindow = 10;
+	ss->QueueRetryDelay = 1000;
+	ss->SubmitMultiThreads = 4;
+	ss->MessageIndexTTL = 86400;
+	ss->MaxIndexedMessages = 100000;
 }
 
 SMPP_API SMSC_HANDLE libSMPP_ServerCreate()
@@ -292,13 +487,44 @@ SMPP_API void libSMPP_ServerSetCallbacks(SMSC_HANDLE hServer,
 	w->callbacks = make_shared<CAPICallback>(validateFn, deliverFn, onDisconFn);
 }
 
+SMPP_API void libSMPP_ServerSetAsyncValidationCallback(SMSC_HANDLE hServer, Callback_ValidateUserAsync validateFn)
+{
+	CAPIWrapper *w = reinterpret_cast<CAPIWrapper*>(hServer);
+	w->validateAsyncFn = validateFn;
+}
+
+SMPP_API void libSMPP_ServerCompleteBind(BIND_HANDLE hBind, LoginResult result)
+{
+	boost::shared_ptr<CBindValidation> *validation = reinterpret_cast<boost::shared_ptr<CBindValidation>*>(hBind);
+	(*validation)->Complete(result);
+	delete validation;
+}
+
+SMPP_API void libSMPP_ServerSetThroughputCallback(SMSC_HANDLE hServer, Callback_GetUserThroughput throughputFn)
+{
+	CAPIWrapper *w = reinterpret_cast<CAPIWrapper*>(hServer);
+	w->throughputFn = throughputFn;
+}
+
+SMPP_API void libSMPP_ServerSetSettings(SMSC_HANDLE hServer, const ServerSettings *ss)
+{
+	CAPIWrapper *w = reinterpret_cast<CAPIWrapper*>(hServer);
+	memcpy(&w->settings, ss, sizeof(ServerSettings));
+}
+
 SMPP_API int libSMPP_ServerStart(SMSC_HANDLE hServer)
 {
 	CAPIWrapper *w = reinterpret_cast<CAPIWrapper*>(hServer);
 	if(!w->callbacks || !w->port) {
 		return -1;
 	}
+	w->callbacks->ThroughputFn = w->throughputFn;
+	w->callbacks->ValidateAsyncFn = w->validateAsyncFn;
+	w->callbacks->DeliverWithIdFn = w->deliverWithIdFn;
+	w->callbacks->CancelFn = w->cancelFn;
+	w->callbacks->ReplaceFn = w->replaceFn;
 	w->server = make_shared<CSMPPServer>(w->callbacks, w->port);
+	w->server->SetServerSettings(w->settings);
 	return w->server->Start();
 }
 
@@ -315,6 +541,34 @@ SMPP_API DeliveryResult libSMPP_ServerSendMessage(SMSC_HANDLE hServer, const cha
 	return w->server->SendMessage(from, to, message);
 }
 
+SMPP_API void libSMPP_ServerSetDeliverMessageWithIdCallback(SMSC_HANDLE hServer, Callback_DeliverMessageWithId deliverFn)
+{
+	CAPIWrapper *w = reinterpret_cast<CAPIWrapper*>(hServer);
+	w->deliverWithIdFn = deliverFn;
+}
+
+SMPP_API DeliveryResult libSMPP_ServerReportMessageState(SMSC_HANDLE hServer, const char *messageId,
+                                                         MessageState state, unsigned int errorCode)
+{
+	CAPIWrapper *w = reinterpret_cast<CAPIWrapper*>(hServer);
+	return w->server->ReportMessageState(messageId, state, errorCode);
+}
+
+SMPP_API DeliveryResult libSMPP_ServerReportDestinationState(SMSC_HANDLE hServer, const char *messageId,
+                                                             const char *destination, MessageState state, unsigned int errorCode)
+{
+	CAPIWrapper *w = reinterpret_cast<CAPIWrapper*>(hServer);
+	return w->server->ReportMessageState(messageId, destination, state, errorCode);
+}
+
+SMPP_API void libSMPP_ServerSetMessageUpdateCallbacks(SMSC_HANDLE hServer, Callback_CancelMessage cancelFn,
+                                                      Callback_ReplaceMessage replaceFn)
+{
+	CAPIWrapper *w = reinterpret_cast<CAPIWrapper*>(hServer);
+	w->cancelFn = cancelFn;
+	w->replaceFn = replaceFn;
+}
+
 
 SMPP_API ESME_HANDLE libSMPP_ClientCreate(Callback_OnIncomingMessage onNewMessage,
                                           Callback_OnConnectionLost onConnectionLost)
@@ -331,6 +585,23 @@ SMPP_API ESME_HANDLE libSMPP_ClientCreate(Callback_OnIncomingMessage onNewMessag
 	return hClient;
 }
 
+SMPP_API ESME_HANDLE libSMPP_ClientCreateWithExecutor(Callback_OnIncomingMessage onNewMessage,
+                                                      Callback_OnConnectionLost onConnectionLost,
+                                                      EXECUTOR_HANDLE hExecutor)
+{
+	ESME_HANDLE hClient;
+
+	shared_ptr<CAPIESMECallback>
+		callbacks = make_shared<CAPIESMECallback>(onNewMessage, onConnectionLost);
+
+	shared_ptr<CClientExecutor> *executor = reinterpret_cast<shared_ptr<CClientExecutor>*>(hExecutor);
+	hClient = (ESME_HANDLE) new CSMPPClient(callbacks->shared_from_this(), "", 0, BIND_TYPE_TRANSCEIVER, *executor);
+
+	callbacks->SetOwner(hClient);
+
+	return hClient;
+}
+
 SMPP_API void libSMPP_ClientDelete(ESME_HANDLE hClient)
 {
 	CSMPPClient *client = reinterpret_cast<CSMPPClient*>(hClient);
@@ -338,6 +609,16 @@ SMPP_API void libSMPP_ClientDelete(ESME_HANDLE hClient)
 	return ;
 }
 
+SMPP_API EXECUTOR_HANDLE libSMPP_ExecutorCreate(unsigned int threads)
+{
+	return (EXECUTOR_HANDLE) new shared_ptr<CClientExecutor>(new CClientExecutor(threads));
+}
+
+SMPP_API void libSMPP_ExecutorDelete(EXECUTOR_HANDLE hExecutor)
+{
+	delete reinterpret_cast<shared_ptr<CClientExecutor>*>(hExecutor);
+}
+
 SMPP_API void libSMPP_ClientSetServerAddress(ESME_HANDLE hClient, const char* serverIP,
                                              short unsigned int serverPort)
 {
@@ -389,6 +670,28 @@ SMPP_API LoginResult libSMPP_ClientBind(ESME_HANDLE hClient)
 	return client->Bind();
 }
 
+SMPP_API void libSMPP_ClientBindAsync(ESME_HANDLE hClient)
+{
+	CSMPPClient *client = reinterpret_cast<CSMPPClient*>(hClient);
+	client->BindAsync();
+}
+
+SMPP_API unsigned int libSMPP_ClientBindAll(ESME_HANDLE *clients, unsigned int count,
+                                            unsigned int parallelism, LoginResult *results)
+{
+	vector<CSMPPClient*> list(count);
+	for (unsigned int i = 0; i < count; i++) {
+		list[i] = reinterpret_cast<CSMPPClient*>(clients[i]);
+	}
+
+	vector<LoginResult> res;
+	unsigned int bound = CSMPPClient::BindAll(list, parallelism, &res);
+	if (results) {
+		std::copy(res.begin(), res.end(), results);
+	}
+	return bound;
+}
+
 SMPP_API void libSMPP_ClientUnBind(ESME_HANDLE hClient)
 {
 	CSMPPClient *client = reinterpret_cast<CSMPPClient*>(hClient);
@@ -410,6 +713,206 @@ SMPP_API DeliveryResult libSMPP_ClientSendMessage(SMSC_HANDLE hClient,
 	return client->SendMessage(from, to, string(content, size));
 }
 
+SMPP_API DeliveryResult libSMPP_ClientSendMessageTracked(ESME_HANDLE hClient,
+                                                         const char *from, const char *to,
+                                                         const char *content,
+                                                         unsigned int size,
+                                                         void *context,
+                                                         char *messageId)
+{
+	CSMPPClient *client = reinterpret_cast<CSMPPClient*>(hClient);
+	string id;
+	DeliveryResult dr = client->SendMessage(from, to, string(content, size), &id, context);
+	if (messageId)
+	{
+		size_t length = min(id.size(), sizeof(((DeliveryReceipt *)0)->MessageId) - 1);
+		memcpy(messageId, id.data(), length);
+		messageId[length] = '\0';
+	}
+	return dr;
+}
+
+SMPP_API DeliveryResult libSMPP_ClientSendDataMessage(ESME_HANDLE hClient,
+                                                      const char *from, const char *to,
+                                                      const char *content,
+                                                      unsigned int size,
+                                                      void *context,
+                                                      char *messageId)
+{
+	CSMPPClient *client = reinterpret_cast<CSMPPClient*>(hClient);
+	string id;
+	DeliveryResult dr = client->SendDataMessage(from, to, string(content, size), &id, context);
+	if (messageId)
+	{
+		size_t length = min(id.size(), sizeof(((DeliveryReceipt *)0)->MessageId) - 1);
+		memcpy(messageId, id.data(), length);
+		messageId[length] = '\0';
+	}
+	return dr;
+}
+
+SMPP_API void libSMPP_ClientSetDeliveryReceiptCallback(ESME_HANDLE hClient, Callback_OnDeliveryReceipt onReceiptFn)
+{
+	CSMPPClient *client = reinterpret_cast<CSMPPClient*>(hClient);
+	shared_ptr<CAPIESMECallback> callbacks = dynamic_pointer_cast<CAPIESMECallback>(client->GetCallbacks());
+	if (callbacks) {
+		callbacks->SetDeliveryReceiptCallback(onReceiptFn);
+	}
+}
+
+SMPP_API void libSMPP_ClientSetAsyncMessageCallback(ESME_HANDLE hClient, Callback_OnIncomingMessageAsync onNewMessageFn)
+{
+	CSMPPClient *client = reinterpret_cast<CSMPPClient*>(hClient);
+	shared_ptr<CAPIESMECallback> callbacks = dynamic_pointer_cast<CAPIESMECallback>(client->GetCallbacks());
+	if (callbacks) {
+		callbacks->SetAsyncMessageCallback(onNewMessageFn);
+	}
+}
+
+SMPP_API void libSMPP_ClientAcknowledgeMessage(INCOMING_HANDLE hMessage, DeliveryResult result)
+{
+	boost::shared_ptr<CIncomingMessage> *message = reinterpret_cast<boost::shared_ptr<CIncomingMessage>*>(hMessage);
+	(*message)->Complete(result);
+	delete message;
+}
+
+SMPP_API void libSMPP_ClientSetReconnectedCallback(ESME_HANDLE hClient, Callback_OnReconnected onReconnectedFn)
+{
+	CSMPPClient *client = reinterpret_cast<CSMPPClient*>(hClient);
+	shared_ptr<CAPIESMECallback> callbacks = dynamic_pointer_cast<CAPIESMECallback>(client->GetCallbacks());
+	if (callbacks) {
+		callbacks->SetReconnectedCallback(onReconnectedFn);
+	}
+}
+
+SMPP_API void libSMPP_ClientSetBoundCallback(ESME_HANDLE hClient, Callback_OnBound onBoundFn)
+{
+	CSMPPClient *client = reinterpret_cast<CSMPPClient*>(hClient);
+	shared_ptr<CAPIESMECallback> callbacks = dynamic_pointer_cast<CAPIESMECallback>(client->GetCallbacks());
+	if (callbacks) {
+		callbacks->SetBoundCallback(onBoundFn);
+	}
+}
+
+SMPP_API DeliveryResult libSMPP_ClientQueueMessage(ESME_HANDLE hClient,
+                                                   const char *from, const char *to,
+                                                   const char *content,
+                                                   unsigned int size,
+                                                   const char *reference)
+{
+	CSMPPClient *client = reinterpret_cast<CSMPPClient*>(hClient);
+	return client->QueueMessage(from, to, string(content, size), reference ? reference : "");
+}
+
+SMPP_API void libSMPP_ClientSetQueuedMessageCallback(ESME_HANDLE hClient, Callback_OnQueuedMessageSent onSentFn)
+{
+	CSMPPClient *client = reinterpret_cast<CSMPPClient*>(hClient);
+	shared_ptr<CAPIESMECallback> callbacks = dynamic_pointer_cast<CAPIESMECallback>(client->GetCallbacks());
+	if (callbacks) {
+		callbacks->SetQueuedMessageCallback(onSentFn);
+	}
+}
+
+SMPP_API DeliveryResult libSMPP_ClientSendMessageMulti(SMSC_HANDLE hClient,
+                                                       const char *from, const char **to,
+                                                       unsigned int count,
+                                                       const char *content,
+                                                       unsigned int size,
+                                                       DeliveryResult *results)
+{
+	CSMPPClient *client = reinterpret_cast<CSMPPClient*>(hClient);
+	vector<DeliveryResult> res;
+	DeliveryResult dr = client->SendMessageMulti(from, vector<string>(to, to + count), string(content, size), &res);
+	if (results && !res.empty()) {
+		memcpy(results, &res[0], res.size() * sizeof(DeliveryResult));
+	}
+	return dr;
+}
+
+SMPP_API MESSAGE_HANDLE libSMPP_ClientPrepareMessage(ESME_HANDLE hClient, const char *from,
+                                                    const char *content, unsigned int size)
+{
+	CSMPPClient *client = reinterpret_cast<CSMPPClient*>(hClient);
+	shared_ptr<CPreparedMessage> message = client->PrepareMessage(from, string(content, size));
+	if (!message) {
+		return NULL;
+	}
+	return (MESSAGE_HANDLE) new shared_ptr<CPreparedMessage>(message);
+}
+
+SMPP_API DeliveryResult libSMPP_ClientSendPreparedMessage(ESME_HANDLE hClient,
+                                                          MESSAGE_HANDLE hMessage,
+                                                          const char **to,
+                                                          unsigned int count,
+                                                          DeliveryResult *results)
+{
+	CSMPPClient *client = reinterpret_cast<CSMPPClient*>(hClient);
+	shared_ptr<CPreparedMessage> *message = reinterpret_cast<shared_ptr<CPreparedMessage>*>(hMessage);
+	vector<DeliveryResult> res;
+	DeliveryResult dr = client->SendPreparedMessage(**message, vector<string>(to, to + count), &res);
+	if (results && !res.empty()) {
+		memcpy(results, &res[0], res.size() * sizeof(DeliveryResult));
+	}
+	return dr;
+}
+
+SMPP_API void libSMPP_ClientDeletePreparedMessage(MESSAGE_HANDLE hMessage)
+{
+	delete reinterpret_cast<shared_ptr<CPreparedMessage>*>(hMessage);
+}
+
+SMPP_API ROUTES_HANDLE libSMPP_RoutesCreate()
+{
+	return new CRouteTable();
+}
+
+SMPP_API void libSMPP_RoutesAdd(ROUTES_HANDLE hRoutes, const char *prefix, ESME_HANDLE hClient, unsigned int cost)
+{
+	CRouteTable *routes = reinterpret_cast<CRouteTable*>(hRoutes);
+	// the caller owns the client
+	routes->AddRoute(prefix ? prefix : "", shared_ptr<CSMPPClient>(reinterpret_cast<CSMPPClient*>(hClient), null_deleter()), cost);
+}
+
+SMPP_API void libSMPP_RoutesDelete(ROUTES_HANDLE hRoutes)
+{
+	delete reinterpret_cast<CRouteTable*>(hRoutes);
+}
+
+SMPP_API ROUTER_HANDLE libSMPP_RouterCreate()
+{
+	return new CSMPPRouter();
+}
+
+SMPP_API void libSMPP_RouterDelete(ROUTER_HANDLE hRouter)
+{
+	delete reinterpret_cast<CSMPPRouter*>(hRouter);
+}
+
+SMPP_API void libSMPP_RouterSetRoutes(ROUTER_HANDLE hRouter, ROUTES_HANDLE hRoutes)
+{
+	CSMPPRouter *router = reinterpret_cast<CSMPPRouter*>(hRouter);
+	router->SetRoutes(*reinterpret_cast<CRouteTable*>(hRoutes));
+}
+
+SMPP_API DeliveryResult libSMPP_RouterSendMessage(ROUTER_HANDLE hRouter,
+                                                  const char *from, const char *to,
+                                                  const char *content,
+                                                  unsigned int size,
+                                                  void *context,
+                                                  char *messageId)
+{
+	CSMPPRouter *router = reinterpret_cast<CSMPPRouter*>(hRouter);
+	string id;
+	DeliveryResult dr = router->SendMessage(from, to, string(content, size), &id, context);
+	if (messageId)
+	{
+		size_t length = min(id.size(), sizeof(((DeliveryReceipt *)0)->MessageId) - 1);
+		memcpy(messageId, id.data(), length);
+		messageId[length] = '\0';
+	}
+	return dr;
+}
+
 } // extern "C"
 
 #ifdef _WIN32
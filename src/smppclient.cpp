@@ -10,16 +10,25 @@
 #include "smppconnection.hpp"
 #include "smppcommands.hpp"
 #include "converter.hpp"
+#include "deliveryreceipt.hpp"
+#include "outbox.hpp"
 #include "logger.h"
 
 #include <boost/make_shared.hpp>
 #include <boost/bind.hpp>
 #include <boost/asio.hpp>
 #include <boost/thread/detail/thread.hpp>
+#include <boost/random/mersenne_twister.hpp>
+#include <boost/random/uniform_int_distribution.hpp>
 
 #include <algorithm>
+#include <cstdio>
 #include <vector>
 
+#ifdef _MSC_VER
+#define snprintf _snprintf
+#endif
+
 #ifdef _WIN32
 # pragma push_macro("SendMessage")
 # undef SendMessage
@@ -28,41 +37,43 @@
 using namespace std;
 using namespace boost;
 
+// threads of each default executor
 #define CLIENT_THREAD_COUNT   ((unsigned int)2)
 
+// SUBMIT_SM sent without waiting for their responses by SendMessageMulti
+#ifndef CLIENT_SUBMIT_WINDOW
+#define CLIENT_SUBMIT_WINDOW  ((unsigned int)32)
+#endif
+
+// number_of_dests is a single octet
+#define MAX_MULTI_DESTINATIONS  ((size_t)255)
+
+// times a message lost with the connection is sent again on a new session
+#ifndef CLIENT_MAX_REPLAYS
+#define CLIENT_MAX_REPLAYS  ((unsigned int)3)
+#endif
+
+// milliseconds the outbox stops sending after a message fails for no fault of its own
+#ifndef OUTBOX_RETRY_DELAY
+#define OUTBOX_RETRY_DELAY  ((unsigned int)1000)
+#endif
+
 namespace opensmpp
 {
 
-class ClientThread
+struct CClientExecutor::impl
 {
-public:
-
-	static shared_ptr<ClientThread> GetInstance()
-	{
-		if(!s_flag) {
-			lock_guard<mutex> lock(s_mutex);
-			if(!s_flag) {
-				s_flag = true;
-				s_instance = make_shared<ClientThread>();
-			}
-		}
-		return s_instance;
-	}
-
-	ClientThread()
+	impl()
 		: m_running(true), m_work(m_ioservice)
 	{
-		SetThreads(CLIENT_THREAD_COUNT);
 	}
 
-	~ClientThread()
+	/*! The threads keep \p self alive, a thread may outlive the executor, \see Stop */
+	static void Start(shared_ptr<impl> self, unsigned int count)
 	{
-		m_running = false;
-		m_ioservice.stop();
-		for ( ; !m_threads.empty(); m_threads.pop_back())
+		for (unsigned int i = 0; i < count; i++)
 		{
-			m_threads.back()->interrupt();
-			m_threads.back()->join();
+			self->m_threads.push_back(make_shared<thread>(bind(&impl::Run, self)));
 		}
 	}
 
@@ -85,85 +96,272 @@ public:
 		}
 	}
 
-	void SetThreads(unsigned int count)
+	void Stop()
 	{
-		if (count > m_threads.size())
+		m_running = false;
+		m_ioservice.stop();
+		for ( ; !m_threads.empty(); m_threads.pop_back())
 		{
-			for (unsigned int i = m_threads.size(); i < count; i++)
-			{
-				m_threads.push_back(make_shared<thread>(&ClientThread::Run, this));
+			if (m_threads.back()->get_id() == this_thread::get_id())
+			{ // the last client went away from one of its callbacks
+				m_threads.back()->detach();
+				continue;
 			}
+			m_threads.back()->join();
+		}
+	}
+
+	volatile bool                   m_running;
+	asio::io_service                m_ioservice;
+	asio::io_service::work          m_work;
+	vector<shared_ptr<thread> >     m_threads;
+};
+
+CClientExecutor::CClientExecutor(unsigned int threads)
+: pimpl(new impl())
+{
+	impl::Start(pimpl, max(threads, 1u));
+}
+
+CClientExecutor::~CClientExecutor()
+{
+	pimpl->Stop();
+}
+
+unsigned int CClientExecutor::GetThreads() const
+{
+	return pimpl->m_threads.size();
+}
+
+/*!
+ * The executors of the clients created without one, there is one per core
+ * unless \c CSMPPClient::SetClientThreads says otherwise
+ */
+class DefaultExecutors
+{
+public:
+
+	/*! \return The executor of the next client, they are given in turns */
+	static shared_ptr<CClientExecutor> Next()
+	{
+		lock_guard<mutex> lock(s_mutex);
+		if (s_executors.empty()) {
+			Resize(s_count ? s_count : max(thread::hardware_concurrency(), 1u));
+		}
+		return s_executors[s_next++ % s_executors.size()];
+	}
+
+	static void SetCount(unsigned int count)
+	{
+		lock_guard<mutex> lock(s_mutex);
+		s_count = count;
+		if (!s_executors.empty() && count) {
+			Resize(count);
 		}
-		else if (count < m_threads.size())
+	}
+
+private:
+
+	/*! Removed executors keep running until their clients are gone, the lock must be held */
+	static void Resize(unsigned int count)
+	{
+		while (s_executors.size() > count) {
+			s_executors.pop_back();
+		}
+		while (s_executors.size() < count) {
+			s_executors.push_back(make_shared<CClientExecutor>(CLIENT_THREAD_COUNT));
+		}
+	}
+
+	static mutex                               s_mutex;
+	static vector<shared_ptr<CClientExecutor> > s_executors;
+	static unsigned int                        s_count;
+	static unsigned int                        s_next;
+};
+
+mutex                               DefaultExecutors::s_mutex;
+vector<shared_ptr<CClientExecutor> > DefaultExecutors::s_executors;
+unsigned int                        DefaultExecutors::s_count = 0;
+unsigned int                        DefaultExecutors::s_next = 0;
+
+static int DeliveryResultToStatus(DeliveryResult res)
+{
+	switch (res)
+	{
+		case DELIVERY_OK:
+			return ESME_ROK;
+		case DELIVERY_REJECTED:
+			return ESME_RTHROTTLED;
+		case DELIVERY_INV_SRC_ADDR:
+			return ESME_RINVSRCADR;
+		case DELIVERY_INV_DEST_ADDR:
+			return ESME_RINVDSTADR;
+		case DELIVERY_UNKNOWN_ERROR:
+		default:
+			return ESME_RSYSERR;
+	}
+}
+
+/*!
+ * Handed to the callback to acknowledge an incoming message, if the callback
+ * forgets about it the message fails when the last reference is gone
+ */
+class IncomingMessage : public CIncomingMessage
+{
+public:
+	IncomingMessage(SMPPConnectionPtr conn, shared_ptr<ISMPPCommand> cmd)
+	 : m_completed(false), m_conn(conn), m_cmd(cmd)
+	{ }
+
+	~IncomingMessage()
+	{
+		if (!m_completed.load())
 		{
-			for ( ; m_threads.size() > count; m_threads.pop_back())
-			{
-				m_threads.back()->interrupt();
-				m_threads.back()->join();
-			}
+			smpp_log_warning("Message %u on connection %u has been abandoned", m_cmd->sequence_number(), m_conn->GetConnectionId());
+			Complete(DELIVERY_UNKNOWN_ERROR);
+		}
+	}
+
+	void Complete(DeliveryResult result)
+	{
+		if (m_completed.exchange(true)) {
+			return; // only once
 		}
+		m_cmd->command_status(DeliveryResultToStatus(result));
+		m_conn->SendResponse(m_cmd);
 	}
 
-	ioservice_t& GetIOService()
+	shared_ptr<ISMPPCommand> Command() const
 	{
-		return m_ioservice;
+		return m_cmd;
 	}
 
 private:
-	volatile bool                   m_running;
-	asio::io_service                m_ioservice;
-	asio::io_service::work          m_work;
-	vector<shared_ptr<thread> >     m_threads;
-	static volatile bool            s_flag;
-	static mutex                    s_mutex;
-	static shared_ptr<ClientThread> s_instance;
+	boost::atomic<bool>        m_completed;
+	SMPPConnectionPtr          m_conn;
+	shared_ptr<ISMPPCommand>   m_cmd;
 };
 
-volatile bool            ClientThread::s_flag = false;
-mutex                    ClientThread::s_mutex;
-shared_ptr<ClientThread> ClientThread::s_instance;
+struct CPreparedMessage::impl
+{
+	/*! A packed SUBMIT_SM split around its destination address */
+	struct Segment
+	{
+		string head;       /*!< Everything before destination_addr */
+		string tail;       /*!< Everything after destination_addr */
+		size_t sarOffset;  /*!< Location of the sar_msg_ref_num value in \c tail, npos if there is none */
+	};
+
+	vector<Segment> segments;
+};
+
+CPreparedMessage::CPreparedMessage()
+: pimpl(new impl())
+{
+}
+
+CPreparedMessage::~CPreparedMessage()
+{
+}
+
+unsigned int CPreparedMessage::GetSegmentCount() const
+{
+	return pimpl->segments.size();
+}
 
 struct CSMPPClient::impl
 {
-	impl(shared_ptr<CESMECallback> callbacks, const std::string &ip, unsigned short port, BindType mode)
+	typedef boost::function<void (LoginResult)> BindCallback;
+
+	impl(shared_ptr<CESMECallback> callbacks, const std::string &ip, unsigned short port, BindType mode, shared_ptr<CClientExecutor> executor)
 	 : m_isBound(false)
+	 , m_submitMultiRejected(false)
+	 , m_stopped(true)
+	 , m_reconnecting(false)
+	 , m_asyncBind(false)
+	 , m_reconnectAttempt(0)
 	 , m_callbacks(callbacks)
 	 , m_serverIP(ip)
 	 , m_serverPort(port)
 	 , m_loginMode(mode)
-	 , m_threadPool(ClientThread::GetInstance())
+	 , m_executor(executor ? executor : DefaultExecutors::Next())
+	 , m_reconnectTimer(IOService())
+	 , m_random((unsigned int)time(NULL) ^ (unsigned int)(size_t)this)
 	{
 		libSMPP_CreateDefaultMessageSettings(&m_settings);
-		//m_connection.reset(new CSMPPClientConnection(m_threadPool->GetIOService(), bind(&impl::OnNewData, this, _1, _2),  bind(&impl::OnConnectionLost, this, _1)));
 	}
 
 	~impl()
 	{
+		if (m_outbox) {
+			m_outbox->Close();
+		}
 		Unbind();
+		// the connection may be reporting it was lost right now
+		if (shared_ptr<CSMPPClientConnection> conn = Connection()) {
+			conn->Detach();
+		}
+		m_outboxSenders.join_all(); // what they were sending stays in the journal
+		m_workers.reset(); // messages still queued are answered with an error
 	}
 
-	void CreateConnection()
+	/*! \return The io_service of the executor running the client */
+	ioservice_t& IOService()
 	{
+		return m_executor->pimpl->m_ioservice;
+	}
+
+	shared_ptr<CSMPPClientConnection> CreateConnection()
+	{
+		shared_ptr<CSMPPClientConnection> conn;
 #ifdef _MSC_VER
 // you wan'it babe! you wan'it!
-		m_connection.reset(new CSMPPClientConnection(
-				m_threadPool->GetIOService(),
+		conn.reset(new CSMPPClientConnection(
+				IOService(),
 				bind(&impl::OnNewData, this, _1, _2),
 				bind(&impl::OnConnectionLost, this, _1)
 			));
 #else
 // we use make_shared whenever it's possible
-		m_connection = make_shared <
+		conn = make_shared <
 				CSMPPClientConnection,
 				ioservice_t&,
 				CSMPPConnection::NewCommandCallback,
 				CSMPPConnection::ConnectionLostCallback
 			>(
-					m_threadPool->GetIOService(),
+					IOService(),
 					bind(&impl::OnNewData, this, _1, _2),
 					bind(&impl::OnConnectionLost, this, _1)
 			);
 #endif
+		// messages over the limit wait in the socket until the application catches up
+		conn->SetInboundLimits(m_settings.MaxInboundPending, shared_ptr<CInboundLimiter>(), false);
+		conn->SetResponseTimeouts(GetResponseTimeouts());
+		return conn;
+	}
+
+	ResponseTimeouts GetResponseTimeouts() const
+	{
+		ResponseTimeouts timeouts;
+		if (m_settings.ResponseTimeout) {
+			timeouts.defaultTimeout = m_settings.ResponseTimeout * 1000;
+		}
+
+		static const unsigned int submits[] = { SUBMIT_SM, SUBMIT_MULTI, DATA_SM };
+		for (size_t i = 0; i < ARRAY_LEN(submits); i++) {
+			timeouts.commands[submits[i]] = m_settings.SubmitTimeout * 1000;
+		}
+		static const unsigned int binds[] = { BIND_TRANSMITTER, BIND_RECEIVER, BIND_TRANSCEIVER };
+		for (size_t i = 0; i < ARRAY_LEN(binds); i++) {
+			timeouts.commands[binds[i]] = m_settings.BindTimeout * 1000;
+		}
+		timeouts.commands[ENQUIRE_LINK] = m_settings.EnquireLinkTimeout * 1000;
+
+		timeouts.adaptive = m_settings.AdaptiveTimeouts != 0;
+		if (m_settings.MinAdaptiveTimeout) {
+			timeouts.minTimeout = m_settings.MinAdaptiveTimeout;
+		}
+		return timeouts;
 	}
 
  	void OnNewData(SMPPConnectionPtr con, shared_ptr<ISMPPCommand> icmd)
@@ -172,56 +370,162 @@ struct CSMPPClient::impl
 		switch (icmd->request_id())
 		{
 		case DELIVER_SM:
-			{ // Got new message
-				shared_ptr<CSMPPDelivery> cmd = dynamic_pointer_cast<CSMPPDelivery>(icmd);
-
-				string text_in = cmd->getText(), text_out;
-
-				const char* charset_out = "UTF-8";
-				const char* charset_in = CConverter::GetCharsetFromDataCoding(cmd->request().data_coding);
-
-				if (cmd->request().data_coding == 0x08 && m_settings.BigEndianUnicode)
-				{ // ok, this is the case, transform the string before converting it!
-					if (text_in.size() & 1u)
-					{ // log a warning with invalid unicode strings
-						string aux = text_in;
-						for ( unsigned i = 0; i < aux.size(); ++i ) {
-							if ( !aux[i] ) aux[i] = '.';
-						}
-						smpp_log_warning("Received unicode string with odd length: %s", aux.c_str());
-						// insert null in the second-last element
-						text_in.insert(text_in.end()-1, '\0');
-					}
-					for (unsigned i = 0; i < text_in.size(); i += 2)
-					{ // two bytes only, to restore endianness it's enough to swap bytes
-						swap(text_in[i], text_in[i+1]); // i+1 is always valid
-					}
-				}
-
-				CConverter c(charset_in, charset_out);
-				if (0 != c.Convert(text_in, text_out))
-				{
-					smpp_log_error("Failed to convert text [%s] to UTF-8", text_in.c_str());
-					cmd->command_status(ESME_RSYSERR);
-					con->SendResponse(icmd);
-					return;
+		case DATA_SM:
+			{ // answered once the application completes the message
+				shared_ptr<IncomingMessage> message = make_shared<IncomingMessage>(con, icmd);
+				if (m_workers) {
+					m_workers->pimpl->m_ioservice.post(bind(&impl::DispatchIncoming, this, message));
+				} else {
+					DispatchIncoming(message);
 				}
-
-				m_callbacks->OnIncomingMessage(cmd->getSourceAddress(), cmd->getDestinationAddress(), text_out);
 			}
-			icmd->command_status(ESME_ROK);
-			break;
+			return;
 		case ENQUIRE_LINK:
 			icmd->command_status(ESME_ROK);
 			break;
 		default: // reject any unknown command
-			icmd = make_shared<CSMPPGenericNack>(icmd->sequence_number());
+			icmd = make_command<CSMPPGenericNack>(icmd->sequence_number());
 			break;
 		}
 
 		con->SendResponse(icmd);
 	}
 
+	/*! Reports an incoming message, on the workers if there are any */
+	void DispatchIncoming(shared_ptr<IncomingMessage> message)
+	{
+		shared_ptr<ISMPPCommand> icmd = message->Command();
+		if (icmd->request_id() == DATA_SM)
+		{ // interactive traffic, the same as a message
+			DispatchText(message, dynamic_pointer_cast<CSMPPDataSm>(icmd));
+			return;
+		}
+
+		shared_ptr<CSMPPDelivery> cmd = dynamic_pointer_cast<CSMPPDelivery>(icmd);
+		if (m_settings.RequestDeliveryReceipts && cmd->isDeliveryReceipt())
+		{
+			OnDeliveryReceipt(cmd);
+			message->Complete(DELIVERY_OK);
+			return;
+		}
+		DispatchText(message, cmd);
+	}
+
+	/*! Hands the text of a DELIVER_SM or DATA_SM to the application */
+	template <class Command>
+	void DispatchText(shared_ptr<IncomingMessage> message, shared_ptr<Command> cmd)
+	{
+		string text;
+		if (!DecodeText(cmd->request().data_coding, cmd->getText(), text))
+		{
+			message->Complete(DELIVERY_UNKNOWN_ERROR);
+			return;
+		}
+		m_callbacks->OnIncomingMessageAsync(cmd->getSourceAddress(), cmd->getDestinationAddress(), text, message);
+	}
+
+	/*! Converts the text of an incoming message to UTF-8, \c false if it cannot be done */
+	bool DecodeText(uint8_t data_coding, string text_in, string &text_out)
+	{
+		const char* charset_out = "UTF-8";
+		const char* charset_in = CConverter::GetCharsetFromDataCoding(data_coding);
+
+		if (data_coding == 0x08 && m_settings.BigEndianUnicode)
+		{ // ok, this is the case, transform the string before converting it!
+			if (text_in.size() & 1u)
+			{ // log a warning with invalid unicode strings
+				string aux = text_in;
+				for ( unsigned i = 0; i < aux.size(); ++i ) {
+					if ( !aux[i] ) aux[i] = '.';
+				}
+				smpp_log_warning("Received unicode string with odd length: %s", aux.c_str());
+				// insert null in the second-last element
+				text_in.insert(text_in.end()-1, '\0');
+			}
+			for (unsigned i = 0; i < text_in.size(); i += 2)
+			{ // two bytes only, to restore endianness it's enough to swap bytes
+				swap(text_in[i], text_in[i+1]); // i+1 is always valid
+			}
+		}
+
+		CConverter c(charset_in, charset_out);
+		if (0 != c.Convert(text_in, text_out))
+		{
+			smpp_log_error("Failed to convert text [%s] to UTF-8", text_in.c_str());
+			return false;
+		}
+		return true;
+	}
+
+	/*! Reports a receipt along with the context of its message */
+	void OnDeliveryReceipt(shared_ptr<CSMPPDelivery> cmd)
+	{
+		DeliveryReceipt receipt;
+		if (!ReadReceipt(cmd->request(), receipt))
+		{
+			smpp_log_warning("Got a delivery receipt without message id from %s", cmd->getSourceAddress().c_str());
+			return;
+		}
+
+		// the message may still change its state
+		bool final_state = receipt.State != MESSAGE_STATE_ENROUTE && receipt.State != MESSAGE_STATE_ACCEPTED;
+
+		void *context = NULL;
+		m_receipts.Find(receipt.MessageId, context, final_state);
+
+		m_callbacks->OnDeliveryReceipt(receipt, context);
+	}
+
+	/*!
+	 * Fills \p receipt with the fields of a receipt, TLVs take precedence over
+	 * the text, which is parsed in place
+	 * \return \c false if there is no message id
+	 */
+	static bool ReadReceipt(const deliver_sm_t &req, DeliveryReceipt &receipt)
+	{
+		memset(&receipt, 0, sizeof(receipt));
+		// the receipt goes back the way the message came
+		snprintf(receipt.Recipient, sizeof(receipt.Recipient), "%s", (const char *)req.source_addr);
+		snprintf(receipt.Sender, sizeof(receipt.Sender), "%s", (const char *)req.destination_addr);
+
+		const tlv_t *payload = NULL;
+		for (const tlv_t *tlv = req.tlv; tlv; tlv = tlv->next)
+		{
+			if (tlv->tag == TLVID_message_payload) {
+				payload = tlv;
+			}
+		}
+
+		if (req.sm_length) {
+			ParseDeliveryReceipt((const char *)req.short_message, req.sm_length, receipt);
+		} else if (payload) {
+			ParseDeliveryReceipt((const char *)payload->value.octet, payload->length, receipt);
+		}
+
+		for (const tlv_t *tlv = req.tlv; tlv; tlv = tlv->next)
+		{
+			switch (tlv->tag)
+			{
+				case TLVID_receipted_message_id:
+				{
+					size_t length = min((size_t)tlv->length, sizeof(receipt.MessageId) - 1);
+					memcpy(receipt.MessageId, tlv->value.octet, length);
+					receipt.MessageId[length] = '\0';
+					break;
+				}
+				case TLVID_message_state:
+					receipt.State = (MessageState)tlv->value.val08;
+					break;
+				case TLVID_network_error_code:
+					// network type followed by the error code
+					receipt.ErrorCode = (tlv->value.octet[1] << 8) | tlv->value.octet[2];
+					break;
+			}
+		}
+
+		return receipt.MessageId[0] != '\0';
+	}
+
 	void OnConnectionLost(SMPPConnectionPtr)
 	{
 		if (m_isBound == false) {
@@ -232,217 +536,1016 @@ struct CSMPPClient::impl
 
 		Reset();
 		m_callbacks->OnConnectionLost(0);
+
+		if (m_settings.AutoReconnect) {
+			StartReconnect();
+		}
+	}
+
+	/*! Starts connecting and binding again in the background */
+	void StartReconnect()
+	{
+		lock_guard<mutex> lock(m_sessionMutex);
+		if (m_stopped || m_reconnecting || m_isBound) {
+			return; // unbound by the user, or bound again from the callback
+		}
+		m_reconnecting = true;
+		m_reconnectAttempt = 0;
+		ScheduleReconnect();
+	}
+
+	/*!
+	 * Arms the timer for the next attempt, the delay doubles after each one up to
+	 * the maximum and half of it is random, the session lock must be held
+	 */
+	void ScheduleReconnect()
+	{
+		uint64_t delay = (uint64_t)m_settings.ReconnectMinDelay << min(m_reconnectAttempt, 31u);
+		delay = min(delay, (uint64_t)max(m_settings.ReconnectMaxDelay, m_settings.ReconnectMinDelay));
+		delay = delay / 2 + random::uniform_int_distribution<uint64_t>(0, delay / 2)(m_random);
+
+		smpp_log_info("Reconnecting to server %s:%u in %u ms", m_serverIP.c_str(), m_serverPort, (unsigned int)delay);
+
+		m_reconnectTimer.expires_from_now(posix_time::milliseconds(delay));
+		m_reconnectTimer.async_wait(bind(&impl::OnReconnectTimer, this, asio::placeholders::error));
+	}
+
+	void OnReconnectTimer(const boost::system::error_code&)
+	{
+		shared_ptr<CSMPPClientConnection> conn;
+		{
+			mutex::scoped_lock lock(m_sessionMutex);
+			if (m_stopped) {
+				EndReconnect(lock, LOGIN_RESULT_FAIL);
+				return;
+			}
+			conn = m_pendingConnection = CreateConnection();
+		}
+
+		conn->ConnectAsync(m_serverIP, m_serverPort, bind(&impl::OnReconnectConnected, this, conn, _1), m_settings.ConnectTimeout);
+	}
+
+	void OnReconnectConnected(shared_ptr<CSMPPClientConnection> conn, int result)
+	{
+		if (result != 0 || m_stopped)
+		{
+			ReconnectFailed(conn, LOGIN_RESULT_FAIL);
+			return;
+		}
+
+		shared_ptr<ISMPPBind> cmd = CreateBindCommand(conn);
+		conn->SendRequestAsync(cmd->shared_from_this(), bind(&impl::OnReconnectBound, this, conn, _1, _2));
+	}
+
+	void OnReconnectBound(shared_ptr<CSMPPClientConnection> conn, int result, shared_ptr<ISMPPCommand> icmd)
+	{
+		if (result != RESULT_OK || icmd->command_status() != ESME_ROK)
+		{
+			smpp_log_warning("Failed to bind to server %s:%u (%d)", m_serverIP.c_str(), m_serverPort,
+					result != RESULT_OK ? result : icmd->command_status());
+			ReconnectFailed(conn, result != RESULT_OK ? LOGIN_RESULT_FAIL : StatusToLoginResult(icmd->command_status()));
+			return;
+		}
+
+		mutex::scoped_lock lock(m_sessionMutex);
+		m_pendingConnection.reset();
+		if (m_stopped)
+		{ // unbound meanwhile
+			lock.unlock();
+			conn->Close();
+			lock.lock();
+			EndReconnect(lock, LOGIN_RESULT_FAIL);
+			return;
+		}
+
+		m_serverSystemId = dynamic_pointer_cast<ISMPPBind>(icmd)->getResponseSystemId();
+		m_connection = conn;
+		m_isBound = true;
+		m_submitMultiRejected = false; // the session may be with a different SMSC
+
+		if (!m_asyncBind) {
+			smpp_log_info("Bound again to server %s:%u after %u attempts", m_serverIP.c_str(), m_serverPort, m_reconnectAttempt + 1);
+		}
+		EndReconnect(lock, LOGIN_RESULT_OK); // wakes up the messages waiting for the session
+	}
+
+	void ReconnectFailed(shared_ptr<CSMPPClientConnection> conn, LoginResult result)
+	{
+		conn->Close();
+
+		mutex::scoped_lock lock(m_sessionMutex);
+		m_pendingConnection.reset();
+		if (m_stopped || m_asyncBind) {
+			EndReconnect(lock, result);
+			return;
+		}
+		m_reconnectAttempt++;
+		ScheduleReconnect();
+	}
+
+	/*! Marks the end of the attempts to reconnect, the session lock must be held */
+	void EndReconnect()
+	{
+		m_reconnecting = false;
+		m_sessionCondition.notify_all();
+	}
+
+	/*!
+	 * Same as \c EndReconnect, then reports \p result with \c OnReconnected if
+	 * reconnecting succeeded or with \c OnBound if the attempt was a bind
+	 * requested with \c BindAsync, which is not retried. The lock is released.
+	 */
+	void EndReconnect(mutex::scoped_lock& lock, LoginResult result)
+	{
+		// the client may be gone as soon as the lock is released
+		shared_ptr<CESMECallback> callbacks = m_callbacks;
+		bool asyncBind = m_asyncBind;
+		BindCallback callback;
+
+		m_bindCallback.swap(callback);
+		m_asyncBind = false;
+		if (asyncBind && result != LOGIN_RESULT_OK) {
+			m_stopped = true; // there is no session to wait for
+		}
+		EndReconnect();
+		lock.unlock();
+
+		if (asyncBind)
+		{
+			callbacks->OnBound(result);
+			if (callback) {
+				callback(result);
+			}
+		}
+		else if (result == LOGIN_RESULT_OK) {
+			callbacks->OnReconnected();
+		}
+	}
+
+	/*! Cancels the attempts to reconnect, waiting for the one in progress */
+	void StopReconnect()
+	{
+		mutex::scoped_lock lock(m_sessionMutex);
+		m_stopped = true;
+		m_sessionCondition.notify_all();
+
+		boost::system::error_code err;
+		m_reconnectTimer.cancel(err);
+
+		shared_ptr<CSMPPClientConnection> pending = m_pendingConnection;
+		if (pending)
+		{
+			lock.unlock();
+			pending->Close();
+			lock.lock();
+		}
+
+		while (m_reconnecting) {
+			m_sessionCondition.wait(lock);
+		}
+	}
+
+	/*! \return The connection of the current session */
+	shared_ptr<CSMPPClientConnection> Connection()
+	{
+		lock_guard<mutex> lock(m_sessionMutex);
+		return m_connection;
+	}
+
+	/*!
+	 * Waits for a session whose connection is not \p dead, for as long as
+	 * \c MessageSettings::ReconnectWaitTimeout when reconnecting is enabled
+	 * \return The connection of the session, empty if there is none
+	 */
+	shared_ptr<CSMPPClientConnection> WaitForSession(shared_ptr<CSMPPClientConnection> dead = shared_ptr<CSMPPClientConnection>())
+	{
+		mutex::scoped_lock lock(m_sessionMutex);
+		if (m_settings.AutoReconnect)
+		{
+			system_time deadline = get_system_time() + posix_time::milliseconds(m_settings.ReconnectWaitTimeout);
+			while (!m_stopped && !(m_isBound && m_connection != dead))
+			{
+				if (!m_sessionCondition.timed_wait(lock, deadline)) {
+					break;
+				}
+			}
+		}
+		if (m_isBound && m_connection != dead) {
+			return m_connection;
+		}
+		return shared_ptr<CSMPPClientConnection>();
+	}
+
+	/*! \return \c true if a request failed with \p result because \p conn is gone and a new session is on its way */
+	bool SessionLost(shared_ptr<CSMPPClientConnection> conn, int result)
+	{
+		return m_settings.AutoReconnect && (result == RESULT_NETERROR || conn != Connection());
+	}
+
+	shared_ptr<ISMPPBind> CreateBindCommand(shared_ptr<CSMPPClientConnection> conn)
+	{
+		shared_ptr<ISMPPBind> cmd;
+
+		if(m_loginMode == BIND_TYPE_RECEIVER)
+		{
+			cmd = make_command<CBindReceiver>(conn->NextSequenceNumber());
+		}
+		else if (m_loginMode == BIND_TYPE_TRANSMITTER)
+		{
+			cmd = make_command<CBindTransmitter>(conn->NextSequenceNumber());
+		}
+		else
+		{
+			cmd = make_command<CBindTransceiver>(conn->NextSequenceNumber());
+		}
+
+		cmd->setSystemInfo(m_systemId, m_password, m_systemType);
+		cmd->setAddress(m_addressRange, TON_UNKNOWN, NPI_UNKNOWN);
+		return cmd;
+	}
+
+	/*! Gets ready for a bind requested by the user, which takes over any attempt to reconnect */
+	void PrepareBind()
+	{
+		StopReconnect();
+
+		if (m_settings.InboundWorkers && !m_workers) {
+			m_workers = make_shared<CClientExecutor>(m_settings.InboundWorkers);
+		}
+	}
+
+	static LoginResult StatusToLoginResult(int status)
+	{
+		switch (status)
+		{
+			case ESME_ROK:
+				return LOGIN_RESULT_OK;
+			case ESME_RINVSYSID:
+				return LOGIN_RESULT_INVALIDUSR;
+			case ESME_RINVPASWD:
+				return LOGIN_RESULT_INVALIDPWD;
+			case ESME_RINVCMDID:
+				return LOGIN_RESULT_INVALIDCMD;
+			case ESME_RBINDFAIL:
+				return LOGIN_RESULT_FAIL;
+		}
+		smpp_log_error("Uknown bind error: %d", status);
+		return LOGIN_RESULT_FAIL;
 	}
 
 	LoginResult Bind()
 	{
 		int res;
-		shared_ptr<ISMPPBind> cmd;
 
-		CreateConnection();
+		PrepareBind();
+
+		shared_ptr<CSMPPClientConnection> conn = CreateConnection();
 
-		if (0 != m_connection->Connect(m_serverIP, m_serverPort))
+		if (0 != conn->Connect(m_serverIP, m_serverPort))
 		{
 			smpp_log_error("Failed to connect to server %s:%u", m_serverIP.c_str(), m_serverPort);
 			return LOGIN_RESULT_FAIL;
 		}
 
-		if(m_loginMode == BIND_TYPE_RECEIVER)
+		shared_ptr<ISMPPBind> cmd = CreateBindCommand(conn);
+		if(!cmd)
+		{
+			smpp_log_fatal("Out of Memory");
+			return LOGIN_RESULT_FAIL;
+		}
+
+		res = conn->SendRequest(cmd->shared_from_this());
+		if(res != RESULT_OK)
+		{
+			smpp_log_error("Failed to send bind request (%d)", res);
+			return LOGIN_RESULT_FAIL;
+		}
+
+		res = cmd->command_status();
+		if(ESME_ROK == res)
+		{ // done
+			lock_guard<mutex> lock(m_sessionMutex);
+			m_serverSystemId = cmd->getResponseSystemId();
+			m_connection = conn;
+			m_isBound = true;
+			m_submitMultiRejected = false; // the session may be with a different SMSC
+			m_stopped = false;
+			return LOGIN_RESULT_OK;
+		}
+
+		// the connection must be closed if bind fails
+		conn->Close();
+
+		return StatusToLoginResult(res);
+	}
+
+	/*!
+	 * Binds on the client threads, going through the same steps used to reconnect
+	 * but only once, the result is reported with \c OnBound
+	 */
+	void BindAsync(const BindCallback& callback = BindCallback())
+	{
+		PrepareBind();
+
+		lock_guard<mutex> lock(m_sessionMutex);
+		m_stopped = false;
+		m_reconnecting = true;
+		m_asyncBind = true;
+		m_bindCallback = callback;
+		m_reconnectAttempt = 0;
+		IOService().post(bind(&impl::OnReconnectTimer, this, boost::system::error_code()));
+	}
+
+	void Unbind()
+	{
+		StopReconnect();
+
+		if(m_isBound == false)
+		{
+			return;
+		}
+
+		Reset();
+
+		shared_ptr<CSMPPClientConnection> conn = Connection();
+		shared_ptr<CSMPPUnbind> cmd = make_command<CSMPPUnbind>(conn->NextSequenceNumber());
+		conn->SendRequest(cmd->shared_from_this());
+		conn->Close();
+	}
+
+	bool SendKeepAlive()
+	{
+		int res;
+		shared_ptr<CSMPPClientConnection> conn = Connection();
+		shared_ptr<CSMPPEnquireLink> cmd = make_command<CSMPPEnquireLink>(conn->NextSequenceNumber());
+
+		res = conn->SendRequest(cmd->shared_from_this());
+		if ( res == RESULT_OK )
+		{
+			res = cmd->command_status();
+			if ( res == ESME_ROK )
+			{
+				return true;
+			}
+
+			smpp_log_warning("Unexpected response status (%d)", res);
+			return false;
+		}
+		smpp_log_warning("Failed to send ENQUIRE_LINK packet (%d)", res);
+		return false;
+	}
+
+	DeliveryResult HandleMessageResponse( shared_ptr<ISMPPCommand> cmd )
+	{
+		return StatusToDeliveryResult(cmd->command_status());
+	}
+
+	static DeliveryResult StatusToDeliveryResult( int status )
+	{
+		switch(status)
+		{
+			case ESME_ROK:
+				return DELIVERY_OK;
+			case ESME_RINVSRCADR:
+				return DELIVERY_INV_SRC_ADDR;
+			case ESME_RINVDSTADR:
+				return DELIVERY_INV_DEST_ADDR;
+			case ESME_RINVCMDID:
+				return DELIVERY_REJECTED;
+			default:
+				return DELIVERY_UNKNOWN_ERROR;
+		}
+	}
+
+	DeliveryResult SendMessage ( const string &from, const string &to, const string &content, string *messageId, void *context)
+	{
+		return SendSegments<CSMPPSubmitSingle>(from, to, SplitText(EncodeText(content)), messageId, context);
+	}
+
+	DeliveryResult SendDataMessage ( const string &from, const string &to, const string &content, string *messageId, void *context)
+	{
+		return SendSegments<CSMPPDataSm>(from, to, SplitPayload(EncodeText(content)), messageId, context);
+	}
+
+	/*!
+	 * Sends every segment as a \p Command, either SUBMIT_SM or DATA_SM, waiting
+	 * for each response before sending the next one. A segment lost with the
+	 * connection is sent again once the session is back.
+	 * \param status If not NULL, set to the command_status of the segment that failed,
+	 * -1 if it got no response
+	 * \param queued The message when it comes from the outbox, segments sent by a
+	 * previous attempt are skipped and those accepted now are recorded
+	 */
+	template <class Command>
+	DeliveryResult SendSegments ( const string &from, const string &to, const vector<string> &segments, string *messageId,
+			void *context, int *status = NULL, OutboxMessage *queued = NULL)
+	{
+		shared_ptr<CSMPPClientConnection> conn = WaitForSession();
+		if (!conn)
+		{
+			if (status) {
+				*status = -1;
+			}
+			return DELIVERY_UNKNOWN_ERROR;
+		}
+
+		size_t first = 0;
+		unsigned int sar_msg_ref_num = 0;
+		if (queued && queued->segmentsSent && queued->segmentCount == segments.size())
+		{ // the handset joins them by the reference, it must not change
+			first = queued->segmentsSent;
+			sar_msg_ref_num = queued->segmentReference;
+		}
+		else if (segments.size() > 1 && m_settings.EnableMessageConcatenation)
+		{
+			sar_msg_ref_num = conn->NextSequenceNumber();
+		}
+
+		for (size_t i = first; i < segments.size(); i++)
+		{
+			shared_ptr<Command> cmd = CreateSubmit<Command>(conn->NextSequenceNumber(), from, to, segments, i, sar_msg_ref_num);
+
+			int res;
+			int retry = 0;
+			unsigned int replays = 0;
+			for (;;)
+			{
+				res = conn->SendRequest(cmd->shared_from_this());
+				if (res == RESULT_OK) {
+					break;
+				}
+				if (SessionLost(conn, res))
+				{
+					if (replays++ == CLIENT_MAX_REPLAYS || !(conn = WaitForSession(conn))) {
+						break;
+					}
+					// the sequence number belongs to the old connection
+					cmd = CreateSubmit<Command>(conn->NextSequenceNumber(), from, to, segments, i, sar_msg_ref_num);
+					continue;
+				}
+				if (++retry == 3) {
+					break;
+				}
+			}
+
+			if(res != RESULT_OK)
+			{
+				smpp_log_warning("Failed to send message chunk %u: %d", (unsigned int)i, res);
+				if (status) {
+					*status = -1;
+				}
+				return DELIVERY_UNKNOWN_ERROR;
+			}
+
+			DeliveryResult delres = HandleMessageResponse(cmd);
+			if (delres != DELIVERY_OK)
+			{
+				if (status) {
+					*status = cmd->command_status();
+				}
+				return delres;
+			}
+
+			if (messageId && i == 0) {
+				*messageId = cmd->getMessageId();
+			}
+			if (context && m_settings.RequestDeliveryReceipts && cmd->getMessageId().size()) {
+				m_receipts.Track(cmd->getMessageId(), context, m_settings.ReceiptTrackingTTL);
+			}
+
+			if (queued && i + 1 < segments.size())
+			{ // the last one needs no record, the message leaves the outbox
+				if (i == 0) {
+					queued->messageId = cmd->getMessageId();
+				}
+				queued->segmentsSent = (unsigned int)i + 1;
+				queued->segmentCount = (unsigned int)segments.size();
+				queued->segmentReference = sar_msg_ref_num;
+				m_outbox->Progress(*queued);
+			}
+		}
+
+		return DELIVERY_OK;
+	}
+
+	/*! Splits \p text in as many segments as needed to fit in SUBMIT_SM */
+	vector<string> SplitText(const string &text)
+	{
+		vector<string> segments;
+		if (FitsSingleMessage(text))
+		{
+			segments.push_back(text);
+			return segments;
+		}
+
+		unsigned int messageLength = m_settings.EnablePayload ? 1024 : m_settings.MaxMessageLength ? min(m_settings.MaxMessageLength, 254u) : 254;
+		for (size_t i = 0; i < text.length(); i += messageLength) {
+			segments.push_back(text.substr(i, messageLength));
+		}
+		return segments;
+	}
+
+	/*! Splits \p text in as many segments as needed to fit in the message_payload of DATA_SM */
+	vector<string> SplitPayload(const string &text)
+	{
+		vector<string> segments;
+		for (size_t i = 0; i < text.length() || segments.empty(); i += MAX_MESSAGE_LENGTH) {
+			segments.push_back(text.substr(i, MAX_MESSAGE_LENGTH));
+		}
+		return segments;
+	}
+
+	/*!
+	 * Creates the SUBMIT_SM or DATA_SM for the segment \p index of \p segments
+	 * \param sar_msg_ref_num Concatenation reference, 0 when the segments are not concatenated
+	 */
+	template <class Command>
+	shared_ptr<Command> CreateSubmit(unsigned int sequence, const string &from, const string &to,
+			const vector<string> &segments, size_t index, unsigned int sar_msg_ref_num)
+	{
+		shared_ptr<Command> cmd = make_command<Command>(sequence);
+		cmd->setDestination(to);
+		cmd->setSourceAddress(from, TON_UNKNOWN, NPI_UNKNOWN);
+		cmd->setText(segments[index]);
+		cmd->request().data_coding = m_settings.DeliverDataCoding;
+		if (m_settings.RequestDeliveryReceipts)
+		{
+			cmd->request().registered_delivery = REGISTERED_DELIVERY_FINAL;
+		}
+		SetPriority(*cmd, m_settings.PriorityFlag);
+		if (sar_msg_ref_num)
+		{
+			cmd->setConcatenatedMessageArgs((int)segments.size(), sar_msg_ref_num, (int)index + 1);
+		}
+		return cmd;
+	}
+
+	static void SetPriority(CSMPPSubmitSingle &cmd, unsigned char priority)
+	{
+		cmd.setPriority(priority);
+	}
+
+	static void SetPriority(CSMPPDataSm &, unsigned char)
+	{
+		// DATA_SM has no priority_flag, it always goes in the bulk lane
+	}
+
+	DeliveryResult SendMessageMulti ( const string &from, const vector<string> &to, const string &content, vector<DeliveryResult> *results)
+	{
+		vector<DeliveryResult> res(to.size(), DELIVERY_UNKNOWN_ERROR);
+
+		if (WaitForSession())
+		{
+			string text = EncodeText(content);
+
+			if (!FitsSingleMessage(text))
+			{ // has to be split, the segments of every recipient go through the window
+				SendPipelined<CSMPPSubmitSingle>(from, to, 0, SplitText(text), res);
+			}
+			else
+			{
+				size_t first = 0;
+				if (m_settings.EnableSubmitMulti && !m_submitMultiRejected)
+				{
+					while (first < to.size() && SendSubmitMulti(from, to, first, text, res)) {
+						first += MAX_MULTI_DESTINATIONS;
+					}
+				}
+				if (first < to.size())
+				{ // the SMSC does not like SUBMIT_MULTI
+					SendPipelined<CSMPPSubmitSingle>(from, to, first, vector<string>(1, text), res);
+				}
+			}
+		}
+
+		if (results) {
+			*results = res;
+		}
+
+		for (size_t i = 0; i < res.size(); i++)
 		{
-			cmd = make_shared<CBindReceiver>(m_connection->NextSequenceNumber());
+			if (res[i] != DELIVERY_OK) {
+				return res[i];
+			}
 		}
-		else if (m_loginMode == BIND_TYPE_TRANSMITTER)
+		return DELIVERY_OK;
+	}
+
+	DeliveryResult SendDataMessageMulti ( const string &from, const vector<string> &to, const string &content, vector<DeliveryResult> *results)
+	{
+		vector<DeliveryResult> res(to.size(), DELIVERY_UNKNOWN_ERROR);
+
+		if (WaitForSession())
 		{
-			cmd = make_shared<CBindTransmitter>(m_connection->NextSequenceNumber());
+			SendPipelined<CSMPPDataSm>(from, to, 0, SplitPayload(EncodeText(content)), res);
 		}
-		else
-		{
-			cmd = make_shared<CBindTransceiver>(m_connection->NextSequenceNumber());
+
+		if (results) {
+			*results = res;
 		}
 
-		if(!cmd)
+		for (size_t i = 0; i < res.size(); i++)
 		{
-			smpp_log_fatal("Out of Memory");
-			return LOGIN_RESULT_FAIL;
+			if (res[i] != DELIVERY_OK) {
+				return res[i];
+			}
 		}
+		return DELIVERY_OK;
+	}
 
-		cmd->setSystemInfo(m_systemId, m_password, m_systemType);
-		cmd->setAddress(m_addressRange, TON_UNKNOWN, NPI_UNKNOWN);
+	/*!
+	 * Sends a SUBMIT_MULTI to the recipients starting at \p first
+	 * \return \c false if the SMSC does not support it, nothing is sent in that case
+	 */
+	bool SendSubmitMulti(const string &from, const vector<string> &to, size_t first, const string &text, vector<DeliveryResult> &res)
+	{
+		size_t count = min(MAX_MULTI_DESTINATIONS, to.size() - first);
+		vector<string> destinations(to.begin() + first, to.begin() + first + count);
 
-		res = m_connection->SendRequest(cmd->shared_from_this());
-		if(res != RESULT_OK)
-		{
-			smpp_log_error("Failed to send bind request (%d)", res);
-			return LOGIN_RESULT_FAIL;
-		}
+		shared_ptr<CSMPPClientConnection> conn = Connection();
+		shared_ptr<CSMPPSubmitMulti> cmd = CreateSubmitMulti(conn, from, destinations, text);
 
-		res = cmd->command_status();
-		if(ESME_ROK == res)
-		{ // done
-			m_isBound = true;
-			m_serverSystemId = cmd->getResponseSystemId();
-			return LOGIN_RESULT_OK;
+		int result = conn->SendRequest(cmd->shared_from_this());
+		for (unsigned int replays = 0; result != RESULT_OK && replays < CLIENT_MAX_REPLAYS && SessionLost(conn, result); replays++)
+		{ // lost with the connection, the whole request goes again
+			if (!(conn = WaitForSession(conn))) {
+				break;
+			}
+			cmd = CreateSubmitMulti(conn, from, destinations, text);
+			result = conn->SendRequest(cmd->shared_from_this());
 		}
 
-		// the connection must be closed if bind fails
-		m_connection->Close();
+		if (result != RESULT_OK)
+		{ // a response that cannot be read may still mean the message was accepted, it's not sent again
+			smpp_log_warning("Failed to send message to %u recipients (%d)", (unsigned int)count, result);
+			fill(res.begin() + first, res.begin() + first + count, DELIVERY_UNKNOWN_ERROR);
+			return true;
+		}
 
-		if(ESME_RINVSYSID == res) {
-			return LOGIN_RESULT_INVALIDUSR;
+		int status = cmd->command_status();
+		if (status == ESME_RINVCMDID)
+		{ // a GENERIC_NACK or the SMSC says so, don't try again with this session
+			smpp_log_warning("The SMSC does not support SUBMIT_MULTI, sending SUBMIT_SM instead");
+			m_submitMultiRejected = true;
+			return false;
 		}
-		if(ESME_RINVPASWD == res) {
-			return LOGIN_RESULT_INVALIDPWD;
+
+		if (status != ESME_ROK)
+		{ // the whole request failed
+			smpp_log_warning("Failed to send message to %u recipients: %d", (unsigned int)count, status);
+			fill(res.begin() + first, res.begin() + first + count, StatusToDeliveryResult(status));
+			return true;
 		}
-		if(ESME_RINVCMDID == res) {
-			return LOGIN_RESULT_INVALIDCMD;
+
+		map<string, int> failures;
+		vector<pair<string, int> > failed = cmd->getFailures();
+		for (size_t i = 0; i < failed.size(); i++) {
+			failures[failed[i].first] = failed[i].second;
 		}
-		if(ESME_RBINDFAIL != res) {
-			smpp_log_error("Uknown bind error: %d", res);
+
+		for (size_t i = first; i < first + count; i++)
+		{
+			map<string, int>::const_iterator it = failures.find(to[i]);
+			res[i] = (it == failures.end()) ? DELIVERY_OK : StatusToDeliveryResult(it->second);
 		}
-		return LOGIN_RESULT_FAIL;
+
+		return true;
 	}
 
-	void Unbind()
+	shared_ptr<CSMPPSubmitMulti> CreateSubmitMulti(shared_ptr<CSMPPClientConnection> conn, const string &from, const vector<string> &destinations, const string &text)
 	{
-		if(m_isBound == false)
+		shared_ptr<CSMPPSubmitMulti> cmd = make_command<CSMPPSubmitMulti>(conn->NextSequenceNumber());
+		cmd->setDestinations(destinations);
+		cmd->setSourceAddress(from, TON_UNKNOWN, NPI_UNKNOWN);
+		cmd->setText(text);
+		cmd->request().data_coding = m_settings.DeliverDataCoding;
+		cmd->setPriority(m_settings.PriorityFlag);
+		return cmd;
+	}
+
+	/*! Keeps track of the SUBMIT_SM sent without waiting for their responses */
+	struct SubmitWindow
+	{
+		mutex          lock;
+		condition      done;
+		unsigned int   outstanding;
+		bool           replay;  /*!< Whether requests lost with the connection are sent again */
+		vector<size_t> lost;    /*!< Recipients with a request lost with the connection */
+
+		SubmitWindow(bool replay)
+			: outstanding(0), replay(replay)
+		{ }
+
+		/*! Waits until there is room for another request */
+		void Acquire()
 		{
-			return;
+			mutex::scoped_lock l(lock);
+			while (outstanding >= CLIENT_SUBMIT_WINDOW) {
+				done.wait(l);
+			}
+			outstanding++;
 		}
 
-		Reset();
-
-		shared_ptr<CSMPPUnbind> cmd = make_shared<CSMPPUnbind>(m_connection->NextSequenceNumber());
-		m_connection->SendRequest(cmd->shared_from_this());
-		m_connection->Close();
-	}
+		/*! Waits for every response */
+		void Wait()
+		{
+			mutex::scoped_lock l(lock);
+			while (outstanding > 0) {
+				done.wait(l);
+			}
+		}
 
-	bool SendKeepAlive()
+		/*! \return The recipients lost with the connection, once each, after \c Wait */
+		vector<size_t> Lost()
+		{
+			sort(lost.begin(), lost.end());
+			lost.erase(unique(lost.begin(), lost.end()), lost.end());
+			return lost;
+		}
+	};
+
+	/*!
+	 * Sends a SUBMIT_SM or DATA_SM per segment to each recipient starting at \p first
+	 * without waiting for the previous responses, a recipient lost with the connection
+	 * gets all of its segments again
+	 */
+	template <class Command>
+	void SendPipelined(const string &from, const vector<string> &to, size_t first, const vector<string> &segments, vector<DeliveryResult> &res)
 	{
-		int res;
-		shared_ptr<CSMPPEnquireLink> cmd = make_shared<CSMPPEnquireLink>(m_connection->NextSequenceNumber());
+		bool concatenate = segments.size() > 1 && m_settings.EnableMessageConcatenation;
+		fill(res.begin() + first, res.end(), DELIVERY_OK);
 
-		res = m_connection->SendRequest(cmd->shared_from_this());
-		if ( res == RESULT_OK )
+		vector<size_t> pending;
+		for (size_t i = first; i < to.size(); i++) {
+			pending.push_back(i);
+		}
+
+		shared_ptr<CSMPPClientConnection> conn = Connection();
+		for (unsigned int replays = 0; ; replays++)
 		{
-			res = cmd->command_status();
-			if ( res == ESME_ROK )
+			SubmitWindow window(m_settings.AutoReconnect != 0);
+
+			for (size_t k = 0; k < pending.size(); k++)
 			{
-				return true;
+				size_t i = pending[k];
+				// every recipient is a message of its own, with its own reference
+				unsigned int sar_msg_ref_num = concatenate ? conn->NextSequenceNumber() : 0;
+				for (size_t j = 0; j < segments.size(); j++)
+				{
+					shared_ptr<Command> cmd = CreateSubmit<Command>(conn->NextSequenceNumber(), from, to[i], segments, j, sar_msg_ref_num);
+
+					window.Acquire();
+					conn->SendRequestAsync(cmd->shared_from_this(),
+							bind(&impl::OnPipelinedResponse, boost::ref(window), boost::ref(res), i, _1, _2)
+						);
+				}
 			}
 
-			smpp_log_warning("Unexpected response status (%d)", res);
-			return false;
+			window.Wait();
+
+			if (!ReplayLost(window, conn, replays, res, pending)) {
+				break;
+			}
 		}
-		smpp_log_warning("Failed to send ENQUIRE_LINK packet (%d)", res);
-		return false;
 	}
 
-	DeliveryResult HandleMessageResponse( shared_ptr<CSMPPSubmitSingle> cmd )
+	/*!
+	 * Decides whether the recipients lost with the connection are sent again
+	 * \param conn Replaced by the connection of the new session
+	 * \param pending Set to the recipients to send again
+	 * \return \c false if there is nothing to send again, the lost recipients fail in that case
+	 */
+	bool ReplayLost(SubmitWindow &window, shared_ptr<CSMPPClientConnection> &conn, unsigned int replays,
+			vector<DeliveryResult> &res, vector<size_t> &pending)
 	{
-		int status = cmd->command_status();
-		switch(status)
+		pending.clear();
+		vector<size_t> lost = window.Lost();
+		for (size_t k = 0; k < lost.size(); k++)
+		{ // those with a failed segment are not worth it
+			if (res[lost[k]] == DELIVERY_OK) {
+				pending.push_back(lost[k]);
+			}
+		}
+		if (pending.empty()) {
+			return false;
+		}
+
+		if (replays == CLIENT_MAX_REPLAYS || !(conn = WaitForSession(conn)))
 		{
-			case ESME_ROK:
-				return DELIVERY_OK;
-			case ESME_RINVSRCADR:
-				return DELIVERY_INV_SRC_ADDR;
-			case ESME_RINVDSTADR:
-				return DELIVERY_INV_DEST_ADDR;
-			case ESME_RINVCMDID:
-				return DELIVERY_REJECTED;
-			default:
-				return DELIVERY_UNKNOWN_ERROR;
+			smpp_log_warning("Failed to send %u messages lost with the connection", (unsigned int)pending.size());
+			for (size_t k = 0; k < pending.size(); k++) {
+				res[pending[k]] = DELIVERY_UNKNOWN_ERROR;
+			}
+			return false;
 		}
+
+		smpp_log_info("Sending %u messages lost with the connection again", (unsigned int)pending.size());
+		return true;
 	}
 
-	DeliveryResult SendMessage ( const string &from, const string &to, const string &content)
+	/*!
+	 * Updates the result of a recipient, which stays \c DELIVERY_OK until
+	 * one of its segments fails
+	 */
+	static void OnPipelinedResponse(SubmitWindow &window, vector<DeliveryResult> &res, size_t index, int result, shared_ptr<ISMPPCommand> cmd)
 	{
-		if (m_isBound == false)
-		{
-			return DELIVERY_UNKNOWN_ERROR;
+		DeliveryResult dr = (result == RESULT_OK) ? StatusToDeliveryResult(cmd->command_status()) : DELIVERY_UNKNOWN_ERROR;
+
+		lock_guard<mutex> lock(window.lock);
+		if (result == RESULT_NETERROR && window.replay) {
+			window.lost.push_back(index);
+		} else if (res[index] == DELIVERY_OK) {
+			res[index] = dr;
 		}
+		window.outstanding--;
+		window.done.notify_all();
+	}
 
-		string text;
-		const char *encoding = CConverter::GetCharsetFromDataCoding(m_settings.DeliverDataCoding ? m_settings.DeliverDataCoding : m_settings.ServerDefaultEncoding);
-		CConverter converter("UTF-8", encoding);
-		converter.Convert(content, text);
+	shared_ptr<CPreparedMessage> PrepareMessage(const string &from, const string &content)
+	{
+		shared_ptr<CPreparedMessage> message(new CPreparedMessage());
 
-		shared_ptr<CSMPPSubmitSingle> cmd;
+		vector<string> segments = SplitText(EncodeText(content));
 
-		if (text.length() <= MAX_MESSAGE_LENGTH &&
-			( m_settings.EnablePayload || text.length() <= (m_settings.MaxMessageLength?min(m_settings.MaxMessageLength, 254u):254) ))
-		{
-			cmd = make_shared<CSMPPSubmitSingle>(m_connection->NextSequenceNumber());
-			cmd->setDestination(to);
-			cmd->setSourceAddress(from, TON_UNKNOWN, NPI_UNKNOWN);
-			cmd->setText(text);
-			cmd->request().data_coding = m_settings.DeliverDataCoding;
+		// the sequence number and the reference are written for each copy,
+		// these are placeholders libsmpp34 accepts
+		unsigned int sar_msg_ref_num = (segments.size() > 1 && m_settings.EnableMessageConcatenation) ? 1 : 0;
 
-			int res;
-			int retry = 0;
-			do {
-				res = m_connection->SendRequest(cmd->shared_from_this());
-			}
-			while (res != RESULT_OK && ++retry<3);
+		for (size_t i = 0; i < segments.size(); i++)
+		{
+			shared_ptr<CSMPPSubmitSingle> cmd = CreateSubmit<CSMPPSubmitSingle>(1, from, "", segments, i, sar_msg_ref_num);
 
-			if(res != RESULT_OK)
+			CPreparedMessage::impl::Segment segment;
+			if (!PackTemplate(cmd, segment))
 			{
-				smpp_log_warning("Failed to send message: %d", res);
-				return DELIVERY_UNKNOWN_ERROR;
+				smpp_log_error("Failed to pack segment %u of the prepared message", (unsigned int)i);
+				return shared_ptr<CPreparedMessage>();
 			}
-
-			return HandleMessageResponse(cmd);
+			message->pimpl->segments.push_back(segment);
 		}
 
-		// at this point the message is too long
+		return message;
+	}
 
-		unsigned int sar_msg_ref_num = 0;
-		unsigned int sar_total_segments = 0;
-		unsigned int sar_segment_seqnum = 0;
-		unsigned int messageLength = m_settings.EnablePayload ? 1024 : m_settings.MaxMessageLength ? min(m_settings.MaxMessageLength, 254u) : 254;
+	/*!
+	 * Packs \p cmd, which has an empty destination address, and splits the PDU
+	 * around it, so a copy is just \c head + address + \c tail
+	 */
+	static bool PackTemplate(shared_ptr<CSMPPSubmitSingle> cmd, CPreparedMessage::impl::Segment &segment)
+	{
+		int err;
+		vector<char> buffer(2048);
+		unsigned int len = cmd->pack_request(&buffer[0], buffer.size(), err);
+		if (err != 0) {
+			return false;
+		}
 
-		if (m_settings.EnableMessageConcatenation)
-		{
-			sar_msg_ref_num = m_connection->NextSequenceNumber();
-			sar_total_segments = (text.length()/messageLength) + (text.length()%messageLength ? 1:0);
+		const submit_sm_t &req = cmd->request();
+		size_t pos = SMPP_HEADER_SIZE
+				+ strlen((const char *)req.service_type) + 1 + 2
+				+ strlen((const char *)req.source_addr) + 1 + 2;
+
+		segment.head.assign(&buffer[0], pos);
+		segment.tail.assign(&buffer[pos + 1], len - pos - 1); // skips the address terminator
+		segment.sarOffset = string::npos;
+
+		// esm_class, protocol_id, priority_flag, schedule_delivery_time, validity_period,
+		// registered_delivery, replace_if_present_flag, data_coding, sm_default_msg_id
+		size_t tpos = 3;
+		tpos += strlen(segment.tail.c_str() + tpos) + 1;
+		tpos += strlen(segment.tail.c_str() + tpos) + 1;
+		tpos += 4;
+		tpos += 1 + (unsigned char)segment.tail[tpos]; // sm_length and short_message
+
+		while (tpos + 4 <= segment.tail.size())
+		{ // look for the concatenation reference among the TLVs
+			unsigned int tag = ReadUInt16(&segment.tail[tpos]);
+			unsigned int length = ReadUInt16(&segment.tail[tpos + 2]);
+			if (tag == TLVID_sar_msg_ref_num && length == 2) {
+				segment.sarOffset = tpos + 4;
+				break;
+			}
+			tpos += 4 + length;
 		}
 
-		for (unsigned int i = 0; i < text.length(); i += messageLength)
+		return true;
+	}
+
+	DeliveryResult SendPreparedMessage(const CPreparedMessage &message, const vector<string> &to, vector<DeliveryResult> *results)
+	{
+		vector<DeliveryResult> res(to.size(), DELIVERY_UNKNOWN_ERROR);
+		const vector<CPreparedMessage::impl::Segment> &segments = message.pimpl->segments;
+
+		shared_ptr<CSMPPClientConnection> conn = WaitForSession();
+		if (conn)
 		{
-			if(text.length()-i < messageLength) {
-				messageLength = text.length() - i;
-			}
-			shared_ptr<CSMPPSubmitSingle> cmd = make_shared<CSMPPSubmitSingle>(m_connection->NextSequenceNumber());
-			cmd->setDestination(to);
-			cmd->setSourceAddress(from, TON_UNKNOWN, NPI_UNKNOWN);
-			cmd->setText( text.substr(i, messageLength) );
-			cmd->request().data_coding = m_settings.DeliverDataCoding;
-			if (m_settings.EnableMessageConcatenation)
+			vector<size_t> pending;
+			for (size_t i = 0; i < to.size(); i++)
 			{
-				cmd->setConcatenatedMessageArgs(sar_total_segments, sar_msg_ref_num, ++sar_segment_seqnum);
+				if (to[i].size() >= sizeof(((submit_sm_t *)0)->destination_addr))
+				{
+					res[i] = DELIVERY_INV_DEST_ADDR;
+					continue;
+				}
+				res[i] = DELIVERY_OK;
+				pending.push_back(i);
 			}
 
-			int res;
-			int retry = 0;
-			do {
-				res = m_connection->SendRequest(cmd->shared_from_this());
+			string pdu;
+			for (unsigned int replays = 0; ; replays++)
+			{
+				SubmitWindow window(m_settings.AutoReconnect != 0);
+
+				for (size_t k = 0; k < pending.size(); k++) {
+					SendPreparedCopy(conn, segments, to, pending[k], pdu, window, res);
+				}
+
+				window.Wait();
+
+				if (!ReplayLost(window, conn, replays, res, pending)) {
+					break;
+				}
 			}
-			while (res != RESULT_OK && ++retry<3);
+		}
 
-			if(res != RESULT_OK)
-			{
-				smpp_log_warning("Failed to send message chunk %d: %d", i, res);
-				return DELIVERY_UNKNOWN_ERROR;
+		if (results) {
+			*results = res;
+		}
+
+		for (size_t i = 0; i < res.size(); i++)
+		{
+			if (res[i] != DELIVERY_OK) {
+				return res[i];
 			}
+		}
+		return DELIVERY_OK;
+	}
 
-			DeliveryResult delres = HandleMessageResponse(cmd);
-			if (delres != DELIVERY_OK)
-			{
-				return delres;
+	/*! Sends every segment of a prepared message to the recipient \p index, \p pdu is a scratch buffer */
+	void SendPreparedCopy(shared_ptr<CSMPPClientConnection> conn, const vector<CPreparedMessage::impl::Segment> &segments,
+			const vector<string> &to, size_t index, string &pdu, SubmitWindow &window, vector<DeliveryResult> &res)
+	{
+		const string &address = to[index];
+		unsigned int sar_msg_ref_num = segments.size() > 1 ? conn->NextSequenceNumber() : 0;
+
+		for (size_t j = 0; j < segments.size(); j++)
+		{
+			const CPreparedMessage::impl::Segment &segment = segments[j];
+			unsigned int sequence = conn->NextSequenceNumber();
+
+			pdu.assign(segment.head);
+			pdu.append(address.c_str(), address.size() + 1);
+			pdu.append(segment.tail);
+
+			WriteUInt32(&pdu[0], (unsigned int)pdu.size());
+			WriteUInt32(&pdu[12], sequence);
+			if (segment.sarOffset != string::npos) {
+				WriteUInt16(&pdu[segment.head.size() + address.size() + 1 + segment.sarOffset], sar_msg_ref_num & 0xFFFF);
 			}
+
+			// priority_flag follows esm_class and protocol_id
+			window.Acquire();
+			conn->SendPackedRequestAsync(make_command<CSMPPSubmitSingle>(sequence), pdu,
+					bind(&impl::OnPipelinedResponse, boost::ref(window), boost::ref(res), index, _1, _2),
+					0, segment.tail[2] ? LANE_PRIORITY : LANE_BULK
+				);
 		}
+	}
 
-		return DELIVERY_OK;
+	static unsigned int ReadUInt16(const char *buffer)
+	{
+		return ((unsigned char)buffer[0] << 8) | (unsigned char)buffer[1];
+	}
+
+	static void WriteUInt16(char *buffer, unsigned int value)
+	{
+		buffer[0] = (char)(value >> 8);
+		buffer[1] = (char)value;
+	}
+
+	static void WriteUInt32(char *buffer, unsigned int value)
+	{
+		buffer[0] = (char)(value >> 24);
+		buffer[1] = (char)(value >> 16);
+		buffer[2] = (char)(value >> 8);
+		buffer[3] = (char)value;
+	}
+
+	/*! Converts \p content from UTF-8 to the encoding set in the message settings */
+	string EncodeText(const string &content)
+	{
+		string text;
+		const char *encoding = CConverter::GetCharsetFromDataCoding(m_settings.DeliverDataCoding ? m_settings.DeliverDataCoding : m_settings.ServerDefaultEncoding);
+		CConverter converter("UTF-8", encoding);
+		converter.Convert(content, text);
+		return text;
+	}
+
+	/*! \return \c true if \p text can be sent in a single message */
+	bool FitsSingleMessage(const string &text)
+	{
+		return text.length() <= MAX_MESSAGE_LENGTH &&
+			( m_settings.EnablePayload || text.length() <= (m_settings.MaxMessageLength?min(m_settings.MaxMessageLength, 254u):254) );
 	}
 
 	void Reset()
@@ -454,9 +1557,86 @@ struct CSMPPClient::impl
 	void SetMessageSettings(const MessageSettings &ms)
 	{
 		memcpy(&m_settings, &ms, sizeof(MessageSettings));
+
+		if (m_settings.OutboxJournalPath) {
+			OpenOutbox(m_settings.OutboxJournalPath);
+		}
+		m_settings.OutboxJournalPath = NULL; // not ours
+
+		// the session in course takes the new timeouts too
+		mutex::scoped_lock lock(m_sessionMutex);
+		if (m_connection) {
+			m_connection->SetResponseTimeouts(GetResponseTimeouts());
+		}
+	}
+
+	/*! Opens the outbox, unless it's open already, and starts sending what was left in it */
+	void OpenOutbox(const string &path)
+	{
+		lock_guard<mutex> lock(m_outboxMutex);
+		if (m_outbox) {
+			return;
+		}
+
+		scoped_ptr<COutbox> outbox(new COutbox());
+		if (!outbox->Open(path))
+		{
+			smpp_log_error("Failed to open outbox %s, messages will not be queued", path.c_str());
+			return;
+		}
+		m_outbox.swap(outbox);
+
+		for (unsigned int i = 0; i < std::max(m_settings.OutboxDrainWindow, 1u); i++) {
+			m_outboxSenders.create_thread(bind(&impl::SendOutbox, this));
+		}
+	}
+
+	DeliveryResult QueueMessage(const string &from, const string &to, const string &content, const string &reference)
+	{
+		COutbox *outbox;
+		{
+			lock_guard<mutex> lock(m_outboxMutex);
+			outbox = m_outbox.get();
+		}
+
+		if (!outbox)
+		{
+			smpp_log_warning("There is no outbox to queue the message to %s", to.c_str());
+			return DELIVERY_UNKNOWN_ERROR;
+		}
+		return outbox->Push(from, to, content, reference) ? DELIVERY_QUEUED : DELIVERY_UNKNOWN_ERROR;
+	}
+
+	/*! Runs on each outbox sender thread until the client is destroyed */
+	void SendOutbox()
+	{
+		OutboxMessage msg;
+		while (m_outbox->Pop(msg))
+		{
+			string messageId = msg.messageId;
+			int status = ESME_ROK;
+			DeliveryResult result = SendSegments<CSMPPSubmitSingle>(msg.from, msg.to, SplitText(EncodeText(msg.text)),
+					&messageId, NULL, &status, &msg);
+			if (status == -1 || status == ESME_RTHROTTLED || status == ESME_RMSGQFUL)
+			{ // not bound, unanswered or throttled, it's not the message's fault
+				m_outbox->Retry(msg, OUTBOX_RETRY_DELAY);
+				continue;
+			}
+
+			m_outbox->Done(msg);
+			m_callbacks->OnQueuedMessageSent(msg.reference, result, messageId);
+		}
 	}
 
 	volatile bool                      m_isBound;
+	volatile bool                      m_submitMultiRejected;
+	volatile bool                      m_stopped;            /*!< Not bound by the user, there is no session to wait for */
+	bool                               m_reconnecting;       /*!< An attempt to reconnect is scheduled or in progress */
+	bool                               m_asyncBind;          /*!< The attempt in progress was requested with \c BindAsync */
+	BindCallback                       m_bindCallback;       /*!< Invoked once the bind requested with \c BindAsync completes */
+	unsigned int                       m_reconnectAttempt;
+	mutex                              m_sessionMutex;       /*!< Guards the connection and the state of the reconnection */
+	condition                          m_sessionCondition;   /*!< Signaled when the session is back or reconnecting ends */
 	shared_ptr<CESMECallback>          m_callbacks;
 	string                             m_serverIP;
 	unsigned short                     m_serverPort;
@@ -467,14 +1647,23 @@ struct CSMPPClient::impl
 	std::string                        m_addressRange;
 	std::string                        m_serverSystemId;
 	MessageSettings                    m_settings;
+	CReceiptTracker                    m_receipts;
+	shared_ptr<CClientExecutor>        m_executor;           /*!< Outlives the connections, which use its io_service */
+	shared_ptr<CClientExecutor>        m_workers;            /*!< Runs the callbacks of incoming messages, if set */
+	asio::deadline_timer               m_reconnectTimer;
 	shared_ptr<CSMPPClientConnection>  m_connection;
-	shared_ptr<ClientThread>           m_threadPool;
+	shared_ptr<CSMPPClientConnection>  m_pendingConnection;  /*!< The connection being established to reconnect */
+	random::mt19937                    m_random;
+	scoped_ptr<COutbox>                m_outbox;             /*!< Messages queued with \c QueueMessage, if enabled */
+	mutex                              m_outboxMutex;
+	thread_group                       m_outboxSenders;
 };
 
 
 
-CSMPPClient::CSMPPClient(shared_ptr<CESMECallback> callbacks, const std::string &ip, unsigned short port, BindType mode)
-: pimpl(new impl(callbacks, ip, port, mode))
+CSMPPClient::CSMPPClient(shared_ptr<CESMECallback> callbacks, const std::string &ip, unsigned short port, BindType mode,
+ shared_ptr<CClientExecutor> executor)
+: pimpl(new impl(callbacks, ip, port, mode, executor))
 {
 
 }
@@ -493,6 +1682,9 @@ unsigned short CSMPPClient::GetServerPort() const {
 BindType CSMPPClient::GetBindMode() const {
 	return pimpl->m_loginMode;
 }
+shared_ptr<CClientExecutor> CSMPPClient::GetExecutor() const {
+	return pimpl->m_executor;
+}
 std::string CSMPPClient::GetSystemId() const {
 	return pimpl->m_systemId;
 }
@@ -508,6 +1700,9 @@ std::string CSMPPClient::GetAddressRange() const {
 bool CSMPPClient::IsBound() const {
 	return pimpl->m_isBound;
 }
+shared_ptr<CESMECallback> CSMPPClient::GetCallbacks() const {
+	return pimpl->m_callbacks;
+}
 std::string CSMPPClient::GetServerSystemId() const {
 	return pimpl->m_serverSystemId;
 }
@@ -546,6 +1741,74 @@ LoginResult CSMPPClient::Bind()
 	return pimpl->Bind();
 }
 
+void CSMPPClient::BindAsync()
+{
+	pimpl->BindAsync();
+}
+
+/*! Keeps \c CSMPPClient::BindAll going, each bind that completes starts the next one */
+class BindAllState
+	: public enable_shared_from_this<BindAllState>
+{
+public:
+
+	BindAllState(const vector<CSMPPClient*>& clients)
+	 : m_clients(clients)
+	 , m_results(clients.size(), LOGIN_RESULT_FAIL)
+	 , m_next(0)
+	 , m_running(0)
+	 , m_bound(0)
+	{ }
+
+	/*! Starts binding the next client, the lock must be held */
+	void StartNext()
+	{
+		size_t index = m_next++;
+		m_running++;
+		m_clients[index]->pimpl->BindAsync(bind(&BindAllState::OnBound, shared_from_this(), index, _1));
+	}
+
+	void OnBound(size_t index, LoginResult result)
+	{
+		lock_guard<mutex> lock(m_mutex);
+		m_results[index] = result;
+		m_running--;
+		if (result == LOGIN_RESULT_OK) {
+			m_bound++;
+		}
+		if (m_next < m_clients.size()) {
+			StartNext();
+		}
+		m_condition.notify_all();
+	}
+
+	vector<CSMPPClient*>  m_clients;
+	vector<LoginResult>   m_results;
+	size_t                m_next;
+	size_t                m_running;
+	unsigned int          m_bound;
+	mutex                 m_mutex;
+	condition             m_condition;
+};
+
+unsigned int CSMPPClient::BindAll(const vector<CSMPPClient*>& clients, unsigned int parallelism, vector<LoginResult> *results)
+{
+	shared_ptr<BindAllState> state = make_shared<BindAllState>(clients);
+
+	mutex::scoped_lock lock(state->m_mutex);
+	while (state->m_next < clients.size() && (parallelism == 0 || state->m_running < parallelism)) {
+		state->StartNext();
+	}
+	while (state->m_running > 0 || state->m_next < clients.size()) {
+		state->m_condition.wait(lock);
+	}
+
+	if (results) {
+		*results = state->m_results;
+	}
+	return state->m_bound;
+}
+
 void CSMPPClient::Unbind()
 {
 	pimpl->Unbind();
@@ -558,12 +1821,47 @@ bool CSMPPClient::SendKeepAlive()
 
 DeliveryResult CSMPPClient::SendMessage ( const string &from, const string &to, const string &content)
 {
-	return pimpl->SendMessage(from, to, content);
+	return pimpl->SendMessage(from, to, content, NULL, NULL);
+}
+
+DeliveryResult CSMPPClient::SendMessage ( const string &from, const string &to, const string &content, string *messageId, void *context)
+{
+	return pimpl->SendMessage(from, to, content, messageId, context);
+}
+
+DeliveryResult CSMPPClient::QueueMessage ( const string &from, const string &to, const string &content, const string &reference)
+{
+	return pimpl->QueueMessage(from, to, content, reference);
+}
+
+DeliveryResult CSMPPClient::SendMessageMulti ( const string &from, const vector<string> &to, const string &content, vector<DeliveryResult> *results)
+{
+	return pimpl->SendMessageMulti(from, to, content, results);
+}
+
+DeliveryResult CSMPPClient::SendDataMessage ( const string &from, const string &to, const string &content, string *messageId, void *context)
+{
+	return pimpl->SendDataMessage(from, to, content, messageId, context);
+}
+
+DeliveryResult CSMPPClient::SendDataMessageMulti ( const string &from, const vector<string> &to, const string &content, vector<DeliveryResult> *results)
+{
+	return pimpl->SendDataMessageMulti(from, to, content, results);
+}
+
+shared_ptr<CPreparedMessage> CSMPPClient::PrepareMessage ( const string &from, const string &content)
+{
+	return pimpl->PrepareMessage(from, content);
+}
+
+DeliveryResult CSMPPClient::SendPreparedMessage ( const CPreparedMessage &message, const vector<string> &to, vector<DeliveryResult> *results)
+{
+	return pimpl->SendPreparedMessage(message, to, results);
 }
 
 void CSMPPClient::SetClientThreads(unsigned int count)
 {
-	ClientThread::GetInstance()->SetThreads(count);
+	DefaultExecutors::SetCount(count);
 }
 
 } // namespace opensmpp
@@ -9,6 +9,7 @@
 #include "libsmpp34/smpp34.h"
 #include "libsmpp34/smpp34_structs.h"
 #include "libsmpp34/smpp34_params.h"
+#include "commandpool.hpp"
 
 #if _MSC_VER > 1000
 #pragma warning(push)	// disable for this header only
@@ -17,6 +18,8 @@
 #endif
 
 #include <boost/enable_shared_from_this.hpp>
+#include <boost/make_shared.hpp>
+#include <cstddef>
 #include <string>
 #include <vector>
 #include <sstream>
@@ -26,6 +29,31 @@
 namespace opensmpp
 {
 
+/*!
+ * Zeroes a PDU, the bytes of short_message are left alone because they are
+ * only ever read up to sm_length. It is the largest field by far and it would
+ * be cleared for every command created.
+ */
+template <typename pdu_t>
+inline void clear_pdu(pdu_t& pdu)
+{
+	memset(&pdu, 0, sizeof(pdu));
+}
+
+template <typename pdu_t>
+inline void clear_pdu_but_text(pdu_t& pdu)
+{
+	const size_t text = offsetof(pdu_t, short_message);
+	const size_t rest = text + sizeof(pdu.short_message);
+	memset(&pdu, 0, text);
+	memset((char *)&pdu + rest, 0, sizeof(pdu) - rest);
+}
+
+inline void clear_pdu(submit_sm_t& pdu)    { clear_pdu_but_text(pdu); }
+inline void clear_pdu(submit_multi_t& pdu) { clear_pdu_but_text(pdu); }
+inline void clear_pdu(deliver_sm_t& pdu)   { clear_pdu_but_text(pdu); }
+inline void clear_pdu(replace_sm_t& pdu)   { clear_pdu_but_text(pdu); }
+
 class ISMPPCommand : public boost::enable_shared_from_this<ISMPPCommand>
 {
 public:
@@ -50,6 +78,8 @@ public:
 	virtual int unpack_request(const char *buffer, int bufferLen, int &err) = 0;
 	virtual int unpack_response(const char *buffer, int bufferLen) = 0;
 	virtual int unpack_response(const char *buffer, int bufferLen, int &err) = 0;
+	// priority_flag of the request, commands without one are never urgent
+	virtual int priority() const { return 0; }
 
 	virtual ~ISMPPCommand(){}
 };
@@ -61,8 +91,12 @@ public:
 
 	CSMPPCommand(int commandId, int sequence_number)
 	{
-		memset(&_request, 0, sizeof(_request));
-		memset(&_response, 0, sizeof(_response));
+		// the rest must be cleared for every command, libsmpp34 packs each
+		// field as a string and unpacks the TLV and address lists onto the
+		// heads left in the struct. Without short_message it's a few hundred
+		// bytes at most, less than tracking which fields each command wrote.
+		clear_pdu(_request);
+		clear_pdu(_response);
 		_request.command_id  = commandId;
 		_response.command_id = commandId | SMPP_RESPONSE_BIT;
 		_request.sequence_number  = sequence_number;
@@ -181,7 +215,7 @@ public:
 	int unpack_request(const char *buffer, int bufferLen, int &err)
 	{
 		unsigned int command_id = _request.command_id;
-		err = smpp34_unpack(command_id, &_request, (uint8_t *)buffer, bufferLen);
+		err = smpp34_unpack_alloc(command_id, &_request, (uint8_t *)buffer, bufferLen, &CDecodeArena::Allocate, &_arena);
 		if(!err && _request.command_id != command_id)
 		{
 			std::swap((unsigned int&)_request.command_id, command_id);
@@ -211,7 +245,7 @@ public:
 	int unpack_response(const char *buffer, int bufferLen, int &err)
 	{
 		unsigned int command_id = _response.command_id;
-		err = smpp34_unpack(command_id, &_response, (uint8_t *)buffer, bufferLen);
+		err = smpp34_unpack_alloc(command_id, &_response, (uint8_t *)buffer, bufferLen, &CDecodeArena::Allocate, &_arena);
 		if(!err && _response.command_id != command_id)
 		{
 			std::swap((unsigned int&)_response.command_id, command_id);
@@ -224,6 +258,7 @@ public:
 protected:
 	request_t  _request;
 	response_t _response;
+	CDecodeArena _arena;  // TLVs and addresses decoded into the structs above
 };
 
 /************************************************************************/
@@ -342,7 +377,7 @@ public:
 	{
 		if(this->_request.tlv)
 		{
-			destroy_tlv(this->_request.tlv);
+			destroy_tlv(this->_arena.HeapNodes(this->_request.tlv));
 			this->_request.tlv = NULL;
 		}
 	}
@@ -374,6 +409,18 @@ public:
 		return std::string((char*)this->_request.source_addr);
 	}
 
+	std::string getMessageId() const
+	{
+		return (char *)this->_response.message_id;
+	}
+
+	void setMessageId(const std::string& messageId)
+	{
+		size_t bytesToCopy = std::min(sizeof(this->_response.message_id) - 1, messageId.size());
+		memcpy(this->_response.message_id, messageId.data(), bytesToCopy);
+		this->_response.message_id[bytesToCopy] = 0;
+	}
+
 	TypeOfNumber getSourceAddressTON() const
 	{
 		return (TypeOfNumber)this->_request.source_addr_ton;
@@ -391,6 +438,16 @@ public:
 		this->_request.source_addr_npi = npi;
 	}
 
+	int priority() const
+	{
+		return this->_request.priority_flag;
+	}
+
+	void setPriority(int priority)
+	{
+		this->_request.priority_flag = priority;
+	}
+
 	void setServiceType(const std::string& serviceType)
 	{
 		snprintf((char *)this->_request.service_type, ARRAY_LEN(this->_request.service_type), "%s", serviceType.c_str());
@@ -477,7 +534,8 @@ public:
 	{
 		dad_t dad;
 		if(this->_request.dest_addr_def) {
-			destroy_dad(this->_request.dest_addr_def);
+			destroy_dad(this->_arena.HeapNodes(this->_request.dest_addr_def));
+			this->_request.dest_addr_def = NULL;
 		}
 
 		for(unsigned int i = destinations.size(); i > 0; i--)
@@ -493,6 +551,77 @@ public:
 		this->_request.number_of_dests = (uint8_t)destinations.size();
 	}
 
+	/*! \return The SME addresses of the request, distribution lists are left out */
+	std::vector<std::string> getDestinations() const
+	{
+		std::vector<std::string> res;
+		for (dad_t *dad = this->_request.dest_addr_def; dad; dad = dad->next)
+		{
+			if (dad->dest_flag == DEST_FLAG_SME) {
+				res.push_back( std::string((char*)dad->value.sme.destination_addr) );
+			}
+		}
+		return res;
+	}
+
+	/*! \return The distribution list names of the request */
+	std::vector<std::string> getDistributionLists() const
+	{
+		std::vector<std::string> res;
+		for (dad_t *dad = this->_request.dest_addr_def; dad; dad = dad->next)
+		{
+			if (dad->dest_flag != DEST_FLAG_SME) {
+				res.push_back( std::string((char*)dad->value.dl_name) );
+			}
+		}
+		return res;
+	}
+
+	/*!
+	 * \brief Fills the unsuccess_smes of the response
+	 * \param failed Pairs of address and error status, TON and NPI are taken from the request
+	 */
+	void setFailedAddresses(const std::vector<std::pair<std::string, int> > &failed)
+	{
+		udad_t udad;
+		if(this->_response.unsuccess_smes) {
+			destroy_udad(this->_arena.HeapNodes(this->_response.unsuccess_smes));
+			this->_response.unsuccess_smes = NULL;
+		}
+
+		for(unsigned int i = failed.size(); i > 0; i--)
+		{ // build_udad() inserts at the beginning of the list
+			const std::string &address = failed[i-1].first;
+			size_t bytesToCopy = std::min(address.size(), sizeof(udad.destination_addr) - 1);
+
+			memset(&udad, 0, sizeof(udad));
+			memcpy(udad.destination_addr, &address[0], bytesToCopy);
+			udad.error_status_code = failed[i-1].second;
+			for (dad_t *dad = this->_request.dest_addr_def; dad; dad = dad->next)
+			{
+				if (dad->dest_flag == DEST_FLAG_SME && address == (char*)dad->value.sme.destination_addr)
+				{
+					udad.dest_addr_ton = dad->value.sme.dest_addr_ton;
+					udad.dest_addr_npi = dad->value.sme.dest_addr_npi;
+					break;
+				}
+			}
+			build_udad(&this->_response.unsuccess_smes, &udad);
+		}
+		this->_response.no_unsuccess = (uint8_t)failed.size();
+	}
+
+	/*! \return Pairs of address and error status from the unsuccess_smes of the response */
+	std::vector<std::pair<std::string, int> > getFailures() const
+	{
+		std::vector<std::pair<std::string, int> > res;
+		for (udad_t *udad = this->_response.unsuccess_smes; udad && this->_response.no_unsuccess > 0; udad = udad->next)
+		{
+			res.push_back( std::make_pair(std::string((char*)udad->destination_addr), (int)udad->error_status_code) );
+		}
+		return res;
+	}
+
 	std::vector<std::string> getFailedAddresses() const
 	{
 		std::vector<std::string> res;
@@ -512,11 +641,11 @@ public:
 	{
 		if(this->_request.dest_addr_def)
 		{
-			destroy_dad(this->_request.dest_addr_def);
+			destroy_dad(this->_arena.HeapNodes(this->_request.dest_addr_def));
 		}
 		if(this->_response.unsuccess_smes)
 		{
-			destroy_udad(this->_response.unsuccess_smes);
+			destroy_udad(this->_arena.HeapNodes(this->_response.unsuccess_smes));
 		}
 	}
 };
@@ -529,6 +658,38 @@ public:
 		: CSMPPSubmit<deliver_sm_t, deliver_sm_resp_t>(DELIVER_SM, sequence_number)
 	{ }
 
+	/*! \return \c true if the SMSC says this is a delivery receipt */
+	bool isDeliveryReceipt() const
+	{
+		return (this->_request.esm_class & ESM_CLASS_TYPE_MASK) == ESM_CLASS_DELIVERY_RECEIPT;
+	}
+
+	/*! \brief Makes this a delivery receipt for \p messageId, the text has to be set apart */
+	void setReceiptArgs(const std::string& messageId, int state, unsigned int errorCode)
+	{
+		this->_request.esm_class = ESM_CLASS_DELIVERY_RECEIPT;
+
+		tlv_t tlv;
+		memset(&tlv, 0, sizeof(tlv));
+		tlv.tag = TLVID_receipted_message_id;
+		tlv.length = (uint16_t)std::min(messageId.size() + 1, (size_t)65);
+		memcpy(tlv.value.octet, messageId.data(), tlv.length - 1);
+		build_tlv(&(this->_request.tlv), &tlv);
+
+		BUILD_TLV(TLVID_message_state, val08, state);
+
+		if (errorCode)
+		{ // GSM network type followed by the error code
+			memset(&tlv, 0, sizeof(tlv));
+			tlv.tag = TLVID_network_error_code;
+			tlv.length = 3;
+			tlv.value.octet[0] = 3;
+			tlv.value.octet[1] = (uint8_t)(errorCode >> 8);
+			tlv.value.octet[2] = (uint8_t)errorCode;
+			build_tlv(&(this->_request.tlv), &tlv);
+		}
+	}
+
 	std::string getDestinationAddress() const
 	{
 		return (char *)this->_request.destination_addr;
@@ -545,6 +706,183 @@ public:
 };
 
 
+/************************************************************************/
+/*!
+ * DATA_SM carries its text in the message_payload TLV only, its accessors
+ * mirror the ones of \c CSMPPSubmit so both can be created the same way
+ */
+class CSMPPDataSm : public CSMPPCommand<data_sm_t, data_sm_resp_t>
+{
+public:
+	CSMPPDataSm(int sequence_number)
+		: CSMPPCommand<data_sm_t, data_sm_resp_t>(DATA_SM, sequence_number)
+	{ }
+
+	virtual ~CSMPPDataSm()
+	{
+		if(this->_request.tlv)
+		{
+			destroy_tlv(this->_arena.HeapNodes(this->_request.tlv));
+			this->_request.tlv = NULL;
+		}
+	}
+
+	std::string getText() const
+	{
+		std::string res;
+		for (tlv_t *tlv = this->_request.tlv; tlv; tlv = tlv->next)
+		{
+			if (tlv->tag == TLVID_message_payload)
+			{
+				res.resize(tlv->length);
+				memcpy(&res[0], tlv->value.octet, tlv->length);
+			}
+		}
+		return res;
+	}
+
+	void setText(const std::string &text)
+	{
+		tlv_t tlv;
+		memset(&tlv, 0, sizeof(tlv));
+		tlv.tag = TLVID_message_payload;
+		tlv.length = std::min(sizeof(tlv.value.octet), text.size());
+		memcpy(tlv.value.octet, text.data(), tlv.length);
+		build_tlv(&(this->_request.tlv), &tlv);
+	}
+
+	void setConcatenatedMessageArgs(int total_segments, int msg_ref_num, int segment_seqnum)
+	{
+		BUILD_TLV(TLVID_sar_total_segments,    val08, total_segments);
+		BUILD_TLV(TLVID_sar_msg_ref_num,       val16, msg_ref_num);
+		BUILD_TLV(TLVID_sar_segment_seqnum,    val08, segment_seqnum);
+		BUILD_TLV(TLVID_more_messages_to_send, val08, (total_segments > segment_seqnum ? 1: 0));
+	}
+
+	std::string getSourceAddress() const
+	{
+		return (char *)this->_request.source_addr;
+	}
+
+	void setSourceAddress(const std::string& address, TypeOfNumber ton, NumberingPlanIndicator npi)
+	{
+		snprintf((char *)this->_request.source_addr, ARRAY_LEN(this->_request.source_addr), "%s", address.c_str());
+		this->_request.source_addr_ton = ton;
+		this->_request.source_addr_npi = npi;
+	}
+
+	std::string getDestinationAddress() const
+	{
+		return (char *)this->_request.destination_addr;
+	}
+
+	void setDestination(const std::string &address, TypeOfNumber ton = TON_UNKNOWN,
+			NumberingPlanIndicator npi = NPI_UNKNOWN)
+	{
+		snprintf((char *)this->_request.destination_addr, ARRAY_LEN(this->_request.destination_addr), "%s", address.c_str());
+		this->_request.dest_addr_ton = ton;
+		this->_request.dest_addr_npi = npi;
+	}
+
+	std::string getMessageId() const
+	{
+		return (char *)this->_response.message_id;
+	}
+
+	void setMessageId(const std::string& messageId)
+	{
+		snprintf((char *)this->_response.message_id, ARRAY_LEN(this->_response.message_id), "%s", messageId.c_str());
+	}
+};
+
+/************************************************************************/
+class CSMPPQuery : public CSMPPCommand<query_sm_t, query_sm_resp_t>
+{
+public:
+	CSMPPQuery(int sequence_number)
+		: CSMPPCommand<query_sm_t, query_sm_resp_t>(QUERY_SM, sequence_number)
+	{ }
+
+	std::string getMessageId() const
+	{
+		return (char *)this->_request.message_id;
+	}
+
+	std::string getSourceAddress() const
+	{
+		return (char *)this->_request.source_addr;
+	}
+
+	/*! \param finalDate Empty while the message has not reached a final state */
+	void setResult(const std::string& finalDate, int state, unsigned int errorCode)
+	{
+		snprintf((char *)this->_response.message_id, ARRAY_LEN(this->_response.message_id), "%s", (char *)this->_request.message_id);
+		snprintf((char *)this->_response.final_date, ARRAY_LEN(this->_response.final_date), "%s", finalDate.c_str());
+		this->_response.message_state = (uint8_t)state;
+		this->_response.error_code = (uint8_t)std::min(errorCode, 0xFFu);
+	}
+};
+
+/************************************************************************/
+class CSMPPCancel : public CSMPPCommand<cancel_sm_t, cancel_sm_resp_t>
+{
+public:
+	CSMPPCancel(int sequence_number)
+		: CSMPPCommand<cancel_sm_t, cancel_sm_resp_t>(CANCEL_SM, sequence_number)
+	{ }
+
+	std::string getMessageId() const
+	{
+		return (char *)this->_request.message_id;
+	}
+
+	std::string getSourceAddress() const
+	{
+		return (char *)this->_request.source_addr;
+	}
+
+	std::string getDestinationAddress() const
+	{
+		return (char *)this->_request.destination_addr;
+	}
+};
+
+/************************************************************************/
+class CSMPPReplace : public CSMPPCommand<replace_sm_t, replace_sm_resp_t>
+{
+public:
+	CSMPPReplace(int sequence_number)
+		: CSMPPCommand<replace_sm_t, replace_sm_resp_t>(REPLACE_SM, sequence_number)
+	{ }
+
+	std::string getMessageId() const
+	{
+		return (char *)this->_request.message_id;
+	}
+
+	std::string getSourceAddress() const
+	{
+		return (char *)this->_request.source_addr;
+	}
+
+	std::string getText() const
+	{
+		return std::string((char *)this->_request.short_message, this->_request.sm_length);
+	}
+};
+
+/************************************************************************/
+/*!
+ * Creates a command in a block taken from the pool of the calling thread, the
+ * block goes back to a pool when the last reference is gone. Commands are
+ * created for every PDU so this is how they should always be created.
+ */
+template <class command_t>
+inline boost::shared_ptr<command_t> make_command(int sequence_number)
+{
+	return boost::allocate_shared<command_t>(CPoolAllocator<command_t>(), sequence_number);
+}
+
 /************************************************************************/
 /************************************************************************/
 template <typename request_t, typename response_t>
@@ -6,6 +6,7 @@
 
 #include "smppconnection.hpp"
 #include "smppcommands.hpp"
+#include "pduview.hpp"
 #include "logger.h"
 #include <boost/lexical_cast.hpp>
 #include <boost/make_shared.hpp>
@@ -56,6 +57,17 @@
 #define RESPONSE_TIMEOUT ((unsigned int)40)
 #endif
 
+// adaptive response timeouts (in milliseconds) are never shorter than this by default
+#ifndef MIN_ADAPTIVE_TIMEOUT
+#define MIN_ADAPTIVE_TIMEOUT ((unsigned int)1000)
+#endif
+
+// the least an adaptive timeout allows for the round trip time to vary, in milliseconds
+#define RTT_CLOCK_GRANULARITY   10u
+
+// times an adaptive timeout is doubled at most after consecutive timeouts
+#define MAX_TIMEOUT_BACKOFF     6u
+
 // defines a range for initial randomized sequence numbers
 #ifndef SEQ_NUM_INITIAL_RANGE
 #define SEQ_NUM_INITIAL_RANGE   0x00004000
@@ -71,12 +83,100 @@ using namespace boost;
 namespace opensmpp
 {
 
+/*!
+ * Requests carrying messages, these are the ones answered with
+ * ESME_RTHROTTLED when the inbound limits are exceeded
+ */
+static bool IsMessageRequest(unsigned int commandId)
+{
+	switch (commandId)
+	{
+	case SUBMIT_SM:
+	case SUBMIT_MULTI:
+	case DELIVER_SM:
+	case DATA_SM:
+	case REPLACE_SM:
+		return true;
+	default:
+		return false;
+	}
+}
+
+CInboundLimiter::CInboundLimiter(unsigned int limit)
+: m_limit(limit), m_count(0), m_waiting(false)
+{
+}
+
+void CInboundLimiter::Acquire()
+{
+	m_count.fetch_add(1, memory_order_relaxed);
+}
+
+void CInboundLimiter::Release(unsigned int count)
+{
+	m_count.fetch_sub(count, memory_order_relaxed);
+	if (m_waiting.load(memory_order_acquire) && !IsSaturated()) {
+		ResumeAll();
+	}
+}
+
+bool CInboundLimiter::IsSaturated() const
+{
+	return m_limit && m_count.load(memory_order_relaxed) >= m_limit;
+}
+
+void CInboundLimiter::Enqueue(SMPPConnectionPtr conn)
+{
+	{
+		lock_guard<mutex> lock(m_mutex);
+		m_paused.push_back(conn);
+		m_waiting.store(true, memory_order_release);
+	}
+	if (!IsSaturated())
+	{ // requests were released meanwhile
+		ResumeAll();
+	}
+}
+
+void CInboundLimiter::ResumeAll()
+{
+	vector<weak_ptr<CSMPPConnection> > paused;
+	{
+		lock_guard<mutex> lock(m_mutex);
+		paused.swap(m_paused);
+		m_waiting.store(false, memory_order_release);
+	}
+	for (size_t i = 0; i < paused.size(); i++)
+	{
+		if (SMPPConnectionPtr conn = paused[i].lock()) {
+			conn->ResumeReading();
+		}
+	}
+}
+
+
+ResponseTimeouts::ResponseTimeouts()
+ : defaultTimeout(RESPONSE_TIMEOUT * 1000)
+ , adaptive(false)
+ , minTimeout(MIN_ADAPTIVE_TIMEOUT)
+{ }
+
+unsigned int ResponseTimeouts::Of(unsigned int commandId) const
+{
+	std::map<unsigned int, unsigned int>::const_iterator it = commands.find(commandId);
+	return it != commands.end() && it->second ? it->second : defaultTimeout;
+}
+
 
 CSMPPConnection::CSMPPConnection(unsigned int connectionId, ioservice_t &ioservice,
  const NewCommandCallback& onNewData, const ConnectionLostCallback& onConnectionLost)
 : m_connectionId(connectionId), m_nextSequenceNumber(INITIAL_SEQ_NUMBER()),
-  m_connectionError(false), m_closeRequested(false), m_ioservice(ioservice), m_socket(m_ioservice),
-  m_onNewDataEvent(onNewData), m_onConnectionLostEvent(onConnectionLost)
+  m_connectionError(false), m_closeRequested(false), m_inboundPending(0), m_inboundLimit(0),
+  m_inboundThrottle(false), m_readPaused(false), m_ioservice(ioservice), m_socket(m_ioservice),
+  m_closeTimer(m_ioservice),
+  m_onNewDataEvent(onNewData), m_onConnectionLostEvent(onConnectionLost), m_detached(false),
+  m_priorityStreak(0), m_writing(false), m_shutdownAfterWrite(false),
+  m_rttMeasured(false), m_srtt(0), m_rttvar(0), m_timeoutBackoff(0)
 {
 	SMPP_TRACE();
 }
@@ -92,6 +192,11 @@ socket_t& CSMPPConnection::socket()
 	return m_socket;
 }
 
+ioservice_t& CSMPPConnection::ioservice()
+{
+	return m_ioservice;
+}
+
 unsigned int CSMPPConnection::GetConnectionId() const
 {
 	return m_connectionId;
@@ -121,12 +226,69 @@ void CSMPPConnection::Close()
 
 	smpp_log_profile("Connection %u: Closing socket", m_connectionId);
 	m_closeRequested = true;
-	if(m_socket.is_open()) {
-		boost::system::error_code err;
-		m_socket.close(err);
+	boost::system::error_code err;
+	m_closeTimer.cancel(err);
+	{
+		mutex::scoped_lock wlock(m_writeMutex);
+		if (m_writing)
+		{ // waiting for it could take forever, the peer may not be reading
+			InterruptWriter();
+			WaitForWriter(wlock);
+		}
+		m_shutdownAfterWrite = false;
+		if(m_socket.is_open()) {
+			m_socket.close(err);
+		}
 	}
 	m_connectionError = false;
+	FailAsyncRequests(RESULT_NETERROR);
 	m_pendingResponses.clear();
+
+	// unanswered requests do not count anymore
+	if (m_globalLimiter && m_inboundPending) {
+		m_globalLimiter->Release(m_inboundPending);
+	}
+	m_inboundPending = 0;
+	m_readPaused = false;
+}
+
+void CSMPPConnection::CloseDeferred(unsigned int delay)
+{
+	lock_guard<recursive_mutex> lock(m_mutex);
+	if (m_closeRequested) {
+		return;
+	}
+
+	smpp_log_profile("Connection %u: Closing socket in %u ms", m_connectionId, delay);
+
+	// the peer gets the FIN right after the last response, a well behaved
+	// ESME closes its side and the pending read completes before the timer
+	boost::system::error_code err;
+	{
+		mutex::scoped_lock wlock(m_writeMutex);
+		if (m_writing)
+		{ // not waiting for it, the timer closes the socket if the write does not end
+			m_shutdownAfterWrite = true;
+		}
+		else
+		{
+			m_socket.shutdown(socket_t::shutdown_send, err);
+		}
+	}
+
+	m_closeTimer.expires_from_now(posix_time::milliseconds(delay));
+	m_closeTimer.async_wait(
+			bind(&CSMPPConnection::CloseTimerHandler, shared_from_this(), asio::placeholders::error)
+		);
+}
+
+void CSMPPConnection::CloseTimerHandler(const boost::system::error_code& error)
+{
+	if (error == asio::error::operation_aborted)
+	{ // cancelled by Close()
+		return;
+	}
+	Close();
 }
 
 void CSMPPConnection::ReadAsync()
@@ -137,31 +299,135 @@ void CSMPPConnection::ReadAsync()
 		);
 }
 
+void CSMPPConnection::SetInboundLimits(unsigned int limit, shared_ptr<CInboundLimiter> global, bool throttle)
+{
+	lock_guard<recursive_mutex> lock(m_mutex);
+	m_inboundLimit = limit;
+	m_globalLimiter = global;
+	m_inboundThrottle = throttle;
+}
+
+void CSMPPConnection::SetInboundFilter(const InboundFilter& filter)
+{
+	lock_guard<recursive_mutex> lock(m_mutex);
+	m_inboundFilter = filter;
+}
+
+void CSMPPConnection::Detach()
+{
+	unique_lock<shared_mutex> lock(m_callbackMutex);
+	m_detached = true;
+}
+
+bool CSMPPConnection::IsInboundSaturated() const
+{
+	return (m_inboundLimit && m_inboundPending >= m_inboundLimit)
+		|| (m_globalLimiter && m_globalLimiter->IsSaturated());
+}
+
+bool CSMPPConnection::IsWaitingResponses() const
+{
+	// answered synchronous requests stay until their caller wakes up
+	for (MapPendingResponse::const_iterator it = m_pendingResponses.begin(); it != m_pendingResponses.end(); ++it)
+	{
+		if (!it->second.answered) {
+			return true;
+		}
+	}
+	return false;
+}
+
+void CSMPPConnection::PauseReading()
+{
+	smpp_log_debug("Connection %u: Too many requests being processed (%u), pausing reads", m_connectionId, m_inboundPending);
+	m_readPaused = true;
+	if (m_globalLimiter && m_globalLimiter->IsSaturated())
+	{ // otherwise our own responses will resume reading
+		m_globalLimiter->Enqueue(shared_from_this());
+	}
+}
+
+void CSMPPConnection::ResumeReading()
+{
+	// may be invoked from any thread, reads are issued from the connection's io_service
+	m_ioservice.post(bind(&CSMPPConnection::ResumeReadingHandler, shared_from_this()));
+}
+
+void CSMPPConnection::ResumeReadingHandler()
+{
+	lock_guard<recursive_mutex> lock(m_mutex);
+	if (!m_readPaused || m_closeRequested) {
+		return;
+	}
+	if (IsInboundSaturated())
+	{ // someone else took the room
+		if (m_globalLimiter && m_globalLimiter->IsSaturated()) {
+			m_globalLimiter->Enqueue(shared_from_this());
+		}
+		return;
+	}
+	smpp_log_debug("Connection %u: Resuming reads", m_connectionId);
+	m_readPaused = false;
+	ReadAsync();
+}
+
 int CSMPPConnection::SendRequest(shared_ptr<ISMPPCommand> cmd)
 {
 	SMPP_TRACE();
 
 	recursive_mutex::scoped_lock lock(m_mutex);
 
-	int res = SendPDU(cmd, false);
-	if(res != RESULT_OK)
-	{
-		smpp_log_warning("Connection %u: Failed to send PDU of type %#X", m_connectionId, cmd->request_id());
-		return res;
+	if (m_readPaused)
+	{ // the response has to be read, requests coming meanwhile will be throttled
+		m_readPaused = false;
+		ReadAsync();
 	}
 
-	PendingResponse respdata = {cmd, new condition()};
+	// registered first, the response may come before the write returns
+	PendingResponse respdata(cmd, new condition());
 	m_pendingResponses[cmd->sequence_number()] = respdata;
+	unsigned int timeout = GetResponseTimeout(cmd->request_id());
+
+	lock.unlock();
+	int res = SendPDU(cmd, false);
+	lock.lock();
 
-	bool timed_out = !respdata.condition->timed_wait(lock, posix_time::seconds(RESPONSE_TIMEOUT));
+	bool timed_out = false;
+	system_time deadline = respdata.sent + posix_time::milliseconds(timeout);
+	MapPendingResponse::iterator it;
+	while (res == RESULT_OK)
+	{
+		it = m_pendingResponses.find(cmd->sequence_number());
+		if (it == m_pendingResponses.end() || it->second.answered || m_connectionError) {
+			break; // answered, or the connection is gone
+		}
+		if (!respdata.condition->timed_wait(lock, deadline)) {
+			timed_out = true;
+			break;
+		}
+	}
 
-	m_pendingResponses.erase(cmd->sequence_number());
+	// the peer may close the connection right after answering (e.g. a rejected bind)
+	it = m_pendingResponses.find(cmd->sequence_number());
+	bool answered = it != m_pendingResponses.end() && it->second.answered;
+	if (it != m_pendingResponses.end()) {
+		m_pendingResponses.erase(it);
+	}
 	delete respdata.condition;
 
-	if(timed_out) {
+	if(res != RESULT_OK)
+	{
+		smpp_log_warning("Connection %u: Failed to send PDU of type %#X", m_connectionId, cmd->request_id());
+		return res;
+	}
+
+	if(timed_out && !answered)
+	{
+		m_timeoutBackoff = std::min(m_timeoutBackoff + 1, MAX_TIMEOUT_BACKOFF);
 		return RESULT_TIMEOUT;
 	}
-	if(m_connectionError) {
+	// closing the connection clears the error and forgets the pending responses
+	if((m_connectionError || (m_closeRequested && -1 == cmd->command_status())) && !answered) {
 		return RESULT_NETERROR;
 	}
 	if(-1 == cmd->command_status()) {
@@ -170,20 +436,196 @@ int CSMPPConnection::SendRequest(shared_ptr<ISMPPCommand> cmd)
 	return RESULT_OK;
 }
 
+void CSMPPConnection::SendRequestAsync(shared_ptr<ISMPPCommand> cmd, const ResponseCallback& callback, unsigned int timeout)
+{
+	SMPP_TRACE();
+
+	{ // registered first, the response may come before the write returns
+		lock_guard<recursive_mutex> lock(m_mutex);
+		AddAsyncRequest(cmd, callback, timeout);
+	}
+
+	int res = SendPDU(cmd, false);
+	if(res != RESULT_OK) {
+		AbortAsyncRequest(cmd, res);
+	}
+}
+
+void CSMPPConnection::SendPackedRequestAsync(shared_ptr<ISMPPCommand> cmd, const string& pdu, const ResponseCallback& callback,
+ unsigned int timeout, OutboundLane lane)
+{
+	SMPP_TRACE();
+
+	{
+		lock_guard<recursive_mutex> lock(m_mutex);
+		AddAsyncRequest(cmd, callback, timeout);
+	}
+
+	DUMP_SMPP_BUFFER(m_connectionId, "Sending PDU", pdu.data(), pdu.size());
+	int res = WritePDU(pdu.data(), pdu.size(), lane);
+	if(res != RESULT_OK) {
+		AbortAsyncRequest(cmd, res);
+	}
+}
+
+void CSMPPConnection::AddAsyncRequest(shared_ptr<ISMPPCommand> cmd, const ResponseCallback& callback, unsigned int timeout)
+{
+	if (m_readPaused)
+	{ // the response has to be read, requests coming meanwhile will be throttled
+		m_readPaused = false;
+		ReadAsync();
+	}
+
+	PendingResponse &respdata = m_pendingResponses[cmd->sequence_number()];
+	respdata.command = cmd;
+	respdata.condition = NULL;
+	respdata.answered = false;
+	respdata.callback = callback;
+	respdata.sent = get_system_time();
+	respdata.timer.reset(new asio::deadline_timer(m_ioservice));
+	respdata.timer->expires_from_now(posix_time::milliseconds(timeout ? timeout * 1000 : GetResponseTimeout(cmd->request_id())));
+	respdata.timer->async_wait(
+			bind(&CSMPPConnection::ResponseTimeoutHandler, shared_from_this(), cmd->sequence_number(), asio::placeholders::error)
+		);
+}
+
+void CSMPPConnection::ResponseTimeoutHandler(unsigned int seqNumber, const boost::system::error_code& error)
+{
+	if (error == asio::error::operation_aborted)
+	{ // the response has come
+		return;
+	}
+
+	recursive_mutex::scoped_lock lock(m_mutex);
+
+	MapPendingResponse::iterator it = m_pendingResponses.find(seqNumber);
+	if (it == m_pendingResponses.end() || it->second.condition || it->second.answered) {
+		return;
+	}
+
+	ResponseCallback callback = it->second.callback;
+	shared_ptr<ISMPPCommand> cmd = it->second.command;
+	m_pendingResponses.erase(it);
+	m_timeoutBackoff = std::min(m_timeoutBackoff + 1, MAX_TIMEOUT_BACKOFF);
+	lock.unlock();
+
+	smpp_log_warning("Connection %u: Request %u of type %#X timed out", m_connectionId, seqNumber, cmd->request_id());
+	callback(RESULT_TIMEOUT, cmd);
+}
+
+void CSMPPConnection::FailAsyncRequests(int result)
+{
+	MapPendingResponse::iterator it = m_pendingResponses.begin();
+	while (it != m_pendingResponses.end())
+	{
+		if (it->second.condition || it->second.answered) {
+			++it;
+			continue;
+		}
+		boost::system::error_code err;
+		it->second.timer->cancel(err);
+		it->second.command->command_status(-1);
+		// the lock is held, callbacks must not run here
+		m_ioservice.post(bind(it->second.callback, result, it->second.command));
+		m_pendingResponses.erase(it++);
+	}
+}
+
+void CSMPPConnection::AbortAsyncRequest(shared_ptr<ISMPPCommand> cmd, int result)
+{
+	recursive_mutex::scoped_lock lock(m_mutex);
+
+	MapPendingResponse::iterator it = m_pendingResponses.find(cmd->sequence_number());
+	if (it == m_pendingResponses.end() || it->second.command != cmd) {
+		return; // failed meanwhile by Close(), the callback is on its way
+	}
+
+	ResponseCallback callback = it->second.callback;
+	boost::system::error_code err;
+	it->second.timer->cancel(err);
+	m_pendingResponses.erase(it);
+	lock.unlock();
+
+	smpp_log_warning("Connection %u: Failed to send PDU of type %#X", m_connectionId, cmd->request_id());
+	callback(result, cmd);
+}
+
+unsigned int CSMPPConnection::GetOutstandingRequests()
+{
+	lock_guard<recursive_mutex> lock(m_mutex);
+	return m_pendingResponses.size();
+}
+
+void CSMPPConnection::SetResponseTimeouts(const ResponseTimeouts& timeouts)
+{
+	lock_guard<recursive_mutex> lock(m_mutex);
+	m_timeouts = timeouts;
+}
+
+unsigned int CSMPPConnection::GetResponseTimeout(unsigned int commandId)
+{
+	lock_guard<recursive_mutex> lock(m_mutex);
+
+	unsigned int timeout = m_timeouts.Of(commandId);
+	if (m_timeouts.adaptive && m_rttMeasured)
+	{ // RTO = SRTT + 4 * RTTVAR, as in RFC 6298
+		uint64_t rto = std::max(m_timeouts.minTimeout, m_srtt + std::max(RTT_CLOCK_GRANULARITY, 4 * m_rttvar));
+		timeout = (unsigned int)std::min<uint64_t>(timeout, rto << m_timeoutBackoff);
+	}
+	return timeout;
+}
+
+void CSMPPConnection::AddRoundTripSample(const system_time& sent)
+{
+	posix_time::time_duration elapsed = get_system_time() - sent;
+	unsigned int rtt = elapsed.is_negative() ? 0 : (unsigned int)elapsed.total_milliseconds();
+
+	if (!m_rttMeasured)
+	{
+		m_srtt = rtt;
+		m_rttvar = rtt / 2;
+		m_rttMeasured = true;
+	}
+	else
+	{
+		unsigned int delta = rtt > m_srtt ? rtt - m_srtt : m_srtt - rtt;
+		m_rttvar = (3 * m_rttvar + delta) / 4;
+		m_srtt = (7 * m_srtt + rtt) / 8;
+	}
+	m_timeoutBackoff = 0;
+}
+
 int CSMPPConnection::SendResponse(shared_ptr<ISMPPCommand> cmd)
 {
 	SMPP_TRACE();
+	int res = SendPDU(cmd, true);
+
 	lock_guard<recursive_mutex> lock(m_mutex);
-	return SendPDU(cmd, true);
+	if (m_inboundPending > 0)
+	{ // one less request being processed
+		bool overLimit = m_inboundLimit && m_inboundPending >= m_inboundLimit;
+		m_inboundPending--;
+		if (m_globalLimiter) {
+			m_globalLimiter->Release();
+		}
+		if (m_readPaused && !IsInboundSaturated())
+		{
+			smpp_log_debug("Connection %u: Resuming reads", m_connectionId);
+			m_readPaused = false;
+			ReadAsync();
+		}
+		else if (m_readPaused && overLimit && m_inboundPending < m_inboundLimit && m_globalLimiter)
+		{ // only the global limit holds it now, it was not queued when it paused
+			m_globalLimiter->Enqueue(shared_from_this());
+		}
+	}
+
+	return res;
 }
 
 int CSMPPConnection::SendPDU(shared_ptr<ISMPPCommand> cmd, bool response)
 {
 	SMPP_TRACE();
-	if(!socket().is_open())
-	{
-		return RESULT_NETERROR;
-	}
 
 	unsigned int (ISMPPCommand::*pack_fn)(char*, unsigned int, int&);
 
@@ -201,7 +643,7 @@ int CSMPPConnection::SendPDU(shared_ptr<ISMPPCommand> cmd, bool response)
 	int err;
 	std::vector<char> buffer(256);
 	unsigned int len = ((*cmd).*pack_fn)(&buffer[0], buffer.size(), err);
-	while(-1 == err && buffer.size() < (2 << 11) ) // 4096 bytes max
+	while(-1 == err && buffer.size() < (2 << 13) ) // 16384 bytes max, enough for submit_multi with 255 destinations
 	{
 		buffer.resize(buffer.size()*2);
 		len = ((*cmd).*pack_fn)(&buffer[0], buffer.size(), err);
@@ -213,20 +655,122 @@ int CSMPPConnection::SendPDU(shared_ptr<ISMPPCommand> cmd, bool response)
 		return RESULT_SYSERROR;
 	}
 
-	if (len < buffer.size())
-	{ // len cannot be bigger than size()
-		buffer.resize(len);
+	return WritePDU(&buffer[0], len, LaneOf(cmd, response));
+}
+
+int CSMPPConnection::WritePDU(const char *buffer, size_t length, OutboundLane lane)
+{
+	OutboundPDU pdu = { buffer, length, false, RESULT_OK };
+
+	mutex::scoped_lock lock(m_writeMutex);
+	m_lanes[lane].push_back(&pdu);
+
+	while (!pdu.written)
+	{
+		if (m_writing)
+		{ // somebody else is writing, may be our PDU
+			m_writeCondition.wait(lock);
+			continue;
+		}
+
+		m_writing = true;
+		while (!pdu.written)
+		{
+			OutboundPDU *next = NextOutboundPDU();
+			if (!m_socket.is_open())
+			{
+				next->result = RESULT_NETERROR;
+			}
+			else
+			{
+				lock.unlock();
+				try
+				{
+					asio::write(m_socket, asio::buffer(next->buffer, next->length));
+					next->result = RESULT_OK;
+				}
+				catch (const std::exception& e)
+				{
+					smpp_log_error("Failed to call asio::write: %s", e.what());
+					next->result = RESULT_NETERROR;
+				}
+				lock.lock();
+			}
+			next->written = true;
+			m_writeCondition.notify_all();
+		}
+		m_writing = false;
+		if (m_shutdownAfterWrite && m_lanes[LANE_CONTROL].empty() && m_lanes[LANE_PRIORITY].empty() &&
+				m_lanes[LANE_BULK].empty())
+		{ // the connection is closing, the last PDU is gone
+			boost::system::error_code err;
+			m_socket.shutdown(socket_t::shutdown_send, err);
+			m_shutdownAfterWrite = false;
+		}
+		m_writeCondition.notify_all();
 	}
 
-	try
+	return pdu.result;
+}
+
+CSMPPConnection::OutboundPDU *CSMPPConnection::NextOutboundPDU()
+{
+	int lane = LANE_CONTROL;
+	if (m_lanes[LANE_CONTROL].empty())
 	{
-		asio::write(socket(), asio::buffer(&buffer[0], len));
-		return RESULT_OK;
+		// priority messages go first, but not forever
+		bool bulkWaiting = !m_lanes[LANE_BULK].empty();
+		if (!m_lanes[LANE_PRIORITY].empty() && !(bulkWaiting && m_priorityStreak >= PRIORITY_LANE_WEIGHT))
+		{
+			lane = LANE_PRIORITY;
+			m_priorityStreak = bulkWaiting ? m_priorityStreak + 1 : 0;
+		}
+		else
+		{
+			lane = LANE_BULK;
+			m_priorityStreak = 0;
+		}
 	}
-	catch (const std::exception& e)
+
+	OutboundPDU *pdu = m_lanes[lane].front();
+	m_lanes[lane].pop_front();
+	return pdu;
+}
+
+void CSMPPConnection::WaitForWriter(mutex::scoped_lock& lock)
+{
+	while (m_writing) {
+		m_writeCondition.wait(lock);
+	}
+}
+
+void CSMPPConnection::InterruptWriter()
+{
+#ifdef _WIN32
+	::shutdown(m_socket.native_handle(), SD_BOTH);
+#else
+	::shutdown(m_socket.native_handle(), SHUT_RDWR);
+#endif
+}
+
+OutboundLane CSMPPConnection::LaneOf(shared_ptr<ISMPPCommand> cmd, bool response)
+{
+	if (response) {
+		return LANE_CONTROL; // the peer's window waits for them
+	}
+
+	switch (cmd->request_id())
 	{
-		smpp_log_error("Failed to call asio::write: %s", e.what());
-		return RESULT_NETERROR;
+	case BIND_RECEIVER:
+	case BIND_TRANSMITTER:
+	case BIND_TRANSCEIVER:
+	case OUTBIND:
+	case UNBIND:
+	case ENQUIRE_LINK:
+	case GENERIC_NACK:
+		return LANE_CONTROL;
+	default:
+		return cmd->priority() ? LANE_PRIORITY : LANE_BULK;
 	}
 }
 
@@ -237,46 +781,91 @@ void CSMPPConnection::ReadHandler(const boost::system::error_code& error)
 
 	if(error)
 	{
-		m_connectionError = true;
+		ReadFailed(lock, "Network error: " + error.message());
+		return;
+	}
 
-		MapPendingResponse::iterator it = m_pendingResponses.begin();
-		for ( ; it != m_pendingResponses.end(); it++)
-		{
-			it->second.command->command_status(-1);
-			it->second.condition->notify_one();
+	unsigned int commandLength = ntohl(m_pduHeader.command_length);
+	if (commandLength < sizeof(PDUHeader) || commandLength > SMPP_MAX_COMMAND_LENGTH)
+	{ // nothing after it can be trusted to be where it should
+		ReadFailed(lock, "Invalid command length " + lexical_cast<string>(commandLength));
+		return;
+	}
+
+	m_readBuffer.assign((char *)&m_pduHeader, sizeof(PDUHeader));
+	if (commandLength == sizeof(PDUHeader))
+	{
+		HandlePDU(lock);
+		return;
+	}
+
+	// the body is read asynchronously as well, a slow peer must not hold the thread
+	m_readBuffer.resize(commandLength, 0);
+	asio::async_read(socket(), asio::buffer(&m_readBuffer[0] + sizeof(PDUHeader), commandLength - sizeof(PDUHeader)),
+			bind(&CSMPPConnection::ReadBodyHandler, shared_from_this(), asio::placeholders::error)
+		);
+}
+
+void CSMPPConnection::ReadBodyHandler(const boost::system::error_code& error)
+{
+	recursive_mutex::scoped_lock lock(m_mutex);
+
+	if(error)
+	{
+		ReadFailed(lock, "Network error: " + error.message());
+		return;
+	}
+
+	HandlePDU(lock);
+}
+
+void CSMPPConnection::ReadFailed(recursive_mutex::scoped_lock& lock, const string& reason)
+{
+	m_connectionError = true;
+
+	FailAsyncRequests(RESULT_NETERROR);
+
+	MapPendingResponse::iterator it = m_pendingResponses.begin();
+	for ( ; it != m_pendingResponses.end(); it++)
+	{
+		if (it->second.answered) {
+			continue;
 		}
+		it->second.command->command_status(-1);
+		it->second.condition->notify_one();
+	}
 
-		if (!m_closeRequested)
+	if (!m_closeRequested)
+	{
+		smpp_log_warning("Connection %u: %s", m_connectionId, reason.c_str());
+		try
 		{
-			smpp_log_warning("Connection %u: Network error: %s", m_connectionId, error.message().c_str());
-			try
-			{
-				Close();
-				lock.unlock();
+			Close();
+			lock.unlock();
+			shared_lock<shared_mutex> callbackLock(m_callbackMutex);
+			if (!m_detached) {
 				m_onConnectionLostEvent(shared_from_this());
 			}
-			catch (const std::exception &e)
-			{
-				smpp_log_warning("Connection %u: Error cleaning up: %s", m_connectionId, e.what());
-			}
 		}
-		return;
+		catch (const std::exception &e)
+		{
+			smpp_log_warning("Connection %u: Error cleaning up: %s", m_connectionId, e.what());
+		}
 	}
+}
+
+void CSMPPConnection::HandlePDU(recursive_mutex::scoped_lock& lock)
+{
+	// the next read reuses the buffer, possibly before we are done with this one
+	std::string pdu;
+	pdu.swap(m_readBuffer);
 
 	unsigned int commandId = ntohl(m_pduHeader.command_id);
+	unsigned int commandStatus = ntohl(m_pduHeader.command_status);
 	unsigned int seqNumber = ntohl(m_pduHeader.sequence_number);
-	unsigned int commandLength = ntohl(m_pduHeader.command_length);
 
 	try
 	{
-		std::string pdu((char *)&m_pduHeader, sizeof(PDUHeader));
-
-		if (commandLength > sizeof(PDUHeader))
-		{ // read PDU body
-			pdu.resize(commandLength, 0);
-			asio::read(socket(), asio::buffer(&pdu[0]+sizeof(PDUHeader), pdu.size() - sizeof(PDUHeader)));
-		}
-
 		DUMP_SMPP_BUFFER(m_connectionId, "Read buffer", &pdu[0], pdu.size());
 
 		if (commandId & SMPP_RESPONSE_BIT)
@@ -297,17 +886,40 @@ void CSMPPConnection::ReadHandler(const boost::system::error_code& error)
 					}
 				}
 
-				cmd->unpack_response(&pdu[0], pdu.size(), err);
-				if (err)
-				{ // this should not happen, I suppose...
-					cmd->command_status(-1);
+				if (commandId == GENERIC_NACK)
+				{ // the peer did not understand the request, there is nothing to unpack
+					cmd->command_status(commandStatus ? commandStatus : ESME_RINVCMDID);
 				}
 				else
-				{ // ok, now we are ready to see the packet in a human readable format
-					DUMP_SMPP_PDU(m_connectionId, cmd->response_id(), cmd->response_ptr(), "Read PDU");
+				{
+					cmd->unpack_response(&pdu[0], pdu.size(), err);
+					if (err)
+					{ // this should not happen, I suppose...
+						cmd->command_status(-1);
+					}
+					else
+					{ // ok, now we are ready to see the packet in a human readable format
+						DUMP_SMPP_PDU(m_connectionId, cmd->response_id(), cmd->response_ptr(), "Read PDU");
+					}
 				}
 				// tell the guy on the door that his response has come...
-				m_pendingResponses[seqNumber].condition->notify_one();
+				PendingResponse &pending = m_pendingResponses[seqNumber];
+				pending.answered = true;
+				AddRoundTripSample(pending.sent);
+				if (pending.callback)
+				{ // nobody is waiting, hand the response to the callback
+					ResponseCallback callback = pending.callback;
+					boost::system::error_code ec;
+					pending.timer->cancel(ec);
+					m_pendingResponses.erase(seqNumber);
+
+					ReadAsync();
+					lock.unlock();
+
+					callback(cmd->command_status() == -1 ? RESULT_INVRESP : RESULT_OK, cmd);
+					return;
+				}
+				pending.condition->notify_one();
 			}
 			else
 			{ // ups, what is going on here?
@@ -316,29 +928,74 @@ void CSMPPConnection::ReadHandler(const boost::system::error_code& error)
 		}
 		else if(m_onNewDataEvent)
 		{ // new packet
-			shared_ptr<ISMPPCommand> cmd = CreateCommandFromBuffer(commandId, seqNumber, pdu);
-			if(cmd)
-			{
-				DUMP_SMPP_PDU(m_connectionId, cmd->request_id(), cmd->request_ptr(), "Read PDU");
-
-				// We should not wait until the callback returns, must start reading before that
+			CPDUView view;
+			if (!view.Parse(&pdu[0], pdu.size()))
+			{ // the fields overrun the PDU, it cannot be decoded
+				shared_ptr<ISMPPCommand> cmd = make_command<CSMPPGenericNack>(seqNumber);
+				SendPDU(cmd, true);
 				ReadAsync();
+				return;
+			}
 
-				lock.unlock();
+			// reading cannot stop while we wait for responses to our own requests
+			bool mustRead = m_inboundThrottle || IsWaitingResponses();
 
-				m_onNewDataEvent(shared_from_this(), cmd);
+			if (IsInboundSaturated() && mustRead && IsMessageRequest(commandId))
+			{ // over the limits, don't even bother decoding it
+				shared_ptr<ISMPPCommand> cmd = CreateCommand(commandId, seqNumber);
+				cmd->command_status(ESME_RTHROTTLED);
+				SendPDU(cmd, true);
+				ReadAsync();
+				return;
+			}
 
-				return; // we dont want to call ReadAsync() twice!
+			m_inboundPending++;
+			if (m_globalLimiter) {
+				m_globalLimiter->Acquire();
+			}
+
+			if (!IsInboundSaturated() || mustRead)
+			{ // We should not wait until the callback returns, must start reading before that
+				ReadAsync();
 			}
 			else
+			{ // let TCP flow control push back on the peer
+				PauseReading();
+			}
+
+			InboundFilter filter = m_inboundFilter;
+			lock.unlock();
+
+			int status = ESME_ROK;
+			if (filter && view.has_addresses()) {
+				status = filter(shared_from_this(), view);
+			}
+
+			shared_ptr<ISMPPCommand> cmd;
+			if (status != ESME_ROK)
+			{ // rejected from what the view tells, decoding is not needed
+				cmd = CreateCommand(commandId, seqNumber);
+				cmd->command_status(status);
+				SendResponse(cmd);
+			}
+			else if (!(cmd = CreateCommandFromBuffer(commandId, seqNumber, pdu)))
 			{ // failed to unpack the buffer? You gotta be kidding me!
-				shared_ptr<ISMPPCommand> cmd(new CSMPPGenericNack(seqNumber));
-				SendPDU(cmd, true);
+				SendResponse(make_command<CSMPPGenericNack>(seqNumber));
+			}
+			else
+			{
+				DUMP_SMPP_PDU(m_connectionId, cmd->request_id(), cmd->request_ptr(), "Read PDU");
+				shared_lock<shared_mutex> callbackLock(m_callbackMutex);
+				if (!m_detached) {
+					m_onNewDataEvent(shared_from_this(), cmd);
+				}
 			}
+
+			return; // we dont want to call ReadAsync() twice!
 		}
 		else
 		{ // no handler? this is evil... ok, send a NO-ACK and forget about it
-			shared_ptr<ISMPPCommand> cmd(new CSMPPGenericNack(seqNumber));
+			shared_ptr<ISMPPCommand> cmd = make_command<CSMPPGenericNack>(seqNumber);
 			SendPDU(cmd, true);
 		}
 
@@ -346,11 +1003,11 @@ void CSMPPConnection::ReadHandler(const boost::system::error_code& error)
 		ReadAsync();
 	}
 	catch (const std::exception &e)
-	{ // I think the only one who could throw exception is asio::read, but you can never be sure ...
+	{ // decoding or a callback may throw, you can never be sure ...
 		if (!m_closeRequested)
 		{ // if the connection was closed the read fails, so ignore this error
 			smpp_log_warning("Connection %u: Something failed while reading, the exception message is: %s", m_connectionId, e.what());
-			if (commandId & SMPP_RESPONSE_BIT)
+			if ((commandId & SMPP_RESPONSE_BIT) && m_pendingResponses.count(seqNumber) && m_pendingResponses[seqNumber].condition)
 			{
 				m_pendingResponses[seqNumber].command->command_status(-1);
 				m_pendingResponses[seqNumber].condition->notify_one();
@@ -361,41 +1018,59 @@ void CSMPPConnection::ReadHandler(const boost::system::error_code& error)
 }
 
 
-shared_ptr<ISMPPCommand> CSMPPConnection::CreateCommandFromBuffer(unsigned int commandId, unsigned int seqNumber, const std::string &buffer)
+shared_ptr<ISMPPCommand> CSMPPConnection::CreateCommand(unsigned int commandId, unsigned int seqNumber)
 {
 	shared_ptr<ISMPPCommand> res;
 	switch (commandId)
 	{
 	case BIND_RECEIVER:
-		res.reset(new CBindReceiver(seqNumber));
+		res = make_command<CBindReceiver>(seqNumber);
 		break;
 	case BIND_TRANSMITTER:
-		res.reset(new CBindTransmitter(seqNumber));
+		res = make_command<CBindTransmitter>(seqNumber);
 		break;
 	case BIND_TRANSCEIVER:
-		res.reset(new CBindTransceiver(seqNumber));
+		res = make_command<CBindTransceiver>(seqNumber);
 		break;
 	case UNBIND:
-		res.reset(new CSMPPUnbind(seqNumber));
+		res = make_command<CSMPPUnbind>(seqNumber);
 		break;
 	case SUBMIT_SM:
-		res.reset(new CSMPPSubmitSingle(seqNumber));
+		res = make_command<CSMPPSubmitSingle>(seqNumber);
 		break;
 	case ENQUIRE_LINK:
-		res.reset(new CSMPPEnquireLink(seqNumber));
+		res = make_command<CSMPPEnquireLink>(seqNumber);
 		break;
 	case DELIVER_SM:
-		res.reset(new CSMPPDelivery(seqNumber));
+		res = make_command<CSMPPDelivery>(seqNumber);
+		break;
+	case SUBMIT_MULTI:
+		res = make_command<CSMPPSubmitMulti>(seqNumber);
+		break;
+	case DATA_SM:
+		res = make_command<CSMPPDataSm>(seqNumber);
 		break;
 	case QUERY_SM:
-	case REPLACE_SM:
+		res = make_command<CSMPPQuery>(seqNumber);
+		break;
 	case CANCEL_SM:
-	case SUBMIT_MULTI:
+		res = make_command<CSMPPCancel>(seqNumber);
+		break;
+	case REPLACE_SM:
+		res = make_command<CSMPPReplace>(seqNumber);
+		break;
 	default:
-		res.reset(new CSMPPGenericNack(seqNumber));
+		res = make_command<CSMPPGenericNack>(seqNumber);
 		break;
 	}
 
+	return res;
+}
+
+shared_ptr<ISMPPCommand> CSMPPConnection::CreateCommandFromBuffer(unsigned int commandId, unsigned int seqNumber, const std::string &buffer)
+{
+	shared_ptr<ISMPPCommand> res = CreateCommand(commandId, seqNumber);
+
 	if(res->request_id() != GENERIC_NACK)
 	{
 		int err;
@@ -415,7 +1090,8 @@ static volatile unsigned int g_clientConnectionCounter = 1000;
 
 CSMPPClientConnection::CSMPPClientConnection(ioservice_t& ioservice,
  const NewCommandCallback& onNewData, const ConnectionLostCallback& onConnectionLost)
-: CSMPPConnection(++g_clientConnectionCounter, ioservice, onNewData, onConnectionLost)
+: CSMPPConnection(++g_clientConnectionCounter, ioservice, onNewData, onConnectionLost),
+  m_connectTimer(ioservice), m_connectTimedOut(false)
 {
 	SMPP_TRACE();
 }
@@ -449,6 +1125,80 @@ int CSMPPClientConnection::Connect( const std::string server, unsigned short por
 	return 0;
 }
 
+void CSMPPClientConnection::ConnectAsync(const std::string& server, unsigned short port, const ConnectCallback& callback, unsigned int timeout)
+{
+	lock_guard<recursive_mutex> lock(m_mutex);
+	resolver_t::query query(server, lexical_cast<std::string>(port));
+
+	smpp_log_info("Connection %u: Connecting to server %s:%d", m_connectionId, server.c_str(), port);
+
+	if (timeout)
+	{
+		m_connectTimer.expires_from_now(posix_time::seconds(timeout));
+		m_connectTimer.async_wait(bind(&CSMPPClientConnection::ConnectTimeoutHandler,
+				static_pointer_cast<CSMPPClientConnection>(shared_from_this()), asio::placeholders::error));
+	}
+
+	m_resolver.reset(new resolver_t(m_ioservice));
+	m_resolver->async_resolve(query, bind(&CSMPPClientConnection::ResolveHandler,
+			static_pointer_cast<CSMPPClientConnection>(shared_from_this()),
+			asio::placeholders::error, asio::placeholders::iterator, server, port, callback));
+}
+
+void CSMPPClientConnection::ResolveHandler(const boost::system::error_code& error, resolver_t::iterator endpoint_iterator,
+ const std::string& server, unsigned short port, const ConnectCallback& callback)
+{
+	recursive_mutex::scoped_lock lock(m_mutex);
+	if (error || m_connectTimedOut)
+	{
+		smpp_log_warning("Connection %u: Cannot resolve host %s: %s", m_connectionId, server.c_str(),
+				m_connectTimedOut ? "Timed out" : error.message().c_str());
+		lock.unlock();
+		callback(-1);
+		return;
+	}
+
+	asio::async_connect(m_socket, endpoint_iterator, bind(&CSMPPClientConnection::ConnectHandler,
+			static_pointer_cast<CSMPPClientConnection>(shared_from_this()),
+			asio::placeholders::error, server, port, callback));
+}
+
+void CSMPPClientConnection::ConnectHandler(const boost::system::error_code& error,
+ const std::string& server, unsigned short port, const ConnectCallback& callback)
+{
+	recursive_mutex::scoped_lock lock(m_mutex);
+	if (error || m_connectTimedOut)
+	{
+		smpp_log_warning("Connection %u: Cannot connect to host %s:%d: %s", m_connectionId, server.c_str(), port,
+				m_connectTimedOut ? "Timed out" : error.message().c_str());
+		lock.unlock();
+		callback(-1);
+		return;
+	}
+
+	boost::system::error_code err;
+	m_connectTimer.cancel(err);
+	m_connectionError = false;
+	m_closeRequested = false;
+	ReadAsync();
+	lock.unlock();
+
+	callback(0);
+}
+
+void CSMPPClientConnection::ConnectTimeoutHandler(const boost::system::error_code& error)
+{
+	lock_guard<recursive_mutex> lock(m_mutex);
+	if (error == asio::error::operation_aborted || m_connectTimedOut) {
+		return; // connected in time
+	}
+
+	m_connectTimedOut = true;
+	m_resolver->cancel();
+	boost::system::error_code err;
+	m_socket.close(err); // aborts the connect in progress
+}
+
 CSMPPClientConnection::~CSMPPClientConnection()
 {
 	SMPP_TRACE();
@@ -8,11 +8,16 @@
 
 
 #include <boost/asio.hpp>
+#include <boost/atomic.hpp>
 #include <boost/thread.hpp>
 #include <boost/shared_ptr.hpp>
+#include <boost/weak_ptr.hpp>
 #include <boost/thread/condition.hpp>
 #include <boost/enable_shared_from_this.hpp>
+#include <deque>
+#include <map>
 #include <string>
+#include <vector>
 
 #define RESULT_OK          0
 #define RESULT_TIMEOUT    -1
@@ -20,9 +25,20 @@
 #define RESULT_INVRESP    -3
 #define RESULT_SYSERROR   -4
 
+// PDUs written from the priority lane in a row before one waiting in the bulk lane goes
+#ifndef PRIORITY_LANE_WEIGHT
+#define PRIORITY_LANE_WEIGHT   ((unsigned int)4)
+#endif
+
+// time (in milliseconds) given to the peer to read the last response before closing
+#ifndef CLOSE_CONNECTION_DELAY
+#define CLOSE_CONNECTION_DELAY   ((unsigned int)500)
+#endif
+
 namespace opensmpp
 {
 	class ISMPPCommand;
+	class CPDUView;
 	class CSMPPConnection;
 	typedef boost::shared_ptr<CSMPPConnection>  SMPPConnectionPtr;
 
@@ -30,6 +46,71 @@ namespace opensmpp
 	typedef boost::asio::ip::tcp::socket     socket_t;
 	typedef boost::asio::ip::tcp::resolver   resolver_t;
 
+	/*!
+	 * \brief Outbound PDUs wait in one of these lanes for their turn to be
+	 * written, lanes go in order and each one is FIFO
+	 */
+	enum OutboundLane
+	{
+		LANE_CONTROL = 0,  /*!< Responses, binds, enquire_link and so on, they always go first */
+		LANE_PRIORITY,     /*!< Messages with priority_flag set */
+		LANE_BULK,         /*!< Every other request, one goes after \c PRIORITY_LANE_WEIGHT priority messages */
+		LANE_COUNT
+	};
+
+	/*!
+	 * \brief Bounds the number of inbound requests being processed (dispatched
+	 * but not answered yet) across all the connections sharing it
+	 */
+	class CInboundLimiter
+	{
+	public:
+
+		CInboundLimiter(unsigned int limit);
+
+		/*! \brief Accounts for a new inbound request */
+		void Acquire();
+
+		/*! \brief Releases \p count requests, resumes paused connections if there is room again */
+		void Release(unsigned int count = 1);
+
+		/*! \return \c true if no more requests should be dispatched */
+		bool IsSaturated() const;
+
+		/*! \brief Registers \p conn to be resumed as soon as there is room again */
+		void Enqueue(SMPPConnectionPtr conn);
+
+	private:
+
+		void ResumeAll();
+
+		const unsigned int                              m_limit;
+		boost::atomic<unsigned int>                     m_count;
+		boost::atomic<bool>                             m_waiting;
+		boost::mutex                                    m_mutex;
+		std::vector<boost::weak_ptr<CSMPPConnection> >  m_paused;
+	};
+
+	/*!
+	 * \brief How long requests wait for their response
+	 *
+	 * In adaptive mode a request waits as long as the round trip times measured
+	 * on its connection suggest, the same way TCP computes its retransmission
+	 * timeout, but never longer than the timeout of its command.
+	 */
+	struct ResponseTimeouts
+	{
+		ResponseTimeouts();
+
+		/*! \return Milliseconds a request of type \p commandId waits at most */
+		unsigned int Of(unsigned int commandId) const;
+
+		unsigned int                          defaultTimeout;  /*!< Milliseconds, for the commands not in \c commands */
+		std::map<unsigned int, unsigned int>  commands;        /*!< Milliseconds by command id */
+		bool                                  adaptive;
+		unsigned int                          minTimeout;      /*!< Milliseconds an adaptive timeout is never shorter than */
+	};
+
 	/*!
 	* \brief A user server connection
 	*/
@@ -47,6 +128,17 @@ namespace opensmpp
 				SMPPConnectionPtr /*sender*/
 			) > ConnectionLostCallback;
 
+		typedef boost::function<void (
+				int /*result*/,
+				boost::shared_ptr<ISMPPCommand> /*cmd*/
+			) > ResponseCallback;
+
+		/*! \return \c ESME_ROK to decode the PDU, otherwise the status it is rejected with */
+		typedef boost::function<int (
+				SMPPConnectionPtr /*sender*/,
+				const CPDUView& /*pdu*/
+			) > InboundFilter;
+
 		virtual ~CSMPPConnection();
 
 		/*! \return The connection id as specified on construction */
@@ -57,16 +149,96 @@ namespace opensmpp
 		/* \brief Sends a SMPP request and wait response */
 		int SendRequest(boost::shared_ptr<ISMPPCommand> cmd);
 
+		/*!
+		 * \brief Sends a SMPP request without waiting for the response
+		 * \p callback is invoked with one of the \c RESULT_XXX values once the response
+		 * comes, the request times out or the connection is lost. It runs on the
+		 * connection's io_service, or on the calling thread if the request cannot be sent.
+		 * \param timeout Seconds to wait for the response, 0 means the default timeout
+		 */
+		void SendRequestAsync(
+					boost::shared_ptr<ISMPPCommand> cmd,
+					const ResponseCallback&         callback,
+					unsigned int                    timeout = 0
+			);
+
+		/*!
+		 * \brief Same as \c SendRequestAsync for a request already packed in \p pdu
+		 * \p cmd is not packed, it only has to match the sequence number written
+		 * in \p pdu and receives the response
+		 * \param lane Where \p pdu waits its turn, it cannot be told from \p cmd
+		 */
+		void SendPackedRequestAsync(
+					boost::shared_ptr<ISMPPCommand> cmd,
+					const std::string&              pdu,
+					const ResponseCallback&         callback,
+					unsigned int                    timeout = 0,
+					OutboundLane                    lane = LANE_BULK
+			);
+
+		/*! \return The number of requests waiting for their response */
+		unsigned int GetOutstandingRequests();
+
+		/*! \brief Sets how long the requests sent from now on wait for their response */
+		void SetResponseTimeouts(const ResponseTimeouts& timeouts);
+
+		/*! \return Milliseconds a request of type \p commandId sent now would wait for its response */
+		unsigned int GetResponseTimeout(unsigned int commandId);
+
 		/* \brief Sends a SMPP response for the given command */
 		int SendResponse(boost::shared_ptr<ISMPPCommand> cmd);
 
 		virtual void Close();
 
+		/*!
+		 * \brief Closes the connection after \p delay milliseconds without
+		 * blocking the calling thread
+		 *
+		 * Responses are written synchronously, so by the time this is called
+		 * they are already on the wire. The sending side is shut down right away
+		 * and the socket is closed when the timer expires or when the peer
+		 * closes its side, whatever happens first.
+		 */
+		void CloseDeferred(unsigned int delay);
+
 		socket_t& socket();
 
+		/*! \return The io_service running the connection's handlers */
+		ioservice_t& ioservice();
+
 		/* \brief Starts an async read operation */
 		void ReadAsync();
 
+		/*!
+		 * \brief Bounds the inbound requests this connection dispatches before
+		 * their responses are sent
+		 * \param limit Maximum number of unanswered requests, 0 means no limit
+		 * \param global Limiter shared by a group of connections, may be empty
+		 * \param throttle When \c true messages over the limit are answered with
+		 * \c ESME_RTHROTTLED, otherwise the connection stops reading from the socket
+		 */
+		void SetInboundLimits(
+					unsigned int                       limit,
+					boost::shared_ptr<CInboundLimiter> global,
+					bool                               throttle
+			);
+
+		/*! \brief Resumes reading if it was paused and the limits allow it */
+		void ResumeReading();
+
+		/*!
+		 * \brief Sets a filter that sees the message requests before they are
+		 * decoded, those it rejects are answered right away and never decoded
+		 */
+		void SetInboundFilter(const InboundFilter& filter);
+
+		/*!
+		 * \brief The new command and connection lost callbacks are not invoked
+		 * anymore, waits for those running, so their target can be destroyed
+		 * once it returns. Must not be called from one of them.
+		 */
+		void Detach();
+
 	protected:
 
 		CSMPPConnection(
@@ -76,9 +248,55 @@ namespace opensmpp
 					const ConnectionLostCallback& onConnectionLost
 			);
 
-		/*! \brief Invoked when an async read has complete */
+		/*! \brief Invoked when the header of a PDU has been read */
 		void ReadHandler(const boost::system::error_code& error);
 
+		/*! \brief Invoked when the body of a PDU has been read into \c m_readBuffer */
+		void ReadBodyHandler(const boost::system::error_code& error);
+
+		/*! \brief Handles the PDU in \c m_readBuffer and starts reading the next one, \p lock must hold \c m_mutex */
+		void HandlePDU(boost::recursive_mutex::scoped_lock& lock);
+
+		/*! \brief Closes the connection after a failed read, \p lock must hold \c m_mutex */
+		void ReadFailed(boost::recursive_mutex::scoped_lock& lock, const std::string& reason);
+
+		/*! \brief Invoked when an async request has not been answered in time */
+		void ResponseTimeoutHandler(unsigned int seqNumber, const boost::system::error_code& error);
+
+		/*! \brief Registers an async request that has been sent, must be called with the lock held */
+		void AddAsyncRequest(
+					boost::shared_ptr<ISMPPCommand> cmd,
+					const ResponseCallback&         callback,
+					unsigned int                    timeout
+			);
+
+		/*! \brief Feeds the round trip time of a request sent at \p sent to the adaptive timeouts, the lock must be held */
+		void AddRoundTripSample(const boost::system_time& sent);
+
+		/*! \brief Fails every async request still waiting for its response, must be called with the lock held */
+		void FailAsyncRequests(int result);
+
+		/*! \brief Forgets the async request \p cmd, which could not be sent, and reports \p result */
+		void AbortAsyncRequest(boost::shared_ptr<ISMPPCommand> cmd, int result);
+
+		/*! \brief Invoked when the timer armed by \c CloseDeferred expires */
+		void CloseTimerHandler(const boost::system::error_code& error);
+
+		/*! \return \c true if no more inbound requests should be dispatched */
+		bool IsInboundSaturated() const;
+
+		/*! \return \c true if a request is waiting for its response, must be called with the lock held */
+		bool IsWaitingResponses() const;
+
+		/*! \brief Stops issuing reads until the inbound requests are answered */
+		void PauseReading();
+
+		/*! \brief Runs on the connection's io_service on behalf of \c ResumeReading */
+		void ResumeReadingHandler();
+
+		/*! \brief Creates an empty command of type \p commandId, GENERIC_NACK if it is not supported */
+		static boost::shared_ptr<ISMPPCommand> CreateCommand(unsigned int commandId, unsigned int seqNumber);
+
 		/*
 		* \brief Creates an ISMPPCommand object based on \p commandId, with
 		* sequence number \p seqNumber and filled  with the data on \p buffer
@@ -89,9 +307,44 @@ namespace opensmpp
 					const std::string& buffer
 			);
 
-		/* \brief Sends a SMPP packet, no locking implementation */
+		/* \brief Sends a SMPP packet, the lock should not be held since it may wait for its turn */
 		int SendPDU(boost::shared_ptr<ISMPPCommand> cmd, bool response);
 
+		/*!
+		 * \brief Writes a packed PDU to the socket once the PDUs ahead of it in
+		 * \p lane and in the lanes that go first are written
+		 *
+		 * There is no writer thread, the first caller that finds the socket idle
+		 * writes whatever goes next until its own PDU is out, then the next
+		 * caller waiting takes over.
+		 */
+		int WritePDU(const char *buffer, size_t length, OutboundLane lane);
+
+		/*! \return The lane \p cmd waits in to be sent */
+		static OutboundLane LaneOf(boost::shared_ptr<ISMPPCommand> cmd, bool response);
+
+		/*! \brief A packed PDU waiting in an outbound lane */
+		struct OutboundPDU
+		{
+			const char  *buffer;
+			size_t       length;
+			bool         written;  /*!< Set once it has been written, or the write failed */
+			int          result;   /*!< \c RESULT_OK or the reason the write failed */
+		};
+
+		/*! \return The PDU to write next, the write lock must be held and a lane must not be empty */
+		OutboundPDU *NextOutboundPDU();
+
+		/*! \brief Waits for the PDU being written, so the socket can be closed, the write lock must be held */
+		void WaitForWriter(boost::mutex::scoped_lock& lock);
+
+		/*!
+		 * \brief Makes a write blocked on a peer that does not read fail right away,
+		 * the socket is shut down through its descriptor, which is safe while
+		 * another thread writes to it
+		 */
+		void InterruptWriter();
+
 		/*! \brief PDU Header: Basic unit of every SMPP packet */
 		struct PDUHeader
 		{
@@ -104,22 +357,57 @@ namespace opensmpp
 		/*! \brief Holds data about a response that the user is expecting due to a call to SendPDU */
 		struct PendingResponse
 		{
+			PendingResponse()
+			 : condition(NULL)
+			 , answered(false)
+			{ }
+
+			/*! \brief A request sent now, \p cond is signaled when it's answered */
+			PendingResponse(const boost::shared_ptr<ISMPPCommand>& cmd, boost::condition *cond)
+			 : command(cmd)
+			 , condition(cond)
+			 , answered(false)
+			 , sent(boost::get_system_time())
+			{ }
+
 			boost::shared_ptr<ISMPPCommand> command;  /*!< The response packet (header+body) */
-			boost::condition *condition;  /*!< Activates when the response is has come */
+			boost::condition *condition;  /*!< Activates when the response is has come, NULL for async requests */
+			bool answered;  /*!< The response has come, a later network error does not affect it */
+			ResponseCallback callback;  /*!< Invoked when the response of an async request has come */
+			boost::shared_ptr<boost::asio::deadline_timer> timer;  /*!< Expires when an async request times out */
+			boost::system_time sent;  /*!< When the request was registered, to measure its round trip time */
 		};
 
 		typedef std::map<int, PendingResponse> MapPendingResponse;
 
 		unsigned int                   m_connectionId, m_nextSequenceNumber;
 		bool                           m_connectionError, m_closeRequested;
+		unsigned int                   m_inboundPending, m_inboundLimit;
+		bool                           m_inboundThrottle, m_readPaused;
+		boost::shared_ptr<CInboundLimiter> m_globalLimiter;
 		ioservice_t&                   m_ioservice;
 		socket_t                       m_socket;
+		boost::asio::deadline_timer    m_closeTimer;
 		PDUHeader                      m_pduHeader;
+		std::string                    m_readBuffer;
 		MapPendingResponse             m_pendingResponses;
 		boost::mutex                   m_mutexCounter;
 		boost::recursive_mutex         m_mutex;
 		NewCommandCallback             m_onNewDataEvent;
 		ConnectionLostCallback         m_onConnectionLostEvent;
+		boost::shared_mutex            m_callbackMutex;   /*!< Held shared by the callbacks above, exclusively by \c Detach */
+		bool                           m_detached;
+		InboundFilter                  m_inboundFilter;
+		std::deque<OutboundPDU*>       m_lanes[LANE_COUNT];
+		unsigned int                   m_priorityStreak;  /*!< Priority PDUs written in a row while bulk ones wait */
+		bool                           m_writing;         /*!< A thread is writing, the others wait their turn */
+		bool                           m_shutdownAfterWrite; /*!< The writer sends the FIN once the lanes are empty */
+		boost::mutex                   m_writeMutex;      /*!< Guards the lanes, taken after the connection lock */
+		boost::condition               m_writeCondition;  /*!< Signaled after each write */
+		ResponseTimeouts               m_timeouts;
+		bool                           m_rttMeasured;     /*!< A response has come, the values below make sense */
+		unsigned int                   m_srtt, m_rttvar;  /*!< Smoothed round trip time and its variation, in milliseconds */
+		unsigned int                   m_timeoutBackoff;  /*!< Adaptive timeouts are doubled this many times, reset by the next response */
 	};
 
 
@@ -137,9 +425,50 @@ namespace opensmpp
 					const ConnectionLostCallback& onConnectionLost
 			);
 
+		typedef boost::function<void (
+				int /*result*/
+			) > ConnectCallback;
+
 		~CSMPPClientConnection();
 
 		int Connect(const std::string server, unsigned short port);
+
+		/*!
+		 * \brief Same as \c Connect without blocking the calling thread
+		 * \p callback is invoked on the io_service with 0 once the connection
+		 * is established and reading, or with -1 if it cannot be established
+		 * \param timeout Seconds to resolve and connect, 0 leaves it to the system
+		 */
+		void ConnectAsync(
+					const std::string&     server,
+					unsigned short         port,
+					const ConnectCallback& callback,
+					unsigned int           timeout = 0
+			);
+
+	private:
+
+		void ResolveHandler(
+					const boost::system::error_code& error,
+					resolver_t::iterator             endpoint_iterator,
+					const std::string&               server,
+					unsigned short                   port,
+					const ConnectCallback&           callback
+			);
+
+		/*! \brief Gives up resolving or connecting, the handler in progress fails */
+		void ConnectTimeoutHandler(const boost::system::error_code& error);
+
+		void ConnectHandler(
+					const boost::system::error_code& error,
+					const std::string&               server,
+					unsigned short                   port,
+					const ConnectCallback&           callback
+			);
+
+		boost::shared_ptr<resolver_t>  m_resolver;
+		boost::asio::deadline_timer    m_connectTimer;
+		bool                           m_connectTimedOut;
 	};
 
 	/*!
@@ -7,8 +7,22 @@
 
 #define SMPP_HEADER_SIZE	16
 
+// longest PDU we accept, room for a 64K message_payload and the mandatory fields
+#define SMPP_MAX_COMMAND_LENGTH	(72 * 1024)
+
 #define SMPP_RESPONSE_BIT (1 << 31)
 
+// esm_class bits 2-5 of a DELIVER_SM tell what kind of message it is
+#define ESM_CLASS_TYPE_MASK         0x3C
+#define ESM_CLASS_DELIVERY_RECEIPT  0x04
+
+// registered_delivery bits 0-1 ask for a receipt on final delivery outcome
+// (or only on failure), bit 4 for intermediate notifications
+#define REGISTERED_DELIVERY_MASK          0x03
+#define REGISTERED_DELIVERY_FINAL         0x01
+#define REGISTERED_DELIVERY_FAILURE       0x02
+#define REGISTERED_DELIVERY_INTERMEDIATE  0x10
+
 // we take a reserver smpp value for us
 #define SMPP_DATA_CODING_UTF8 0x0B
 
@@ -0,0 +1,283 @@
+/*!
+ * \file smpprouter.cpp
+ * \author ichramm
+ */
+#include "stdafx.h"
+
+#ifdef _WIN32
+# pragma push_macro("SendMessage")
+# undef SendMessage
+#endif
+
+#include "../smpp.hpp"
+#include "routetrie.hpp"
+#include "logger.h"
+
+#include <boost/atomic.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/weak_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/locks.hpp>
+
+#include <algorithm>
+#include <ctime>
+#include <map>
+#include <vector>
+
+using namespace std;
+using namespace boost;
+
+// seconds a client is skipped after a message fails on it
+#define ROUTER_FAILOVER_HOLD 1
+
+namespace opensmpp
+{
+
+/*!
+ * What the router knows about one client, shared by every route to it. The
+ * client is held weakly, a table still in use after being replaced does not
+ * keep the clients it no longer routes to.
+ */
+struct ClientState
+{
+	ClientState(const boost::shared_ptr<CSMPPClient>& c)
+	 : client(c)
+	 , heldUntil(0)
+	{ }
+
+	boost::weak_ptr<CSMPPClient>    client;
+	boost::atomic<long>             heldUntil;
+};
+
+/*! The clients of a prefix, sorted by cost */
+struct PrefixRoute
+{
+	struct Candidate
+	{
+		boost::shared_ptr<ClientState>  state;
+		unsigned int                    cost;
+
+		bool operator<(const Candidate& other) const
+		{
+			return cost < other.cost;
+		}
+	};
+
+	PrefixRoute() : next(0) { }
+
+	/*!
+	 * Calls \p visit with the clients in the order they should be tried: those
+	 * bound and not held first, then those bound but held back. Clients with
+	 * the same cost take turns to be the first of their group. Clients already
+	 * released are skipped.
+	 * \return As soon as \p visit does
+	 */
+	template <class Visitor>
+	bool Visit(Visitor& visit, long now) const
+	{
+		unsigned int turn = next.fetch_add(1, memory_order_relaxed);
+		for (int held = 0; held < 2; held++)
+		{
+			for (size_t group = 0; group < candidates.size(); )
+			{
+				size_t end = group + 1;
+				while (end < candidates.size() && candidates[end].cost == candidates[group].cost) {
+					end++;
+				}
+				for (size_t i = 0; i < end - group; i++)
+				{
+					ClientState &state = *candidates[group + (turn + i) % (end - group)].state;
+					if ((state.heldUntil.load(memory_order_relaxed) > now) != (held != 0)) {
+						continue;
+					}
+					boost::shared_ptr<CSMPPClient> client = state.client.lock();
+					if (client && client->IsBound() && visit(state, client)) {
+						return true;
+					}
+				}
+				group = end;
+			}
+		}
+		return false;
+	}
+
+	std::vector<Candidate>          candidates;
+	mutable boost::atomic<unsigned> next;
+};
+
+typedef CRouteTrie<PrefixRoute> RouteTrie;
+
+
+struct CRouteTable::impl
+{
+	struct Entry
+	{
+		string                          digits;
+		boost::shared_ptr<CSMPPClient>  client;
+		unsigned int                    cost;
+	};
+
+	vector<Entry> entries;
+};
+
+CRouteTable::CRouteTable()
+ : pimpl(new impl)
+{ }
+
+CRouteTable::~CRouteTable()
+{ }
+
+void CRouteTable::AddRoute(const string& prefix, boost::shared_ptr<CSMPPClient> client, unsigned int cost)
+{
+	if (!client) {
+		return;
+	}
+
+	impl::Entry entry;
+	for (string::const_iterator it = prefix.begin(); it != prefix.end(); ++it)
+	{
+		if (*it >= '0' && *it <= '9') {
+			entry.digits += *it;
+		}
+	}
+	entry.client = client;
+	entry.cost = cost;
+	pimpl->entries.push_back(entry);
+}
+
+
+struct CSMPPRouter::impl
+{
+	/*! The clients of the current routes, the only strong references the router has */
+	typedef map<boost::shared_ptr<CSMPPClient>, boost::shared_ptr<ClientState> > StateMap;
+
+	impl()
+	 : table(boost::make_shared<RouteTrie>())
+	{ }
+
+	/*! \return The current table, it stays alive as long as the caller holds it */
+	boost::shared_ptr<const RouteTrie> Current() const
+	{
+		return boost::atomic_load(&table);
+	}
+
+	void SetRoutes(const CRouteTable::impl& routes)
+	{
+		typedef map<string, boost::shared_ptr<PrefixRoute> > RouteMap;
+
+		lock_guard<mutex> lock(tableMutex);
+
+		RouteMap compiled;
+		StateMap newStates;
+		for (vector<CRouteTable::impl::Entry>::const_iterator it = routes.entries.begin(); it != routes.entries.end(); ++it)
+		{
+			// clients keep their state across tables
+			boost::shared_ptr<ClientState> &state = newStates[it->client];
+			if (!state)
+			{
+				StateMap::const_iterator old = states.find(it->client);
+				state = old != states.end() ? old->second : boost::make_shared<ClientState>(it->client);
+			}
+
+			boost::shared_ptr<PrefixRoute> &route = compiled[it->digits];
+			if (!route) {
+				route = boost::make_shared<PrefixRoute>();
+			}
+			PrefixRoute::Candidate candidate = { state, it->cost };
+			route->candidates.push_back(candidate);
+		}
+
+		boost::shared_ptr<RouteTrie> trie = boost::make_shared<RouteTrie>();
+		for (RouteMap::iterator it = compiled.begin(); it != compiled.end(); ++it)
+		{
+			std::stable_sort(it->second->candidates.begin(), it->second->candidates.end());
+			trie->Insert(it->first, it->second);
+		}
+
+		boost::atomic_store(&table, boost::shared_ptr<const RouteTrie>(trie));
+		states.swap(newStates);
+	}
+
+	/*! Picks the first client visited */
+	struct PickFirst
+	{
+		boost::shared_ptr<CSMPPClient> client;
+
+		bool operator()(ClientState&, const boost::shared_ptr<CSMPPClient>& c)
+		{
+			client = c;
+			return true;
+		}
+	};
+
+	/*! Sends the message through each client visited until one does not fail */
+	struct SendThrough
+	{
+		const string    &from, &to, &content;
+		string          *messageId;
+		void            *context;
+		DeliveryResult   result;
+
+		bool operator()(ClientState& state, const boost::shared_ptr<CSMPPClient>& client)
+		{
+			result = client->SendMessage(from, to, content, messageId, context);
+			if (result != DELIVERY_UNKNOWN_ERROR) {
+				return true;
+			}
+			state.heldUntil.store((long)time(NULL) + ROUTER_FAILOVER_HOLD, memory_order_relaxed);
+			smpp_log_debug("Message to %s failed on a client, trying the next route", to.c_str());
+			return false;
+		}
+	};
+
+	mutex                                 tableMutex;   /*!< Serializes \c SetRoutes, lookups don't take it */
+	boost::shared_ptr<const RouteTrie>    table;        /*!< Only accessed with \c atomic_load and \c atomic_store */
+	StateMap                              states;
+};
+
+CSMPPRouter::CSMPPRouter()
+ : pimpl(new impl)
+{ }
+
+CSMPPRouter::~CSMPPRouter()
+{ }
+
+void CSMPPRouter::SetRoutes(const CRouteTable& routes)
+{
+	pimpl->SetRoutes(*routes.pimpl);
+}
+
+boost::shared_ptr<CSMPPClient> CSMPPRouter::Route(const string& to)
+{
+	impl::PickFirst pick;
+	boost::shared_ptr<const RouteTrie> table = pimpl->Current();
+	const PrefixRoute *route = table->Lookup(to);
+	if (route) {
+		route->Visit(pick, (long)time(NULL));
+	}
+	return pick.client;
+}
+
+DeliveryResult CSMPPRouter::SendMessage(const string& from, const string& to, const string& content,
+                                        string* messageId, void* context)
+{
+	// keeps the table alive while sending, the routes could be replaced meanwhile
+	boost::shared_ptr<const RouteTrie> table = pimpl->Current();
+
+	const PrefixRoute *route = table->Lookup(to);
+	if (!route)
+	{
+		smpp_log_warning("There is no route to %s", to.c_str());
+		return DELIVERY_INV_DEST_ADDR;
+	}
+
+	impl::SendThrough send = { from, to, content, messageId, context, DELIVERY_UNKNOWN_ERROR };
+	route->Visit(send, (long)time(NULL));
+	return send.result;
+}
+
+} // namespace opensmpp
+
+#ifdef _WIN32
+# pragma pop_macro("SendMessage")
+#endif
@@ -14,9 +14,15 @@
 #include "smppcommands.hpp"
 #include "smppusersmanager.hpp"
 #include "logger.h"
+#include <boost/bind.hpp>
 #include <boost/lexical_cast.hpp>
 #include <vector>
 
+#if defined(__linux__)
+# include <pthread.h>
+# include <sched.h>
+#endif
+
 #ifndef STARTUP_THREAD_COUNT
 # define STARTUP_THREAD_COUNT	((unsigned int)20)
 #endif
@@ -31,10 +37,38 @@ using namespace boost;
 namespace opensmpp
 {
 
+/*!
+ * Pins the calling thread to \p cpu
+ */
+static void SetCurrentThreadAffinity(int cpu)
+{
+#if defined(__linux__)
+	cpu_set_t cpuset;
+	CPU_ZERO(&cpuset);
+	CPU_SET(cpu, &cpuset);
+	int err = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset);
+	if (err) {
+		smpp_log_warning("Failed to pin thread %#0lx to CPU %d: error %d", (unsigned long int)pthread_self(), cpu, err);
+	}
+#elif defined(_WIN32)
+	if (!SetThreadAffinityMask(GetCurrentThread(), DWORD_PTR(1) << cpu)) {
+		smpp_log_warning("Failed to pin thread %lu to CPU %d: error %lu", (unsigned long int)GetCurrentThreadId(), cpu, (unsigned long int)GetLastError());
+	}
+#else
+	smpp_log_warning("CPU affinity is not supported on this platform, ignoring CPU %d", cpu);
+#endif
+}
+
+CSMPPServerImpl::IOContext::IOContext(unsigned int index)
+: index(index), work(ioservice), acceptor(ioservice)
+{
+}
+
 CSMPPServerImpl::CSMPPServerImpl(shared_ptr<CSMPPUserManager> userManager, unsigned short port)
-: m_running(false), m_port(port), m_work(m_ioservice), m_acceptor(m_ioservice), m_connectionCounter(0), m_userManager(userManager)
+: m_running(false), m_port(port), m_roundRobin(false), m_nextContext(0), m_connectionCounter(0), m_userManager(userManager)
 {
 	SMPP_TRACE();
+	libSMPP_CreateDefaultServerSettings(&m_settings);
 }
 
 CSMPPServerImpl::~CSMPPServerImpl()
@@ -43,46 +77,126 @@ CSMPPServerImpl::~CSMPPServerImpl()
 	Stop();
 }
 
+void CSMPPServerImpl::SetSettings(const ServerSettings& settings)
+{
+	lock_guard<mutex> lock(m_mutex);
+	if (!m_contexts.empty())
+	{ // io_services cannot be rearranged once created
+		smpp_log_warning("Server settings must be set before starting the server, ignoring them");
+		return;
+	}
+	memcpy(&m_settings, &settings, sizeof(ServerSettings));
+}
+
 void CSMPPServerImpl::Start(unsigned int numThreads)
 {
 	SMPP_TRACE();
 
+	if (m_running) {
+		return;
+	}
+
+	bool perCore = (m_settings.ThreadingModel == SERVER_THREADING_PER_CORE);
+
 	if(!numThreads) {
-		numThreads = STARTUP_THREAD_COUNT;
+		numThreads = perCore ? thread::hardware_concurrency() : STARTUP_THREAD_COUNT;
+	}
+
+	if(!numThreads) { // hardware_concurrency() could not tell
+		numThreads = 1;
 	}
 
 	if(numThreads > MAX_THREAD_COUNT) {
 		numThreads = MAX_THREAD_COUNT;
 	}
 
-	if(!m_acceptor.is_open())
+	if (m_contexts.empty())
+	{ // shared: one context with all the threads, per core: one context per thread
+		for (unsigned int i = 0; i < (perCore ? numThreads : 1); i++) {
+			m_contexts.push_back(IOContextPtr(new IOContext(i)));
+		}
+	}
+
+	bool reusePort = perCore && m_settings.EnableReusePort && m_contexts.size() > 1;
+#ifndef SO_REUSEPORT
+	if (reusePort)
 	{
-		try {
-			asio::ip::tcp::endpoint endpoint(asio::ip::tcp::v4(), m_port);
-			asio::ip::tcp::acceptor::reuse_address option(true);
-			m_acceptor.open(endpoint.protocol());
-			m_acceptor.set_option(option);
-			m_acceptor.bind(endpoint);
-			m_acceptor.listen();
+		smpp_log_warning("SO_REUSEPORT is not supported on this platform, using a single acceptor");
+		reusePort = false;
+	}
+#endif
+	m_roundRobin = (m_contexts.size() > 1 && !reusePort);
+
+	if (m_settings.MaxInboundTotal && !m_inboundLimiter) {
+		m_inboundLimiter.reset(new CInboundLimiter(m_settings.MaxInboundTotal));
+	}
+
+	for (size_t i = 0; i < m_contexts.size(); i++)
+	{
+		IOContextPtr context = m_contexts[i];
+		if (i > 0 && !reusePort) {
+			continue; // only the first context accepts connections
 		}
-		catch (boost::system::system_error &e) {
-			throw std::runtime_error("Failed to start listening on port " + lexical_cast<string>(m_port) + " - " + e.what());
+
+		if(!context->acceptor.is_open())
+		{
+			try {
+				OpenAcceptor(context, reusePort);
+			}
+			catch (boost::system::system_error &e) {
+				throw std::runtime_error("Failed to start listening on port " + lexical_cast<string>(m_port) + " - " + e.what());
+			}
 		}
 
-		// cleanup ioservice's internal flag 'stopped'
-		m_ioservice.reset();
+		AcceptConnection(context);
 	}
 
-	AcceptConnection();
+	unsigned int threadsPerContext = perCore ? 1 : numThreads;
+	unsigned int cpuCount = thread::hardware_concurrency();
 
-	for (unsigned int i = 0; i < numThreads; i++)
+	for (size_t i = 0; i < m_contexts.size(); i++)
 	{
-		m_threads.push_back(ThreadPtr(new thread(bind(&CSMPPServerImpl::RunIOService, this))));
+		IOContextPtr context = m_contexts[i];
+
+		// cleanup ioservice's internal flag 'stopped'
+		context->ioservice.reset();
+
+		int cpu = -1;
+		if (perCore && m_settings.EnableCPUAffinity && cpuCount) {
+			cpu = (int)(i % cpuCount);
+		}
+
+		for (unsigned int j = 0; j < threadsPerContext; j++) {
+			context->threads.push_back(ThreadPtr(new thread(bind(&CSMPPServerImpl::RunIOService, this, context, cpu))));
+		}
 	}
 
+	smpp_log_info("Server listening on port %u with %u io_service(s) and %u thread(s) each%s",
+			(unsigned int)m_port, (unsigned int)m_contexts.size(), threadsPerContext,
+			reusePort ? ", one SO_REUSEPORT acceptor per io_service" : "");
+
 	m_running = true;
 }
 
+void CSMPPServerImpl::OpenAcceptor(IOContextPtr context, bool reusePort)
+{
+	asio::ip::tcp::endpoint endpoint(asio::ip::tcp::v4(), m_port);
+	asio::ip::tcp::acceptor::reuse_address option(true);
+	context->acceptor.open(endpoint.protocol());
+	context->acceptor.set_option(option);
+#ifdef SO_REUSEPORT
+	if (reusePort)
+	{ // every core listens on the same port, the kernel balances new connections
+		typedef asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT> reuse_port;
+		context->acceptor.set_option(reuse_port(true));
+	}
+#else
+	(void)reusePort;
+#endif
+	context->acceptor.bind(endpoint);
+	context->acceptor.listen();
+}
+
 void CSMPPServerImpl::Stop()
 {
 	SMPP_TRACE();
@@ -90,10 +204,17 @@ void CSMPPServerImpl::Stop()
 	{
 		boost::system::error_code err;
 		m_running = false;
-		m_acceptor.close(err);
-		m_ioservice.stop();
-		for ( ; !m_threads.empty(); m_threads.pop_back()) {
-			m_threads.back()->join();
+		for (size_t i = 0; i < m_contexts.size(); i++)
+		{
+			m_contexts[i]->acceptor.close(err);
+			m_contexts[i]->ioservice.stop();
+		}
+		for (size_t i = 0; i < m_contexts.size(); i++)
+		{
+			vector<ThreadPtr> &threads = m_contexts[i]->threads;
+			for ( ; !threads.empty(); threads.pop_back()) {
+				threads.back()->join();
+			}
 		}
 	}
 }
@@ -103,14 +224,17 @@ bool CSMPPServerImpl::IsRunning() const
 	return m_running;
 }
 
-void CSMPPServerImpl::RunIOService()
+void CSMPPServerImpl::RunIOService(IOContextPtr context, int cpu)
 {
-	smpp_log_profile(" -- ioservice thread %#0lx start", (unsigned long int)pthread_self());
+	smpp_log_profile(" -- ioservice %u thread %#0lx start", context->index, (unsigned long int)pthread_self());
+	if (cpu >= 0) {
+		SetCurrentThreadAffinity(cpu);
+	}
 	do
 	{
 		try
 		{
-			m_ioservice.run();
+			context->ioservice.run();
 		}
 		catch (std::exception &e)
 		{
@@ -118,27 +242,40 @@ void CSMPPServerImpl::RunIOService()
 		}
 	}
 	while (m_running); // keep running if there is an error
-	smpp_log_profile(" -- ioservice thread %#0lx end", (unsigned long int)pthread_self());
+	smpp_log_profile(" -- ioservice %u thread %#0lx end", context->index, (unsigned long int)pthread_self());
+}
+
+CSMPPServerImpl::IOContextPtr CSMPPServerImpl::NextContext(IOContextPtr acceptingContext)
+{
+	if (!m_roundRobin) {
+		return acceptingContext;
+	}
+	return m_contexts[m_nextContext++ % m_contexts.size()];
 }
 
-void CSMPPServerImpl::AcceptConnection()
+void CSMPPServerImpl::AcceptConnection(IOContextPtr context)
 {
 	SMPP_TRACE();
 	lock_guard<mutex> lock(m_mutex);
-	SMPPConnectionPtr conn(new CSMPPServerConnection(++m_connectionCounter, m_ioservice,
+	// the connection lives on its own io_service from now on, which may not
+	// be the one accepting it
+	IOContextPtr owner = NextContext(context);
+	SMPPConnectionPtr conn(new CSMPPServerConnection(++m_connectionCounter, owner->ioservice,
 											bind(&CSMPPServerImpl::OnNewPDUHandler, shared_from_this(), _1, _2),
 											bind(&CSMPPServerImpl::OnConnectionError, shared_from_this(), _1)));
-	m_acceptor.async_accept(conn->socket(), bind(&CSMPPServerImpl::OnNewConnection, this, conn, asio::placeholders::error));
+	conn->SetInboundLimits(m_settings.MaxInboundPerConnection, m_inboundLimiter, m_settings.ThrottleOnOverload != 0);
+	conn->SetInboundFilter(bind(&CSMPPUserManager::CheckInbound, m_userManager, _1, _2));
+	context->acceptor.async_accept(conn->socket(), bind(&CSMPPServerImpl::OnNewConnection, this, context, conn, asio::placeholders::error));
 }
 
-void CSMPPServerImpl::OnNewConnection(SMPPConnectionPtr conn, const boost::system::error_code& error)
+void CSMPPServerImpl::OnNewConnection(IOContextPtr context, SMPPConnectionPtr conn, const boost::system::error_code& error)
 {
 	SMPP_TRACE();
 	if(!error)
 	{
 		// accept new connections before
 		// just in case the server connection runs synchronously
-		AcceptConnection();
+		AcceptConnection(context);
 
 		// let the connection start reading
 		conn->ReadAsync();
@@ -154,10 +291,9 @@ void CSMPPServerImpl::OnNewPDUHandler(SMPPConnectionPtr sender, shared_ptr<ISMPP
 {
 	SMPP_TRACE();
 	if(!m_userManager->OnCommand(sender, cmd))
-	{ // close the connection but with some delay
-		this_thread::sleep(boost::posix_time::milliseconds(500));
+	{ // close the connection but with some delay, never block the io thread
 		smpp_log_profile("Closing connection %u", sender->GetConnectionId());
-		sender->Close();
+		sender->CloseDeferred(CLOSE_CONNECTION_DELAY);
 	}
 };
 
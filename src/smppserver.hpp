@@ -8,6 +8,7 @@
 #pragma once
 #endif
 
+#include "../smpp.h"
 #include "smppconnection.hpp"
 
 #include <boost/asio.hpp>
@@ -42,6 +43,17 @@ namespace opensmpp
 
 		~CSMPPServerImpl();
 
+		/*!
+		 * \brief Sets the threading model and related options
+		 * \pre The server is not running
+		 */
+		void SetSettings(const ServerSettings& settings);
+
+		/*!
+		 * \brief Starts listening
+		 * \param numThreads Number of threads of the shared pool, or number of
+		 * cores when running with \c SERVER_THREADING_PER_CORE
+		 */
 		void Start(unsigned int numThreads = 0);
 
 		void Stop();
@@ -51,20 +63,40 @@ namespace opensmpp
 	private:
 		typedef boost::shared_ptr<boost::thread> ThreadPtr;
 
-		void RunIOService();
-		void AcceptConnection();
-		void OnNewConnection(boost::shared_ptr<CSMPPConnection> conn, const boost::system::error_code& error);
+		/*!
+		 * \brief An io_service together with the threads running it
+		 * With the per-core model there is one of these for each core, every one
+		 * of them with a single thread and, optionally, its own acceptor
+		 */
+		struct IOContext
+		{
+			IOContext(unsigned int index);
+
+			unsigned int             index;
+			ioservice_t              ioservice;
+			ioservice_t::work        work;
+			acceptor_t               acceptor; // must be declared after ioservice
+			std::vector<ThreadPtr>   threads;
+		};
+		typedef boost::shared_ptr<IOContext> IOContextPtr;
+
+		void OpenAcceptor(IOContextPtr context, bool reusePort);
+		IOContextPtr NextContext(IOContextPtr acceptingContext);
+		void RunIOService(IOContextPtr context, int cpu);
+		void AcceptConnection(IOContextPtr context);
+		void OnNewConnection(IOContextPtr context, boost::shared_ptr<CSMPPConnection> conn, const boost::system::error_code& error);
 		void OnNewPDUHandler(SMPPConnectionPtr sender, boost::shared_ptr<ISMPPCommand> cmd);
 		void OnConnectionError(SMPPConnectionPtr sender);
 
-		volatile bool            m_running;
-		unsigned short           m_port;
-		ioservice_t              m_ioservice;
-		ioservice_t::work        m_work;
-		acceptor_t               m_acceptor; // must be declared after m_ioservice
-		std::vector<ThreadPtr>   m_threads;
-		size_t                   m_connectionCounter;
-		boost::mutex             m_mutex;
+		volatile bool             m_running;
+		unsigned short            m_port;
+		ServerSettings            m_settings;
+		std::vector<IOContextPtr> m_contexts;
+		bool                      m_roundRobin;
+		size_t                    m_nextContext;
+		size_t                    m_connectionCounter;
+		boost::shared_ptr<CInboundLimiter>         m_inboundLimiter;
+		boost::mutex              m_mutex;
 		boost::shared_ptr<CSMPPUserManager>        m_userManager;
 	};
 
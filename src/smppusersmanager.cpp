@@ -13,15 +13,26 @@
 
 #include "smppusersmanager.hpp"
 #include "smppcommands.hpp"
+#include "pduview.hpp"
+#include "messagestore.hpp"
+#include "workerpool.hpp"
+#include "tokenbucket.hpp"
+#include "deliveryreceipt.hpp"
 #include "iconv/gsm7.h"
 #include "converter.hpp"
 #include "logger.h"
 
+#include <boost/bind.hpp>
 #include <boost/make_shared.hpp>
+#include <boost/uuid/uuid.hpp>
+#include <boost/uuid/uuid_generators.hpp>
+#include <boost/uuid/detail/sha1.hpp>
 #include <boost/algorithm/string.hpp>
 #include <boost/lexical_cast.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
 
 #include <vector>
+#include <algorithm>
 
 
 #define KEEP_ALIVE_TIMEOUT  50
@@ -46,6 +57,24 @@ static BindType bindtype_to_logintype(int cmd)
 	return (BindType)-1;
 }
 
+static int DeliveryResultToStatus(DeliveryResult res)
+{
+	switch (res)
+	{
+		case DELIVERY_OK:
+			return ESME_ROK;
+		case DELIVERY_REJECTED:
+			return ESME_RTHROTTLED;
+		case DELIVERY_INV_SRC_ADDR:
+			return ESME_RINVSRCADR;
+		case DELIVERY_INV_DEST_ADDR:
+			return ESME_RINVDSTADR;
+		case DELIVERY_UNKNOWN_ERROR:
+		default:
+			return ESME_RSYSERR;
+	}
+}
+
 static string ConvertTextToUTF8(uint8_t data_coding, const string &text) {
 	const char *charset = CConverter::GetCharsetFromDataCoding(data_coding);
 	CConverter conv(charset, "UTF-8");
@@ -75,7 +104,10 @@ static string ConvertTextToGSM7(const string &utf8String)
 class UserAddress
 {
 public:
-	virtual bool matches(const std::string& address) = 0;
+	virtual bool matches(const boost::string_ref& address) = 0;
+
+	/*! Adds the destinations that may match, in string order, to \p spans */
+	virtual void spans(CMessageStore::AddressSpans& spans) const = 0;
 };
 
 /*!
@@ -88,11 +120,18 @@ public:
 		: m_address(address)
 	{ }
 
-	bool matches(const std::string& address)
+	bool matches(const boost::string_ref& address)
 	{
 		return (address == m_address);
 	}
 
+	void spans(CMessageStore::AddressSpans& spans) const
+	{
+		CMessageStore::AddressSpan span;
+		span.first = span.last = m_address;
+		spans.push_back(span);
+	}
+
 private:
 	std::string m_address;
 };
@@ -110,23 +149,48 @@ public:
 		m_endInt = atoi(m_addressEnd.c_str());
 	}
 
-	bool matches(const std::string& address)
+	bool matches(const boost::string_ref& address)
 	{
-		if (address.size() < m_addressStart.size() || address.size() > m_addressEnd.size())
+		if (address.empty() || address.size() < m_addressStart.size() || address.size() > m_addressEnd.size())
 		{ // early validation to make sure boundaries are fine
 			return false;
 		}
 
-		char *first_not_number = NULL;
-		int address_int = (int)strtol(address.c_str(), &first_not_number, 10);
-		if (first_not_number && *first_not_number)
-		{ // not a valid number
-			return 0;
+		long long address_int = 0;
+		for (size_t i = 0; i < address.size(); i++)
+		{
+			if (address[i] < '0' || address[i] > '9')
+			{ // not a valid number
+				return false;
+			}
+			address_int = address_int * 10 + (address[i] - '0');
 		}
 
 		return ((address_int >= m_startInt) && (address_int <= m_endInt));
 	}
 
+	void spans(CMessageStore::AddressSpans& spans) const
+	{ // numbers of the same length sort as strings, leading zeros included
+		long long limit = 1;
+		for (size_t length = 1; length <= m_addressEnd.size(); length++)
+		{
+			limit *= 10;
+			long long first = std::max(m_startInt, 0);
+			long long last = std::min((long long)m_endInt, limit - 1);
+			if (length < m_addressStart.size() || first > last) {
+				continue;
+			}
+
+			char buffer[32];
+			CMessageStore::AddressSpan span;
+			sprintf(buffer, "%0*lld", (int)length, first);
+			span.first = buffer;
+			sprintf(buffer, "%0*lld", (int)length, last);
+			span.last = buffer;
+			spans.push_back(span);
+		}
+	}
+
 private:
 	std::string m_addressStart;
 	std::string m_addressEnd;
@@ -142,7 +206,7 @@ class SMPPUser
 public:
 	SMPPUser() : errCount(0), lastKeepAlive(0) {}
 
-	bool ownsAddress(const std::string& address)
+	bool ownsAddress(const boost::string_ref& address)
 	{
 		vector<shared_ptr<UserAddress> >::const_iterator it, end;
 		for (it = m_addresses.begin(), end = m_addresses.end(); it != end; it++)
@@ -161,10 +225,23 @@ public:
 		m_addresses.push_back(address);
 	}
 
+	CMessageStore::AddressSpans addressSpans() const
+	{
+		CMessageStore::AddressSpans spans;
+		vector<shared_ptr<UserAddress> >::const_iterator it, end;
+		for (it = m_addresses.begin(), end = m_addresses.end(); it != end; it++)
+		{
+			(*it)->spans(spans);
+		}
+		return spans;
+	}
+
 	std::vector<boost::shared_ptr<UserAddress> > m_addresses;
 
 
 	SMPPConnectionPtr         connection;
+	boost::scoped_ptr<CTokenBucket> throughput; // empty if there is no limit
+	CMessageStore::Cursor     stored;     // queues of the store this one drains
 	int                       bindMode;
 	std::string               systemId;
 	unsigned int              errCount;
@@ -172,11 +249,151 @@ public:
 };
 
 
+/*!
+ * What the callback validates besides the system_id, a bind is taken from the
+ * cache only if all of it is the same. Only a digest of it is kept
+ */
+struct BindCredentials
+{
+	uuids::detail::sha1::digest_type  digest;
+
+	bool operator==(const BindCredentials& other) const
+	{
+		// every word is compared, the time taken tells nothing about the password
+		unsigned int diff = 0;
+		for (size_t i = 0; i < sizeof(digest) / sizeof(digest[0]); i++) {
+			diff |= digest[i] ^ other.digest[i];
+		}
+		return diff == 0;
+	}
+};
+
+/*!
+ * Remembers the credentials of users that were validated not so long ago, as
+ * a SHA-1 digest salted with random bytes chosen when the cache is created
+ */
+class CredentialCache
+{
+public:
+	CredentialCache(unsigned int ttl)
+	 : m_ttl(ttl), m_salt(uuids::random_generator()()), m_lastPurge(0)
+	{ }
+
+	shared_ptr<const BindCredentials> Digest(BindType bindType, const string& password, const string& addressRange) const
+	{
+		uuids::detail::sha1 sha1;
+		sha1.process_bytes(m_salt.data, m_salt.size());
+		unsigned int type = (unsigned int)bindType;
+		sha1.process_bytes(&type, sizeof(type));
+		// lengths first, so the password cannot run into the address range
+		unsigned int length = (unsigned int)password.size();
+		sha1.process_bytes(&length, sizeof(length));
+		sha1.process_bytes(password.data(), password.size());
+		length = (unsigned int)addressRange.size();
+		sha1.process_bytes(&length, sizeof(length));
+		sha1.process_bytes(addressRange.data(), addressRange.size());
+
+		shared_ptr<BindCredentials> credentials = make_shared<BindCredentials>();
+		sha1.get_digest(credentials->digest);
+		return credentials;
+	}
+
+	bool Check(const string& systemId, const BindCredentials& credentials)
+	{
+		map<string, Entry>::iterator it = m_entries.find(systemId);
+		if (it == m_entries.end()) {
+			return false;
+		}
+		if (it->second.expires < time(NULL))
+		{ // too old, validate it again
+			m_entries.erase(it);
+			return false;
+		}
+		return *it->second.credentials == credentials;
+	}
+
+	void Store(const string& systemId, shared_ptr<const BindCredentials> credentials)
+	{
+		time_t now = time(NULL);
+		if (m_entries.size() > 64 && m_lastPurge + (time_t)m_ttl < now)
+		{ // don't let expired users pile up
+			for (map<string, Entry>::iterator it = m_entries.begin(); it != m_entries.end(); ) {
+				if (it->second.expires < now) {
+					m_entries.erase(it++);
+				} else {
+					++it;
+				}
+			}
+			m_lastPurge = now;
+		}
+		Entry &entry = m_entries[systemId];
+		entry.credentials = credentials;
+		entry.expires = now + m_ttl;
+	}
+
+private:
+	struct Entry
+	{
+		shared_ptr<const BindCredentials> credentials;
+		time_t                            expires;
+	};
+
+	const unsigned int  m_ttl;
+	const uuids::uuid   m_salt;
+	time_t              m_lastPurge;
+	map<string, Entry>  m_entries;
+};
+
+/*!
+ * Handed to the callback to complete a bind, if the callback forgets about
+ * it the bind fails when the last reference is gone
+ */
+class BindValidation : public CBindValidation
+{
+public:
+	BindValidation(shared_ptr<CSMPPUserManager> manager, SMPPConnectionPtr conn,
+			shared_ptr<ISMPPCommand> cmd, shared_ptr<SMPPUser> user, shared_ptr<const BindCredentials> credentials)
+	 : m_completed(false), m_manager(manager), m_conn(conn), m_cmd(cmd), m_user(user), m_credentials(credentials)
+	{ }
+
+	~BindValidation()
+	{
+		if (!m_completed.load())
+		{
+			smpp_log_warning("Validation of connection %u has been abandoned", m_conn->GetConnectionId());
+			Complete(LOGIN_RESULT_FAIL);
+		}
+	}
+
+	void Complete(LoginResult result)
+	{
+		if (m_completed.exchange(true)) {
+			return; // only once
+		}
+		if (shared_ptr<CSMPPUserManager> manager = m_manager.lock()) {
+			manager->CompleteBind(m_conn, m_cmd, m_user, result, m_credentials);
+		}
+	}
+
+private:
+	boost::atomic<bool>           m_completed;
+	weak_ptr<CSMPPUserManager>    m_manager;
+	SMPPConnectionPtr             m_conn;
+	shared_ptr<ISMPPCommand>      m_cmd;
+	shared_ptr<SMPPUser>          m_user;
+	shared_ptr<const BindCredentials> m_credentials;
+};
+
 
 CSMPPUserManager::CSMPPUserManager(shared_ptr<CSMSCCallback> callbacks)
  : m_encoding(DATA_CODING_UTF8)
+ , m_nextReceiver(0)
+ , m_index(0, 0)
  , m_callbacks(callbacks)
 {
+	libSMPP_CreateDefaultServerSettings(&m_settings);
+	m_index.SetLimits(m_settings.MaxIndexedMessages, m_settings.MessageIndexTTL);
+	m_multiWorkers.reset(new CWorkerPool(m_settings.SubmitMultiThreads));
 	m_threadKeepAlive = thread(&CSMPPUserManager::KeepAliveThread, this);
 }
 
@@ -209,6 +426,15 @@ bool CSMPPUserManager::OnCommand(shared_ptr<CSMPPConnection> conn, shared_ptr<IS
 
 	if (!m_clients.count(connectionId))
 	{
+		if (m_bindsInProgress.count(connectionId))
+		{ // wait for the bind response, dude!
+			lock.unlock();
+			bool isBind = (cmd->request_id() == BIND_RECEIVER || cmd->request_id() == BIND_TRANSMITTER || cmd->request_id() == BIND_TRANSCEIVER);
+			cmd->command_status(isBind ? ESME_RALYBND : ESME_RINVBNDSTS);
+			conn->SendResponse(cmd);
+			return true;
+		}
+
 		if (cmd->request_id() != BIND_RECEIVER && cmd->request_id() != BIND_TRANSMITTER && cmd->request_id() != BIND_TRANSCEIVER)
 		{
 			status = ESME_RINVBNDSTS;
@@ -283,53 +509,45 @@ bool CSMPPUserManager::OnCommand(shared_ptr<CSMPPConnection> conn, shared_ptr<IS
 				}
 			}
 
-			// this is a big move... will be fine if I release the lock here?
-			// should be...
+			if (m_settings.MaxConcurrentBinds && m_bindsInProgress.size() >= m_settings.MaxConcurrentBinds)
+			{ // let the ESME try again later, the callback is not bothered
+				smpp_log_info("Rejecting BIND request on connection %u, there are %u binds being validated",
+					connectionId, (unsigned int)m_bindsInProgress.size());
+				status = ESME_RTHROTTLED;
+				goto send_response;
+			}
+
+			shared_ptr<const BindCredentials> credentials;
+			if (m_credentials)
+			{
+				credentials = m_credentials->Digest(bindtype_to_logintype(cmd->request_id()),
+						cmdBind->getPasssword(), user_addresses);
+				if (m_credentials->Check(user->systemId, *credentials))
+				{ // validated not so long ago, skip the callback
+					smpp_log_info("BIND request on connection %u validated from the credentials cache", connectionId);
+					lock.unlock();
+					CompleteBind(conn, cmd, user, LOGIN_RESULT_OK, shared_ptr<const BindCredentials>());
+					return true;
+				}
+			}
+
+			// from now on the bind is in the hands of the callback, which may take
+			// its time on a different thread, requests from the connection
+			// are rejected until it's done
+			m_bindsInProgress.insert(connectionId);
 			lock.unlock();
 
-			LoginResult res = m_callbacks->ValidateUser(connectionId, bindtype_to_logintype(cmd->request_id()),
-					user->systemId, cmdBind->getPasssword(), user_addresses
+			shared_ptr<CBindValidation> validation(
+					new BindValidation(shared_from_this(), conn, cmd, user, credentials)
 				);
 
-			// But I must acquire the lock as soon as the callback ends
-			// A lot can happen while the callback has the control flow,
-			// but, for this client, no request will be attended
-			lock.lock();
-
-			switch(res)
-			{
-			case LOGIN_RESULT_OK:
-				smpp_log_info("BIND request on connection %u accepted", connectionId);
-				status = ESME_ROK;
-				cmdBind->setResponseSystemId("SMSC");
-				break;
-			case LOGIN_RESULT_INVALIDPWD:
-				smpp_log_info("Rejecting BIND request on connection %u due to invalid password", connectionId);
-				status = ESME_RINVPASWD;
-				break;
-			case LOGIN_RESULT_INVALIDUSR:
-				smpp_log_info("Rejecting BIND request on connection %u due to invalid systemId", connectionId);
-				status = ESME_RINVSYSID;
-				break;
-			case LOGIN_RESULT_INVALIDCMD:
-				smpp_log_info("Rejecting BIND request on connection %u due to... invalid command? really? that's my job dude!", connectionId);
-				status = ESME_RINVCMDID;
-			default: // LOGIN_RESULT_INALIDADDR or LOGIN_RESULT_FAIL
-				smpp_log_info("Rejecting BIND request on connection %u due to some user-specific error", connectionId);
-				status = ESME_RBINDFAIL;
-				break;
-			}
-		}
+			m_callbacks->ValidateUserAsync(connectionId, bindtype_to_logintype(cmd->request_id()),
+					user->systemId, cmdBind->getPasssword(), user_addresses, validation
+				);
 
-		if(status == ESME_ROK)
-		{
-			m_clients.insert(make_pair(connectionId, user));
-			m_newClientCondition.notify_one();
+			return true;
 		}
 
-		// we dont need the lock anymore...
-		lock.unlock();
-
 send_response:
 		// set and send the response status
 		cmd->command_status(status);
@@ -365,11 +583,11 @@ send_response:
 		return false;
 	}
 
-	if(cmd->request_id() == SUBMIT_SM)
+	if(cmd->request_id() == SUBMIT_SM || cmd->request_id() == DATA_SM)
 	{
 		lock.unlock();
 
-		smpp_log_profile(" ==>> SUBMIT_SM");
+		smpp_log_profile(" ==>> %s", cmd->request_id() == SUBMIT_SM ? "SUBMIT_SM" : "DATA_SM");
 
 		if (user->bindMode == BIND_RECEIVER)
 		{ // only transmitter and transceiver can send messages
@@ -378,67 +596,64 @@ send_response:
 			return true;
 		}
 
-		shared_ptr<CSMPPSubmitSingle> cmdSubmit = dynamic_pointer_cast<CSMPPSubmitSingle>(cmd);
-		if(!cmdSubmit)
-		{ // this should never happen!
-			cmd->command_status(ESME_RUNKNOWNERR);
+		if (user->throughput && !user->throughput->TryConsume())
+		{ // over the contracted throughput, the callback is not bothered
+			cmd->command_status(ESME_RTHROTTLED);
 			conn->SendResponse(cmd);
 			return true;
 		}
 
-		string from = cmdSubmit->getSourceAddress();
-		string to = cmdSubmit->getDestinationAddress();
-
-		if (user->bindMode != BIND_TRANSMITTER)
-		{ // check user addresses for conflict
-			if (!user->ownsAddress(from))
-			{ // user does not own the addres is sending from
-				cmd->command_status(ESME_RINVSRCADR);
-				conn->SendResponse(cmd);
-				return true;
-			}
-			else if (user->ownsAddress(to))
-			{ // user is sending a message to it self
-				cmd->command_status(ESME_RINVDSTADR);
-				conn->SendResponse(cmd);
-				return true;
-			}
+		if (cmd->request_id() == SUBMIT_SM) {
+			SubmitSingle<CSMPPSubmitSingle>(conn, cmd, user);
+		} else {
+			SubmitSingle<CSMPPDataSm>(conn, cmd, user);
 		}
+		return true;
+	}
 
-		string text = ConvertTextToUTF8(cmdSubmit->request().data_coding, cmdSubmit->getText());
+	if(cmd->request_id() == SUBMIT_MULTI)
+	{
+		lock.unlock();
 
-		if (m_callbacks)
-		{ // callbacks are set only once, it's safe to check/call here
-			DeliveryResult res = m_callbacks->DeliverMessage(connectionId, from, to, text);
-			switch (res)
-			{
-				case DELIVERY_OK:
-					status = ESME_ROK;
-					break;
-				case DELIVERY_REJECTED:
-					status = ESME_RTHROTTLED;
-					break;
-				case DELIVERY_INV_SRC_ADDR:
-					status = ESME_RINVSRCADR;
-					break;
-				case DELIVERY_INV_DEST_ADDR:
-					status = ESME_RINVDSTADR;
-					break;
-				case DELIVERY_UNKNOWN_ERROR:
-				default:
-					status = ESME_RSYSERR;
-					break;
-			}
-		}
-		else
-		{
-			cmd.reset(new CSMPPGenericNack(cmd->sequence_number()));
-			status = ESME_ROK;
+		smpp_log_profile(" ==>> SUBMIT_MULTI");
+
+		if (user->bindMode == BIND_RECEIVER || !m_callbacks)
+		{ // only transmitter and transceiver can send messages
+			cmd->command_status(ESME_RINVCMDID);
+			conn->SendResponse(cmd);
+			return true;
 		}
 
-		cmd->command_status(status);
-		conn->SendResponse(cmd);
+		SubmitMulti(conn, cmd, user);
+		return true;
+	}
+
+	if (cmd->request_id() == QUERY_SM)
+	{
+		lock.unlock();
+		smpp_log_profile(" ==>> QUERY_SM");
+		QueryMessage(conn, cmd, user);
+		return true;
+	}
+
+	if (cmd->request_id() == CANCEL_SM || cmd->request_id() == REPLACE_SM)
+	{
+		lock.unlock();
+
+		smpp_log_profile(" ==>> %s", cmd->request_id() == CANCEL_SM ? "CANCEL_SM" : "REPLACE_SM");
+
+		if (user->bindMode == BIND_RECEIVER || !m_callbacks)
+		{ // only the ones who can submit can change their messages
+			cmd->command_status(ESME_RINVCMDID);
+			conn->SendResponse(cmd);
+			return true;
+		}
 
+		if (cmd->request_id() == CANCEL_SM) {
+			CancelMessage(conn, cmd, user);
+		} else {
+			ReplaceMessage(conn, cmd, user);
+		}
 		return true;
 	}
 
@@ -460,37 +675,730 @@ send_response:
 }
 
 
+int CSMPPUserManager::CheckInbound(shared_ptr<CSMPPConnection> conn, const CPDUView& pdu)
+{
+	if (pdu.command_id() != SUBMIT_SM && pdu.command_id() != DATA_SM) {
+		return ESME_ROK;
+	}
+
+	UserRef user;
+	{
+		lock_guard<mutex> lock(m_mutex);
+		map<int, UserRef>::const_iterator it = m_clients.find(conn->GetConnectionId());
+		if (it == m_clients.end())
+		{ // not bound, or the bind is still being validated
+			return ESME_RINVBNDSTS;
+		}
+		user = it->second;
+	}
+
+	if (user->bindMode == BIND_RECEIVER)
+	{ // only transmitter and transceiver can send messages
+		return ESME_RINVCMDID;
+	}
+
+	if (user->bindMode != BIND_TRANSMITTER)
+	{ // check user addresses for conflict
+		if (!user->ownsAddress(pdu.source_addr()))
+		{ // user does not own the addres is sending from
+			return ESME_RINVSRCADR;
+		}
+		if (user->ownsAddress(pdu.destination_addr()))
+		{ // user is sending a message to it self
+			return ESME_RINVDSTADR;
+		}
+	}
+
+	return ESME_ROK;
+}
+
 void CSMPPUserManager::SetDeliveryEncoding(DataCoding data_coding)
 {
 	lock_guard<mutex> lock(m_mutex);
 	m_encoding = data_coding;
 }
 
+void CSMPPUserManager::SetSettings(const ServerSettings& settings)
+{
+	// the old pool finishes its jobs once the lock is released
+	shared_ptr<CWorkerPool> oldWorkers;
+
+	lock_guard<mutex> lock(m_mutex);
+	memcpy(&m_settings, &settings, sizeof(ServerSettings));
+	if (m_multiWorkers->GetThreads() != m_settings.SubmitMultiThreads)
+	{
+		oldWorkers = m_multiWorkers;
+		m_multiWorkers.reset(new CWorkerPool(m_settings.SubmitMultiThreads));
+	}
+	m_credentials.reset();
+	if (m_settings.CredentialCacheTTL) {
+		m_credentials.reset(new CredentialCache(m_settings.CredentialCacheTTL));
+	}
+	if (!m_store && (m_settings.MaxQueuedMessages || m_settings.QueueJournalPath))
+	{ // the journal is opened once, later changes are ignored
+		m_store.reset(new CMessageStore(m_settings.MaxQueuedMessages,
+				m_settings.QueueJournalPath ? m_settings.QueueJournalPath : ""));
+	}
+	m_index.SetLimits(m_settings.MaxIndexedMessages, m_settings.MessageIndexTTL);
+	m_settings.QueueJournalPath = NULL; // not ours
+}
+
+void CSMPPUserManager::CompleteBind(SMPPConnectionPtr conn, shared_ptr<ISMPPCommand> cmd, UserRef user,
+                                    LoginResult res, shared_ptr<const BindCredentials> credentials)
+{
+	int status;
+	unsigned int connectionId = conn->GetConnectionId();
+	ISMPPBind *cmdBind = dynamic_cast<ISMPPBind*>(cmd.get());
+
+	switch(res)
+	{
+	case LOGIN_RESULT_OK:
+		smpp_log_info("BIND request on connection %u accepted", connectionId);
+		status = ESME_ROK;
+		cmdBind->setResponseSystemId("SMSC");
+		if (user->bindMode != BIND_RECEIVER)
+		{ // receivers cannot submit
+			unsigned int rate = m_settings.DefaultSubmitRate, burst = m_settings.DefaultSubmitBurst;
+			m_callbacks->GetUserThroughput(connectionId, user->systemId, rate, burst);
+			if (rate)
+			{
+				smpp_log_info("Connection %u is allowed %u messages per second (burst %u)", connectionId, rate, burst);
+				user->throughput.reset(new CTokenBucket(rate, burst));
+			}
+		}
+		break;
+	case LOGIN_RESULT_INVALIDPWD:
+		smpp_log_info("Rejecting BIND request on connection %u due to invalid password", connectionId);
+		status = ESME_RINVPASWD;
+		break;
+	case LOGIN_RESULT_INVALIDUSR:
+		smpp_log_info("Rejecting BIND request on connection %u due to invalid systemId", connectionId);
+		status = ESME_RINVSYSID;
+		break;
+	case LOGIN_RESULT_INVALIDCMD:
+		smpp_log_info("Rejecting BIND request on connection %u due to... invalid command? really? that's my job dude!", connectionId);
+		status = ESME_RINVCMDID;
+	default: // LOGIN_RESULT_INALIDADDR or LOGIN_RESULT_FAIL
+		smpp_log_info("Rejecting BIND request on connection %u due to some user-specific error", connectionId);
+		status = ESME_RBINDFAIL;
+		break;
+	}
+
+	{
+		lock_guard<mutex> lock(m_mutex);
+		m_bindsInProgress.erase(connectionId);
+
+		if (!conn->socket().is_open())
+		{ // the ESME got tired of waiting
+			smpp_log_info("Connection %u was closed while validating the BIND request", connectionId);
+			return;
+		}
+
+		if(status == ESME_ROK)
+		{
+			m_clients.insert(make_pair(connectionId, user));
+			m_newClientCondition.notify_one();
+			if (m_credentials && credentials) {
+				m_credentials->Store(user->systemId, credentials);
+			}
+		}
+	}
+
+	// set and send the response status
+	cmd->command_status(status);
+	conn->SendResponse(cmd);
+
+	if (status != ESME_ROK)
+	{ // the server does not know about this one
+		conn->CloseDeferred(CLOSE_CONNECTION_DELAY);
+	}
+	else if (m_store && user->bindMode != BIND_TRANSMITTER)
+	{ // messages may be waiting for this one
+		DrainStore(user);
+	}
+}
+
 DeliveryResult CSMPPUserManager::SendMessage(const string &from,  const string &to, const string &message)
 {
-	bool bFound = false;
-	SMPPConnectionPtr conn;
+	switch (m_store ? m_store->PushBehind(from, to, message) : CMessageStore::NOT_WAITING)
+	{
+	case CMessageStore::PUSHED: // the messages stored for the destination go first
+		smpp_log_debug("Message to %s queued behind the stored ones", to.c_str());
+		return DELIVERY_QUEUED;
+	case CMessageStore::FULL: // sending it now would get it ahead of them
+		smpp_log_info("Refusing message to %s, the store is full", to.c_str());
+		return DELIVERY_REJECTED;
+	case CMessageStore::NOT_WAITING:
+		break;
+	}
+
+	SMPPConnectionPtr conn = SelectReceiver(from, to);
+
+	if(!conn)
+	{
+		if (m_store && m_store->Push(from, to, message))
+		{ // to be sent when the receiver binds
+			smpp_log_debug("Message to %s stored, there are %u messages waiting", to.c_str(), (unsigned int)m_store->Size());
+			return DELIVERY_QUEUED;
+		}
+		return DELIVERY_INV_DEST_ADDR;
+	}
+
+	shared_ptr<CSMPPDelivery> cmd = CreateDelivery(conn, from, to, message);
+
+	int res = conn->SendRequest(cmd->shared_from_this());
+
+	if(res != RESULT_OK)
+	{
+		return DELIVERY_UNKNOWN_ERROR;
+	}
+
+	if(cmd->command_status() != ESME_ROK)
+	{
+		return DELIVERY_REJECTED;
+	}
+
+	return DELIVERY_OK;
+}
+
+template <class Command>
+void CSMPPUserManager::SubmitSingle(SMPPConnectionPtr conn, shared_ptr<ISMPPCommand> icmd, UserRef user)
+{
+	int status;
+	unsigned int connectionId = conn->GetConnectionId();
+
+	shared_ptr<Command> cmd = dynamic_pointer_cast<Command>(icmd);
+	if(!cmd)
+	{ // this should never happen!
+		icmd->command_status(ESME_RUNKNOWNERR);
+		conn->SendResponse(icmd);
+		return;
+	}
+
+	// the addresses were checked by CheckInbound before the PDU was decoded
+	string from = cmd->getSourceAddress();
+	string to = cmd->getDestinationAddress();
+
+	string text = ConvertTextToUTF8(cmd->request().data_coding, cmd->getText());
+
+	if (!m_callbacks)
+	{
+		shared_ptr<ISMPPCommand> nack = make_command<CSMPPGenericNack>(cmd->sequence_number());
+		conn->SendResponse(nack);
+		return;
+	}
+
+	// callbacks are set only once, it's safe to check/call here
+	string messageId = m_idGenerator.Next();
+
+	// indexed before the callback, the application may report its state right away
+	MessageRecord record;
+	record.connectionId = connectionId;
+	record.systemId = user->systemId;
+	record.source = from;
+	record.destination = to;
+	record.registeredDelivery = cmd->request().registered_delivery;
+	record.state = MESSAGE_STATE_ENROUTE;
+	record.errorCode = 0;
+	record.submitted = time(NULL);
+	record.done = 0;
+	m_index.Add(messageId, record);
+
+	DeliveryResult res = m_callbacks->DeliverMessageWithId(connectionId, from, to, text, messageId);
+	status = DeliveryResultToStatus(res);
+
+	if (status == ESME_ROK) {
+		cmd->setMessageId(messageId);
+	} else {
+		m_index.Remove(messageId);
+	}
+
+	cmd->command_status(status);
+	conn->SendResponse(cmd);
+}
+
+/*! Invoked when the ESME answers a receipt, nothing else to do but logging */
+static void OnReceiptDelivered(string messageId, int result, shared_ptr<ISMPPCommand> cmd)
+{
+	if (result != RESULT_OK || cmd->command_status() != ESME_ROK) {
+		smpp_log_warning("The receipt of message %s was not delivered, result %d", messageId.c_str(), result);
+	}
+}
+
+/*! \return \c true if \p state is not going to change */
+static bool IsFinalState(MessageState state)
+{
+	return state != MESSAGE_STATE_ENROUTE && state != MESSAGE_STATE_SCHEDULED;
+}
+
+DeliveryResult CSMPPUserManager::ReportMessageState(const string &messageId, MessageState state, unsigned int errorCode)
+{
+	MessageRecord record;
+	if (!m_index.Update(messageId, state, errorCode, record)) {
+		return DELIVERY_UNKNOWN_ERROR;
+	}
+
+	if (record.destinations.empty()) {
+		return SendReceipt(messageId, record);
+	}
+
+	// a SUBMIT_MULTI, every destination takes the state
+	DeliveryResult result = DELIVERY_OK;
+	for (size_t i = 0; i < record.destinations.size(); i++)
+	{
+		MessageRecord destRecord;
+		if (!m_index.Update(CMessageIndex::DestinationKey(messageId, record.destinations[i]), state, errorCode, destRecord))
+		{ // it was not accepted
+			continue;
+		}
+		DeliveryResult res = SendReceipt(messageId, destRecord);
+		if (res != DELIVERY_OK) {
+			result = res;
+		}
+	}
+	return result;
+}
+
+DeliveryResult CSMPPUserManager::ReportMessageState(const string &messageId, const string &destination,
+                                                    MessageState state, unsigned int errorCode)
+{
+	MessageRecord record;
+	if (!m_index.Update(CMessageIndex::DestinationKey(messageId, destination), state, errorCode, record))
+	{ // may have been submitted with SUBMIT_SM
+		if (!m_index.Find(messageId, record) || !record.destinations.empty() || record.destination != destination) {
+			return DELIVERY_UNKNOWN_ERROR;
+		}
+		return ReportMessageState(messageId, state, errorCode);
+	}
+
+	MessageRecord message;
+	if (IsFinalState(state) && m_index.Find(messageId, message))
+	{ // the message is done once all of its destinations are
+		bool done = true;
+		for (size_t i = 0; i < message.destinations.size() && done; i++)
+		{
+			MessageRecord other;
+			if (m_index.Find(CMessageIndex::DestinationKey(messageId, message.destinations[i]), other)) {
+				done = IsFinalState(other.state);
+			}
+		}
+		if (done) {
+			m_index.Update(messageId, state, errorCode, message);
+		}
+	}
+
+	return SendReceipt(messageId, record);
+}
+
+DeliveryResult CSMPPUserManager::SendReceipt(const string &messageId, const MessageRecord& record)
+{
+	MessageState state = record.state;
+	bool final = IsFinalState(state);
+	bool wanted;
+	switch (record.registeredDelivery & REGISTERED_DELIVERY_MASK)
+	{
+	case REGISTERED_DELIVERY_FINAL:
+		wanted = final;
+		break;
+	case REGISTERED_DELIVERY_FAILURE:
+		wanted = final && state != MESSAGE_STATE_DELIVERED;
+		break;
+	default:
+		wanted = false;
+		break;
+	}
+	if (!final && (record.registeredDelivery & REGISTERED_DELIVERY_INTERMEDIATE)) {
+		wanted = true;
+	}
+
+	if (!wanted) {
+		return DELIVERY_OK;
+	}
+
+	SMPPConnectionPtr conn = SelectReceiptReceiver(record);
+	if (!conn) {
+		return DELIVERY_INV_DEST_ADDR;
+	}
+
+	// pipelined, the application is not kept waiting for the ESME
+	shared_ptr<CSMPPDelivery> cmd = CreateReceipt(conn, messageId, record);
+	conn->SendRequestAsync(cmd->shared_from_this(), bind(&OnReceiptDelivered, messageId, _1, _2));
+	return DELIVERY_OK;
+}
+
+
+/*!
+ * A SUBMIT_MULTI being delivered, each destination is handed to the callback
+ * on its own and the last one to finish sends the response
+ */
+struct MultiDelivery
+{
+	SMPPConnectionPtr              conn;
+	shared_ptr<CSMPPSubmitMulti>   cmd;
+	string                         from;
+	string                         text;
+	string                         messageId;
+	vector<string>                 destinations;
+	vector<int>                    status;
+	boost::atomic<unsigned int>    remaining;
+};
+
+void CSMPPUserManager::SubmitMulti(SMPPConnectionPtr conn, shared_ptr<ISMPPCommand> cmd, UserRef user)
+{
+	shared_ptr<CSMPPSubmitMulti> cmdSubmit = dynamic_pointer_cast<CSMPPSubmitMulti>(cmd);
+	if(!cmdSubmit)
+	{ // this should never happen!
+		cmd->command_status(ESME_RUNKNOWNERR);
+		conn->SendResponse(cmd);
+		return;
+	}
+
+	shared_ptr<MultiDelivery> delivery = make_shared<MultiDelivery>();
+	delivery->conn = conn;
+	delivery->cmd = cmdSubmit;
+	delivery->from = cmdSubmit->getSourceAddress();
+	delivery->destinations = cmdSubmit->getDestinations();
+
+	vector<string> lists = cmdSubmit->getDistributionLists();
+	if (delivery->destinations.empty() && lists.empty())
+	{
+		cmd->command_status(ESME_RINVNUMDESTS);
+		conn->SendResponse(cmd);
+		return;
+	}
+
+	if (user->bindMode != BIND_TRANSMITTER && !user->ownsAddress(delivery->from))
+	{ // user does not own the addres is sending from
+		cmd->command_status(ESME_RINVSRCADR);
+		conn->SendResponse(cmd);
+		return;
+	}
+
+	// the text is decoded once for all the destinations
+	delivery->text = ConvertTextToUTF8(cmdSubmit->request().data_coding, cmdSubmit->getText());
+	// one id for the whole message, as in the response
+	delivery->messageId = m_idGenerator.Next();
+	cmdSubmit->setMessageId(delivery->messageId);
+
+	// there are no distribution lists here, they fail as another destination
+	delivery->destinations.insert(delivery->destinations.end(), lists.begin(), lists.end());
+	delivery->status.resize(delivery->destinations.size(), ESME_RINVDLNAME);
+
+	vector<size_t> pending;
+	pending.reserve(delivery->destinations.size() - lists.size());
+	for (size_t i = 0; i < delivery->destinations.size() - lists.size(); i++)
+	{ // the same checks of SUBMIT_SM, for every destination
+		if (user->bindMode != BIND_TRANSMITTER && user->ownsAddress(delivery->destinations[i])) {
+			delivery->status[i] = ESME_RINVDSTADR;
+		} else if (user->throughput && !user->throughput->TryConsume()) {
+			delivery->status[i] = ESME_RTHROTTLED;
+		} else {
+			pending.push_back(i);
+		}
+	}
+
+	if (!pending.empty())
+	{ // indexed before the callbacks, as in SUBMIT_SM, with a record per destination
+		MessageRecord record;
+		record.connectionId = conn->GetConnectionId();
+		record.systemId = user->systemId;
+		record.source = delivery->from;
+		record.registeredDelivery = cmdSubmit->request().registered_delivery;
+		record.state = MESSAGE_STATE_ENROUTE;
+		record.errorCode = 0;
+		record.submitted = time(NULL);
+		record.done = 0;
+		vector<string> destinations;
+		destinations.reserve(pending.size());
+		for (size_t i = 0; i < pending.size(); i++)
+		{
+			record.destination = delivery->destinations[pending[i]];
+			m_index.Add(CMessageIndex::DestinationKey(delivery->messageId, record.destination), record);
+			destinations.push_back(record.destination);
+		}
+		// only the record of the whole message lists them
+		record.destination.clear();
+		record.destinations.swap(destinations);
+		m_index.Add(delivery->messageId, record);
+	}
+
+	shared_ptr<CWorkerPool> workers;
+	{
+		lock_guard<mutex> lock(m_mutex);
+		workers = m_multiWorkers;
+	}
+
+	// one extra so nobody completes the delivery while it's still being dispatched
+	delivery->remaining = pending.size() + 1;
+	for (size_t i = 0; i < pending.size(); i++)
+	{
+		if (!workers->GetThreads())
+		{ // one after the other, right here
+			DeliverMultiDestination(delivery, pending[i]);
+			continue;
+		}
+		// in parallel, the network threads are left alone
+		workers->Post(bind(&CSMPPUserManager::DeliverMultiDestination, shared_from_this(), delivery, pending[i]));
+	}
+
+	if (delivery->remaining.fetch_sub(1) == 1) {
+		CompleteMulti(delivery);
+	}
+}
+
+void CSMPPUserManager::DeliverMultiDestination(shared_ptr<MultiDelivery> delivery, size_t index)
+{
+	DeliveryResult res = m_callbacks->DeliverMessageWithId(delivery->conn->GetConnectionId(),
+			delivery->from, delivery->destinations[index], delivery->text, delivery->messageId);
+	delivery->status[index] = DeliveryResultToStatus(res);
+
+	if (delivery->remaining.fetch_sub(1) == 1) {
+		CompleteMulti(delivery);
+	}
+}
+
+void CSMPPUserManager::CompleteMulti(shared_ptr<MultiDelivery> delivery)
+{
+	vector<pair<string, int> > failed;
+	for (size_t i = 0; i < delivery->destinations.size(); i++)
+	{
+		if (delivery->status[i] != ESME_ROK)
+		{ // there is nothing to report about it
+			failed.push_back(make_pair(delivery->destinations[i], delivery->status[i]));
+			m_index.Remove(CMessageIndex::DestinationKey(delivery->messageId, delivery->destinations[i]));
+		}
+	}
+	if (failed.size() == delivery->destinations.size()) {
+		m_index.Remove(delivery->messageId);
+	}
+
+	smpp_log_debug("SUBMIT_MULTI on connection %u delivered to %u out of %u destinations", delivery->conn->GetConnectionId(),
+		(unsigned int)(delivery->destinations.size() - failed.size()), (unsigned int)delivery->destinations.size());
+
+	delivery->cmd->setFailedAddresses(failed);
+	delivery->cmd->command_status(ESME_ROK);
+	delivery->conn->SendResponse(delivery->cmd);
+}
+
+bool CSMPPUserManager::FindUserMessage(UserRef user, const string &messageId, const string &source, MessageRecord &record)
+{
+	if (!m_index.Find(messageId, record)) {
+		return false;
+	}
+	// nobody gets to know about the messages of other ESMEs
+	return record.systemId == user->systemId && (source.empty() || source == record.source);
+}
+
+void CSMPPUserManager::QueryMessage(SMPPConnectionPtr conn, shared_ptr<ISMPPCommand> cmd, UserRef user)
+{
+	shared_ptr<CSMPPQuery> cmdQuery = dynamic_pointer_cast<CSMPPQuery>(cmd);
+
+	MessageRecord record;
+	if (!cmdQuery || !FindUserMessage(user, cmdQuery->getMessageId(), cmdQuery->getSourceAddress(), record))
+	{
+		cmd->command_status(ESME_RQUERYFAIL);
+		conn->SendResponse(cmd);
+		return;
+	}
+
+	string finalDate;
+	if (record.done)
+	{ // absolute time format, in UTC
+		char buffer[17];
+		tm date = posix_time::to_tm(posix_time::from_time_t(record.done));
+		strftime(buffer, sizeof(buffer), "%y%m%d%H%M%S000+", &date);
+		finalDate = buffer;
+	}
+
+	cmdQuery->setResult(finalDate, record.state, record.errorCode);
+	cmd->command_status(ESME_ROK);
+	conn->SendResponse(cmd);
+}
+
+void CSMPPUserManager::CancelMessage(SMPPConnectionPtr conn, shared_ptr<ISMPPCommand> cmd, UserRef user)
+{
+	shared_ptr<CSMPPCancel> cmdCancel = dynamic_pointer_cast<CSMPPCancel>(cmd);
+	string messageId = cmdCancel ? cmdCancel->getMessageId() : string();
+
+	// only one message at a time, cancelling by address is not supported
+	MessageRecord record;
+	if (!cmdCancel || !FindUserMessage(user, messageId, cmdCancel->getSourceAddress(), record))
+	{
+		cmd->command_status(ESME_RINVMSGID);
+		conn->SendResponse(cmd);
+		return;
+	}
+
+	if (record.done || m_callbacks->CancelMessage(conn->GetConnectionId(), messageId) != DELIVERY_OK)
+	{ // too late, or the application doesn't want to
+		cmd->command_status(ESME_RCANCELFAIL);
+		conn->SendResponse(cmd);
+		return;
+	}
+
+	cmd->command_status(ESME_ROK);
+	conn->SendResponse(cmd);
+
+	// the receipt, if asked for, goes after the response
+	ReportMessageState(messageId, MESSAGE_STATE_DELETED, 0);
+}
+
+void CSMPPUserManager::ReplaceMessage(SMPPConnectionPtr conn, shared_ptr<ISMPPCommand> cmd, UserRef user)
+{
+	shared_ptr<CSMPPReplace> cmdReplace = dynamic_pointer_cast<CSMPPReplace>(cmd);
+	string messageId = cmdReplace ? cmdReplace->getMessageId() : string();
+
+	MessageRecord record;
+	if (!cmdReplace || !FindUserMessage(user, messageId, cmdReplace->getSourceAddress(), record))
+	{
+		cmd->command_status(ESME_RINVMSGID);
+		conn->SendResponse(cmd);
+		return;
+	}
+
+	// replace_sm carries no data_coding, the text is taken as the SMSC default
+	string text = ConvertTextToUTF8(DATA_CODING_DEFAULT, cmdReplace->getText());
+	if (record.done || m_callbacks->ReplaceMessage(conn->GetConnectionId(), messageId, text) != DELIVERY_OK)
+	{
+		cmd->command_status(ESME_RREPLACEFAIL);
+		conn->SendResponse(cmd);
+		return;
+	}
+
+	record.registeredDelivery = cmdReplace->request().registered_delivery;
+	m_index.Set(messageId, record);
+	for (size_t i = 0; i < record.destinations.size(); i++)
+	{ // and every destination of a SUBMIT_MULTI
+		MessageRecord destRecord;
+		string key = CMessageIndex::DestinationKey(messageId, record.destinations[i]);
+		if (m_index.Find(key, destRecord))
+		{
+			destRecord.registeredDelivery = record.registeredDelivery;
+			m_index.Set(key, destRecord);
+		}
+	}
+
+	cmd->command_status(ESME_ROK);
+	conn->SendResponse(cmd);
+}
+
+SMPPConnectionPtr CSMPPUserManager::SelectReceiver(const string &from, const string &to)
+{
+	vector<SMPPConnectionPtr> receivers;
 
 	{
 		lock_guard<mutex> lock(m_mutex);
 		map<int, UserRef>::iterator it, end;
-		for (it = m_clients.begin(), end = m_clients.end(); !bFound && it != end; it++)
+		for (it = m_clients.begin(), end = m_clients.end(); it != end; it++)
 		{
-			if (it->second->ownsAddress(to))
+			if (it->second->bindMode != BIND_TRANSMITTER && it->second->ownsAddress(to))
 			{
-				bFound = true;
-				conn = it->second->connection;
-				break;
+				receivers.push_back(it->second->connection);
+				if (m_settings.DeliveryBalancing == DELIVERY_BALANCING_FIRST) {
+					break;
+				}
 			}
 		}
 	}
 
-	if(!bFound)
+	if (receivers.size() < 2) {
+		return receivers.empty() ? SMPPConnectionPtr() : receivers[0];
+	}
+
+	switch (m_settings.DeliveryBalancing)
 	{
-		return DELIVERY_INV_DEST_ADDR;
+	case DELIVERY_BALANCING_ROUND_ROBIN:
+		return receivers[m_nextReceiver.fetch_add(1, memory_order_relaxed) % receivers.size()];
+	case DELIVERY_BALANCING_LEAST_OUTSTANDING:
+	{ // ties are broken in a round-robin fashion
+		size_t start = m_nextReceiver.fetch_add(1, memory_order_relaxed) % receivers.size();
+		size_t best = start;
+		unsigned int bestOutstanding = receivers[start]->GetOutstandingRequests();
+		for (size_t i = 1; i < receivers.size() && bestOutstanding; i++)
+		{
+			size_t current = (start + i) % receivers.size();
+			unsigned int outstanding = receivers[current]->GetOutstandingRequests();
+			if (outstanding < bestOutstanding)
+			{
+				best = current;
+				bestOutstanding = outstanding;
+			}
+		}
+		return receivers[best];
+	}
+	case DELIVERY_BALANCING_STICKY_SOURCE:
+		// clients are sorted by connection id, the same source keeps the same receiver
+		return receivers[hash<string>()(from) % receivers.size()];
+	default:
+		return receivers[0];
+	}
+}
+
+SMPPConnectionPtr CSMPPUserManager::SelectReceiptReceiver(const MessageRecord& record)
+{
+	{
+		lock_guard<mutex> lock(m_mutex);
+		map<int, UserRef>::iterator it = m_clients.find(record.connectionId);
+		if (it != m_clients.end() && it->second->bindMode != BIND_TRANSMITTER) {
+			return it->second->connection;
+		}
+
+		// a transmitter gets its receipts on a receiver of the same ESME
+		map<int, UserRef>::iterator end;
+		for (it = m_clients.begin(), end = m_clients.end(); it != end; it++)
+		{
+			if (it->second->bindMode != BIND_TRANSMITTER && it->second->systemId == record.systemId) {
+				return it->second->connection;
+			}
+		}
 	}
 
-	shared_ptr<CSMPPDelivery> cmd(new CSMPPDelivery(conn->NextSequenceNumber()));
+	// as any other message sent to the source address
+	return SelectReceiver(record.destination, record.source);
+}
+
+/*! Formats \p t as YYMMDDhhmm, the resolution of the receipt dates */
+static void FormatReceiptDate(time_t t, char *buffer, size_t size)
+{
+	if (!t) {
+		buffer[0] = '\0';
+		return;
+	}
+	tm date = posix_time::to_tm(posix_time::from_time_t(t));
+	strftime(buffer, size, "%y%m%d%H%M", &date);
+}
+
+shared_ptr<CSMPPDelivery> CSMPPUserManager::CreateReceipt(SMPPConnectionPtr conn, const string &messageId, const MessageRecord &record)
+{
+	shared_ptr<CSMPPDelivery> cmd = make_command<CSMPPDelivery>(conn->NextSequenceNumber());
+
+	// the receipt goes back the way the message came
+	cmd->setSourceAddress(record.destination, TON_UNKNOWN, NPI_UNKNOWN);
+	cmd->setDestination(record.source);
+
+	DeliveryReceipt receipt;
+	memset(&receipt, 0, sizeof(receipt));
+	strncpy(receipt.MessageId, messageId.c_str(), sizeof(receipt.MessageId) - 1);
+	receipt.State = record.state;
+	receipt.ErrorCode = record.errorCode;
+	receipt.Submitted = 1;
+	receipt.Delivered = record.state == MESSAGE_STATE_DELIVERED ? 1 : 0;
+	FormatReceiptDate(record.submitted, receipt.SubmitDate, sizeof(receipt.SubmitDate));
+	FormatReceiptDate(record.done, receipt.DoneDate, sizeof(receipt.DoneDate));
+
+	char text[160];
+	size_t length = FormatDeliveryReceipt(receipt, text, sizeof(text));
+
+	cmd->request().data_coding = DATA_CODING_DEFAULT;
+	cmd->setText(string(text, length));
+	cmd->setReceiptArgs(messageId, record.state, record.errorCode);
+
+	return cmd;
+}
+
+shared_ptr<CSMPPDelivery> CSMPPUserManager::CreateDelivery(SMPPConnectionPtr conn, const string &from, const string &to, const string &message)
+{
+	shared_ptr<CSMPPDelivery> cmd = make_command<CSMPPDelivery>(conn->NextSequenceNumber());
 
 	cmd->setSourceAddress(from, TON_UNKNOWN, NPI_UNKNOWN);
 	cmd->setDestination(to);
@@ -502,21 +1410,85 @@ DeliveryResult CSMPPUserManager::SendMessage(const string &from,  const string &
 	cmd->request().data_coding = m_encoding;
 	cmd->setText(encoded_message);
 
-	int res = conn->SendRequest(cmd->shared_from_this());
+	return cmd;
+}
 
-	if(res != RESULT_OK)
-	{
-		return DELIVERY_UNKNOWN_ERROR;
+void CSMPPUserManager::DrainStore(UserRef user)
+{
+	// fill the window, every response sends the next one
+	unsigned int window = m_settings.QueueDrainWindow ? m_settings.QueueDrainWindow : 1;
+	unsigned int sent = 0;
+	m_store->Find(user->addressSpans(), bind(&SMPPUser::ownsAddress, user, _1), user->stored);
+	while (sent < window && DeliverStored(user)) {
+		sent++;
+	}
+	if (sent) {
+		smpp_log_info("Delivering stored messages to connection %u", user->connection->GetConnectionId());
 	}
+}
 
-	if(cmd->command_status() != ESME_ROK)
-	{
-		return DELIVERY_REJECTED;
+bool CSMPPUserManager::DeliverStored(UserRef user)
+{
+	StoredMessage msg;
+	if (!m_store->Pop(user->stored, msg)) {
+		return false;
 	}
 
-	return DELIVERY_OK;
+	shared_ptr<CSMPPDelivery> cmd = CreateDelivery(user->connection, msg.from, msg.to, msg.text);
+	user->connection->SendRequestAsync(cmd->shared_from_this(),
+			bind(&CSMPPUserManager::OnStoredDelivered, shared_from_this(), user, msg, _1, _2)
+		);
+	return true;
+}
+
+void CSMPPUserManager::OnStoreRetry(UserRef user, shared_ptr<asio::deadline_timer>, const boost::system::error_code& error)
+{
+	if (error) {
+		return;
+	}
+	{ // messages for a receiver that is gone wait for the next bind
+		lock_guard<mutex> lock(m_mutex);
+		map<int, UserRef>::iterator it = m_clients.find(user->connection->GetConnectionId());
+		if (it == m_clients.end() || it->second != user) {
+			return;
+		}
+	}
+	DeliverStored(user);
 }
 
+void CSMPPUserManager::OnStoredDelivered(UserRef user, StoredMessage msg, int result, shared_ptr<ISMPPCommand> cmd)
+{
+	unsigned int connectionId = user->connection->GetConnectionId();
+
+	if (result != RESULT_OK)
+	{ // gone, wait for the next bind
+		m_store->Requeue(msg, user->stored);
+		return;
+	}
+
+	switch (cmd->command_status())
+	{
+	case ESME_ROK:
+		break;
+	case ESME_RTHROTTLED:
+	case ESME_RMSGQFUL:
+	{ // try again later, this slot of the window waits
+		smpp_log_info("Connection %u cannot take stored messages right now", connectionId);
+		m_store->Requeue(msg, user->stored);
+		shared_ptr<asio::deadline_timer> timer(new asio::deadline_timer(user->connection->ioservice()));
+		timer->expires_from_now(posix_time::milliseconds(m_settings.QueueRetryDelay));
+		timer->async_wait(bind(&CSMPPUserManager::OnStoreRetry, shared_from_this(), user, timer, asio::placeholders::error));
+		return;
+	}
+	default:
+		smpp_log_warning("Connection %u rejected stored message to %s with status %#x, dropping it",
+			connectionId, msg.to.c_str(), cmd->command_status());
+		break;
+	}
+
+	m_store->Release(msg);
+	DeliverStored(user);
+}
 
 void CSMPPUserManager::KeepAliveThread()
 {
@@ -559,7 +1531,7 @@ void CSMPPUserManager::KeepAliveThread()
 
 			try
 			{
-				cmd.reset(new CSMPPEnquireLink(user->connection->NextSequenceNumber()));
+				cmd = make_command<CSMPPEnquireLink>(user->connection->NextSequenceNumber());
 
 				smpp_log_profile(" == ENQUIRE_LINK (%s)", user->systemId.c_str());
 					int res = user->connection->SendRequest(cmd);
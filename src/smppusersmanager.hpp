@@ -10,16 +10,26 @@
 
 #include "../smpp.hpp"
 #include "smppconnection.hpp"
+#include "messageindex.hpp"
 #include <boost/thread.hpp>
 #include <boost/thread/condition.hpp>
 #include <boost/enable_shared_from_this.hpp>
 #include <map>
+#include <set>
 
 namespace opensmpp
 {
 	class ISMPPCommand;
 	class CSMPPCallback;
+	class CSMPPDelivery;
+	class CMessageStore;
+	class CWorkerPool;
 	class SMPPUser;
+	class CredentialCache;
+	struct BindCredentials;
+	class BindValidation;
+	struct StoredMessage;
+	struct MultiDelivery;
 
 	/*!
 	*\brief Holds the list of users connected to this server
@@ -38,24 +48,165 @@ namespace opensmpp
 				boost::shared_ptr<ISMPPCommand>    cmd
 			);
 
+		/*!
+		 * \brief Checks a message from the addresses of the undecoded PDU, so those
+		 * that would be rejected anyway are never decoded
+		 * \return \c ESME_ROK or the status the PDU is rejected with
+		 */
+		int CheckInbound (
+				boost::shared_ptr<CSMPPConnection> conn,
+				const CPDUView&                    pdu
+			);
+
 		void SetDeliveryEncoding( DataCoding data_coding );
 
+		void SetSettings( const ServerSettings& settings );
+
 		DeliveryResult SendMessage (
 				const std::string& from,
 				const std::string& to,
 				const std::string& message
 			);
 
+		/*!
+		 * \brief Updates the state of a submitted message and sends its receipt
+		 * if the ESME asked for it
+		 */
+		DeliveryResult ReportMessageState(
+				const std::string& messageId,
+				MessageState       state,
+				unsigned int       errorCode
+			);
+
+		/*!
+		 * \brief Same as above for one destination of a SUBMIT_MULTI, the message
+		 * takes the state once every destination has reached a final one
+		 */
+		DeliveryResult ReportMessageState(
+				const std::string& messageId,
+				const std::string& destination,
+				MessageState       state,
+				unsigned int       errorCode
+			);
+
 	private:
 
+		friend class BindValidation;
+
 		typedef boost::shared_ptr<SMPPUser> UserRef;
 
+		/*!
+		 * \brief Accepts or rejects a bind once validated, may be invoked from any thread
+		 * \param credentials The credentials to cache, empty to not cache them
+		 */
+		void CompleteBind(
+				SMPPConnectionPtr               conn,
+				boost::shared_ptr<ISMPPCommand> cmd,
+				UserRef                         user,
+				LoginResult                     res,
+				boost::shared_ptr<const BindCredentials> credentials
+			);
+
+		/*! \brief Hands a SUBMIT_SM or DATA_SM to the application and sends the response */
+		template <class Command>
+		void SubmitSingle(SMPPConnectionPtr conn, boost::shared_ptr<ISMPPCommand> cmd, UserRef user);
+
+		/*! \brief Delivers a SUBMIT_MULTI to all its destinations in parallel */
+		void SubmitMulti(SMPPConnectionPtr conn, boost::shared_ptr<ISMPPCommand> cmd, UserRef user);
+
+		/*! \brief Delivers the SUBMIT_MULTI to its \p index destination, the last one sends the response */
+		void DeliverMultiDestination(boost::shared_ptr<MultiDelivery> delivery, size_t index);
+
+		/*! \brief Sends the response of a SUBMIT_MULTI once all its destinations are done */
+		void CompleteMulti(boost::shared_ptr<MultiDelivery> delivery);
+
+		/*! \brief Answers a QUERY_SM from the message index, the application is not involved */
+		void QueryMessage(SMPPConnectionPtr conn, boost::shared_ptr<ISMPPCommand> cmd, UserRef user);
+
+		/*! \brief Asks the application to cancel a message that is still enroute */
+		void CancelMessage(SMPPConnectionPtr conn, boost::shared_ptr<ISMPPCommand> cmd, UserRef user);
+
+		/*! \brief Asks the application to replace the text of a message that is still enroute */
+		void ReplaceMessage(SMPPConnectionPtr conn, boost::shared_ptr<ISMPPCommand> cmd, UserRef user);
+
+		/*!
+		 * \brief Looks for the message \p messageId submitted by \p user from \p source
+		 * \param source Not checked if empty
+		 * \return \c false if the message is unknown or belongs to another ESME
+		 */
+		bool FindUserMessage(
+				UserRef            user,
+				const std::string& messageId,
+				const std::string& source,
+				MessageRecord&     record
+			);
+
+		/*! \brief Creates a DELIVER_SM for \p conn, \p message is encoded as set by \c SetDeliveryEncoding */
+		boost::shared_ptr<CSMPPDelivery> CreateDelivery(
+				SMPPConnectionPtr  conn,
+				const std::string& from,
+				const std::string& to,
+				const std::string& message
+			);
+
+		/*!
+		 * \brief Picks the connection that takes a message to \p to as set by \c DeliveryBalancing
+		 * \return An empty pointer if no receiver owns \p to
+		 */
+		SMPPConnectionPtr SelectReceiver(const std::string& from, const std::string& to);
+
+		/*!
+		 * \brief Picks the connection that takes the receipt of \p record, the one that
+		 * submitted the message if it can receive, otherwise another bind of the same ESME
+		 * \return An empty pointer if the ESME has no receiver bound
+		 */
+		SMPPConnectionPtr SelectReceiptReceiver(const MessageRecord& record);
+
+		/*! \brief Sends the receipt of \p record if its ESME asked for one in its state */
+		DeliveryResult SendReceipt(const std::string& messageId, const MessageRecord& record);
+
+		/*! \brief Creates the DELIVER_SM carrying the receipt of \p messageId */
+		boost::shared_ptr<CSMPPDelivery> CreateReceipt(
+				SMPPConnectionPtr    conn,
+				const std::string&   messageId,
+				const MessageRecord& record
+			);
+
+		/*! \brief Starts delivering the messages stored for a receiver that just bound */
+		void DrainStore(UserRef user);
+
+		/*! \brief Sends the next message stored for \p user, \c false if there is none */
+		bool DeliverStored(UserRef user);
+
+		/*! \brief Sends the next stored message once \p timer expires, if \p user is still bound */
+		void OnStoreRetry(
+				UserRef                                          user,
+				boost::shared_ptr<boost::asio::deadline_timer>   timer,
+				const boost::system::error_code&                 error
+			);
+
+		/*! \brief Invoked when the receiver answers a stored message */
+		void OnStoredDelivered(
+				UserRef                         user,
+				StoredMessage                   msg,
+				int                             result,
+				boost::shared_ptr<ISMPPCommand> cmd
+			);
+
 		DataCoding                       m_encoding;
+		ServerSettings                   m_settings;
 		boost::mutex                     m_mutex;
 		boost::thread                    m_threadKeepAlive;
 		boost::condition                 m_exitEvent;
 		boost::condition                 m_newClientCondition;
 		std::map<int, UserRef>           m_clients;
+		boost::atomic<unsigned int>      m_nextReceiver;
+		std::set<unsigned int>           m_bindsInProgress;
+		boost::shared_ptr<CredentialCache> m_credentials;
+		boost::shared_ptr<CMessageStore> m_store;
+		boost::shared_ptr<CWorkerPool>   m_multiWorkers;
+		CMessageIdGenerator              m_idGenerator;
+		CMessageIndex                    m_index;
 		boost::shared_ptr<CSMSCCallback> m_callbacks;
 
 		// ENQUIRE_LINK
@@ -0,0 +1,94 @@
+/*!
+ * \file tokenbucket.hpp
+ * \author ichramm
+ */
+#ifndef OPENSMPP_TOKENBUCKET_HPP_
+#define OPENSMPP_TOKENBUCKET_HPP_
+#if _MSC_VER > 1000
+#pragma once
+#endif
+
+#include <boost/atomic.hpp>
+#include <boost/cstdint.hpp>
+#include <algorithm>
+
+#if defined(_WIN32)
+# include <windows.h>
+#else
+# include <time.h>
+#endif
+
+namespace opensmpp
+{
+	/*!
+	 * \return Nanoseconds elapsed since some unspecified starting point, never goes back
+	 */
+	inline boost::uint64_t MonotonicNanoseconds()
+	{
+#if defined(_WIN32)
+		static LARGE_INTEGER frequency = {{0, 0}};
+		LARGE_INTEGER counter;
+		if (!frequency.QuadPart) {
+			QueryPerformanceFrequency(&frequency);
+		}
+		QueryPerformanceCounter(&counter);
+		return (boost::uint64_t)((double)counter.QuadPart * 1e9 / (double)frequency.QuadPart);
+#else
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return (boost::uint64_t)ts.tv_sec * 1000000000ull + (boost::uint64_t)ts.tv_nsec;
+#endif
+	}
+
+	/*!
+	 * \brief Token bucket implemented as a GCRA (generic cell rate algorithm)
+	 *
+	 * The whole state is the theoretical arrival time of the next message, so a
+	 * single compare-and-swap is enough to take a token, no locks involved.
+	 */
+	class CTokenBucket
+	{
+	public:
+
+		/*!
+		 * \param rate Tokens per second, must not be 0
+		 * \param burst Tokens that can be taken at once, 0 means 1
+		 */
+		CTokenBucket(unsigned int rate, unsigned int burst)
+		 : m_interval(1000000000ull / rate)
+		 , m_tolerance(m_interval * (burst ? burst - 1 : 0))
+		 , m_tat(0)
+		{ }
+
+		/*! \return \c true if there is a token available, which is taken */
+		bool TryConsume()
+		{
+			return TryConsume(MonotonicNanoseconds());
+		}
+
+		/*! \brief Same as above, \p now being the time given by \c MonotonicNanoseconds */
+		bool TryConsume(boost::uint64_t now)
+		{
+			boost::uint64_t tat = m_tat.load(boost::memory_order_relaxed);
+			for (;;)
+			{
+				boost::uint64_t base = std::max(tat, now);
+				if (base - now > m_tolerance)
+				{ // bucket is empty
+					return false;
+				}
+				if (m_tat.compare_exchange_weak(tat, base + m_interval, boost::memory_order_relaxed)) {
+					return true;
+				}
+			}
+		}
+
+	private:
+
+		const boost::uint64_t           m_interval;   /*!< Nanoseconds between messages */
+		const boost::uint64_t           m_tolerance;  /*!< How early a message may come */
+		boost::atomic<boost::uint64_t>  m_tat;
+	};
+} // namespace opensmpp
+
+#endif // OPENSMPP_TOKENBUCKET_HPP_
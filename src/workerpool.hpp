@@ -0,0 +1,100 @@
+/*!
+ * \file workerpool.hpp
+ * \author ichramm
+ */
+#ifndef OPENSMPP_WORKERPOOL_HPP_
+#define OPENSMPP_WORKERPOOL_HPP_
+#if _MSC_VER > 1000
+#pragma once
+#endif
+
+#include "logger.h"
+
+#include <boost/asio/io_service.hpp>
+#include <boost/bind.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/thread.hpp>
+#include <vector>
+
+namespace opensmpp
+{
+	/*!
+	 * \brief Threads running the jobs posted to them, in no particular order
+	 *
+	 * Jobs still pending when the pool is destroyed are run before it goes.
+	 */
+	class CWorkerPool
+	{
+	public:
+
+		CWorkerPool(unsigned int threads)
+		 : m_queue(new Queue)
+		{
+			for (unsigned int i = 0; i < threads; i++) {
+				m_threads.push_back(boost::shared_ptr<boost::thread>(new boost::thread(boost::bind(&CWorkerPool::Run, m_queue))));
+			}
+		}
+
+		~CWorkerPool()
+		{
+			m_queue->work.reset();
+			for ( ; !m_threads.empty(); m_threads.pop_back())
+			{
+				if (m_threads.back()->get_id() == boost::this_thread::get_id())
+				{ // the last job released the owner of the pool, the thread keeps the queue alive
+					m_threads.back()->detach();
+					continue;
+				}
+				m_threads.back()->join();
+			}
+		}
+
+		unsigned int GetThreads() const
+		{
+			return (unsigned int)m_threads.size();
+		}
+
+		template <typename Handler>
+		void Post(Handler handler)
+		{
+			m_queue->ioservice.post(handler);
+		}
+
+	private:
+
+		CWorkerPool(const CWorkerPool&);
+		CWorkerPool& operator=(const CWorkerPool&);
+
+		struct Queue
+		{
+			Queue()
+			 : work(new boost::asio::io_service::work(ioservice))
+			{ }
+
+			boost::asio::io_service                             ioservice;
+			boost::scoped_ptr<boost::asio::io_service::work>    work;
+		};
+
+		static void Run(boost::shared_ptr<Queue> queue)
+		{
+			for ( ; ; )
+			{
+				try
+				{
+					queue->ioservice.run();
+					return;
+				}
+				catch (const std::exception& e)
+				{
+					smpp_log_error("Error running a job: %s", e.what());
+				}
+			}
+		}
+
+		boost::shared_ptr<Queue>                          m_queue;
+		std::vector<boost::shared_ptr<boost::thread> >    m_threads;
+	};
+} // namespace opensmpp
+
+#endif // OPENSMPP_WORKERPOOL_HPP_
@@ -31,7 +31,8 @@ namespace esmesim.smpp
 		Rejected,
 		InvalidSourceAddress,
 		InvalidDestinationAddress,
-		Fail
+		Fail,
+		Queued
 	}
 
 	public enum DisconnectReason : int
@@ -0,0 +1,110 @@
+/*!
+ * \file deliveryreceipt_test.cpp
+ * \author ichramm
+ */
+#include "deliveryreceipt.hpp"
+
+#include <boost/test/unit_test.hpp>
+#include <cstring>
+#include <string>
+
+using namespace std;
+using namespace opensmpp;
+
+namespace
+{
+	bool Parse(const string& text, DeliveryReceipt& receipt)
+	{
+		memset(&receipt, 0, sizeof(receipt));
+		return ParseDeliveryReceipt(text.data(), text.size(), receipt);
+	}
+}
+
+BOOST_AUTO_TEST_SUITE(deliveryreceipt)
+
+BOOST_AUTO_TEST_CASE(appendix_b_format)
+{
+	DeliveryReceipt receipt;
+	BOOST_REQUIRE(Parse("id:0123456789 sub:001 dlvrd:001 submit date:2610190900 done date:2610190901 stat:DELIVRD err:000 text:hello", receipt));
+	BOOST_CHECK_EQUAL(receipt.MessageId, "0123456789");
+	BOOST_CHECK_EQUAL(receipt.Submitted, 1u);
+	BOOST_CHECK_EQUAL(receipt.Delivered, 1u);
+	BOOST_CHECK_EQUAL(receipt.SubmitDate, "2610190900");
+	BOOST_CHECK_EQUAL(receipt.DoneDate, "2610190901");
+	BOOST_CHECK_EQUAL(receipt.State, MESSAGE_STATE_DELIVERED);
+	BOOST_CHECK_EQUAL(receipt.ErrorCode, 0u);
+}
+
+BOOST_AUTO_TEST_CASE(any_order_and_case)
+{
+	DeliveryReceipt receipt;
+	BOOST_REQUIRE(Parse("Stat:UNDELIV  ERR:034 foo:bar ID:abc", receipt));
+	BOOST_CHECK_EQUAL(receipt.MessageId, "abc");
+	BOOST_CHECK_EQUAL(receipt.State, MESSAGE_STATE_UNDELIVERABLE);
+	BOOST_CHECK_EQUAL(receipt.ErrorCode, 34u);
+}
+
+BOOST_AUTO_TEST_CASE(text_is_left_alone)
+{
+	DeliveryReceipt receipt;
+	BOOST_REQUIRE(Parse("id:1 stat:DELIVRD text:err:999 stat:REJECTD", receipt));
+	BOOST_CHECK_EQUAL(receipt.State, MESSAGE_STATE_DELIVERED);
+	BOOST_CHECK_EQUAL(receipt.ErrorCode, 0u);
+}
+
+BOOST_AUTO_TEST_CASE(unknown_state)
+{
+	DeliveryReceipt receipt;
+	BOOST_REQUIRE(Parse("id:1 stat:WHATEVER", receipt));
+	BOOST_CHECK_EQUAL(receipt.State, MESSAGE_STATE_UNKNOWN);
+}
+
+BOOST_AUTO_TEST_CASE(without_id)
+{
+	DeliveryReceipt receipt;
+	BOOST_CHECK(!Parse("stat:DELIVRD err:000", receipt));
+	BOOST_CHECK(!Parse("", receipt));
+}
+
+BOOST_AUTO_TEST_CASE(long_values_are_truncated)
+{
+	DeliveryReceipt receipt;
+	BOOST_REQUIRE(Parse("id:" + string(100, '7') + " done date:26101909001234567", receipt));
+	BOOST_CHECK_EQUAL(strlen(receipt.MessageId), sizeof(receipt.MessageId) - 1);
+	BOOST_CHECK_EQUAL(strlen(receipt.DoneDate), sizeof(receipt.DoneDate) - 1);
+}
+
+BOOST_AUTO_TEST_CASE(not_terminated)
+{
+	// the text is parsed in place, nothing past length is read
+	const char text[] = "id:12345 stat:DELIVRD";
+	DeliveryReceipt receipt;
+	memset(&receipt, 0, sizeof(receipt));
+	BOOST_REQUIRE(ParseDeliveryReceipt(text, 8, receipt));
+	BOOST_CHECK_EQUAL(receipt.MessageId, "12345");
+	BOOST_CHECK_EQUAL(receipt.State, MESSAGE_STATE_SCHEDULED);
+}
+
+BOOST_AUTO_TEST_CASE(format_round_trip)
+{
+	DeliveryReceipt receipt;
+	memset(&receipt, 0, sizeof(receipt));
+	strcpy(receipt.MessageId, "42");
+	strcpy(receipt.SubmitDate, "2610190900");
+	strcpy(receipt.DoneDate, "2610190905");
+	receipt.State = MESSAGE_STATE_EXPIRED;
+	receipt.ErrorCode = 7;
+	receipt.Submitted = receipt.Delivered = 1;
+
+	char text[200];
+	size_t length = FormatDeliveryReceipt(receipt, text, sizeof(text));
+
+	DeliveryReceipt parsed;
+	BOOST_REQUIRE(Parse(string(text, length), parsed));
+	BOOST_CHECK_EQUAL(parsed.MessageId, "42");
+	BOOST_CHECK_EQUAL(parsed.DoneDate, "2610190905");
+	BOOST_CHECK_EQUAL(parsed.State, MESSAGE_STATE_EXPIRED);
+	BOOST_CHECK_EQUAL(parsed.ErrorCode, 7u);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
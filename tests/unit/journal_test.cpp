@@ -0,0 +1,266 @@
+/*!
+ * \file journal_test.cpp
+ * \author ichramm
+ */
+#include "journal.hpp"
+
+#include <boost/test/unit_test.hpp>
+#include <cstdio>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace std;
+using namespace opensmpp;
+
+namespace
+{
+	/*! Removes the journal before and after each test */
+	struct JournalFile
+	{
+		JournalFile() : path("opensmpp_test.jrnl")
+		{
+			remove(path.c_str());
+		}
+
+		~JournalFile()
+		{
+			remove(path.c_str());
+		}
+
+		std::string path;
+	};
+
+	typedef vector<pair<boost::uint64_t, string> > Records;
+
+	struct Collect
+	{
+		Records *records;
+
+		void operator()(boost::uint64_t offset, const string& data)
+		{
+			records->push_back(make_pair(offset, data));
+		}
+	};
+
+	long FileSize(const string& path)
+	{
+		FILE *fp = fopen(path.c_str(), "rb");
+		if (!fp) {
+			return -1;
+		}
+		fseek(fp, 0, SEEK_END);
+		long size = ftell(fp);
+		fclose(fp);
+		return size;
+	}
+
+	Records Recover(CJournal& journal)
+	{
+		Records records;
+		Collect collect = { &records };
+		journal.Recover(collect);
+		return records;
+	}
+}
+
+BOOST_FIXTURE_TEST_SUITE(journal, JournalFile)
+
+BOOST_AUTO_TEST_CASE(recovers_live_records_in_order)
+{
+	boost::uint64_t first, second, third;
+	{
+		CJournal journal;
+		BOOST_REQUIRE(journal.Open(path));
+		BOOST_REQUIRE(journal.Append("first", first));
+		BOOST_REQUIRE(journal.Append("second", second));
+		BOOST_REQUIRE(journal.Append("third", third));
+		journal.Release(second);
+		BOOST_CHECK_EQUAL(journal.GetLiveRecords(), 2u);
+		BOOST_CHECK(journal.Sync());
+	}
+
+	CJournal journal;
+	BOOST_REQUIRE(journal.Open(path));
+	BOOST_CHECK_EQUAL(journal.GetLiveRecords(), 2u);
+
+	Records records = Recover(journal);
+	BOOST_REQUIRE_EQUAL(records.size(), 2u);
+	BOOST_CHECK_EQUAL(records[0].first, first);
+	BOOST_CHECK_EQUAL(records[0].second, "first");
+	BOOST_CHECK_EQUAL(records[1].first, third);
+	BOOST_CHECK_EQUAL(records[1].second, "third");
+
+	string data;
+	BOOST_CHECK(journal.Read(third, data));
+	BOOST_CHECK_EQUAL(data, "third");
+	BOOST_CHECK(!journal.Read(second, data));
+}
+
+BOOST_AUTO_TEST_CASE(rewinds_once_empty)
+{
+	CJournal journal;
+	BOOST_REQUIRE(journal.Open(path));
+
+	boost::uint64_t first, second, again;
+	BOOST_REQUIRE(journal.Append("first", first));
+	BOOST_REQUIRE(journal.Append("second", second));
+	journal.Release(first);
+	journal.Release(second);
+	journal.Release(second);    // twice is harmless
+	BOOST_CHECK_EQUAL(journal.GetLiveRecords(), 0u);
+
+	BOOST_REQUIRE(journal.Append("again", again));
+	BOOST_CHECK(again != first);    // ids are not given twice, old ones find nothing
+	string data;
+	BOOST_CHECK(!journal.Read(first, data));
+	BOOST_CHECK(journal.Read(again, data));
+
+	// the stale second record must not come back
+	journal.Close();
+	BOOST_REQUIRE(journal.Open(path));
+	Records records = Recover(journal);
+	BOOST_REQUIRE_EQUAL(records.size(), 1u);
+	BOOST_CHECK_EQUAL(records[0].second, "again");
+}
+
+BOOST_AUTO_TEST_CASE(grows)
+{
+	vector<boost::uint64_t> offsets;
+	{
+		CJournal journal;
+		BOOST_REQUIRE(journal.Open(path, 64));
+		for (int i = 0; i < 100; i++)
+		{
+			boost::uint64_t offset;
+			BOOST_REQUIRE(journal.Append(string(100 + i, (char)('a' + i % 26)), offset));
+			offsets.push_back(offset);
+		}
+	}
+
+	CJournal journal;
+	BOOST_REQUIRE(journal.Open(path, 64));
+	Records records = Recover(journal);
+	BOOST_REQUIRE_EQUAL(records.size(), 100u);
+	for (size_t i = 0; i < records.size(); i++)
+	{
+		BOOST_CHECK_EQUAL(records[i].first, offsets[i]);
+		BOOST_CHECK_EQUAL(records[i].second, string(100 + i, (char)('a' + i % 26)));
+	}
+}
+
+BOOST_AUTO_TEST_CASE(compacts_around_live_records)
+{
+	boost::uint64_t stuck;
+	{
+		CJournal journal;
+		BOOST_REQUIRE(journal.Open(path, 4096));
+		// a message for a destination that never binds, while others come and go
+		BOOST_REQUIRE(journal.Append("0000 stuck", stuck));
+		for (int i = 0; i < 10000; i++)
+		{
+			boost::uint64_t id;
+			BOOST_REQUIRE(journal.Append(string(200, (char)('a' + i % 26)), id));
+			journal.Release(id);
+		}
+		BOOST_CHECK_EQUAL(FileSize(path), 4096);
+		BOOST_CHECK_EQUAL(journal.GetLiveRecords(), 1u);
+
+		// the record moved, its id did not
+		string data;
+		BOOST_REQUIRE(journal.Read(stuck, data));
+		BOOST_CHECK_EQUAL(data, "0000 stuck");
+		BOOST_CHECK(journal.Write(stuck, 0, "0001"));
+		BOOST_CHECK(journal.Sync());
+	}
+
+	CJournal journal;
+	BOOST_REQUIRE(journal.Open(path, 4096));
+	Records records = Recover(journal);
+	BOOST_REQUIRE_EQUAL(records.size(), 1u);
+	BOOST_CHECK_EQUAL(records[0].first, stuck);
+	BOOST_CHECK_EQUAL(records[0].second, "0001 stuck");
+	BOOST_CHECK(FileSize(path + ".tmp") < 0);
+}
+
+BOOST_AUTO_TEST_CASE(compacts_a_growing_backlog)
+{
+	// every other record stays, the file grows with them and not with the rest
+	vector<boost::uint64_t> kept;
+	CJournal journal;
+	BOOST_REQUIRE(journal.Open(path, 4096));
+	for (int i = 0; i < 2000; i++)
+	{
+		boost::uint64_t id;
+		BOOST_REQUIRE(journal.Append(string(100, (char)('a' + i % 26)), id));
+		if (i % 2) {
+			journal.Release(id);
+		} else {
+			kept.push_back(id);
+		}
+	}
+	// 1000 records of 120 bytes, at most twice as much as they take
+	BOOST_CHECK(FileSize(path) <= 2 * 2 * 1000 * 120);
+
+	Records records = Recover(journal);
+	BOOST_REQUIRE_EQUAL(records.size(), kept.size());
+	for (size_t i = 0; i < records.size(); i++)
+	{
+		BOOST_CHECK_EQUAL(records[i].first, kept[i]);
+		BOOST_CHECK_EQUAL(records[i].second, string(100, (char)('a' + (2 * i) % 26)));
+	}
+}
+
+BOOST_AUTO_TEST_CASE(writes_in_place)
+{
+	boost::uint64_t offset;
+	{
+		CJournal journal;
+		BOOST_REQUIRE(journal.Open(path));
+		BOOST_REQUIRE(journal.Append("0000 message", offset));
+		BOOST_CHECK(journal.Write(offset, 0, "0002"));
+		BOOST_CHECK(!journal.Write(offset, 10, "toolong"));
+	}
+
+	CJournal journal;
+	BOOST_REQUIRE(journal.Open(path));
+	string data;
+	BOOST_REQUIRE(journal.Read(offset, data));
+	BOOST_CHECK_EQUAL(data, "0002 message");
+
+	journal.Release(offset);
+	BOOST_CHECK(!journal.Write(offset, 0, "0003"));
+}
+
+BOOST_AUTO_TEST_CASE(rejects_other_files)
+{
+	FILE *fp = fopen(path.c_str(), "wb");
+	BOOST_REQUIRE(fp);
+	fputs("not a journal at all", fp);
+	fclose(fp);
+
+	CJournal journal;
+	BOOST_CHECK(!journal.Open(path));
+	BOOST_CHECK(!journal.IsOpen());
+}
+
+BOOST_AUTO_TEST_CASE(encodes_strings)
+{
+	string buffer;
+	CJournal::PutString(buffer, "from");
+	CJournal::PutString(buffer, "");
+	CJournal::PutString(buffer, string("a\0b", 3));
+
+	size_t pos = 0;
+	string value;
+	BOOST_CHECK(CJournal::GetString(buffer, pos, value) && value == "from");
+	BOOST_CHECK(CJournal::GetString(buffer, pos, value) && value.empty());
+	BOOST_CHECK(CJournal::GetString(buffer, pos, value) && value == string("a\0b", 3));
+	BOOST_CHECK(!CJournal::GetString(buffer, pos, value));
+
+	// a length past the end of the buffer
+	size_t start = 0;
+	BOOST_CHECK(!CJournal::GetString(buffer.substr(0, 6), start, value));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,9 @@
+/*!
+ * \file main.cpp
+ * \author ichramm
+ *
+ * Unit tests of the parts of the library that can be tried without a
+ * connection, run them with `make test`
+ */
+#define BOOST_TEST_MODULE opensmpp
+#include <boost/test/included/unit_test.hpp>
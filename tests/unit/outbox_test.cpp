@@ -0,0 +1,172 @@
+/*!
+ * \file outbox_test.cpp
+ * \author ichramm
+ */
+#include "outbox.hpp"
+
+#include <boost/test/unit_test.hpp>
+#include <cstdio>
+#include <string>
+
+using namespace std;
+using namespace opensmpp;
+
+namespace
+{
+	/*! Removes the outbox journal before and after each test */
+	struct OutboxFile
+	{
+		OutboxFile() : path("opensmpp_test.outbox")
+		{
+			remove(path.c_str());
+		}
+
+		~OutboxFile()
+		{
+			remove(path.c_str());
+		}
+
+		std::string path;
+	};
+
+	long FileSize(const string& path)
+	{
+		FILE *fp = fopen(path.c_str(), "rb");
+		if (!fp) {
+			return -1;
+		}
+		fseek(fp, 0, SEEK_END);
+		long size = ftell(fp);
+		fclose(fp);
+		return size;
+	}
+}
+
+BOOST_FIXTURE_TEST_SUITE(outbox, OutboxFile)
+
+BOOST_AUTO_TEST_CASE(messages_not_done_survive)
+{
+	{
+		COutbox outbox;
+		BOOST_REQUIRE(outbox.Open(path));
+		BOOST_REQUIRE(outbox.Push("1000", "2000", "one", "r1"));
+		BOOST_REQUIRE(outbox.Push("1000", "2001", "two", "r2"));
+		BOOST_REQUIRE(outbox.Push("1000", "2002", "three", "r3"));
+		BOOST_CHECK_EQUAL(outbox.Size(), 3u);
+
+		OutboxMessage msg;
+		BOOST_REQUIRE(outbox.Pop(msg));
+		BOOST_CHECK_EQUAL(msg.reference, "r1");
+		outbox.Done(msg);
+
+		BOOST_REQUIRE(outbox.Pop(msg));
+		BOOST_CHECK_EQUAL(msg.reference, "r2");
+		BOOST_CHECK_EQUAL(outbox.Size(), 2u);
+		// the process stops before r2 is answered
+	}
+
+	COutbox outbox;
+	BOOST_REQUIRE(outbox.Open(path));
+	BOOST_CHECK_EQUAL(outbox.Size(), 2u);
+
+	OutboxMessage msg;
+	BOOST_REQUIRE(outbox.Pop(msg));
+	BOOST_CHECK_EQUAL(msg.from, "1000");
+	BOOST_CHECK_EQUAL(msg.to, "2001");
+	BOOST_CHECK_EQUAL(msg.text, "two");
+	BOOST_CHECK_EQUAL(msg.reference, "r2");
+	BOOST_CHECK_EQUAL(msg.segmentsSent, 0u);
+	outbox.Done(msg);
+
+	BOOST_REQUIRE(outbox.Pop(msg));
+	BOOST_CHECK_EQUAL(msg.reference, "r3");
+	outbox.Done(msg);
+	BOOST_CHECK_EQUAL(outbox.Size(), 0u);
+}
+
+BOOST_AUTO_TEST_CASE(segment_progress_survives)
+{
+	{
+		COutbox outbox;
+		BOOST_REQUIRE(outbox.Open(path));
+		BOOST_REQUIRE(outbox.Push("1000", "2000", string(400, 'x'), "long"));
+
+		OutboxMessage msg;
+		BOOST_REQUIRE(outbox.Pop(msg));
+		msg.segmentsSent = 1;
+		msg.segmentCount = 2;
+		msg.segmentReference = 1234;
+		msg.messageId = "M1";
+		BOOST_CHECK(outbox.Progress(msg));
+	}
+
+	COutbox outbox;
+	BOOST_REQUIRE(outbox.Open(path));
+	OutboxMessage msg;
+	BOOST_REQUIRE(outbox.Pop(msg));
+	BOOST_CHECK_EQUAL(msg.text, string(400, 'x'));
+	BOOST_CHECK_EQUAL(msg.segmentsSent, 1u);
+	BOOST_CHECK_EQUAL(msg.segmentCount, 2u);
+	BOOST_CHECK_EQUAL(msg.segmentReference, 1234u);
+	BOOST_CHECK_EQUAL(msg.messageId, "M1");
+}
+
+BOOST_AUTO_TEST_CASE(retry_goes_first)
+{
+	COutbox outbox;
+	BOOST_REQUIRE(outbox.Open(path));
+	BOOST_REQUIRE(outbox.Push("1000", "2000", "one", "r1"));
+	BOOST_REQUIRE(outbox.Push("1000", "2000", "two", "r2"));
+
+	OutboxMessage msg;
+	BOOST_REQUIRE(outbox.Pop(msg));
+	outbox.Retry(msg, 0);
+	BOOST_CHECK_EQUAL(outbox.Size(), 2u);
+
+	BOOST_REQUIRE(outbox.Pop(msg));
+	BOOST_CHECK_EQUAL(msg.reference, "r1");
+}
+
+BOOST_AUTO_TEST_CASE(stays_bounded)
+{
+	{
+		COutbox outbox;
+		BOOST_REQUIRE(outbox.Open(path));
+		long size = FileSize(path);
+
+		// one message the SMSC never answers while a few MB go through
+		OutboxMessage stuck;
+		BOOST_REQUIRE(outbox.Push("1000", "2000", "stuck", "r0"));
+		BOOST_REQUIRE(outbox.Pop(stuck));
+		for (int i = 0; i < 3000; i++)
+		{
+			OutboxMessage msg;
+			BOOST_REQUIRE(outbox.Push("1000", "2001", string(1000, 'x'), "r"));
+			BOOST_REQUIRE(outbox.Pop(msg));
+			outbox.Done(msg);
+		}
+		BOOST_CHECK_EQUAL(FileSize(path), size);
+		BOOST_CHECK_EQUAL(outbox.Size(), 1u);
+	}
+
+	COutbox outbox;
+	BOOST_REQUIRE(outbox.Open(path));
+	BOOST_CHECK_EQUAL(outbox.Size(), 1u);
+	OutboxMessage msg;
+	BOOST_REQUIRE(outbox.Pop(msg));
+	BOOST_CHECK_EQUAL(msg.text, "stuck");
+	BOOST_CHECK_EQUAL(msg.reference, "r0");
+}
+
+BOOST_AUTO_TEST_CASE(closed)
+{
+	COutbox outbox;
+	BOOST_REQUIRE(outbox.Open(path));
+	BOOST_REQUIRE(outbox.Push("1000", "2000", "one", "r1"));
+	outbox.Close();
+
+	OutboxMessage msg;
+	BOOST_CHECK(!outbox.Pop(msg));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,203 @@
+/*!
+ * \file pduview_test.cpp
+ * \author ichramm
+ */
+#include "pduview.hpp"
+#include "libsmpp34/smpp34.h"
+
+#include <boost/test/unit_test.hpp>
+#include <string>
+
+using namespace std;
+using namespace opensmpp;
+
+namespace
+{
+	// command_length, command_id, command_status and sequence_number
+	const size_t HeaderSize = 16;
+
+	void PutInteger(string& pdu, unsigned int value, size_t size)
+	{
+		while (size--) {
+			pdu += (char)(value >> (size * 8));
+		}
+	}
+
+	void PutString(string& pdu, const string& value)
+	{
+		pdu += value;
+		pdu += '\0';
+	}
+
+	/*! \return The PDU of \p command with \p body, its command_length set */
+	string MakePDU(unsigned int command, const string& body)
+	{
+		string pdu;
+		PutInteger(pdu, (unsigned int)(HeaderSize + body.size()), 4);
+		PutInteger(pdu, command, 4);
+		PutInteger(pdu, 0, 4);
+		PutInteger(pdu, 7, 4);
+		return pdu + body;
+	}
+
+	/*! \return The body of a SUBMIT_SM, up to sm_length unless \p text is given */
+	string SubmitBody(const string& source, const string& destination, const string& text)
+	{
+		string body;
+		PutString(body, "");            // service_type
+		body += "\x01\x01";             // source ton and npi
+		PutString(body, source);
+		body += "\x01\x01";             // destination ton and npi
+		PutString(body, destination);
+		body += string(3, '\0');        // esm_class, protocol_id, priority_flag
+		PutString(body, "");            // schedule_delivery_time
+		PutString(body, "");            // validity_period
+		body += string(4, '\0');        // registered_delivery up to sm_default_msg_id
+		body += (char)text.size();      // sm_length
+		return body + text;
+	}
+
+	string DataBody(const string& source, const string& destination)
+	{
+		string body;
+		PutString(body, "");
+		body += "\x01\x01";
+		PutString(body, source);
+		body += "\x01\x01";
+		PutString(body, destination);
+		body += string(3, '\0');        // esm_class, registered_delivery, data_coding
+		return body;
+	}
+
+	string TLV(unsigned int tag, const string& value)
+	{
+		string tlv;
+		PutInteger(tlv, tag, 2);
+		PutInteger(tlv, (unsigned int)value.size(), 2);
+		return tlv + value;
+	}
+}
+
+BOOST_AUTO_TEST_SUITE(pduview)
+
+BOOST_AUTO_TEST_CASE(submit_sm_fields)
+{
+	string pdu = MakePDU(SUBMIT_SM, SubmitBody("1000", "2000", "hello") + TLV(0x0204, string("\x00\x01", 2)));
+	CPDUView view;
+	BOOST_REQUIRE(view.Parse(pdu.data(), pdu.size()));
+	BOOST_CHECK_EQUAL(view.command_id(), (unsigned int)SUBMIT_SM);
+	BOOST_CHECK_EQUAL(view.sequence_number(), 7u);
+	BOOST_CHECK(view.has_addresses());
+	BOOST_CHECK_EQUAL(view.source_addr(), "1000");
+	BOOST_CHECK_EQUAL(view.destination_addr(), "2000");
+	BOOST_CHECK_EQUAL(view.short_message(), "hello");
+
+	boost::string_ref value;
+	BOOST_CHECK(view.find_tlv(0x0204, value));
+	BOOST_CHECK_EQUAL(value.size(), 2u);
+	BOOST_CHECK(!view.find_tlv(0x0424, value));
+}
+
+BOOST_AUTO_TEST_CASE(command_length_must_match)
+{
+	string pdu = MakePDU(SUBMIT_SM, SubmitBody("1000", "2000", "hello"));
+	CPDUView view;
+	BOOST_CHECK(!view.Parse(pdu.data(), pdu.size() - 1));
+	BOOST_CHECK(!view.Parse(pdu.data(), HeaderSize - 1));
+}
+
+BOOST_AUTO_TEST_CASE(commands_without_addresses)
+{
+	string pdu = MakePDU(ENQUIRE_LINK, "");
+	CPDUView view;
+	BOOST_REQUIRE(view.Parse(pdu.data(), pdu.size()));
+	BOOST_CHECK(!view.has_addresses());
+	BOOST_CHECK(view.source_addr().empty());
+}
+
+BOOST_AUTO_TEST_CASE(truncated_fields)
+{
+	string body = SubmitBody("1000", "2000", "hello");
+	CPDUView view;
+
+	// cut right after each byte of the fixed part, nothing short of it parses
+	for (size_t size = 0; size < body.size() - 5; size++)
+	{
+		string pdu = MakePDU(SUBMIT_SM, body.substr(0, size));
+		BOOST_CHECK_MESSAGE(!view.Parse(pdu.data(), pdu.size()), "body cut at " << size);
+	}
+
+	// the source address is not terminated before the PDU ends
+	string unterminated = MakePDU(SUBMIT_SM, string(1, '\0') + "\x01\x01" + "1000");
+	BOOST_CHECK(!view.Parse(unterminated.data(), unterminated.size()));
+}
+
+BOOST_AUTO_TEST_CASE(addresses_longer_than_allowed)
+{
+	CPDUView view;
+	string longest = MakePDU(SUBMIT_SM, SubmitBody(string(20, '1'), "2000", "hi"));
+	BOOST_CHECK(view.Parse(longest.data(), longest.size()));
+
+	string source = MakePDU(SUBMIT_SM, SubmitBody(string(21, '1'), "2000", "hi"));
+	BOOST_CHECK(!view.Parse(source.data(), source.size()));
+
+	string destination = MakePDU(SUBMIT_SM, SubmitBody("1000", string(21, '2'), "hi"));
+	BOOST_CHECK(!view.Parse(destination.data(), destination.size()));
+}
+
+BOOST_AUTO_TEST_CASE(oversized_sm_length)
+{
+	CPDUView view;
+
+	// sm_length goes past the end of the PDU
+	string body = SubmitBody("1000", "2000", "hello");
+	body[body.size() - 6] = (char)200;
+	string pdu = MakePDU(SUBMIT_SM, body);
+	BOOST_CHECK(!view.Parse(pdu.data(), pdu.size()));
+
+	// 255 is over the limit even if the bytes are there
+	string full = MakePDU(SUBMIT_SM, SubmitBody("1000", "2000", string(255, 'x')));
+	BOOST_CHECK(!view.Parse(full.data(), full.size()));
+
+	string fits = MakePDU(SUBMIT_SM, SubmitBody("1000", "2000", string(254, 'x')));
+	BOOST_REQUIRE(view.Parse(fits.data(), fits.size()));
+	BOOST_CHECK_EQUAL(view.short_message().size(), 254u);
+}
+
+BOOST_AUTO_TEST_CASE(data_sm_long_destination)
+{
+	CPDUView view;
+
+	// DATA_SM takes destinations of up to 64 characters, SUBMIT_SM does not
+	string data = MakePDU(DATA_SM, DataBody("1000", string(64, '2')) + TLV(0x0424, "hi"));
+	BOOST_REQUIRE(view.Parse(data.data(), data.size()));
+	BOOST_CHECK_EQUAL(view.destination_addr().size(), 64u);
+	BOOST_CHECK(view.short_message().empty());
+
+	boost::string_ref payload;
+	BOOST_CHECK(view.find_tlv(0x0424, payload));
+	BOOST_CHECK_EQUAL(payload, "hi");
+
+	string tooLong = MakePDU(DATA_SM, DataBody("1000", string(65, '2')));
+	BOOST_CHECK(!view.Parse(tooLong.data(), tooLong.size()));
+
+	string submit = MakePDU(SUBMIT_SM, SubmitBody("1000", string(64, '2'), "hi"));
+	BOOST_CHECK(!view.Parse(submit.data(), submit.size()));
+
+	// esm_class, registered_delivery and data_coding must be there
+	string truncated = MakePDU(DATA_SM, DataBody("1000", "2000").substr(0, 16));
+	BOOST_CHECK(!view.Parse(truncated.data(), truncated.size()));
+}
+
+BOOST_AUTO_TEST_CASE(truncated_tlv)
+{
+	string tlv = TLV(0x0424, "hello");
+	string pdu = MakePDU(SUBMIT_SM, SubmitBody("1000", "2000", "") + tlv.substr(0, tlv.size() - 2));
+	CPDUView view;
+	BOOST_REQUIRE(view.Parse(pdu.data(), pdu.size()));
+
+	boost::string_ref value;
+	BOOST_CHECK(!view.find_tlv(0x0424, value));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,109 @@
+/*!
+ * \file routetrie_test.cpp
+ * \author ichramm
+ */
+#include "routetrie.hpp"
+
+#include <boost/make_shared.hpp>
+#include <boost/test/unit_test.hpp>
+#include <string>
+
+using namespace std;
+using namespace opensmpp;
+
+namespace
+{
+	typedef CRouteTrie<string> Trie;
+
+	void Insert(Trie& trie, const string& digits)
+	{
+		trie.Insert(digits, boost::make_shared<const string>(digits));
+	}
+
+	/*! \return The prefix found for \p to, "-" if there is none */
+	string Lookup(const Trie& trie, const string& to)
+	{
+		const string *route = trie.Lookup(to);
+		return route ? *route : "-";
+	}
+}
+
+BOOST_AUTO_TEST_SUITE(routetrie)
+
+BOOST_AUTO_TEST_CASE(empty)
+{
+	Trie trie;
+	BOOST_CHECK_EQUAL(Lookup(trie, "598"), "-");
+	BOOST_CHECK_EQUAL(Lookup(trie, ""), "-");
+}
+
+BOOST_AUTO_TEST_CASE(empty_prefix_matches_everything)
+{
+	Trie trie;
+	Insert(trie, "");
+	Insert(trie, "598");
+	BOOST_CHECK_EQUAL(Lookup(trie, "1234"), "");
+	BOOST_CHECK_EQUAL(Lookup(trie, "5981"), "598");
+}
+
+BOOST_AUTO_TEST_CASE(longest_prefix)
+{
+	Trie trie;
+	Insert(trie, "5");
+	Insert(trie, "598");
+	Insert(trie, "59899");
+	BOOST_CHECK_EQUAL(Lookup(trie, "4"), "-");
+	BOOST_CHECK_EQUAL(Lookup(trie, "5"), "5");
+	BOOST_CHECK_EQUAL(Lookup(trie, "59"), "5");
+	BOOST_CHECK_EQUAL(Lookup(trie, "598"), "598");
+	BOOST_CHECK_EQUAL(Lookup(trie, "5989"), "598");
+	BOOST_CHECK_EQUAL(Lookup(trie, "59899123"), "59899");
+	BOOST_CHECK_EQUAL(Lookup(trie, "59812"), "598");
+}
+
+BOOST_AUTO_TEST_CASE(split_where_prefixes_differ)
+{
+	// inserted longest first, each insert splits the edge of the one before
+	Trie trie;
+	Insert(trie, "59899");
+	Insert(trie, "59812");
+	Insert(trie, "598");
+	Insert(trie, "5");
+	BOOST_CHECK_EQUAL(Lookup(trie, "5989"), "598");
+	BOOST_CHECK_EQUAL(Lookup(trie, "598991"), "59899");
+	BOOST_CHECK_EQUAL(Lookup(trie, "598121"), "59812");
+	BOOST_CHECK_EQUAL(Lookup(trie, "59813"), "598");
+	BOOST_CHECK_EQUAL(Lookup(trie, "597"), "5");
+	BOOST_CHECK_EQUAL(Lookup(trie, "6"), "-");
+}
+
+BOOST_AUTO_TEST_CASE(split_in_the_middle_of_an_edge)
+{
+	Trie trie;
+	Insert(trie, "123456");
+	Insert(trie, "1299");
+	BOOST_CHECK_EQUAL(Lookup(trie, "12"), "-");
+	BOOST_CHECK_EQUAL(Lookup(trie, "1234"), "-");
+	BOOST_CHECK_EQUAL(Lookup(trie, "1234567"), "123456");
+	BOOST_CHECK_EQUAL(Lookup(trie, "12990"), "1299");
+}
+
+BOOST_AUTO_TEST_CASE(insert_replaces)
+{
+	Trie trie;
+	Insert(trie, "598");
+	trie.Insert("598", boost::make_shared<const string>("other"));
+	BOOST_CHECK_EQUAL(Lookup(trie, "5981"), "other");
+}
+
+BOOST_AUTO_TEST_CASE(only_digits_count)
+{
+	Trie trie;
+	Insert(trie, "598");
+	Insert(trie, "59899");
+	BOOST_CHECK_EQUAL(Lookup(trie, "+598 99-123"), "59899");
+	BOOST_CHECK_EQUAL(Lookup(trie, "(598) 1"), "598");
+	BOOST_CHECK_EQUAL(Lookup(trie, "+5 9"), "-");
+}
+
+BOOST_AUTO_TEST_SUITE_END()
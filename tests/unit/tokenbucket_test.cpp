@@ -0,0 +1,84 @@
+/*!
+ * \file tokenbucket_test.cpp
+ * \author ichramm
+ */
+#include "tokenbucket.hpp"
+
+#include <boost/test/unit_test.hpp>
+
+using namespace opensmpp;
+
+namespace
+{
+	const boost::uint64_t MS = 1000000;   // nanoseconds
+
+	/*! \return The tokens taken at \p now, trying \p tries times */
+	int Take(CTokenBucket& bucket, boost::uint64_t now, int tries)
+	{
+		int taken = 0;
+		for (int i = 0; i < tries; i++) {
+			taken += bucket.TryConsume(now) ? 1 : 0;
+		}
+		return taken;
+	}
+}
+
+BOOST_AUTO_TEST_SUITE(tokenbucket)
+
+BOOST_AUTO_TEST_CASE(burst_then_rate)
+{
+	const boost::uint64_t start = 1000 * MS;
+	CTokenBucket bucket(100, 10);   // one every 10ms, 10 at once
+
+	BOOST_CHECK_EQUAL(Take(bucket, start, 20), 10);
+	BOOST_CHECK_EQUAL(Take(bucket, start + 9 * MS, 5), 0);
+	BOOST_CHECK_EQUAL(Take(bucket, start + 10 * MS, 5), 1);
+	BOOST_CHECK_EQUAL(Take(bucket, start + 50 * MS, 10), 4);
+}
+
+BOOST_AUTO_TEST_CASE(refills_up_to_the_burst)
+{
+	const boost::uint64_t start = 1000 * MS;
+	CTokenBucket bucket(100, 10);
+
+	BOOST_CHECK_EQUAL(Take(bucket, start, 10), 10);
+	// an idle second does not earn more than the burst
+	BOOST_CHECK_EQUAL(Take(bucket, start + 1000 * MS, 50), 10);
+}
+
+BOOST_AUTO_TEST_CASE(no_burst)
+{
+	const boost::uint64_t start = 1000 * MS;
+	CTokenBucket bucket(10, 0);     // one every 100ms, 0 means 1
+
+	BOOST_CHECK_EQUAL(Take(bucket, start, 3), 1);
+	BOOST_CHECK_EQUAL(Take(bucket, start + 99 * MS, 3), 0);
+	BOOST_CHECK_EQUAL(Take(bucket, start + 100 * MS, 3), 1);
+}
+
+BOOST_AUTO_TEST_CASE(steady_rate)
+{
+	const boost::uint64_t start = 1000 * MS;
+	CTokenBucket bucket(1000, 1);
+
+	// over a second at the rate, every message gets through and no more
+	int taken = 0;
+	for (boost::uint64_t t = 0; t < 1000 * MS; t += MS / 2) {
+		taken += bucket.TryConsume(start + t) ? 1 : 0;
+	}
+	BOOST_CHECK_EQUAL(taken, 1000);
+}
+
+BOOST_AUTO_TEST_CASE(monotonic_clock)
+{
+	CTokenBucket bucket(1, 2);
+	BOOST_CHECK(bucket.TryConsume());
+	BOOST_CHECK(bucket.TryConsume());
+	BOOST_CHECK(!bucket.TryConsume());
+
+	boost::uint64_t a = MonotonicNanoseconds();
+	boost::uint64_t b = MonotonicNanoseconds();
+	BOOST_CHECK(b >= a);
+}
+
+BOOST_AUTO_TEST_SUITE_END()